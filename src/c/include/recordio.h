@@ -19,6 +19,7 @@
 #define __RECORDIO_H__
 
 #include <sys/types.h>
+#include <string.h>
 #ifndef WIN32
 #define STRUCT_INITIALIZER(l,r) .l = r
 #else
@@ -35,6 +36,73 @@ struct buffer {
     char *buff;
 };
 
+/**
+ * A bump allocator records can be deserialized into. Everything allocated
+ * from an arena is released at once by zoo_arena_reset() or
+ * zoo_arena_destroy(), so records decoded into an arena must not be passed
+ * to the deallocate_ functions.
+ */
+typedef struct zoo_arena zoo_arena_t;
+
+/**
+ * Creates an arena that allocates in blocks of block_size bytes, or of a
+ * default size if block_size is 0. Returns NULL if out of memory.
+ */
+zoo_arena_t *zoo_arena_create(size_t block_size);
+/**
+ * Allocates size bytes, aligned for any record field, from the arena.
+ * Returns NULL if out of memory.
+ */
+void *zoo_arena_alloc(zoo_arena_t *arena, size_t size);
+/**
+ * Releases everything allocated from the arena. The first block is kept
+ * for reuse, any further blocks are freed.
+ */
+void zoo_arena_reset(zoo_arena_t *arena);
+void zoo_arena_destroy(zoo_arena_t *arena);
+
+/**
+ * The frames sent to and received from the servers, and the buffers of the
+ * oarchives they are serialized with, come from a process-wide pool of
+ * power-of-two size classes rather than straight from the heap, so that
+ * mixing small and large frames does not fragment it. Frames are not
+ * zeroed. Freed frames are kept for reuse as long as the pool retains less
+ * than its limit, and frames larger than the largest class always go back
+ * to the heap.
+ */
+#define ZOO_FRAME_POOL_DEFAULT_LIMIT (8*1024*1024)
+
+typedef struct zoo_frame_pool_stats {
+    int64_t in_use_bytes;       /* allocated to frames not freed yet */
+    int64_t in_use_frames;
+    int64_t retained_bytes;     /* kept by the pool for reuse */
+    int64_t retained_frames;
+    int64_t retained_limit;     /* the most the pool keeps */
+    int64_t hits;               /* allocations served by the pool */
+    int64_t misses;             /* allocations that went to the heap */
+} zoo_frame_pool_stats_t;
+
+/**
+ * Allocates a frame of at least len bytes. Returns NULL if out of memory
+ * or if len is negative.
+ */
+char *zoo_frame_alloc(int32_t len);
+/**
+ * Grows a frame to at least len bytes, keeping its content. A NULL frame
+ * is allocated. Returns NULL if out of memory, in which case the frame is
+ * left untouched.
+ */
+char *zoo_frame_realloc(char *frame, int32_t len);
+/** Returns the number of bytes that can be written to a frame. */
+int32_t zoo_frame_capacity(const char *frame);
+void zoo_frame_free(char *frame);
+/**
+ * Sets how many bytes of freed frames the pool keeps, releasing the
+ * frames beyond it. 0 disables the pool.
+ */
+void zoo_frame_pool_set_limit(int64_t bytes);
+void zoo_frame_pool_get_stats(zoo_frame_pool_stats_t *stats);
+
 void deallocate_String(char **s);
 void deallocate_Buffer(struct buffer *b);
 void deallocate_vector(void *d);
@@ -50,6 +118,9 @@ struct iarchive {
             struct buffer *);
     int (*deserialize_String)(struct iarchive *ia, const char *name, char **);
     void *priv;
+    /* if set, the strings, buffers and vectors being deserialized are
+     * allocated from this arena instead of the heap */
+    zoo_arena_t *arena;
 };
 struct oarchive {
     int (*start_record)(struct oarchive *oa, const char *tag);
@@ -67,12 +138,93 @@ struct oarchive {
 };
 
 struct oarchive *create_buffer_oarchive(void);
+/**
+ * Frees an oarchive and, if free_buffer is set, its buffer. Otherwise the
+ * caller owns the buffer returned by get_buffer: it is a frame of the pool,
+ * which must be released with zoo_frame_free, not free.
+ */
 void close_buffer_oarchive(struct oarchive **oa, int free_buffer);
 struct iarchive *create_buffer_iarchive(char *buffer, int len);
+/* allocates the elements of a deserialized vector */
+void *ia_allocate_vector(struct iarchive *ia, int32_t count, size_t size);
 void close_buffer_iarchive(struct iarchive **ia);
+/* the buffer is a frame: see close_buffer_oarchive */
 char *get_buffer(struct oarchive *);
 int get_buffer_len(struct oarchive *);
 
+/**
+ * Direct access to the bytes of the buffer archives, used by the generated
+ * code to encode and decode fixed size fields with one bounds check.
+ * oa_reserve() appends len bytes to a buffer oarchive and returns where to
+ * write them; ia_consume() returns the next len bytes of a buffer iarchive.
+ * Both return NULL for any other archive, if the buffer cannot grow, or if
+ * fewer than len bytes are left to read.
+ */
+char *oa_reserve(struct oarchive *oa, int32_t len);
+const char *ia_consume(struct iarchive *ia, int32_t len);
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ZOO_BSWAP32(v) ((int32_t)__builtin_bswap32(v))
+#define ZOO_BSWAP64(v) ((int64_t)__builtin_bswap64(v))
+#elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ZOO_BSWAP32(v) (v)
+#define ZOO_BSWAP64(v) (v)
+#endif
+#endif
+
+/* big endian stores and loads of possibly unaligned fields */
+static inline void zoo_put_int32(char *p, int32_t v)
+{
+#ifdef ZOO_BSWAP32
+    v = ZOO_BSWAP32(v);
+    memcpy(p, &v, sizeof(v));
+#else
+    unsigned char *u = (unsigned char*)p;
+    u[0] = (unsigned char)(v >> 24);
+    u[1] = (unsigned char)(v >> 16);
+    u[2] = (unsigned char)(v >> 8);
+    u[3] = (unsigned char)v;
+#endif
+}
+
+static inline void zoo_put_int64(char *p, int64_t v)
+{
+#ifdef ZOO_BSWAP64
+    v = ZOO_BSWAP64(v);
+    memcpy(p, &v, sizeof(v));
+#else
+    zoo_put_int32(p, (int32_t)(v >> 32));
+    zoo_put_int32(p + 4, (int32_t)v);
+#endif
+}
+
+static inline int32_t zoo_get_int32(const char *p)
+{
+#ifdef ZOO_BSWAP32
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ZOO_BSWAP32(v);
+#else
+    const unsigned char *u = (const unsigned char*)p;
+    return (int32_t)(((unsigned long)u[0] << 24) | ((unsigned long)u[1] << 16) |
+            ((unsigned long)u[2] << 8) | u[3]);
+#endif
+}
+
+static inline int64_t zoo_get_int64(const char *p)
+{
+#ifdef ZOO_BSWAP64
+    int64_t v;
+    memcpy(&v, p, sizeof(v));
+    return ZOO_BSWAP64(v);
+#else
+    unsigned long long hi = zoo_get_int32(p) & 0xffffffffUL;
+    unsigned long long lo = zoo_get_int32(p + 4) & 0xffffffffUL;
+    return (int64_t)(hi << 32 | lo);
+#endif
+}
+
 int64_t htonll(int64_t v);
 
 #ifdef __cplusplus
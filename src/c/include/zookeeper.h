@@ -556,6 +556,67 @@ ZOOAPI int zookeeper_interest(zhandle_t *zh, int *fd, int *interest,
  *              to be processed (when called with ZOOKEEPER_READ flag).
  */
 ZOOAPI int zookeeper_process(zhandle_t *zh, int events);
+
+#ifndef WIN32
+/**
+ * The callbacks through which an external event loop (epoll, kqueue, libev,
+ * ...) is told what to wait for on behalf of a handle, instead of asking
+ * \ref zookeeper_interest on every iteration.
+ *
+ * The socket is watched for the ZOOKEEPER_READ and ZOOKEEPER_WRITE events
+ * given to fd_add or the last fd_mod, until fd_del is called; fd_del is
+ * always called before the socket is closed. The handle reads and writes
+ * until the socket would block, so the socket can be watched
+ * edge-triggered. timer_set gives the time \ref zoo_io_event must be called
+ * by even if nothing happens on the socket, or NULL if there is none. The
+ * time is on the CLOCK_MONOTONIC clock, as a timerfd armed with
+ * TFD_TIMER_ABSTIME expects it.
+ *
+ * fd_add and fd_mod return 0 on success.
+ */
+typedef struct zoo_io_callbacks {
+    int (*fd_add)(zhandle_t *zh, int fd, int events, void *ctx);
+    int (*fd_mod)(zhandle_t *zh, int fd, int events, void *ctx);
+    void (*fd_del)(zhandle_t *zh, int fd, void *ctx);
+    void (*timer_set)(zhandle_t *zh, const struct timespec *deadline,
+            void *ctx);
+    void *ctx; /* passed to the callbacks */
+} zoo_io_callbacks_t;
+
+/**
+ * \brief hands the IO of a handle over to an external event loop.
+ *
+ * The callbacks are called right away with the socket and deadline to wait
+ * for, and then whenever they change, from \ref zoo_io_event and from the
+ * calls queuing a request. The handle must not be driven by
+ * \ref zookeeper_interest and \ref zookeeper_process any more.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param callbacks the callbacks, copied, or NULL to unregister the ones set
+ * (fd_del and timer_set are called to withdraw what they were given).
+ * \return ZOK, ZBADARGUMENTS, ZSYSTEMERROR if fd_add or fd_mod failed, or
+ * an error of \ref zookeeper_interest.
+ */
+ZOOAPI int zoo_set_io_callbacks(zhandle_t *zh,
+        const zoo_io_callbacks_t *callbacks);
+
+/**
+ * \brief notifies a handle driven by an external event loop that its socket
+ * is ready or that its deadline has passed.
+ *
+ * It processes everything there is to process, calls the completions and
+ * watchers, and updates what the event loop waits for through the
+ * callbacks set by \ref zoo_set_io_callbacks.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param events an OR of the ZOOKEEPER_WRITE and ZOOKEEPER_READ flags, or 0
+ * if the deadline passed.
+ * \return ZOK, or an error of \ref zookeeper_process or
+ * \ref zookeeper_interest. The handle keeps reconnecting after a
+ * connection error; it is only done with after ZINVALIDSTATE.
+ */
+ZOOAPI int zoo_io_event(zhandle_t *zh, int events);
+#endif
 #endif
 
 /**
@@ -1133,6 +1194,65 @@ ZOOAPI int zoo_aset_acl(zhandle_t *zh, const char *path, int version,
 ZOOAPI int zoo_amulti(zhandle_t *zh, int count, const zoo_op_t *ops, 
         zoo_op_result_t *results, void_completion_t, const void *data);
 
+/**
+ * \brief signature of the progress callback of \ref zoo_adelete_recursive.
+ *
+ * \param deleted the number of nodes deleted so far
+ * \param found the number of nodes found so far, the root included
+ * \param data the pointer passed to zoo_adelete_recursive.
+ */
+typedef void (*delete_progress_t)(int64_t deleted, int64_t found,
+        const void *data);
+
+/**
+ * \brief signature of the completion of \ref zoo_adelete_recursive.
+ *
+ * \param rc ZOK if the whole tree was deleted, otherwise the error of the
+ *   first node in failed, or ZNONODE if the root did not exist.
+ * \param deleted the number of nodes deleted
+ * \param failed the paths of the nodes that could not be deleted (their
+ *   ancestors are left as well). The programmer is NOT responsible for
+ *   freeing it.
+ * \param data the pointer passed to zoo_adelete_recursive.
+ */
+typedef void (*delete_recursive_completion_t)(int rc, int64_t deleted,
+        const struct String_vector *failed, const void *data);
+
+/**
+ * \brief delete a node and all its descendants.
+ *
+ * The tree is listed with pipelined get_children requests, and its
+ * leaves are deleted with multi requests of up to batch_size deletes, a
+ * parent once its children are gone; at most max_in_flight requests are
+ * in flight at once. Deleting a tree of n nodes thus takes about n /
+ * batch_size requests for the deletes, and a few round trips per level of
+ * the tree rather than per node.
+ *
+ * A batch that fails is retried one delete at a time, so that a node
+ * which cannot be deleted only leaves itself and its ancestors. A node
+ * that gets new children while the tree is deleted is listed again once.
+ * The nodes that are already gone count as deleted. The deletes are not
+ * atomic: the tree can be seen partly deleted, and is left so if the
+ * handle is closed.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param path the root of the tree, which cannot be "/"
+ * \param batch_size the maximum number of deletes of a multi, 0 for 100.
+ *   All of them must fit in the jute.maxbuffer of the server.
+ * \param max_in_flight the maximum number of requests in flight, 0 for 16
+ * \param progress called after every batch of deletes, or NULL
+ * \param completion called once the tree is deleted or could not be
+ *   deleted further; with ZNONODE if the root does not exist.
+ * \param data the data that will be passed to the callbacks.
+ * \return ZOK on success or one of the following errcodes on failure:
+ * ZBADARGUMENTS - invalid input parameters
+ * ZINVALIDSTATE - zhandle state is either ZOO_SESSION_EXPIRED_STATE or ZOO_AUTH_FAILED_STATE
+ * ZSYSTEMERROR - out of memory
+ */
+ZOOAPI int zoo_adelete_recursive(zhandle_t *zh, const char *path,
+        int batch_size, int max_in_flight, delete_progress_t progress,
+        delete_recursive_completion_t completion, const void *data);
+
 /**
  * \brief return an error string.
  * 
@@ -1208,6 +1328,316 @@ ZOOAPI void zoo_set_log_stream(FILE* logStream);
  */
 ZOOAPI void zoo_deterministic_conn_order(int yesOrNo);
 
+/**
+ * \brief sets the zone the client runs in.
+ *
+ * A server of the host list given to zookeeper_init() can be tagged with
+ * the zone it runs in, e.g. "zk1:2181@us-east-1a,zk2:2181@us-east-1b".
+ * The servers tagged with the zone of the client are connected to before
+ * the other ones, and are preferred by the \ref ZOO_SELECT_LATENCY policy.
+ * This setting affects the handles created after the call.
+ *
+ * \param zone the name of the zone, or NULL to prefer no server.
+ */
+ZOOAPI void zoo_set_client_zone(const char *zone);
+
+/** Connect to the servers in the order of the (permuted) host list */
+#define ZOO_SELECT_RANDOM 0
+/** Connect to the server with the lowest measured latency */
+#define ZOO_SELECT_LATENCY 1
+
+/**
+ * \brief sets how the client chooses the server to connect to.
+ *
+ * The client measures the time the connection handshake and the pings
+ * take with every server it connects to. With the \ref ZOO_SELECT_LATENCY
+ * policy, when the connection is lost the client reconnects to the server
+ * of the client's zone with the lowest latency that has not failed yet,
+ * then to the other ones with the lowest latency; servers never measured
+ * are tried after the measured ones, in the order of the host list.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param policy \ref ZOO_SELECT_RANDOM (the default) or \ref ZOO_SELECT_LATENCY
+ * \param rebalance_interval if positive, every rebalance_interval ms the
+ * client looks for a server at least twice as fast as the current one, or
+ * for a server of its zone if it is connected to another zone, and moves
+ * the session to it when no request is in flight. Like any reconnection,
+ * the move is reported to the watcher as a ZOO_CONNECTING_STATE event
+ * followed by a ZOO_CONNECTED_STATE event.
+ * \return ZOK, or ZBADARGUMENTS if the policy is unknown.
+ */
+ZOOAPI int zoo_set_server_selection(zhandle_t *zh, int policy,
+        int rebalance_interval);
+
+/**
+ * \brief limits the time a request can wait for its response.
+ *
+ * When the oldest request in flight has not been answered timeout ms after
+ * it was issued, or after the session was reestablished if it was issued
+ * while the client was disconnected, the client gives up the connection as
+ * if it had timed out: the requests in flight complete with
+ * ZOPERATIONTIMEOUT and the client reconnects, possibly to another server.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param timeout the limit in milliseconds, 0 (the default) for none. It
+ * applies to the requests issued after the call.
+ * \return ZOK, or ZBADARGUMENTS if timeout is negative.
+ */
+ZOOAPI int zoo_set_request_timeout(zhandle_t *zh, int timeout);
+
+/**
+ * \brief coalesces the identical reads in flight.
+ *
+ * When enabled, a get, exists, get_children or get_children2 request on
+ * a path (sync or async) is not sent if the same request on the same path
+ * is still waiting for its response: it completes with that response,
+ * right after the request it joined. A read joins another one only if no
+ * other request (write, sync, multi, auth) was issued by the handle in
+ * between, so that it still sees the writes made before it, and only if
+ * the other one sets a watch when it does.
+ *
+ * The completions of a coalesced read may thus be called before those of
+ * requests issued before it. The coalesced reads are not listed by
+ * \ref zoo_get_inflight.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param enable 1 to coalesce the reads issued after the call, 0 (the
+ * default) to send them all.
+ * \return ZOK, ZBADARGUMENTS if zh is NULL, or ZSYSTEMERROR if out of
+ * memory.
+ */
+ZOOAPI int zoo_set_read_coalescing(zhandle_t *zh, int enable);
+
+/**
+ * \brief compresses the values written and decompresses those read.
+ *
+ * When enabled, the values of at least min_size bytes passed to zoo_aset,
+ * zoo_acreate and their sync versions are compressed with a built-in LZ77
+ * codec (the block format of LZ4) before they are sent, if that makes
+ * them smaller. The values read by zoo_aget, zoo_awget and their sync
+ * versions are decompressed, in buffers of the frame pool, if they start
+ * with the header of the codec; the others, written by clients that do not
+ * compress, are returned as they are. The values of a multi are sent and
+ * returned as they are.
+ *
+ * The dataLength of the stats is the size of the value stored, compressed
+ * or not, and the buffer of a sync read must hold the value decompressed.
+ * Clients reading values compressed by another one must enable it too.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param min_size the size in bytes of the smallest values compressed, 0
+ * (the default) to neither compress nor decompress the values. A value of
+ * INT_MAX only decompresses them.
+ * \return ZOK, or ZBADARGUMENTS if zh is NULL or min_size is negative.
+ */
+ZOOAPI int zoo_set_compression(zhandle_t *zh, int min_size);
+
+/**
+ * \brief coalesces the watch events delivered to a watcher.
+ *
+ * The events of one type for one path that a watcher gets within window
+ * ms of the first one, or while their delivery is waiting for the
+ * completion thread, are merged into a single call of the watcher, made
+ * once the window has passed. The watcher can tell how many events the
+ * call stands for with \ref zoo_coalesced_events. Session events are never
+ * coalesced.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param watcher the watcher, and context its context, as passed along
+ * with the watches (the default watcher and context of the handle for the
+ * calls with a watch flag)
+ * \param window in ms, 0 to only merge the events whose delivery is still
+ * pending, or negative to stop coalescing the events of the watcher
+ * \return ZOK, ZBADARGUMENTS if zh or watcher is NULL, or ZSYSTEMERROR if
+ * out of memory.
+ */
+ZOOAPI int zoo_set_watcher_coalescing(zhandle_t *zh, watcher_fn watcher,
+        void *context, int window);
+
+/**
+ * \brief returns the number of watch events merged into the call of the
+ * watcher being made, see \ref zoo_set_watcher_coalescing.
+ *
+ * It must be called from the watcher, and returns 1 for the events that
+ * were not coalesced.
+ */
+ZOOAPI int zoo_coalesced_events(zhandle_t *zh);
+
+/**
+ * The durations of one kind measured by the client, in microseconds.
+ */
+typedef struct zoo_latency {
+    int64_t count;              /* measures */
+    int64_t over;               /* ... above the threshold */
+    int64_t total_us;
+    int64_t max_us;
+} zoo_latency_t;
+
+/**
+ * What the client measured of its own delays, see \ref zoo_get_latency_stats.
+ */
+typedef struct zoo_latency_stats {
+    zoo_latency_t wakeup_lag;   /* how late the IO loop woke up for a deadline */
+    zoo_latency_t frame_delay;  /* how long a response waited in the socket */
+    zoo_latency_t queue_delay;  /* how long a response waited for its callback */
+    zoo_latency_t callback;     /* how long the completions and watchers ran */
+} zoo_latency_stats_t;
+
+#define ZOO_DEFAULT_LAG_THRESHOLD 10
+#define ZOO_DEFAULT_CALLBACK_THRESHOLD 100
+
+/**
+ * \brief sets the delays above which the client reports its own slowness.
+ *
+ * A session is lost when the client does not ping the server in time,
+ * either because the thread running the IO loop was held up (in the
+ * single-threaded library, by the callbacks it runs or by the application
+ * not calling \ref zookeeper_process soon enough) or because a callback
+ * blocks the completion thread and the responses pile up behind it. The
+ * client measures how late the IO loop wakes up for its deadlines, how long
+ * the responses wait for their callback and how long every completion and
+ * watcher runs, and logs a warning naming the loop, or the callback and its
+ * path, when a measure is above its threshold.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param loop_lag the lag of the IO loop, or the wait of a response for the
+ * completion thread, in milliseconds; \ref ZOO_DEFAULT_LAG_THRESHOLD by
+ * default.
+ * \param frame_delay how long a response can wait in the socket receive
+ * buffer, in milliseconds. Measuring it costs a poll() per wakeup of the
+ * IO loop: 0, the default, leaves it unmeasured.
+ * \param callback how long a completion or a watcher can run, in
+ * milliseconds; \ref ZOO_DEFAULT_CALLBACK_THRESHOLD by default.
+ * \return ZOK, or ZBADARGUMENTS if a threshold is negative. A threshold of
+ * 0 turns the corresponding warnings off.
+ */
+ZOOAPI int zoo_set_latency_thresholds(zhandle_t *zh, int loop_lag,
+        int frame_delay, int callback);
+
+/**
+ * \brief gets the delays the client measured since it was created.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param stats filled with the counts, totals and maxima of the measures.
+ * The lag of the IO loop is only counted for the wakeups that came after
+ * a deadline, by a millisecond or more.
+ * \return ZOK, or ZBADARGUMENTS if an argument is NULL.
+ */
+ZOOAPI int zoo_get_latency_stats(zhandle_t *zh, zoo_latency_stats_t *stats);
+
+/** A request waits in the send queue of the client */
+#define ZOO_REQUEST_TO_SEND 0
+/** A request was written to the socket and waits for its response */
+#define ZOO_REQUEST_SENT 1
+/** A request was answered and waits for its completion to be called */
+#define ZOO_REQUEST_ANSWERED 2
+
+/**
+ * A request in flight, see \ref zoo_get_inflight.
+ */
+typedef struct zoo_request_info {
+    int xid;
+    int type;           /* the ZOO_*_OP of proto.h, ZOO_NOTIFY_OP for a watch */
+    int queue;          /* ZOO_REQUEST_TO_SEND, _SENT or _ANSWERED */
+    int32_t bytes;      /* of the request, or of the response once answered */
+    int64_t age_us;     /* since the request was issued */
+    char *path;         /* the path sent to the server, or NULL */
+} zoo_request_info_t;
+
+/**
+ * The requests in one of the queues of a handle.
+ */
+typedef struct zoo_queue_info {
+    int count;
+    int64_t bytes;
+    int64_t oldest_us;  /* the age of the oldest request, 0 if none */
+} zoo_queue_info_t;
+
+typedef struct zoo_inflight {
+    zoo_queue_info_t queues[3]; /* indexed by ZOO_REQUEST_* */
+    int count;                  /* of the requests below */
+    zoo_request_info_t *requests;
+} zoo_inflight_t;
+
+/**
+ * \brief takes a snapshot of the requests a handle is waiting on.
+ *
+ * Tells whether a slow request is still held by the client (to send, or
+ * answered but waiting for a busy completion thread) or waits for the
+ * server. The snapshot only holds the locks of the queues while it copies
+ * them, one after the other, and can be taken every second from a health
+ * check. The send queue also counts the authentication and watch packets
+ * sent on reconnection; answered synchronous requests are not listed.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param max_requests the number of requests to list, 0 for the counts
+ * only. The requests waiting on the server or to be sent are listed first,
+ * then the answered ones, each from the oldest: as answered requests are
+ * usually older than the ones still sent, the list is not sorted by age.
+ * \param inflight filled with the counts, bytes and oldest age of each
+ * queue, and the first max_requests requests. It must be freed with
+ * \ref zoo_free_inflight.
+ * \return ZOK, ZBADARGUMENTS if an argument is invalid, or ZSYSTEMERROR
+ * if out of memory.
+ */
+ZOOAPI int zoo_get_inflight(zhandle_t *zh, int max_requests,
+        zoo_inflight_t *inflight);
+
+/**
+ * \brief frees the requests listed by \ref zoo_get_inflight.
+ */
+ZOOAPI void zoo_free_inflight(zoo_inflight_t *inflight);
+
+/**
+ * A path among the most used by a handle, see \ref zoo_get_hot_paths. The
+ * counts are estimated from the sampled requests and watch events.
+ */
+typedef struct zoo_hot_path {
+    char *path;         /* as sent to the server, with the chroot if any */
+    int64_t count;      /* requests and watch events on the path */
+    int64_t reads;      /* the reads, writes and watch events counted */
+    int64_t writes;     /* ... since the path entered the top ones */
+    int64_t watches;
+    int64_t bytes;      /* of the requests, responses and watch events */
+} zoo_hot_path_t;
+
+/**
+ * \brief profiles the paths a handle uses the most.
+ *
+ * The type, path and size of a random sample of the requests and watch
+ * events of the handle are counted in a count-min sketch, which estimates
+ * in a fixed space how often each path is used, and the paths with the
+ * highest estimates are kept in a heap of the given size. Each call starts
+ * the profile over. The requests without a path (multi, ping) are not
+ * counted.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param rate the fraction of the requests and watch events sampled, in
+ * [0, 1]. 0 stops the profiling.
+ * \param top the number of paths kept, at least 1 unless rate is 0.
+ * \return ZOK, ZBADARGUMENTS if an argument is out of range, or
+ * ZSYSTEMERROR if out of memory.
+ */
+ZOOAPI int zoo_set_path_sampling(zhandle_t *zh, double rate, int top);
+
+/**
+ * \brief gets the paths a handle uses the most.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param paths filled with the paths by decreasing count. They must be
+ * freed with \ref zoo_free_hot_paths.
+ * \param count the size of paths on input, the number of paths filled on
+ * output (0 if the handle is not profiled).
+ * \return ZOK, ZBADARGUMENTS if an argument is invalid, or ZSYSTEMERROR
+ * if out of memory.
+ */
+ZOOAPI int zoo_get_hot_paths(zhandle_t *zh, zoo_hot_path_t *paths, int *count);
+
+/**
+ * \brief frees the paths returned by \ref zoo_get_hot_paths.
+ */
+ZOOAPI void zoo_free_hot_paths(zoo_hot_path_t *paths, int count);
+
 /**
  * \brief create a node synchronously.
  * 
@@ -1523,6 +1953,60 @@ ZOOAPI int zoo_wget_children2(zhandle_t *zh, const char *path,
         watcher_fn watcher, void* watcherCtx,
         struct String_vector *strings, struct Stat *stat);
 
+/**
+ * \brief lists the children of a node synchronously, allocating the result
+ * from an arena.
+ * 
+ * This function is similar to \ref zoo_get_children except that the
+ * children are allocated from the given arena rather than one by one from
+ * the heap. They are released by resetting or destroying the arena and must
+ * not be passed to deallocate_String_vector.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param path the name of the node. Expressed as a file name with slashes 
+ * separating ancestors of the node.
+ * \param watch if nonzero, a watch will be set at the server to notify 
+ * the client if the node changes.
+ * \param strings return value of children paths.
+ * \param arena the arena the result is allocated from, see \ref zoo_arena_create.
+ * It may only be used by one thread at a time.
+ * \return the return code of the function.
+ * ZOK operation completed successfully
+ * ZNONODE the node does not exist.
+ * ZNOAUTH the client does not have permission.
+ * ZBADARGUMENTS - invalid input parameters
+ * ZINVALIDSTATE - zhandle state is either ZOO_SESSION_EXPIRED_STATE or ZOO_AUTH_FAILED_STATE
+ * ZMARSHALLINGERROR - failed to marshall a request; possibly, out of memory
+ */
+ZOOAPI int zoo_get_children_arena(zhandle_t *zh, const char *path, int watch,
+        struct String_vector *strings, zoo_arena_t *arena);
+
+/**
+ * \brief lists the children of a node and get its stat synchronously,
+ * allocating the result from an arena.
+ * 
+ * This function is similar to \ref zoo_get_children2 except that the
+ * children are allocated from the given arena, see \ref zoo_get_children_arena.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param path the name of the node. Expressed as a file name with slashes 
+ * separating ancestors of the node.
+ * \param watch if nonzero, a watch will be set at the server to notify 
+ * the client if the node changes.
+ * \param strings return value of children paths.
+ * \param stat return value of node stat.
+ * \param arena the arena the result is allocated from.
+ * \return the return code of the function.
+ * ZOK operation completed successfully
+ * ZNONODE the node does not exist.
+ * ZNOAUTH the client does not have permission.
+ * ZBADARGUMENTS - invalid input parameters
+ * ZINVALIDSTATE - zhandle state is either ZOO_SESSION_EXPIRED_STATE or ZOO_AUTH_FAILED_STATE
+ * ZMARSHALLINGERROR - failed to marshall a request; possibly, out of memory
+ */
+ZOOAPI int zoo_get_children2_arena(zhandle_t *zh, const char *path, int watch,
+        struct String_vector *strings, struct Stat *stat, zoo_arena_t *arena);
+
 /**
  * \brief gets the acl associated with a node synchronously.
  * 
@@ -1542,6 +2026,31 @@ ZOOAPI int zoo_wget_children2(zhandle_t *zh, const char *path,
 ZOOAPI int zoo_get_acl(zhandle_t *zh, const char *path, struct ACL_vector *acl,
                        struct Stat *stat);
 
+/**
+ * \brief gets the acl associated with a node synchronously, allocating the
+ * result from an arena.
+ * 
+ * This function is similar to \ref zoo_get_acl except that the acls are
+ * allocated from the given arena and must not be passed to
+ * deallocate_ACL_vector.
+ *
+ * \param zh the zookeeper handle obtained by a call to \ref zookeeper_init
+ * \param path the name of the node. Expressed as a file name with slashes 
+ * separating ancestors of the node.
+ * \param acl the return value of acls on the path.
+ * \param stat returns the stat of the path specified.
+ * \param arena the arena the result is allocated from.
+ * \return the return code for the function call.
+ * ZOK operation completed successfully
+ * ZNONODE the node does not exist.
+ * ZNOAUTH the client does not have permission.
+ * ZBADARGUMENTS - invalid input parameters
+ * ZINVALIDSTATE - zhandle state is either ZOO_SESSION_EXPIRED_STATE or ZOO_AUTH_FAILED_STATE
+ * ZMARSHALLINGERROR - failed to marshall a request; possibly, out of memory
+ */
+ZOOAPI int zoo_get_acl_arena(zhandle_t *zh, const char *path,
+        struct ACL_vector *acl, struct Stat *stat, zoo_arena_t *arena);
+
 /**
  * \brief sets the acl associated with a node synchronously.
  * 
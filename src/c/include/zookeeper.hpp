@@ -0,0 +1,704 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZOOKEEPER_HPP_
+#define ZOOKEEPER_HPP_
+
+/**
+ * \file zookeeper.hpp
+ * A header-only C++17 layer over the asynchronous API of zookeeper.h.
+ *
+ * Every request comes in two flavors:
+ * - get(), set(), ... submit the request right away and return a
+ *   std::future of its result. Someone has to run the IO of the handle for
+ *   the future to become ready: the threads of zookeeper_mt do, while with
+ *   zookeeper_st the application has to keep calling zookeeper_process (or
+ *   zoo_io_event) rather than block on the future.
+ * - co_get(), co_set(), ... return an awaitable for C++20 coroutines. The
+ *   request is submitted when it is awaited, and the coroutine is resumed
+ *   right from the completion callback, on the thread calling the
+ *   completions. The arguments must stay valid until then, which they do
+ *   in a plain "co_await zk->co_get(path)".
+ *
+ * Results are returned as zk::result, holding the ZOK, ZNONODE, ... code of
+ * the C API and, on success, the value. Nothing is thrown. Values are moved
+ * out of the completions: the data of a node is copied once into a
+ * zk::buffer, and co_get even hands out a view of the data of the response
+ * itself.
+ *
+ * Paths are taken as std::string_view; they are copied into a
+ * NUL-terminated buffer on the stack unless longer than 255 bytes.
+ */
+
+#include <zookeeper.h>
+
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define ZOOKEEPER_HPP_COROUTINES 1
+#endif
+
+namespace zk {
+
+/**
+ * The result of a request: a result code of zookeeper.h and, if it is ZOK,
+ * a value.
+ */
+template <class T>
+class result {
+public:
+    explicit result(int rc) : rc_(rc) {}
+    result(T &&value) : rc_(ZOK), value_(std::move(value)) {}
+
+    /** the result code, ZOK on success */
+    int code() const { return rc_; }
+    /** the description of the result code, as given by zerror() */
+    const char *message() const { return zerror(rc_); }
+    explicit operator bool() const { return rc_ == ZOK; }
+
+    /** the value; only there if code() is ZOK */
+    T &value() & { return *value_; }
+    const T &value() const & { return *value_; }
+    T &&value() && { return std::move(*value_); }
+    T *operator->() { return &*value_; }
+    const T *operator->() const { return &*value_; }
+
+private:
+    int rc_;
+    std::optional<T> value_;
+};
+
+template <>
+class result<void> {
+public:
+    explicit result(int rc = ZOK) : rc_(rc) {}
+    int code() const { return rc_; }
+    const char *message() const { return zerror(rc_); }
+    explicit operator bool() const { return rc_ == ZOK; }
+
+private:
+    int rc_;
+};
+
+/**
+ * The data of a node, owned. A node can hold no data at all (null), which
+ * is told apart from empty data.
+ */
+class buffer {
+public:
+    buffer() : size_(-1) {}
+    buffer(const char *data, int len) : size_(len < 0 ? -1 : len) {
+        if (size_ > 0) {
+            data_.reset(new char[size_]);
+            std::memcpy(data_.get(), data, size_);
+        }
+    }
+    buffer(buffer &&) noexcept = default;
+    buffer &operator=(buffer &&) noexcept = default;
+
+    const char *data() const { return data_.get(); }
+    std::size_t size() const { return size_ < 0 ? 0 : size_; }
+    bool is_null() const { return size_ < 0; }
+    std::string_view view() const { return std::string_view(data(), size()); }
+
+private:
+    std::unique_ptr<char[]> data_;
+    int size_;
+};
+
+/** The data and stat of a node, as returned by get */
+struct node {
+    buffer data;
+    Stat stat;
+};
+
+/**
+ * The data and stat of a node, as returned by co_get. The data is the one
+ * of the response received from the server: it is only valid until the
+ * coroutine suspends again, or returns.
+ */
+struct data_view {
+    std::string_view data;
+    bool is_null;
+    Stat stat;
+};
+
+/** An event delivered to a watch or to the session callback of a client */
+struct event {
+    int type;   /* ZOO_CREATED_EVENT, ..., ZOO_SESSION_EVENT */
+    int state;  /* ZOO_CONNECTED_STATE, ... */
+    std::string_view path;
+};
+
+using event_fn = std::function<void(const event &)>;
+
+class client;
+
+namespace detail {
+
+/* where the completion callbacks below deliver a result */
+template <class T>
+class sink {
+public:
+    virtual void done(result<T> &&r) = 0;
+
+protected:
+    ~sink() {}
+};
+
+template <class T>
+const void *as_data(sink<T> *s) { return static_cast<const void *>(s); }
+
+template <class T>
+sink<T> *sink_of(const void *data) {
+    return static_cast<sink<T> *>(const_cast<void *>(data));
+}
+
+template <class T>
+class promise_sink final : public sink<T> {
+public:
+    std::promise<result<T>> promise;
+    void done(result<T> &&r) override {
+        promise.set_value(std::move(r));
+        delete this;
+    }
+};
+
+/* submits a request whose completion fulfills the returned future; submit
+ * is given the data to pass to the completion and returns the result code
+ * of the zoo_a* call */
+template <class T, class Submit>
+std::future<result<T>> start(Submit &&submit) {
+    promise_sink<T> *s = new promise_sink<T>;
+    std::future<result<T>> f = s->promise.get_future();
+    int rc = submit(as_data<T>(s));
+    if (rc != ZOK)
+        s->done(result<T>(rc));
+    return f;
+}
+
+#ifdef ZOOKEEPER_HPP_COROUTINES
+template <class T, class Submit>
+class awaiter final : public sink<T> {
+public:
+    explicit awaiter(Submit submit) : submit_(std::move(submit)) {}
+    /* the completion is given the address of the awaiter */
+    awaiter(const awaiter &) = delete;
+    awaiter &operator=(const awaiter &) = delete;
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        h_ = h;
+        int rc = submit_(as_data<T>(this));
+        if (rc != ZOK) {
+            r_.emplace(rc);
+            return false;
+        }
+        /* the completion may already have resumed the coroutine on another
+         * thread: this must not be touched any more */
+        return true;
+    }
+    result<T> await_resume() { return std::move(*r_); }
+
+    void done(result<T> &&r) override {
+        r_.emplace(std::move(r));
+        h_.resume();
+    }
+
+private:
+    Submit submit_;
+    std::optional<result<T>> r_;
+    std::coroutine_handle<> h_;
+};
+#endif
+
+/* a NUL-terminated copy of a path */
+class cstr {
+public:
+    explicit cstr(std::string_view s) {
+        if (s.size() < sizeof(inline_)) {
+            std::memcpy(inline_, s.data(), s.size());
+            inline_[s.size()] = '\0';
+            p_ = inline_;
+        } else {
+            heap_.assign(s);
+            p_ = heap_.c_str();
+        }
+    }
+    cstr(const cstr &) = delete;
+    cstr &operator=(const cstr &) = delete;
+    const char *c_str() const { return p_; }
+
+private:
+    char inline_[256];
+    std::string heap_;
+    const char *p_;
+};
+
+inline int value_len(std::string_view v) {
+    return v.data() ? static_cast<int>(v.size()) : -1;
+}
+
+inline void on_void(int rc, const void *data) {
+    sink_of<void>(data)->done(result<void>(rc));
+}
+
+inline void on_stat(int rc, const Stat *stat, const void *data) {
+    sink<Stat> *s = sink_of<Stat>(data);
+    if (rc != ZOK)
+        return s->done(result<Stat>(rc));
+    s->done(Stat(*stat));
+}
+
+inline void on_string(int rc, const char *value, const void *data) {
+    sink<std::string> *s = sink_of<std::string>(data);
+    if (rc != ZOK)
+        return s->done(result<std::string>(rc));
+    s->done(std::string(value ? value : ""));
+}
+
+inline void on_data(int rc, const char *value, int len, const Stat *stat,
+        const void *data) {
+    sink<node> *s = sink_of<node>(data);
+    if (rc != ZOK)
+        return s->done(result<node>(rc));
+    s->done(node{buffer(value, len), *stat});
+}
+
+inline void on_data_view(int rc, const char *value, int len,
+        const Stat *stat, const void *data) {
+    sink<data_view> *s = sink_of<data_view>(data);
+    if (rc != ZOK)
+        return s->done(result<data_view>(rc));
+    s->done(data_view{std::string_view(value, len < 0 ? 0 : len), len < 0,
+            *stat});
+}
+
+inline void on_strings(int rc, const String_vector *strings,
+        const void *data) {
+    typedef std::vector<std::string> strings_t;
+    sink<strings_t> *s = sink_of<strings_t>(data);
+    if (rc != ZOK)
+        return s->done(result<strings_t>(rc));
+    strings_t v;
+    v.reserve(strings->count);
+    for (int i = 0; i < strings->count; i++)
+        v.emplace_back(strings->data[i]);
+    s->done(std::move(v));
+}
+
+/* what a watch shares with its registrations */
+struct watch_state {
+    explicit watch_state(event_fn f) : fn(std::move(f)), cancelled(false) {}
+    event_fn fn;
+    bool cancelled;
+    /* held while the callback runs, so that cancel() waits for it */
+    std::recursive_mutex lock;
+};
+
+/* one arming of a watch, the context of the C watcher; owned by the
+ * client, which frees the ones that never fire when it is destroyed */
+struct watch_registration {
+    client *owner;
+    std::shared_ptr<watch_state> state;
+    bool fired;
+    watch_registration *prev;
+    watch_registration *next;
+};
+
+inline void on_watch(zhandle_t *zh, int type, int state, const char *path,
+        void *ctx);
+
+} // namespace detail
+
+/**
+ * A watch set by get, exists or children, calling its callback once the
+ * node changes. The callback is called at most once per request the watch
+ * is passed to, and never once the watch is cancelled or destroyed: after
+ * cancel() returns, the callback is not running and will not run (unless
+ * cancel() is called by the callback itself).
+ *
+ * The callback is also called if the session expires, with a
+ * ZOO_SESSION_EVENT.
+ */
+class watch {
+public:
+    watch() {}
+    explicit watch(event_fn fn)
+        : state_(std::make_shared<detail::watch_state>(std::move(fn))) {}
+    watch(watch &&other) noexcept : state_(std::move(other.state_)) {}
+    watch &operator=(watch &&other) noexcept {
+        if (this != &other) {
+            cancel();
+            state_ = std::move(other.state_);
+        }
+        return *this;
+    }
+    ~watch() { cancel(); }
+
+    /** stops the callback from being called; the watch is empty after */
+    void cancel() {
+        if (!state_)
+            return;
+        std::lock_guard<std::recursive_mutex> guard(state_->lock);
+        state_->cancelled = true;
+        state_.reset();
+    }
+    /** whether the watch has a callback, i.e. was not cancelled */
+    bool active() const { return static_cast<bool>(state_); }
+
+private:
+    friend class client;
+    std::shared_ptr<detail::watch_state> state_;
+};
+
+/**
+ * A session, closed when destroyed. The requests still in flight complete
+ * with ZCLOSING as it is.
+ */
+class client {
+public:
+    /**
+     * \brief connects to the ensemble, see \ref zookeeper_init.
+     *
+     * \param on_session called with the session events.
+     * \return the client, or nullptr with errno set.
+     */
+    static std::unique_ptr<client> init(std::string_view hosts,
+            int recv_timeout, event_fn on_session = event_fn(),
+            int flags = 0) {
+        std::unique_ptr<client> c(new client(std::move(on_session)));
+        detail::cstr h(hosts);
+        /* the session callback may be called before zookeeper_init
+         * returns, hence the client is passed as the context */
+        c->zh_ = zookeeper_init(h.c_str(), &client::on_session_event,
+                recv_timeout, 0, c.get(), flags);
+        if (!c->zh_)
+            return nullptr;
+        return c;
+    }
+
+    ~client() {
+        zookeeper_close(zh_);
+        std::lock_guard<std::mutex> guard(watches_lock_);
+        while (watches_) {
+            detail::watch_registration *r = watches_;
+            watches_ = r->next;
+            delete r;
+        }
+    }
+
+    client(const client &) = delete;
+    client &operator=(const client &) = delete;
+
+    /** the handle, for the calls of zookeeper.h; its context is the client */
+    zhandle_t *handle() const { return zh_; }
+    int state() const { return zoo_state(zh_); }
+
+    /** \ref zoo_acreate; the result is the path of the node created */
+    std::future<result<std::string>> create(std::string_view path,
+            std::string_view value, int flags = 0,
+            const ACL_vector *acl = &ZOO_OPEN_ACL_UNSAFE) {
+        return detail::start<std::string>(
+                create_op(this, path, value, flags, acl));
+    }
+    /** \ref zoo_adelete */
+    std::future<result<void>> remove(std::string_view path,
+            int version = -1) {
+        return detail::start<void>(remove_op(this, path, version));
+    }
+    /** \ref zoo_aexists */
+    std::future<result<Stat>> exists(std::string_view path) {
+        return detail::start<Stat>(exists_op(this, path, 0));
+    }
+    /** \ref zoo_awexists, arming w */
+    std::future<result<Stat>> exists(std::string_view path, watch &w) {
+        return detail::start<Stat>(exists_op(this, path, &w));
+    }
+    /** \ref zoo_aget */
+    std::future<result<node>> get(std::string_view path) {
+        return detail::start<node>(get_op(this, path, 0, &detail::on_data));
+    }
+    /** \ref zoo_awget, arming w */
+    std::future<result<node>> get(std::string_view path, watch &w) {
+        return detail::start<node>(get_op(this, path, &w, &detail::on_data));
+    }
+    /** \ref zoo_aset */
+    std::future<result<Stat>> set(std::string_view path,
+            std::string_view value, int version = -1) {
+        return detail::start<Stat>(set_op(this, path, value, version));
+    }
+    /** \ref zoo_aget_children */
+    std::future<result<std::vector<std::string>>> children(
+            std::string_view path) {
+        return detail::start<std::vector<std::string>>(
+                children_op(this, path, 0));
+    }
+    /** \ref zoo_awget_children, arming w */
+    std::future<result<std::vector<std::string>>> children(
+            std::string_view path, watch &w) {
+        return detail::start<std::vector<std::string>>(
+                children_op(this, path, &w));
+    }
+    /** \ref zoo_async */
+    std::future<result<std::string>> sync(std::string_view path) {
+        return detail::start<std::string>(sync_op(this, path));
+    }
+
+#ifdef ZOOKEEPER_HPP_COROUTINES
+    template <class T, class Submit>
+    using awaitable = detail::awaiter<T, Submit>;
+
+    auto co_create(std::string_view path, std::string_view value,
+            int flags = 0, const ACL_vector *acl = &ZOO_OPEN_ACL_UNSAFE) {
+        return awaitable<std::string, create_op>(
+                create_op(this, path, value, flags, acl));
+    }
+    auto co_remove(std::string_view path, int version = -1) {
+        return awaitable<void, remove_op>(remove_op(this, path, version));
+    }
+    auto co_exists(std::string_view path) {
+        return awaitable<Stat, exists_op>(exists_op(this, path, 0));
+    }
+    auto co_exists(std::string_view path, watch &w) {
+        return awaitable<Stat, exists_op>(exists_op(this, path, &w));
+    }
+    /** the result is a view of the response, see data_view */
+    auto co_get(std::string_view path) {
+        return awaitable<data_view, get_op>(
+                get_op(this, path, 0, &detail::on_data_view));
+    }
+    auto co_get(std::string_view path, watch &w) {
+        return awaitable<data_view, get_op>(
+                get_op(this, path, &w, &detail::on_data_view));
+    }
+    auto co_set(std::string_view path, std::string_view value,
+            int version = -1) {
+        return awaitable<Stat, set_op>(set_op(this, path, value, version));
+    }
+    auto co_children(std::string_view path) {
+        return awaitable<std::vector<std::string>, children_op>(
+                children_op(this, path, 0));
+    }
+    auto co_children(std::string_view path, watch &w) {
+        return awaitable<std::vector<std::string>, children_op>(
+                children_op(this, path, &w));
+    }
+    auto co_sync(std::string_view path) {
+        return awaitable<std::string, sync_op>(sync_op(this, path));
+    }
+#endif
+
+private:
+    friend void detail::on_watch(zhandle_t *, int, int, const char *,
+            void *);
+
+    explicit client(event_fn on_session)
+        : zh_(0), on_session_(std::move(on_session)), watches_(0) {}
+
+    static void on_session_event(zhandle_t *, int type, int state,
+            const char *path, void *ctx) {
+        client *c = static_cast<client *>(ctx);
+        if (c->on_session_)
+            c->on_session_(event{type, state, path ? path : ""});
+    }
+
+    /* the requests, submitted by detail::start or an awaiter */
+    struct create_op {
+        create_op(client *c_, std::string_view p, std::string_view v,
+                int f, const ACL_vector *a) : c(c_), path(p), value(v), flags(f), acl(a) {}
+        client *c;
+        std::string_view path, value;
+        int flags;
+        const ACL_vector *acl;
+        int operator()(const void *data) const {
+            detail::cstr p(path);
+            return zoo_acreate(c->zh_, p.c_str(), value.data(),
+                    detail::value_len(value), acl, flags,
+                    &detail::on_string, data);
+        }
+    };
+    struct remove_op {
+        remove_op(client *c_, std::string_view p, int v)
+            : c(c_), path(p), version(v) {}
+        client *c;
+        std::string_view path;
+        int version;
+        int operator()(const void *data) const {
+            detail::cstr p(path);
+            return zoo_adelete(c->zh_, p.c_str(), version,
+                    &detail::on_void, data);
+        }
+    };
+    struct exists_op {
+        exists_op(client *c_, std::string_view p, watch *w_)
+            : c(c_), path(p), w(w_) {}
+        client *c;
+        std::string_view path;
+        watch *w;
+        int operator()(const void *data) const {
+            detail::cstr p(path);
+            if (!w)
+                return zoo_aexists(c->zh_, p.c_str(), 0, &detail::on_stat,
+                        data);
+            return c->with_watch(*w, [&](detail::watch_registration *r) {
+                return zoo_awexists(c->zh_, p.c_str(), &detail::on_watch, r,
+                        &detail::on_stat, data);
+            });
+        }
+    };
+    struct get_op {
+        get_op(client *c_, std::string_view p, watch *w_,
+                data_completion_t cb) : c(c_), path(p), w(w_), completion(cb) {}
+        client *c;
+        std::string_view path;
+        watch *w;
+        data_completion_t completion;
+        int operator()(const void *data) const {
+            detail::cstr p(path);
+            if (!w)
+                return zoo_aget(c->zh_, p.c_str(), 0, completion, data);
+            return c->with_watch(*w, [&](detail::watch_registration *r) {
+                return zoo_awget(c->zh_, p.c_str(), &detail::on_watch, r,
+                        completion, data);
+            });
+        }
+    };
+    struct set_op {
+        set_op(client *c_, std::string_view p, std::string_view v,
+                int ver) : c(c_), path(p), value(v), version(ver) {}
+        client *c;
+        std::string_view path, value;
+        int version;
+        int operator()(const void *data) const {
+            detail::cstr p(path);
+            return zoo_aset(c->zh_, p.c_str(), value.data(),
+                    detail::value_len(value), version, &detail::on_stat,
+                    data);
+        }
+    };
+    struct children_op {
+        children_op(client *c_, std::string_view p, watch *w_)
+            : c(c_), path(p), w(w_) {}
+        client *c;
+        std::string_view path;
+        watch *w;
+        int operator()(const void *data) const {
+            detail::cstr p(path);
+            if (!w)
+                return zoo_aget_children(c->zh_, p.c_str(), 0,
+                        &detail::on_strings, data);
+            return c->with_watch(*w, [&](detail::watch_registration *r) {
+                return zoo_awget_children(c->zh_, p.c_str(),
+                        &detail::on_watch, r, &detail::on_strings, data);
+            });
+        }
+    };
+    struct sync_op {
+        sync_op(client *c_, std::string_view p) : c(c_), path(p) {}
+        client *c;
+        std::string_view path;
+        int operator()(const void *data) const {
+            detail::cstr p(path);
+            return zoo_async(c->zh_, p.c_str(), &detail::on_string, data);
+        }
+    };
+
+    /* registers an arming of w for the duration of submit, and for good if
+     * submit succeeds */
+    template <class Submit>
+    int with_watch(watch &w, Submit &&submit) {
+        if (!w.state_)
+            return ZBADARGUMENTS;
+        detail::watch_registration *r = new detail::watch_registration;
+        r->owner = this;
+        r->state = w.state_;
+        r->fired = false;
+        link(r);
+        int rc = submit(r);
+        if (rc != ZOK) {
+            unlink(r);
+            delete r;
+        }
+        return rc;
+    }
+
+    void link(detail::watch_registration *r) {
+        std::lock_guard<std::mutex> guard(watches_lock_);
+        r->prev = 0;
+        r->next = watches_;
+        if (watches_)
+            watches_->prev = r;
+        watches_ = r;
+    }
+
+    void unlink(detail::watch_registration *r) {
+        std::lock_guard<std::mutex> guard(watches_lock_);
+        if (r->prev)
+            r->prev->next = r->next;
+        else
+            watches_ = r->next;
+        if (r->next)
+            r->next->prev = r->prev;
+    }
+
+    zhandle_t *zh_;
+    event_fn on_session_;
+    std::mutex watches_lock_;
+    detail::watch_registration *watches_;
+};
+
+namespace detail {
+
+/* a node event is delivered once, after which the C client forgets the
+ * registration; session events are delivered to every watch still set,
+ * for as long as the session lives, so the registration is only freed
+ * with the client */
+inline void on_watch(zhandle_t *, int type, int state, const char *path,
+        void *ctx) {
+    watch_registration *r = static_cast<watch_registration *>(ctx);
+    bool node_event = type != ZOO_SESSION_EVENT;
+    if (r->fired || (!node_event && state != ZOO_EXPIRED_SESSION_STATE))
+        return;
+    r->fired = true;
+    {
+        std::lock_guard<std::recursive_mutex> guard(r->state->lock);
+        if (!r->state->cancelled)
+            r->state->fn(event{type, state, path ? path : ""});
+    }
+    if (node_event) {
+        r->owner->unlink(r);
+        delete r;
+    }
+}
+
+} // namespace detail
+
+} // namespace zk
+
+#endif /* ZOOKEEPER_HPP_ */
@@ -0,0 +1,167 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZOOKEEPER_POOL_H_
+#define ZOOKEEPER_POOL_H_
+
+#include <zookeeper.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \file zookeeper_pool.h
+ * A pool of sessions spreading the requests of one process across the
+ * servers of an ensemble.
+ *
+ * Each session of the pool is a separate zhandle, with its own connection,
+ * IO pipeline and (in the multithreaded library) threads. The sessions
+ * first try consecutive servers of the host list, starting from one drawn
+ * at random for each pool, so a pool as large as the ensemble has a
+ * connection to every server and smaller pools are spread across it.
+ *
+ * Reads without a watch go to the connected session with the fewest
+ * requests in flight. Writes, and reads that set a watch, go to a session
+ * chosen by hashing the path, so the operations on one path keep the order
+ * they were issued in, and a watch is always delivered ahead of the result
+ * of a later read of the same path. Reads without a watch are not ordered
+ * with the writes of the pool: use zoo_pool_key_handle() to read your own
+ * writes.
+ */
+
+typedef struct _zoo_pool zoo_pool_t;
+
+/**
+ * Request counts of a pool or of one of its sessions.
+ */
+typedef struct zoo_pool_stats {
+    int sessions;           /* sessions counted */
+    int connected;          /* ... of which are connected */
+    int outstanding;        /* requests in flight */
+    int64_t reads;          /* read requests submitted */
+    int64_t writes;         /* write requests submitted */
+    int64_t completed;      /* requests completed */
+    int64_t errors;         /* requests completed with an error */
+} zoo_pool_stats_t;
+
+/**
+ * \brief creates a pool of sessions.
+ *
+ * The arguments are those of \ref zookeeper_init. Every session is started
+ * with the same watcher and context; the watcher is given the zhandle of
+ * the session the event occurred on.
+ *
+ * \param size the number of sessions, at least 1.
+ * \return the pool, or NULL with errno set if a session could not be
+ * created.
+ */
+ZOOAPI zoo_pool_t *zoo_pool_init(const char *host, int size, watcher_fn fn,
+        int recv_timeout, void *context, int flags);
+
+/**
+ * \brief closes every session of the pool and frees it.
+ *
+ * The completions of the requests still in flight are called with
+ * ZCLOSING before it returns.
+ * \return ZOK, or the first error returned by \ref zookeeper_close.
+ */
+ZOOAPI int zoo_pool_close(zoo_pool_t *pool);
+
+/**
+ * \brief returns the number of sessions of the pool.
+ */
+ZOOAPI int zoo_pool_size(zoo_pool_t *pool);
+
+/**
+ * \brief returns the zhandle of the index-th session, or NULL.
+ */
+ZOOAPI zhandle_t *zoo_pool_handle(zoo_pool_t *pool, int index);
+
+/**
+ * \brief returns the zhandle the pool routes the writes to a path to.
+ */
+ZOOAPI zhandle_t *zoo_pool_key_handle(zoo_pool_t *pool, const char *path);
+
+/**
+ * \brief gets the request counts of the index-th session, or of the whole
+ * pool if index is -1.
+ * \return ZOK, or ZBADARGUMENTS if index is out of range.
+ */
+ZOOAPI int zoo_pool_get_stats(zoo_pool_t *pool, int index,
+        zoo_pool_stats_t *stats);
+
+/**
+ * The request functions below are those of zookeeper.h, taking a pool
+ * instead of a zhandle. They return the error of the underlying call, in
+ * which case the completion is not called.
+ */
+
+/** \brief \ref zoo_aget on the least loaded session, or the path's session
+ * if watch is set */
+ZOOAPI int zoo_pool_aget(zoo_pool_t *pool, const char *path, int watch,
+        data_completion_t completion, const void *data);
+/** \brief \ref zoo_awget on the path's session */
+ZOOAPI int zoo_pool_awget(zoo_pool_t *pool, const char *path,
+        watcher_fn watcher, void *watcherCtx,
+        data_completion_t completion, const void *data);
+/** \brief \ref zoo_aexists on the least loaded session, or the path's
+ * session if watch is set */
+ZOOAPI int zoo_pool_aexists(zoo_pool_t *pool, const char *path, int watch,
+        stat_completion_t completion, const void *data);
+/** \brief \ref zoo_awexists on the path's session */
+ZOOAPI int zoo_pool_awexists(zoo_pool_t *pool, const char *path,
+        watcher_fn watcher, void *watcherCtx,
+        stat_completion_t completion, const void *data);
+/** \brief \ref zoo_aget_children on the least loaded session, or the path's
+ * session if watch is set */
+ZOOAPI int zoo_pool_aget_children(zoo_pool_t *pool, const char *path,
+        int watch, strings_completion_t completion, const void *data);
+/** \brief \ref zoo_awget_children on the path's session */
+ZOOAPI int zoo_pool_awget_children(zoo_pool_t *pool, const char *path,
+        watcher_fn watcher, void *watcherCtx,
+        strings_completion_t completion, const void *data);
+/** \brief \ref zoo_aget_children2 on the least loaded session, or the
+ * path's session if watch is set */
+ZOOAPI int zoo_pool_aget_children2(zoo_pool_t *pool, const char *path,
+        int watch, strings_stat_completion_t completion, const void *data);
+/** \brief \ref zoo_awget_children2 on the path's session */
+ZOOAPI int zoo_pool_awget_children2(zoo_pool_t *pool, const char *path,
+        watcher_fn watcher, void *watcherCtx,
+        strings_stat_completion_t completion, const void *data);
+/** \brief \ref zoo_acreate on the path's session */
+ZOOAPI int zoo_pool_acreate(zoo_pool_t *pool, const char *path,
+        const char *value, int valuelen, const struct ACL_vector *acl,
+        int flags, string_completion_t completion, const void *data);
+/** \brief \ref zoo_aset on the path's session */
+ZOOAPI int zoo_pool_aset(zoo_pool_t *pool, const char *path,
+        const char *buffer, int buflen, int version,
+        stat_completion_t completion, const void *data);
+/** \brief \ref zoo_adelete on the path's session */
+ZOOAPI int zoo_pool_adelete(zoo_pool_t *pool, const char *path, int version,
+        void_completion_t completion, const void *data);
+/** \brief \ref zoo_amulti on the session of the path of the first op */
+ZOOAPI int zoo_pool_amulti(zoo_pool_t *pool, int count, const zoo_op_t *ops,
+        zoo_op_result_t *results, void_completion_t completion,
+        const void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*ZOOKEEPER_POOL_H_*/
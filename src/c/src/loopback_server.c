@@ -0,0 +1,1548 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <zookeeper.h>
+#include <proto.h>
+#include "zk_adaptor.h"
+#include "loopback_server.h"
+#include "hashtable/hashtable.h"
+#include "hashtable/hashtable_itr.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/* frames larger than this are a protocol error */
+#define MAX_FRAME_SIZE (16 * 1024 * 1024)
+/* how often disconnected sessions are checked for expiry, in ms */
+#define EXPIRY_CHECK_MS 100
+#define MIN_SESSION_TIMEOUT 4000
+#define MAX_SESSION_TIMEOUT 40000
+/* parent paths up to this long are looked up without allocating */
+#define PARENT_BUFFER_SIZE 512
+
+typedef struct lb_node {
+    char *path;             /* also the key of the node table, which frees it */
+    char *data;
+    int data_len;
+    struct Stat stat;
+    char **children;        /* names of the children, unsorted */
+    int child_count;
+    int child_cap;
+} lb_node_t;
+
+/* the sessions watching a path */
+typedef struct lb_watch {
+    int64_t *sessions;
+    int count;
+    int cap;
+} lb_watch_t;
+
+typedef struct lb_pending {
+    int64_t due;            /* when the response may be written, in us */
+    char *buf;              /* the framed response */
+    int len;
+    struct lb_pending *next;
+} lb_pending_t;
+
+struct lb_session;
+
+typedef struct lb_conn {
+    int fd;
+    int handshaken;
+    int closing;            /* close once the queued responses are written */
+    struct lb_session *session;
+    char *in;
+    int in_len;
+    int in_cap;
+    char *out;
+    int out_off;
+    int out_len;
+    int out_cap;
+    /* responses waiting for their latency to elapse, in due order */
+    lb_pending_t *pending_head;
+    lb_pending_t *pending_tail;
+    struct lb_conn *next;
+} lb_conn_t;
+
+typedef struct lb_session {
+    int64_t id;
+    char passwd[16];
+    int timeout;
+    lb_conn_t *conn;        /* NULL while disconnected */
+    int64_t expires;        /* when a disconnected session expires, in us */
+    char **ephemerals;
+    int ephemeral_count;
+    int ephemeral_cap;
+    struct lb_session *next;
+} lb_session_t;
+
+/* a change made by a write, kept until the transaction commits */
+typedef struct lb_undo {
+    int type;
+    lb_node_t *node;        /* the created or deleted node */
+    char *path;             /* the path of a set node */
+    char *old_data;
+    int old_len;
+    struct Stat old_stat;
+    int64_t parent_pzxid;
+    int32_t parent_cversion;
+    struct lb_undo *next;
+} lb_undo_t;
+
+typedef struct lb_trigger {
+    int type;
+    char *path;
+    struct lb_trigger *next;
+} lb_trigger_t;
+
+typedef struct lb_txn {
+    lb_undo_t *undo;        /* most recent first */
+    lb_trigger_t *triggers;
+    lb_trigger_t *last_trigger;
+} lb_txn_t;
+
+struct _loopback_server {
+    loopback_options_t opts;
+    int listen_fd;
+    int port;
+    int wake[2];
+    volatile int stop;
+    int started;
+    pthread_t thread;
+    struct hashtable *nodes;
+    struct hashtable *data_watches;
+    struct hashtable *child_watches;
+    lb_conn_t *conns;
+    lb_session_t *sessions;
+    int64_t zxid;
+    int64_t next_session;
+    unsigned int seed;
+    char *fill;             /* backs synthetic getData responses */
+    int fill_len;
+};
+
+static int64_t now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static unsigned int path_hash(void *key)
+{
+    const unsigned char *s = key;
+    unsigned int h = 5381;
+    while (*s)
+        h = h * 33 + *s++;
+    return h;
+}
+
+static int path_equal(void *key1, void *key2)
+{
+    return strcmp(key1, key2) == 0;
+}
+
+int loopback_parse_dist(const char *spec, loopback_dist_t *dist)
+{
+    char *end;
+    memset(dist, 0, sizeof(*dist));
+    if (strncmp(spec, "fixed:", 6) == 0) {
+        spec += 6;
+    } else if (strncmp(spec, "uniform:", 8) == 0) {
+        dist->kind = LOOPBACK_DIST_UNIFORM;
+        dist->a = strtod(spec + 8, &end);
+        if (end == spec + 8 || *end != '-')
+            return -1;
+        spec = end + 1;
+        dist->b = strtod(spec, &end);
+        if (end == spec || *end || dist->a < 0 || dist->b < dist->a)
+            return -1;
+        return 0;
+    } else if (strncmp(spec, "exp:", 4) == 0) {
+        dist->kind = LOOPBACK_DIST_EXP;
+        spec += 4;
+    }
+    dist->a = strtod(spec, &end);
+    if (end == spec || *end || dist->a < 0)
+        return -1;
+    if (dist->kind == LOOPBACK_DIST_NONE)
+        dist->kind = LOOPBACK_DIST_FIXED;
+    return 0;
+}
+
+static double sample(loopback_server_t *srv, const loopback_dist_t *dist)
+{
+    double u;
+    switch (dist->kind) {
+    case LOOPBACK_DIST_FIXED:
+        return dist->a;
+    case LOOPBACK_DIST_UNIFORM:
+        u = rand_r(&srv->seed) / ((double)RAND_MAX + 1);
+        return dist->a + (dist->b - dist->a) * u;
+    case LOOPBACK_DIST_EXP:
+        u = (rand_r(&srv->seed) + 1.0) / ((double)RAND_MAX + 2);
+        return -dist->a * log(u);
+    }
+    return 0;
+}
+
+// *****************************************************************************
+// the data tree
+
+static void parent_path(const char *path, char *parent, size_t size)
+{
+    const char *slash = strrchr(path, '/');
+    size_t len = slash == path ? 1 : (size_t)(slash - path);
+    if (len >= size)
+        len = size - 1;
+    memcpy(parent, path, len);
+    parent[len] = 0;
+}
+
+static lb_node_t *find_node(loopback_server_t *srv, const char *path)
+{
+    return hashtable_search(srv->nodes, (void*)path);
+}
+
+static lb_node_t *find_parent(loopback_server_t *srv, const char *path)
+{
+    char parent[PARENT_BUFFER_SIZE];
+    char *buf = parent;
+    lb_node_t *node;
+    size_t len = strlen(path) + 1;
+    if (len > sizeof(parent))
+        buf = malloc(len);
+    parent_path(path, buf, len);
+    node = find_node(srv, buf);
+    if (buf != parent)
+        free(buf);
+    return node;
+}
+
+static void add_child(lb_node_t *parent, const char *name)
+{
+    if (parent->child_count == parent->child_cap) {
+        parent->child_cap = parent->child_cap ? parent->child_cap * 2 : 4;
+        parent->children = realloc(parent->children,
+                parent->child_cap * sizeof(char*));
+    }
+    parent->children[parent->child_count++] = strdup(name);
+    parent->stat.numChildren = parent->child_count;
+}
+
+static void remove_child(lb_node_t *parent, const char *name)
+{
+    int i;
+    for (i = 0; i < parent->child_count; i++) {
+        if (strcmp(parent->children[i], name) == 0) {
+            free(parent->children[i]);
+            parent->children[i] = parent->children[--parent->child_count];
+            break;
+        }
+    }
+    parent->stat.numChildren = parent->child_count;
+}
+
+static const char *base_name(const char *path)
+{
+    return strrchr(path, '/') + 1;
+}
+
+static void free_node(lb_node_t *node)
+{
+    int i;
+    for (i = 0; i < node->child_count; i++)
+        free(node->children[i]);
+    free(node->children);
+    free(node->data);
+    free(node);
+}
+
+static lb_node_t *new_node(const char *path, const char *data, int len)
+{
+    lb_node_t *node = calloc(1, sizeof(*node));
+    node->path = strdup(path);
+    if (len > 0) {
+        node->data = malloc(len);
+        memcpy(node->data, data, len);
+        node->data_len = len;
+    }
+    return node;
+}
+
+static void init_stat(loopback_server_t *srv, struct Stat *stat, int64_t owner,
+        int data_len)
+{
+    int64_t now = now_us() / 1000;
+    memset(stat, 0, sizeof(*stat));
+    stat->czxid = stat->mzxid = stat->pzxid = srv->zxid;
+    stat->ctime = stat->mtime = now;
+    stat->ephemeralOwner = owner;
+    stat->dataLength = data_len;
+}
+
+static lb_session_t *find_session(loopback_server_t *srv, int64_t id)
+{
+    lb_session_t *s;
+    for (s = srv->sessions; s; s = s->next) {
+        if (s->id == id)
+            return s;
+    }
+    return 0;
+}
+
+static void add_ephemeral(lb_session_t *s, const char *path)
+{
+    if (s->ephemeral_count == s->ephemeral_cap) {
+        s->ephemeral_cap = s->ephemeral_cap ? s->ephemeral_cap * 2 : 4;
+        s->ephemerals = realloc(s->ephemerals, s->ephemeral_cap * sizeof(char*));
+    }
+    s->ephemerals[s->ephemeral_count++] = strdup(path);
+}
+
+static void remove_ephemeral(lb_session_t *s, const char *path)
+{
+    int i;
+    for (i = 0; i < s->ephemeral_count; i++) {
+        if (strcmp(s->ephemerals[i], path) == 0) {
+            free(s->ephemerals[i]);
+            s->ephemerals[i] = s->ephemerals[--s->ephemeral_count];
+            return;
+        }
+    }
+}
+
+// *****************************************************************************
+// watches
+
+static void add_watch(struct hashtable *table, const char *path, int64_t session)
+{
+    lb_watch_t *w = hashtable_search(table, (void*)path);
+    int i;
+    if (!w) {
+        w = calloc(1, sizeof(*w));
+        hashtable_insert(table, strdup(path), w);
+    }
+    for (i = 0; i < w->count; i++) {
+        if (w->sessions[i] == session)
+            return;
+    }
+    if (w->count == w->cap) {
+        w->cap = w->cap ? w->cap * 2 : 4;
+        w->sessions = realloc(w->sessions, w->cap * sizeof(int64_t));
+    }
+    w->sessions[w->count++] = session;
+}
+
+static void free_watch(lb_watch_t *w)
+{
+    if (w) {
+        free(w->sessions);
+        free(w);
+    }
+}
+
+static void drop_session_watches(struct hashtable *table, int64_t session)
+{
+    struct hashtable_itr *it;
+    if (hashtable_count(table) == 0)
+        return;
+    it = hashtable_iterator(table);
+    do {
+        lb_watch_t *w = hashtable_iterator_value(it);
+        int i;
+        for (i = 0; i < w->count; i++) {
+            if (w->sessions[i] == session) {
+                w->sessions[i] = w->sessions[--w->count];
+                break;
+            }
+        }
+    } while (hashtable_iterator_advance(it));
+    free(it);
+}
+
+// *****************************************************************************
+// connection output
+
+static void append_out(lb_conn_t *conn, const char *buf, int len)
+{
+    if (conn->out_off > 0 && conn->out_off == conn->out_len) {
+        conn->out_off = conn->out_len = 0;
+    }
+    if (conn->out_len + len > conn->out_cap) {
+        if (conn->out_off > 0) {
+            memmove(conn->out, conn->out + conn->out_off,
+                    conn->out_len - conn->out_off);
+            conn->out_len -= conn->out_off;
+            conn->out_off = 0;
+        }
+        while (conn->out_len + len > conn->out_cap)
+            conn->out_cap = conn->out_cap ? conn->out_cap * 2 : 16384;
+        conn->out = realloc(conn->out, conn->out_cap);
+    }
+    memcpy(conn->out + conn->out_len, buf, len);
+    conn->out_len += len;
+}
+
+/* queues a response, framed with its length, behind the sampled latency */
+static void send_frame(loopback_server_t *srv, lb_conn_t *conn,
+        struct oarchive *oa)
+{
+    int len = get_buffer_len(oa);
+    int32_t nlen = htonl(len);
+    int64_t due;
+    lb_pending_t *p;
+
+    if (srv->opts.latency.kind == LOOPBACK_DIST_NONE) {
+        append_out(conn, (char*)&nlen, sizeof(nlen));
+        append_out(conn, get_buffer(oa), len);
+        return;
+    }
+    /* responses on a connection must stay in order, so a response is never
+     * due before the one queued ahead of it */
+    due = now_us() + (int64_t)sample(srv, &srv->opts.latency);
+    if (conn->pending_tail && conn->pending_tail->due > due)
+        due = conn->pending_tail->due;
+    p = malloc(sizeof(*p));
+    p->due = due;
+    p->len = len + sizeof(nlen);
+    p->buf = malloc(p->len);
+    memcpy(p->buf, &nlen, sizeof(nlen));
+    memcpy(p->buf + sizeof(nlen), get_buffer(oa), len);
+    p->next = 0;
+    if (conn->pending_tail)
+        conn->pending_tail->next = p;
+    else
+        conn->pending_head = p;
+    conn->pending_tail = p;
+}
+
+static void send_reply_header(loopback_server_t *srv, lb_conn_t *conn,
+        int32_t xid, int32_t err)
+{
+    struct oarchive *oa = create_buffer_oarchive();
+    struct ReplyHeader h = { xid, srv->zxid, err };
+    serialize_ReplyHeader(oa, "hdr", &h);
+    send_frame(srv, conn, oa);
+    close_buffer_oarchive(&oa, 1);
+}
+
+static void send_event(loopback_server_t *srv, lb_conn_t *conn, int type,
+        const char *path)
+{
+    struct oarchive *oa = create_buffer_oarchive();
+    struct ReplyHeader h = { WATCHER_EVENT_XID, -1, ZOK };
+    struct WatcherEvent evt;
+    evt.type = type;
+    evt.state = CONNECTED_STATE_DEF;
+    evt.path = (char*)path;
+    serialize_ReplyHeader(oa, "hdr", &h);
+    serialize_WatcherEvent(oa, "event", &evt);
+    send_frame(srv, conn, oa);
+    close_buffer_oarchive(&oa, 1);
+}
+
+static void fire_watch(loopback_server_t *srv, struct hashtable *table,
+        const char *path, int type)
+{
+    lb_watch_t *w = hashtable_remove(table, (void*)path);
+    int i;
+    if (!w)
+        return;
+    for (i = 0; i < w->count; i++) {
+        lb_session_t *s = find_session(srv, w->sessions[i]);
+        if (s && s->conn)
+            send_event(srv, s->conn, type, path);
+    }
+    free_watch(w);
+}
+
+static void fire_trigger(loopback_server_t *srv, int type, const char *path)
+{
+    switch (type) {
+    case CREATED_EVENT_DEF:
+    case CHANGED_EVENT_DEF:
+        fire_watch(srv, srv->data_watches, path, type);
+        break;
+    case DELETED_EVENT_DEF:
+        fire_watch(srv, srv->data_watches, path, type);
+        fire_watch(srv, srv->child_watches, path, type);
+        break;
+    case CHILD_EVENT_DEF:
+        fire_watch(srv, srv->child_watches, path, type);
+        break;
+    }
+}
+
+// *****************************************************************************
+// writes: every write runs in a transaction, so a failed multi can be undone
+// and the watches fire only once all of its operations have succeeded
+
+static void txn_trigger(lb_txn_t *txn, int type, const char *path)
+{
+    lb_trigger_t *t = malloc(sizeof(*t));
+    t->type = type;
+    t->path = strdup(path);
+    t->next = 0;
+    if (txn->last_trigger)
+        txn->last_trigger->next = t;
+    else
+        txn->triggers = t;
+    txn->last_trigger = t;
+}
+
+static lb_undo_t *txn_undo(lb_txn_t *txn, int type)
+{
+    lb_undo_t *u = calloc(1, sizeof(*u));
+    u->type = type;
+    u->next = txn->undo;
+    txn->undo = u;
+    return u;
+}
+
+static void free_triggers(lb_txn_t *txn)
+{
+    while (txn->triggers) {
+        lb_trigger_t *t = txn->triggers;
+        txn->triggers = t->next;
+        free(t->path);
+        free(t);
+    }
+    txn->last_trigger = 0;
+}
+
+static void txn_commit(loopback_server_t *srv, lb_txn_t *txn)
+{
+    lb_trigger_t *t;
+    while (txn->undo) {
+        lb_undo_t *u = txn->undo;
+        txn->undo = u->next;
+        if (u->type == ZOO_DELETE_OP) {
+            free(u->node->path);
+            free_node(u->node);
+        }
+        free(u->path);
+        free(u->old_data);
+        free(u);
+    }
+    for (t = txn->triggers; t; t = t->next)
+        fire_trigger(srv, t->type, t->path);
+    free_triggers(txn);
+}
+
+static void txn_rollback(loopback_server_t *srv, lb_txn_t *txn)
+{
+    while (txn->undo) {
+        lb_undo_t *u = txn->undo;
+        lb_node_t *parent;
+        lb_session_t *owner;
+        txn->undo = u->next;
+        switch (u->type) {
+        case ZOO_CREATE_OP:
+            parent = find_parent(srv, u->node->path);
+            remove_child(parent, base_name(u->node->path));
+            parent->stat.cversion = u->parent_cversion;
+            parent->stat.pzxid = u->parent_pzxid;
+            owner = find_session(srv, u->node->stat.ephemeralOwner);
+            if (owner)
+                remove_ephemeral(owner, u->node->path);
+            /* the table owns the path and frees it */
+            hashtable_remove(srv->nodes, u->node->path);
+            free_node(u->node);
+            break;
+        case ZOO_DELETE_OP:
+            parent = find_parent(srv, u->node->path);
+            add_child(parent, base_name(u->node->path));
+            parent->stat.cversion = u->parent_cversion;
+            parent->stat.pzxid = u->parent_pzxid;
+            owner = find_session(srv, u->node->stat.ephemeralOwner);
+            if (owner)
+                add_ephemeral(owner, u->node->path);
+            hashtable_insert(srv->nodes, u->node->path, u->node);
+            break;
+        case ZOO_SETDATA_OP: {
+            lb_node_t *node = find_node(srv, u->path);
+            free(node->data);
+            node->data = u->old_data;
+            node->data_len = u->old_len;
+            node->stat = u->old_stat;
+            u->old_data = 0;
+            break;
+        }
+        }
+        free(u->path);
+        free(u->old_data);
+        free(u);
+    }
+    free_triggers(txn);
+}
+
+static int do_create(loopback_server_t *srv, lb_txn_t *txn, lb_session_t *s,
+        struct CreateRequest *req, char **created)
+{
+    lb_node_t *parent = req->path[0] == '/' ? find_parent(srv, req->path) : 0;
+    lb_node_t *node;
+    lb_undo_t *u;
+    char *path;
+    int64_t owner = req->flags & ZOO_EPHEMERAL ? s->id : 0;
+
+    if (req->path[0] != '/' || strcmp(req->path, "/") == 0)
+        return ZBADARGUMENTS;
+    if (!parent)
+        return ZNONODE;
+    if (parent->stat.ephemeralOwner != 0)
+        return ZNOCHILDRENFOREPHEMERALS;
+    if (req->flags & ZOO_SEQUENCE) {
+        size_t len = strlen(req->path);
+        path = malloc(len + 11);
+        sprintf(path, "%s%010d", req->path, parent->stat.cversion);
+    } else {
+        path = strdup(req->path);
+    }
+    if (find_node(srv, path)) {
+        free(path);
+        return ZNODEEXISTS;
+    }
+    node = new_node(path, req->data.buff, req->data.len);
+    free(path);
+    init_stat(srv, &node->stat, owner, node->data_len);
+    hashtable_insert(srv->nodes, node->path, node);
+
+    u = txn_undo(txn, ZOO_CREATE_OP);
+    u->node = node;
+    u->parent_cversion = parent->stat.cversion;
+    u->parent_pzxid = parent->stat.pzxid;
+    add_child(parent, base_name(node->path));
+    parent->stat.cversion++;
+    parent->stat.pzxid = srv->zxid;
+    if (owner)
+        add_ephemeral(s, node->path);
+
+    txn_trigger(txn, CREATED_EVENT_DEF, node->path);
+    txn_trigger(txn, CHILD_EVENT_DEF, parent->path);
+    *created = node->path;
+    return ZOK;
+}
+
+static int delete_node(loopback_server_t *srv, lb_txn_t *txn, const char *path,
+        int version)
+{
+    lb_node_t *node = find_node(srv, path);
+    lb_node_t *parent;
+    lb_session_t *owner;
+    lb_undo_t *u;
+
+    if (strcmp(path, "/") == 0)
+        return ZBADARGUMENTS;
+    if (!node)
+        return ZNONODE;
+    if (version != -1 && version != node->stat.version)
+        return ZBADVERSION;
+    if (node->child_count > 0)
+        return ZNOTEMPTY;
+    parent = find_parent(srv, path);
+    u = txn_undo(txn, ZOO_DELETE_OP);
+    u->parent_cversion = parent->stat.cversion;
+    u->parent_pzxid = parent->stat.pzxid;
+    /* the table frees its key, so the node gets a fresh copy of its path */
+    u->node = node;
+    txn_trigger(txn, DELETED_EVENT_DEF, path);
+    txn_trigger(txn, CHILD_EVENT_DEF, parent->path);
+    node->path = strdup(path);
+    hashtable_remove(srv->nodes, node->path);
+    remove_child(parent, base_name(node->path));
+    parent->stat.cversion++;
+    parent->stat.pzxid = srv->zxid;
+    owner = find_session(srv, node->stat.ephemeralOwner);
+    if (owner)
+        remove_ephemeral(owner, node->path);
+    return ZOK;
+}
+
+static int do_set(loopback_server_t *srv, lb_txn_t *txn,
+        struct SetDataRequest *req, struct Stat *stat)
+{
+    lb_node_t *node = find_node(srv, req->path);
+    lb_undo_t *u;
+
+    if (!node)
+        return ZNONODE;
+    if (req->version != -1 && req->version != node->stat.version)
+        return ZBADVERSION;
+    u = txn_undo(txn, ZOO_SETDATA_OP);
+    u->path = strdup(req->path);
+    u->old_data = node->data;
+    u->old_len = node->data_len;
+    u->old_stat = node->stat;
+    node->data = 0;
+    node->data_len = req->data.len > 0 ? req->data.len : 0;
+    if (node->data_len > 0) {
+        node->data = malloc(node->data_len);
+        memcpy(node->data, req->data.buff, node->data_len);
+    }
+    node->stat.version++;
+    node->stat.mzxid = srv->zxid;
+    node->stat.mtime = now_us() / 1000;
+    node->stat.dataLength = node->data_len;
+    txn_trigger(txn, CHANGED_EVENT_DEF, req->path);
+    *stat = node->stat;
+    return ZOK;
+}
+
+static int do_check(loopback_server_t *srv, struct CheckVersionRequest *req)
+{
+    lb_node_t *node = find_node(srv, req->path);
+    if (!node)
+        return ZNONODE;
+    if (req->version != -1 && req->version != node->stat.version)
+        return ZBADVERSION;
+    return ZOK;
+}
+
+// *****************************************************************************
+// sessions
+
+static void close_session(loopback_server_t *srv, lb_session_t *s)
+{
+    lb_session_t **pp;
+    lb_txn_t txn = { 0, 0, 0 };
+
+    if (s->ephemeral_count > 0) {
+        srv->zxid++;
+        while (s->ephemeral_count > 0) {
+            char *path = strdup(s->ephemerals[s->ephemeral_count - 1]);
+            if (delete_node(srv, &txn, path, -1) != ZOK)
+                remove_ephemeral(s, path);
+            free(path);
+        }
+    }
+    if (s->conn)
+        s->conn->session = 0;
+    drop_session_watches(srv->data_watches, s->id);
+    drop_session_watches(srv->child_watches, s->id);
+    for (pp = &srv->sessions; *pp; pp = &(*pp)->next) {
+        if (*pp == s) {
+            *pp = s->next;
+            break;
+        }
+    }
+    free(s->ephemerals);
+    free(s);
+    txn_commit(srv, &txn);
+}
+
+static void expire_sessions(loopback_server_t *srv, int64_t now)
+{
+    lb_session_t *s = srv->sessions;
+    while (s) {
+        lb_session_t *next = s->next;
+        if (!s->conn && s->expires <= now)
+            close_session(srv, s);
+        s = next;
+    }
+}
+
+// *****************************************************************************
+// request dispatch
+
+static void send_response(loopback_server_t *srv, lb_conn_t *conn,
+        int32_t xid, int32_t err, int (*serialize)(struct oarchive*,
+        const char*, void*), void *body)
+{
+    struct oarchive *oa = create_buffer_oarchive();
+    struct ReplyHeader h = { xid, srv->zxid, err };
+    serialize_ReplyHeader(oa, "hdr", &h);
+    if (err == ZOK && serialize)
+        serialize(oa, "rsp", body);
+    send_frame(srv, conn, oa);
+    close_buffer_oarchive(&oa, 1);
+}
+
+#define SERIALIZER(type) \
+    ((int (*)(struct oarchive*, const char*, void*))serialize_##type)
+
+static void handle_connect(loopback_server_t *srv, lb_conn_t *conn,
+        struct iarchive *ia)
+{
+    struct ConnectRequest req;
+    struct ConnectResponse rsp;
+    struct oarchive *oa;
+    lb_session_t *s = 0;
+
+    memset(&req, 0, sizeof(req));
+    memset(&rsp, 0, sizeof(rsp));
+    if (deserialize_ConnectRequest(ia, "connect", &req) != 0) {
+        conn->closing = 1;
+        return;
+    }
+    if (req.sessionId != 0) {
+        s = find_session(srv, req.sessionId);
+        if (s && (req.passwd.len != sizeof(s->passwd) ||
+                memcmp(req.passwd.buff, s->passwd, sizeof(s->passwd)) != 0)) {
+            s = 0;
+        }
+        if (s && s->conn) {
+            /* the client moved on, drop its old connection */
+            s->conn->session = 0;
+            s->conn->closing = 1;
+        }
+    } else {
+        int i;
+        s = calloc(1, sizeof(*s));
+        s->id = srv->next_session++;
+        for (i = 0; i < (int)sizeof(s->passwd); i++)
+            s->passwd[i] = rand_r(&srv->seed);
+        /* the bounds a server with the default tick time negotiates */
+        s->timeout = req.timeOut < MIN_SESSION_TIMEOUT ? MIN_SESSION_TIMEOUT :
+                req.timeOut > MAX_SESSION_TIMEOUT ? MAX_SESSION_TIMEOUT :
+                req.timeOut;
+        s->next = srv->sessions;
+        srv->sessions = s;
+    }
+    rsp.protocolVersion = 0;
+    rsp.passwd.len = sizeof(s->passwd);
+    if (s) {
+        s->conn = conn;
+        conn->session = s;
+        rsp.timeOut = s->timeout;
+        rsp.sessionId = s->id;
+        rsp.passwd.buff = s->passwd;
+    } else {
+        /* an unknown session has expired: answer with a null session, then
+         * hang up */
+        static char no_passwd[16];
+        rsp.passwd.buff = no_passwd;
+        conn->closing = 1;
+    }
+    conn->handshaken = 1;
+    oa = create_buffer_oarchive();
+    serialize_ConnectResponse(oa, "connect", &rsp);
+    send_frame(srv, conn, oa);
+    close_buffer_oarchive(&oa, 1);
+    deallocate_ConnectRequest(&req);
+}
+
+static void handle_set_watches(loopback_server_t *srv, lb_conn_t *conn,
+        struct iarchive *ia)
+{
+    struct SetWatches req;
+    int64_t id = conn->session->id;
+    int i;
+
+    if (deserialize_SetWatches(ia, "req", &req) != 0) {
+        conn->closing = 1;
+        return;
+    }
+    send_reply_header(srv, conn, SET_WATCHES_XID, ZOK);
+    /* watches on nodes that changed while the client was away fire at once */
+    for (i = 0; i < req.dataWatches.count; i++) {
+        const char *path = req.dataWatches.data[i];
+        lb_node_t *node = find_node(srv, path);
+        if (!node)
+            send_event(srv, conn, DELETED_EVENT_DEF, path);
+        else if (node->stat.mzxid > req.relativeZxid)
+            send_event(srv, conn, CHANGED_EVENT_DEF, path);
+        else
+            add_watch(srv->data_watches, path, id);
+    }
+    for (i = 0; i < req.existWatches.count; i++) {
+        const char *path = req.existWatches.data[i];
+        if (find_node(srv, path))
+            send_event(srv, conn, CREATED_EVENT_DEF, path);
+        else
+            add_watch(srv->data_watches, path, id);
+    }
+    for (i = 0; i < req.childWatches.count; i++) {
+        const char *path = req.childWatches.data[i];
+        lb_node_t *node = find_node(srv, path);
+        if (!node)
+            send_event(srv, conn, DELETED_EVENT_DEF, path);
+        else if (node->stat.pzxid > req.relativeZxid)
+            send_event(srv, conn, CHILD_EVENT_DEF, path);
+        else
+            add_watch(srv->child_watches, path, id);
+    }
+    deallocate_SetWatches(&req);
+}
+
+static void handle_multi(loopback_server_t *srv, lb_conn_t *conn, int32_t xid,
+        struct iarchive *ia)
+{
+    struct MultiHeader mh;
+    struct oarchive *oa;
+    struct ReplyHeader h;
+    lb_txn_t txn = { 0, 0, 0 };
+    /* the result of each op, kept until it is known whether all succeeded */
+    struct { int type; int err; char *path; struct Stat stat; } *results = 0;
+    int count = 0, cap = 0, failed = -1, i, rc = 0;
+
+    srv->zxid++;
+    for (;;) {
+        if (deserialize_MultiHeader(ia, "multiheader", &mh) != 0) {
+            rc = -1;
+            break;
+        }
+        if (mh.done)
+            break;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 8;
+            results = realloc(results, cap * sizeof(*results));
+        }
+        memset(&results[count], 0, sizeof(*results));
+        results[count].type = mh.type;
+        switch (mh.type) {
+        case ZOO_CREATE_OP: {
+            struct CreateRequest req;
+            char *created = 0;
+            rc = deserialize_CreateRequest(ia, "req", &req);
+            if (rc == 0 && failed < 0) {
+                results[count].err = do_create(srv, &txn, conn->session, &req,
+                        &created);
+                if (created)
+                    results[count].path = strdup(created);
+            }
+            if (rc == 0)
+                deallocate_CreateRequest(&req);
+            break;
+        }
+        case ZOO_DELETE_OP: {
+            struct DeleteRequest req;
+            rc = deserialize_DeleteRequest(ia, "req", &req);
+            if (rc == 0 && failed < 0)
+                results[count].err = delete_node(srv, &txn, req.path,
+                        req.version);
+            if (rc == 0)
+                deallocate_DeleteRequest(&req);
+            break;
+        }
+        case ZOO_SETDATA_OP: {
+            struct SetDataRequest req;
+            rc = deserialize_SetDataRequest(ia, "req", &req);
+            if (rc == 0 && failed < 0)
+                results[count].err = do_set(srv, &txn, &req,
+                        &results[count].stat);
+            if (rc == 0)
+                deallocate_SetDataRequest(&req);
+            break;
+        }
+        case ZOO_CHECK_OP: {
+            struct CheckVersionRequest req;
+            rc = deserialize_CheckVersionRequest(ia, "req", &req);
+            if (rc == 0 && failed < 0)
+                results[count].err = do_check(srv, &req);
+            if (rc == 0)
+                deallocate_CheckVersionRequest(&req);
+            break;
+        }
+        default:
+            results[count].err = ZUNIMPLEMENTED;
+            rc = -1;
+            break;
+        }
+        if (rc != 0)
+            break;
+        if (failed < 0 && results[count].err != ZOK)
+            failed = count;
+        count++;
+    }
+    if (rc != 0) {
+        txn_rollback(srv, &txn);
+        conn->closing = 1;
+        goto done;
+    }
+    if (failed >= 0)
+        txn_rollback(srv, &txn);
+
+    oa = create_buffer_oarchive();
+    h.xid = xid;
+    h.zxid = srv->zxid;
+    h.err = failed >= 0 ? results[failed].err : ZOK;
+    serialize_ReplyHeader(oa, "hdr", &h);
+    for (i = 0; i < count; i++) {
+        if (failed >= 0) {
+            /* every op of a failed multi reports an error result */
+            struct ErrorResponse er;
+            er.err = i < failed ? ZOK :
+                    i == failed ? results[i].err : ZRUNTIMEINCONSISTENCY;
+            mh.type = -1;
+            mh.done = 0;
+            mh.err = er.err;
+            serialize_MultiHeader(oa, "multiheader", &mh);
+            serialize_ErrorResponse(oa, "rsp", &er);
+            continue;
+        }
+        mh.type = results[i].type;
+        mh.done = 0;
+        mh.err = 0;
+        serialize_MultiHeader(oa, "multiheader", &mh);
+        if (results[i].type == ZOO_CREATE_OP) {
+            struct CreateResponse cr;
+            cr.path = results[i].path;
+            serialize_CreateResponse(oa, "rsp", &cr);
+        } else if (results[i].type == ZOO_SETDATA_OP) {
+            struct SetDataResponse sr;
+            sr.stat = results[i].stat;
+            serialize_SetDataResponse(oa, "rsp", &sr);
+        }
+    }
+    mh.type = -1;
+    mh.done = 1;
+    mh.err = -1;
+    serialize_MultiHeader(oa, "multiheader", &mh);
+    send_frame(srv, conn, oa);
+    close_buffer_oarchive(&oa, 1);
+    /* the response goes out ahead of the watch events the multi fires */
+    txn_commit(srv, &txn);
+done:
+    for (i = 0; i < count; i++)
+        free(results[i].path);
+    free(results);
+}
+
+static void handle_request(loopback_server_t *srv, lb_conn_t *conn,
+        struct iarchive *ia)
+{
+    struct RequestHeader h;
+    lb_session_t *s = conn->session;
+    lb_txn_t txn = { 0, 0, 0 };
+    lb_node_t *node;
+    int rc;
+
+    if (deserialize_RequestHeader(ia, "hdr", &h) != 0 || !s) {
+        conn->closing = 1;
+        return;
+    }
+    switch (h.type) {
+    case ZOO_PING_OP:
+        send_reply_header(srv, conn, h.xid, ZOK);
+        break;
+    case ZOO_SETAUTH_OP:
+        send_reply_header(srv, conn, h.xid, ZOK);
+        break;
+    case ZOO_SETWATCHES_OP:
+        handle_set_watches(srv, conn, ia);
+        break;
+    case ZOO_CLOSE_OP:
+        close_session(srv, s);
+        send_reply_header(srv, conn, h.xid, ZOK);
+        conn->closing = 1;
+        break;
+    case ZOO_GETDATA_OP: {
+        struct GetDataRequest req;
+        struct GetDataResponse rsp;
+        if (deserialize_GetDataRequest(ia, "req", &req) != 0)
+            break;
+        node = find_node(srv, req.path);
+        if (node) {
+            rsp.stat = node->stat;
+            rsp.data.buff = node->data;
+            rsp.data.len = node->data ? node->data_len : -1;
+            if (srv->opts.data_size.kind != LOOPBACK_DIST_NONE) {
+                rsp.data.len = (int)sample(srv, &srv->opts.data_size);
+                if (rsp.data.len > srv->fill_len) {
+                    srv->fill = realloc(srv->fill, rsp.data.len);
+                    memset(srv->fill + srv->fill_len, 'x',
+                            rsp.data.len - srv->fill_len);
+                    srv->fill_len = rsp.data.len;
+                }
+                rsp.data.buff = srv->fill;
+                rsp.stat.dataLength = rsp.data.len;
+            }
+            if (req.watch)
+                add_watch(srv->data_watches, req.path, s->id);
+        }
+        send_response(srv, conn, h.xid, node ? ZOK : ZNONODE,
+                SERIALIZER(GetDataResponse), &rsp);
+        deallocate_GetDataRequest(&req);
+        break;
+    }
+    case ZOO_EXISTS_OP: {
+        struct ExistsRequest req;
+        struct ExistsResponse rsp;
+        if (deserialize_ExistsRequest(ia, "req", &req) != 0)
+            break;
+        node = find_node(srv, req.path);
+        if (node)
+            rsp.stat = node->stat;
+        /* an exists watch is a data watch, whether or not the node exists */
+        if (req.watch)
+            add_watch(srv->data_watches, req.path, s->id);
+        send_response(srv, conn, h.xid, node ? ZOK : ZNONODE,
+                SERIALIZER(ExistsResponse), &rsp);
+        deallocate_ExistsRequest(&req);
+        break;
+    }
+    case ZOO_GETCHILDREN_OP:
+    case ZOO_GETCHILDREN2_OP: {
+        struct GetChildrenRequest req;
+        struct GetChildren2Response rsp;
+        if (deserialize_GetChildrenRequest(ia, "req", &req) != 0)
+            break;
+        node = find_node(srv, req.path);
+        if (node) {
+            rsp.children.count = node->child_count;
+            rsp.children.data = node->children;
+            rsp.stat = node->stat;
+            if (req.watch)
+                add_watch(srv->child_watches, req.path, s->id);
+        }
+        /* GetChildrenResponse is a prefix of GetChildren2Response */
+        send_response(srv, conn, h.xid, node ? ZOK : ZNONODE,
+                h.type == ZOO_GETCHILDREN_OP ?
+                        SERIALIZER(GetChildrenResponse) :
+                        SERIALIZER(GetChildren2Response), &rsp);
+        deallocate_GetChildrenRequest(&req);
+        break;
+    }
+    case ZOO_GETACL_OP: {
+        struct GetACLRequest req;
+        struct GetACLResponse rsp;
+        if (deserialize_GetACLRequest(ia, "req", &req) != 0)
+            break;
+        node = find_node(srv, req.path);
+        if (node) {
+            rsp.acl = ZOO_OPEN_ACL_UNSAFE;
+            rsp.stat = node->stat;
+        }
+        send_response(srv, conn, h.xid, node ? ZOK : ZNONODE,
+                SERIALIZER(GetACLResponse), &rsp);
+        deallocate_GetACLRequest(&req);
+        break;
+    }
+    case ZOO_SETACL_OP: {
+        struct SetACLRequest req;
+        struct SetACLResponse rsp;
+        if (deserialize_SetACLRequest(ia, "req", &req) != 0)
+            break;
+        node = find_node(srv, req.path);
+        rc = ZNONODE;
+        if (node) {
+            rc = ZBADVERSION;
+            if (req.version == -1 || req.version == node->stat.aversion) {
+                srv->zxid++;
+                node->stat.aversion++;
+                rsp.stat = node->stat;
+                rc = ZOK;
+            }
+        }
+        send_response(srv, conn, h.xid, rc, SERIALIZER(SetACLResponse), &rsp);
+        deallocate_SetACLRequest(&req);
+        break;
+    }
+    case ZOO_SYNC_OP: {
+        struct SyncRequest req;
+        struct SyncResponse rsp;
+        if (deserialize_SyncRequest(ia, "req", &req) != 0)
+            break;
+        rsp.path = req.path;
+        send_response(srv, conn, h.xid, ZOK, SERIALIZER(SyncResponse), &rsp);
+        deallocate_SyncRequest(&req);
+        break;
+    }
+    case ZOO_CREATE_OP: {
+        struct CreateRequest req;
+        struct CreateResponse rsp;
+        if (deserialize_CreateRequest(ia, "req", &req) != 0)
+            break;
+        srv->zxid++;
+        rsp.path = 0;
+        rc = do_create(srv, &txn, s, &req, &rsp.path);
+        send_response(srv, conn, h.xid, rc, SERIALIZER(CreateResponse), &rsp);
+        txn_commit(srv, &txn);
+        deallocate_CreateRequest(&req);
+        break;
+    }
+    case ZOO_DELETE_OP: {
+        struct DeleteRequest req;
+        if (deserialize_DeleteRequest(ia, "req", &req) != 0)
+            break;
+        srv->zxid++;
+        rc = delete_node(srv, &txn, req.path, req.version);
+        send_reply_header(srv, conn, h.xid, rc);
+        txn_commit(srv, &txn);
+        deallocate_DeleteRequest(&req);
+        break;
+    }
+    case ZOO_SETDATA_OP: {
+        struct SetDataRequest req;
+        struct SetDataResponse rsp;
+        if (deserialize_SetDataRequest(ia, "req", &req) != 0)
+            break;
+        srv->zxid++;
+        rc = do_set(srv, &txn, &req, &rsp.stat);
+        send_response(srv, conn, h.xid, rc, SERIALIZER(SetDataResponse), &rsp);
+        txn_commit(srv, &txn);
+        deallocate_SetDataRequest(&req);
+        break;
+    }
+    case ZOO_MULTI_OP:
+        handle_multi(srv, conn, h.xid, ia);
+        break;
+    default:
+        send_reply_header(srv, conn, h.xid, ZUNIMPLEMENTED);
+        break;
+    }
+}
+
+/* handles every complete frame in the input buffer */
+static void process_input(loopback_server_t *srv, lb_conn_t *conn)
+{
+    int off = 0;
+    while (!conn->closing && conn->in_len - off >= 4) {
+        int32_t len;
+        struct iarchive *ia;
+        memcpy(&len, conn->in + off, sizeof(len));
+        len = ntohl(len);
+        if (len < 0 || len > MAX_FRAME_SIZE) {
+            conn->closing = 1;
+            break;
+        }
+        if (conn->in_len - off - 4 < len)
+            break;
+        ia = create_buffer_iarchive(conn->in + off + 4, len);
+        if (!conn->handshaken)
+            handle_connect(srv, conn, ia);
+        else
+            handle_request(srv, conn, ia);
+        close_buffer_iarchive(&ia);
+        off += 4 + len;
+    }
+    if (off > 0) {
+        memmove(conn->in, conn->in + off, conn->in_len - off);
+        conn->in_len -= off;
+    }
+}
+
+// *****************************************************************************
+// the event loop
+
+static int read_conn(loopback_server_t *srv, lb_conn_t *conn)
+{
+    for (;;) {
+        int rc;
+        if (conn->in_cap - conn->in_len < 4096) {
+            conn->in_cap = conn->in_cap ? conn->in_cap * 2 : 16384;
+            conn->in = realloc(conn->in, conn->in_cap);
+        }
+        rc = recv(conn->fd, conn->in + conn->in_len,
+                conn->in_cap - conn->in_len, 0);
+        if (rc > 0) {
+            conn->in_len += rc;
+            process_input(srv, conn);
+            continue;
+        }
+        if (rc == 0)
+            return -1;
+        if (errno == EINTR)
+            continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+}
+
+static int write_conn(lb_conn_t *conn)
+{
+    while (conn->out_off < conn->out_len) {
+        int rc = send(conn->fd, conn->out + conn->out_off,
+                conn->out_len - conn->out_off, MSG_NOSIGNAL);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        conn->out_off += rc;
+    }
+    conn->out_off = conn->out_len = 0;
+    return 0;
+}
+
+/* moves the responses whose latency has elapsed to the output buffer */
+static void release_pending(lb_conn_t *conn, int64_t now)
+{
+    while (conn->pending_head && conn->pending_head->due <= now) {
+        lb_pending_t *p = conn->pending_head;
+        conn->pending_head = p->next;
+        if (!conn->pending_head)
+            conn->pending_tail = 0;
+        append_out(conn, p->buf, p->len);
+        free(p->buf);
+        free(p);
+    }
+}
+
+static void free_conn(loopback_server_t *srv, lb_conn_t *conn)
+{
+    if (conn->session) {
+        conn->session->conn = 0;
+        conn->session->expires = now_us() +
+                (int64_t)conn->session->timeout * 1000;
+    }
+    while (conn->pending_head) {
+        lb_pending_t *p = conn->pending_head;
+        conn->pending_head = p->next;
+        free(p->buf);
+        free(p);
+    }
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+static void accept_conns(loopback_server_t *srv)
+{
+    for (;;) {
+        int one = 1;
+        lb_conn_t *conn;
+        int fd = accept(srv->listen_fd, 0, 0);
+        if (fd < 0)
+            return;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn = calloc(1, sizeof(*conn));
+        conn->fd = fd;
+        conn->next = srv->conns;
+        srv->conns = conn;
+    }
+}
+
+int loopback_server_run(loopback_server_t *srv)
+{
+    struct pollfd *fds = 0;
+    lb_conn_t **polled = 0;
+    int fds_cap = 0;
+
+    while (!srv->stop) {
+        lb_conn_t *conn, **pp;
+        int64_t now = now_us();
+        int64_t wake = now + EXPIRY_CHECK_MS * 1000;
+        int nfds = 2, i, timeout;
+
+        for (conn = srv->conns; conn; conn = conn->next) {
+            if (conn->pending_head && conn->pending_head->due < wake)
+                wake = conn->pending_head->due;
+            nfds++;
+        }
+        if (nfds > fds_cap) {
+            fds_cap = nfds * 2;
+            fds = realloc(fds, fds_cap * sizeof(*fds));
+            polled = realloc(polled, fds_cap * sizeof(*polled));
+        }
+        fds[0].fd = srv->listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = srv->wake[0];
+        fds[1].events = POLLIN;
+        for (i = 2, conn = srv->conns; conn; conn = conn->next, i++) {
+            fds[i].fd = conn->fd;
+            fds[i].events = POLLIN;
+            if (conn->out_off < conn->out_len)
+                fds[i].events |= POLLOUT;
+            polled[i] = conn;
+        }
+        timeout = wake > now ? (int)((wake - now + 999) / 1000) : 0;
+        if (poll(fds, nfds, timeout) < 0 && errno != EINTR)
+            break;
+
+        for (i = 2; i < nfds; i++) {
+            conn = polled[i];
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                if (read_conn(srv, conn) < 0) {
+                    conn->closing = 1;
+                    conn->out_off = conn->out_len = 0;
+                    while (conn->pending_head) {
+                        lb_pending_t *p = conn->pending_head;
+                        conn->pending_head = p->next;
+                        free(p->buf);
+                        free(p);
+                    }
+                    conn->pending_tail = 0;
+                }
+            }
+        }
+        now = now_us();
+        for (pp = &srv->conns; *pp; ) {
+            conn = *pp;
+            release_pending(conn, now);
+            if (write_conn(conn) < 0 || (conn->closing &&
+                    !conn->pending_head && conn->out_off == conn->out_len)) {
+                *pp = conn->next;
+                free_conn(srv, conn);
+                continue;
+            }
+            pp = &conn->next;
+        }
+        if (fds[0].revents & POLLIN)
+            accept_conns(srv);
+        if (fds[1].revents & POLLIN) {
+            char buf[64];
+            while (read(srv->wake[0], buf, sizeof(buf)) > 0)
+                ;
+        }
+        expire_sessions(srv, now);
+    }
+    free(fds);
+    free(polled);
+    return 0;
+}
+
+static void *server_thread(void *arg)
+{
+    loopback_server_run(arg);
+    return 0;
+}
+
+int loopback_server_start(loopback_server_t *srv)
+{
+    int rc = pthread_create(&srv->thread, 0, server_thread, srv);
+    if (rc == 0)
+        srv->started = 1;
+    return rc;
+}
+
+void loopback_server_stop(loopback_server_t *srv)
+{
+    char c = 0;
+    int rc;
+    srv->stop = 1;
+    rc = write(srv->wake[1], &c, 1);
+    (void)rc;
+    if (srv->started) {
+        pthread_join(srv->thread, 0);
+        srv->started = 0;
+    }
+}
+
+loopback_server_t *loopback_server_create(const loopback_options_t *opts)
+{
+    loopback_server_t *srv = calloc(1, sizeof(*srv));
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    lb_node_t *root;
+    int one = 1;
+
+    if (opts)
+        srv->opts = *opts;
+    srv->seed = srv->opts.seed;
+    srv->wake[0] = srv->wake[1] = -1;
+    srv->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (srv->listen_fd < 0 || pipe(srv->wake) != 0)
+        goto fail;
+    setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(srv->opts.port);
+    if (bind(srv->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            listen(srv->listen_fd, 128) != 0 ||
+            getsockname(srv->listen_fd, (struct sockaddr*)&addr,
+                    &addr_len) != 0) {
+        goto fail;
+    }
+    srv->port = ntohs(addr.sin_port);
+    fcntl(srv->listen_fd, F_SETFL, fcntl(srv->listen_fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(srv->wake[0], F_SETFL, fcntl(srv->wake[0], F_GETFL, 0) | O_NONBLOCK);
+
+    srv->nodes = create_hashtable(1024, path_hash, path_equal);
+    srv->data_watches = create_hashtable(256, path_hash, path_equal);
+    srv->child_watches = create_hashtable(256, path_hash, path_equal);
+    srv->zxid = 0;
+    srv->next_session = ((int64_t)time(0) << 24) + 1;
+    root = new_node("/", 0, 0);
+    init_stat(srv, &root->stat, 0, 0);
+    hashtable_insert(srv->nodes, root->path, root);
+    return srv;
+fail:
+    if (srv->listen_fd >= 0)
+        close(srv->listen_fd);
+    if (srv->wake[0] >= 0) {
+        close(srv->wake[0]);
+        close(srv->wake[1]);
+    }
+    free(srv);
+    return 0;
+}
+
+int loopback_server_port(loopback_server_t *srv)
+{
+    return srv->port;
+}
+
+static void destroy_watches(struct hashtable *table)
+{
+    struct hashtable_itr *it;
+    if (hashtable_count(table) > 0) {
+        it = hashtable_iterator(table);
+        do {
+            free(((lb_watch_t*)hashtable_iterator_value(it))->sessions);
+        } while (hashtable_iterator_advance(it));
+        free(it);
+    }
+    hashtable_destroy(table, 1);
+}
+
+void loopback_server_destroy(loopback_server_t *srv)
+{
+    struct hashtable_itr *it;
+    if (!srv)
+        return;
+    while (srv->conns) {
+        lb_conn_t *conn = srv->conns;
+        srv->conns = conn->next;
+        free_conn(srv, conn);
+    }
+    while (srv->sessions) {
+        lb_session_t *s = srv->sessions;
+        int i;
+        srv->sessions = s->next;
+        for (i = 0; i < s->ephemeral_count; i++)
+            free(s->ephemerals[i]);
+        free(s->ephemerals);
+        free(s);
+    }
+    /* the table frees the paths and the node structures themselves */
+    it = hashtable_iterator(srv->nodes);
+    do {
+        lb_node_t *node = hashtable_iterator_value(it);
+        int i;
+        for (i = 0; i < node->child_count; i++)
+            free(node->children[i]);
+        free(node->children);
+        free(node->data);
+    } while (hashtable_iterator_advance(it));
+    free(it);
+    hashtable_destroy(srv->nodes, 1);
+    destroy_watches(srv->data_watches);
+    destroy_watches(srv->child_watches);
+    close(srv->listen_fd);
+    close(srv->wake[0]);
+    close(srv->wake[1]);
+    free(srv->fill);
+    free(srv);
+}
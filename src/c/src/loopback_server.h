@@ -0,0 +1,112 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOOPBACK_SERVER_H_
+#define LOOPBACK_SERVER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * An in-memory, single process stand-in for a zookeeper server.
+ *
+ * The loopback server speaks the client wire protocol on 127.0.0.1 and keeps
+ * the whole data tree in memory. It implements the handshake, pings, every
+ * data and children operation, multi, watches (including the replay of
+ * SetWatches after a reconnect), ephemeral nodes and session expiry; ACLs
+ * and authentication are accepted but not enforced. It is meant for
+ * benchmarking and testing the client without a JVM, so every response can
+ * be delayed by a configurable latency and getData responses can be given a
+ * synthetic size.
+ */
+
+#define LOOPBACK_DIST_NONE 0
+#define LOOPBACK_DIST_FIXED 1
+#define LOOPBACK_DIST_UNIFORM 2
+#define LOOPBACK_DIST_EXP 3
+
+/**
+ * A distribution of non negative values, e.g. response latencies in
+ * microseconds or response sizes in bytes.
+ */
+typedef struct loopback_dist {
+    int kind;   /* one of LOOPBACK_DIST_* */
+    double a;   /* the fixed value, the uniform minimum or the exp mean */
+    double b;   /* the uniform maximum */
+} loopback_dist_t;
+
+typedef struct loopback_options {
+    int port;                   /* port to listen on, 0 picks a free one */
+    loopback_dist_t latency;    /* microseconds every response is delayed */
+    loopback_dist_t data_size;  /* if set, the size of getData responses */
+    unsigned int seed;          /* seeds the distributions */
+} loopback_options_t;
+
+typedef struct _loopback_server loopback_server_t;
+
+/**
+ * \brief parses a distribution specification.
+ *
+ * Accepted forms are "N" or "fixed:N", "uniform:MIN-MAX" and "exp:MEAN".
+ * \return 0 on success, -1 if the specification is invalid.
+ */
+int loopback_parse_dist(const char *spec, loopback_dist_t *dist);
+
+/**
+ * \brief creates a server listening on 127.0.0.1.
+ *
+ * \param opts the options, or NULL for the defaults.
+ * \return the server, or NULL with errno set if the socket could not be set up.
+ */
+loopback_server_t *loopback_server_create(const loopback_options_t *opts);
+
+/**
+ * \brief returns the port the server listens on.
+ */
+int loopback_server_port(loopback_server_t *srv);
+
+/**
+ * \brief serves clients on the calling thread until loopback_server_stop
+ * is called.
+ */
+int loopback_server_run(loopback_server_t *srv);
+
+/**
+ * \brief serves clients on a new thread.
+ * \return 0 on success, an errno value otherwise.
+ */
+int loopback_server_start(loopback_server_t *srv);
+
+/**
+ * \brief asks the server to stop, and waits for the thread started by
+ * loopback_server_start to exit. Safe to call from a signal handler if the
+ * server was not started with loopback_server_start.
+ */
+void loopback_server_stop(loopback_server_t *srv);
+
+/**
+ * \brief closes every connection and frees the server and its data tree.
+ */
+void loopback_server_destroy(loopback_server_t *srv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*LOOPBACK_SERVER_H_*/
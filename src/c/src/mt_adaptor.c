@@ -66,9 +66,12 @@ void lock_completion_list(completion_head_t *l)
 }
 void unlock_completion_list(completion_head_t *l)
 {
-    pthread_cond_broadcast(&l->cond);
     pthread_mutex_unlock(&l->lock);
 }
+void signal_completion_list(completion_head_t *l)
+{
+    pthread_cond_signal(&l->cond);
+}
 struct sync_completion *alloc_sync_completion(void)
 {
     struct sync_completion *sc = (struct sync_completion*)calloc(1, sizeof(struct sync_completion));
@@ -24,6 +24,13 @@
 #ifndef WIN32
 #include <netinet/in.h>
 #endif
+#ifdef THREADED
+#ifndef WIN32
+#include <pthread.h>
+#else
+#include <windows.h>
+#endif
+#endif
 
 void deallocate_String(char **s)
 {
@@ -39,6 +46,261 @@ void deallocate_Buffer(struct buffer *b)
     b->buff = 0;
 }
 
+/* arena allocations are aligned for the widest field of a record */
+#define ARENA_ALIGN 8
+#define ARENA_DEFAULT_BLOCK_SIZE 4096
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+};
+
+#define ARENA_BLOCK_HEADER \
+    ((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct zoo_arena {
+    struct arena_block *head;
+    struct arena_block *current;
+    size_t block_size;
+};
+
+static struct arena_block *create_arena_block(size_t size)
+{
+    struct arena_block *b;
+    if (size > (size_t)-1 - ARENA_BLOCK_HEADER) {
+        return 0;
+    }
+    b = malloc(ARENA_BLOCK_HEADER + size);
+    if (!b) {
+        return 0;
+    }
+    b->next = 0;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+zoo_arena_t *zoo_arena_create(size_t block_size)
+{
+    zoo_arena_t *arena = malloc(sizeof(*arena));
+    if (!arena) {
+        return 0;
+    }
+    arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+    arena->head = create_arena_block(arena->block_size);
+    if (!arena->head) {
+        free(arena);
+        return 0;
+    }
+    arena->current = arena->head;
+    return arena;
+}
+
+void *zoo_arena_alloc(zoo_arena_t *arena, size_t size)
+{
+    struct arena_block *b = arena->current;
+    char *p;
+    if (size > (size_t)-1 - ARENA_ALIGN) {
+        return 0;
+    }
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size > b->size - b->used) {
+        b = create_arena_block(size > arena->block_size ?
+                size : arena->block_size);
+        if (!b) {
+            return 0;
+        }
+        arena->current->next = b;
+        arena->current = b;
+    }
+    p = (char*)b + ARENA_BLOCK_HEADER + b->used;
+    b->used += size;
+    return p;
+}
+
+void zoo_arena_reset(zoo_arena_t *arena)
+{
+    struct arena_block *b = arena->head->next;
+    while (b) {
+        struct arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    arena->head->next = 0;
+    arena->head->used = 0;
+    arena->current = arena->head;
+}
+
+void zoo_arena_destroy(zoo_arena_t *arena)
+{
+    if (arena) {
+        zoo_arena_reset(arena);
+        free(arena->head);
+        free(arena);
+    }
+}
+
+/* frames of 2^FRAME_MIN_SHIFT to 2^FRAME_MAX_SHIFT bytes, header included */
+#define FRAME_MIN_SHIFT 6
+#define FRAME_MAX_SHIFT 21
+#define FRAME_CLASSES (FRAME_MAX_SHIFT - FRAME_MIN_SHIFT + 1)
+#define FRAME_UNPOOLED -1
+
+struct frame_header {
+    struct frame_header *next; /* while retained by the pool */
+    int32_t cls; /* the size class, or FRAME_UNPOOLED */
+    int32_t size; /* the bytes allocated, header included */
+};
+
+#define FRAME_HEADER \
+    ((sizeof(struct frame_header) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define to_frame_header(frame) ((struct frame_header*)((frame) - FRAME_HEADER))
+
+static struct frame_header *frame_pool[FRAME_CLASSES];
+static zoo_frame_pool_stats_t frame_stats = { 0, 0, 0, 0,
+    ZOO_FRAME_POOL_DEFAULT_LIMIT, 0, 0 };
+
+#ifdef THREADED
+#ifndef WIN32
+static pthread_mutex_t frame_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#define lock_frame_pool() pthread_mutex_lock(&frame_pool_lock)
+#define unlock_frame_pool() pthread_mutex_unlock(&frame_pool_lock)
+#else
+static volatile LONG frame_pool_lock = 0;
+#define lock_frame_pool() \
+    while (InterlockedExchange(&frame_pool_lock, 1)) Sleep(0)
+#define unlock_frame_pool() InterlockedExchange(&frame_pool_lock, 0)
+#endif
+#else
+#define lock_frame_pool()
+#define unlock_frame_pool()
+#endif
+
+char *zoo_frame_alloc(int32_t len)
+{
+    struct frame_header *h = 0;
+    int cls = 0;
+    int32_t size;
+
+    if (len < 0 || (size_t)len > 0x7fffffff - FRAME_HEADER) {
+        return 0;
+    }
+    while (cls < FRAME_CLASSES &&
+            (size_t)len > ((size_t)1 << (cls + FRAME_MIN_SHIFT)) - FRAME_HEADER) {
+        cls++;
+    }
+    if (cls < FRAME_CLASSES) {
+        size = 1 << (cls + FRAME_MIN_SHIFT);
+    } else {
+        cls = FRAME_UNPOOLED;
+        size = (int32_t)(len + FRAME_HEADER);
+    }
+    lock_frame_pool();
+    if (cls != FRAME_UNPOOLED && frame_pool[cls]) {
+        h = frame_pool[cls];
+        frame_pool[cls] = h->next;
+        frame_stats.retained_bytes -= size;
+        frame_stats.retained_frames--;
+        frame_stats.hits++;
+    } else {
+        frame_stats.misses++;
+    }
+    frame_stats.in_use_bytes += size;
+    frame_stats.in_use_frames++;
+    unlock_frame_pool();
+    if (!h) {
+        h = malloc(size);
+        if (!h) {
+            lock_frame_pool();
+            frame_stats.in_use_bytes -= size;
+            frame_stats.in_use_frames--;
+            unlock_frame_pool();
+            return 0;
+        }
+        h->cls = cls;
+        h->size = size;
+    }
+    h->next = 0;
+    return (char*)h + FRAME_HEADER;
+}
+
+int32_t zoo_frame_capacity(const char *frame)
+{
+    return to_frame_header(frame)->size - (int32_t)FRAME_HEADER;
+}
+
+void zoo_frame_free(char *frame)
+{
+    struct frame_header *h;
+    if (!frame) {
+        return;
+    }
+    h = to_frame_header(frame);
+    lock_frame_pool();
+    frame_stats.in_use_bytes -= h->size;
+    frame_stats.in_use_frames--;
+    if (h->cls != FRAME_UNPOOLED &&
+            frame_stats.retained_bytes + h->size <= frame_stats.retained_limit) {
+        h->next = frame_pool[h->cls];
+        frame_pool[h->cls] = h;
+        frame_stats.retained_bytes += h->size;
+        frame_stats.retained_frames++;
+        h = 0;
+    }
+    unlock_frame_pool();
+    free(h);
+}
+
+char *zoo_frame_realloc(char *frame, int32_t len)
+{
+    char *grown;
+    if (frame && len <= zoo_frame_capacity(frame)) {
+        return frame;
+    }
+    grown = zoo_frame_alloc(len);
+    if (grown && frame) {
+        memcpy(grown, frame, zoo_frame_capacity(frame));
+        zoo_frame_free(frame);
+    }
+    return grown;
+}
+
+void zoo_frame_pool_set_limit(int64_t bytes)
+{
+    struct frame_header *released = 0;
+    int cls = FRAME_CLASSES - 1;
+
+    lock_frame_pool();
+    frame_stats.retained_limit = bytes > 0 ? bytes : 0;
+    /* release the largest frames first */
+    while (frame_stats.retained_bytes > frame_stats.retained_limit) {
+        struct frame_header *h;
+        while (!frame_pool[cls]) {
+            cls--;
+        }
+        h = frame_pool[cls];
+        frame_pool[cls] = h->next;
+        frame_stats.retained_bytes -= h->size;
+        frame_stats.retained_frames--;
+        h->next = released;
+        released = h;
+    }
+    unlock_frame_pool();
+    while (released) {
+        struct frame_header *next = released->next;
+        free(released);
+        released = next;
+    }
+}
+
+void zoo_frame_pool_get_stats(zoo_frame_pool_stats_t *stats)
+{
+    lock_frame_pool();
+    *stats = frame_stats;
+    unlock_frame_pool();
+}
+
 struct buff_struct {
     int32_t len;
     int32_t off;
@@ -51,12 +313,14 @@ static int resize_buffer(struct buff_struct *s, int newlen)
     while (s->len < newlen) {
         s->len *= 2;
     }
-    buffer = (char*)realloc(s->buffer, s->len);
+    buffer = zoo_frame_realloc(s->buffer, s->len);
     if (!buffer) {
+        zoo_frame_free(s->buffer);
         s->buffer = 0;
         return -ENOMEM;
     }
     s->buffer = buffer;
+    s->len = zoo_frame_capacity(buffer);
     return 0;
 }
 
@@ -82,18 +346,14 @@ int oa_serialize_int(struct oarchive *oa, const char *tag, const int32_t *d)
 }
 int64_t htonll(int64_t v)
 {
-    int i = 0;
-    char *s = (char *)&v;
-    if (htonl(1) == 1) {
-        return v;
-    }
-    for (i = 0; i < 4; i++) {
-        int tmp = s[i];
-        s[i] = s[8-i-1];
-        s[8-i-1] = tmp;
-    }
-
+#ifdef ZOO_BSWAP64
+    return ZOO_BSWAP64(v);
+#else
+    char s[sizeof(v)];
+    zoo_put_int64(s, v);
+    memcpy(&v, s, sizeof(v));
     return v;
+#endif
 }
 
 int oa_serialize_long(struct oarchive *oa, const char *tag, const int64_t *d)
@@ -232,6 +492,27 @@ int ia_deserialize_bool(struct iarchive *ia, const char *name, int32_t *v)
     //fprintf(stderr, "Deserializing bool end %d\n", priv->off);
     return 0;
 }
+static void *ia_allocate(struct iarchive *ia, size_t size)
+{
+    return ia->arena ? zoo_arena_alloc(ia->arena, size) : malloc(size);
+}
+
+void *ia_allocate_vector(struct iarchive *ia, int32_t count, size_t size)
+{
+    void *data;
+    if (!ia->arena) {
+        return calloc(count, size);
+    }
+    if (count <= 0 || (size_t)count > (size_t)-1 / size) {
+        return 0;
+    }
+    data = zoo_arena_alloc(ia->arena, count * size);
+    if (data) {
+        memset(data, 0, count * size);
+    }
+    return data;
+}
+
 int ia_deserialize_buffer(struct iarchive *ia, const char *name,
         struct buffer *b)
 {
@@ -247,7 +528,7 @@ int ia_deserialize_buffer(struct iarchive *ia, const char *name,
        b->buff = NULL;
        return rc;
     }
-    b->buff = malloc(b->len);
+    b->buff = ia_allocate(ia, b->len);
     if (!b->buff) {
         return -ENOMEM;
     }
@@ -268,7 +549,7 @@ int ia_deserialize_string(struct iarchive *ia, const char *name, char **s)
     if (len < 0) {
         return -EINVAL;
     }
-    *s = malloc(len+1);
+    *s = ia_allocate(ia, len+1);
     if (!*s) {
         return -ENOMEM;
     }
@@ -322,8 +603,13 @@ struct oarchive *create_buffer_oarchive()
     }
     *oa = oa_default;
     buff->off = 0;
-    buff->buffer = malloc(128);
-    buff->len = 128;
+    buff->buffer = zoo_frame_alloc(128);
+    if (!buff->buffer) {
+        free(buff);
+        free(oa);
+        return 0;
+    }
+    buff->len = zoo_frame_capacity(buff->buffer);
     oa->priv = buff;
     return oa;
 }
@@ -339,9 +625,7 @@ void close_buffer_oarchive(struct oarchive **oa, int free_buffer)
 {
     if (free_buffer) {
         struct buff_struct *buff = (struct buff_struct *)(*oa)->priv;
-        if (buff->buffer) {
-            free(buff->buffer);
-        }
+        zoo_frame_free(buff->buffer);
     }
     free((*oa)->priv);
     free(*oa);
@@ -358,3 +642,33 @@ int get_buffer_len(struct oarchive *oa)
     struct buff_struct *buff = oa->priv;
     return buff->off;
 }
+
+char *oa_reserve(struct oarchive *oa, int32_t len)
+{
+    struct buff_struct *priv = oa->priv;
+    char *p;
+    if (oa->serialize_Int != oa_serialize_int) {
+        return 0;
+    }
+    if ((priv->len - priv->off) < len) {
+        if (resize_buffer(priv, priv->off + len) < 0) {
+            return 0;
+        }
+    }
+    p = priv->buffer + priv->off;
+    priv->off += len;
+    return p;
+}
+
+const char *ia_consume(struct iarchive *ia, int32_t len)
+{
+    struct buff_struct *priv = ia->priv;
+    const char *p;
+    if (ia->deserialize_Int != ia_deserialize_int ||
+            (priv->len - priv->off) < len) {
+        return 0;
+    }
+    p = priv->buffer + priv->off;
+    priv->off += len;
+    return p;
+}
@@ -42,6 +42,9 @@ void lock_completion_list(completion_head_t *l)
 void unlock_completion_list(completion_head_t *l)
 {
 }
+void signal_completion_list(completion_head_t *l)
+{
+}
 struct sync_completion *alloc_sync_completion(void)
 {
     return (struct sync_completion*)calloc(1, sizeof(struct sync_completion));
@@ -78,7 +81,11 @@ int flush_send_queue(zhandle_t *, int);
 
 int adaptor_send_queue(zhandle_t *zh, int timeout)
 {
-    return flush_send_queue(zh, timeout);
+    int rc = flush_send_queue(zh, timeout);
+#ifndef WIN32
+    io_send_queued(zh);
+#endif
+    return rc;
 }
 
 int32_t inc_ref_counter(zhandle_t* zh,int i)
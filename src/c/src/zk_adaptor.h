@@ -28,6 +28,7 @@
 #endif
 #include "zookeeper.h"
 #include "zk_hashtable.h"
+#include "zk_timer.h"
 
 /* predefined xid's values recognized as special by the server */
 #define WATCHER_EVENT_XID -1 
@@ -79,6 +80,9 @@ void lock_buffer_list(buffer_head_t *l);
 void unlock_buffer_list(buffer_head_t *l);
 void lock_completion_list(completion_head_t *l);
 void unlock_completion_list(completion_head_t *l);
+/* wakes up a thread waiting for the list to be non empty; called with the
+ * list locked */
+void signal_completion_list(completion_head_t *l);
 
 struct sync_completion {
     int rc;
@@ -108,6 +112,9 @@ struct sync_completion {
         } sasl;
     } u;
     int complete;
+    /* the response, decoded by the waiting thread rather than the IO thread */
+    struct _completion_list *deferred;
+    zoo_arena_t *arena; /* if set, the result is decoded into this arena */
 #ifdef THREADED
     pthread_cond_t cond;
     pthread_mutex_t lock;
@@ -184,6 +191,16 @@ typedef struct _auth_list_head {
  * This structure represents the connection to zookeeper.
  */
 
+/* what the client measured of one of the servers it can connect to */
+struct server_stats {
+    int rtt; /* smoothed ping round trip in microseconds, 0 if unknown */
+    int handshake; /* duration of the last connection handshake in microseconds */
+    int failures; /* connections lost or refused since the last handshake */
+    int64_t failed_at; /* the time of the last failure, in ms */
+    char local; /* the server is in the client's zone */
+    char tried; /* already tried since the last successful handshake */
+};
+
 struct _zhandle {
 #ifdef WIN32
     SOCKET fd; /* the descriptor used to talk to zookeeper */
@@ -193,13 +210,47 @@ struct _zhandle {
     char *hostname; /* the hostname of zookeeper */
     struct sockaddr_storage *addrs; /* the addresses that correspond to the hostname */
     int addrs_count; /* The number of addresses in the addrs array */
+    struct server_stats *addr_stats; /* The measurements of each of the addrs */
+    int server_selection; /* ZOO_SELECT_RANDOM or ZOO_SELECT_LATENCY */
+    int rebalance_interval; /* ms between looks for a faster server, 0 for never */
+    int rebalance_index; /* the server to switch to, or -1 */
+    int64_t connect_start; /* The time the current connection was started, in us */
     watcher_fn watcher; /* the registered watcher */
-    struct timeval last_recv; /* The time that the last message was received */
-    struct timeval last_send; /* The time that the last message was sent */
-    struct timeval last_ping; /* The time that the last PING was sent */
-    struct timeval next_deadline; /* The time of the next deadline */
+    /* The times below are read from the monotonic clock (zk_clock_us), the
+     * ones without a unit in milliseconds */
+    int64_t now; /* The time of the current wakeup of the IO loop, in us */
+    int now_fresh; /* now was read by zookeeper_process and is still current */
+    int64_t last_recv; /* The time that the last message was received */
+    int64_t last_send; /* The time that the last message was sent */
+    int64_t last_ping; /* The time that the last PING was sent, in us */
+    int64_t next_deadline; /* The time of the next deadline, 0 if none */
+    int64_t connected_at; /* The time the session was last (re)established */
     int recv_timeout; /* The maximum amount of time that can go by without 
      receiving anything from the zookeeper server */
+    int request_timeout; /* ms a request can stay unanswered, 0 for no limit */
+    int lag_threshold; /* ms of lag of the IO loop before it is reported */
+    int frame_delay_threshold; /* ms a response can wait in the socket, 0 for unmeasured */
+    int callback_threshold; /* ms a callback can run before it is reported */
+    zoo_latency_stats_t latency; /* guarded by the lock of completions_to_process */
+    struct zk_hotpaths *hotpaths; /* the path profile, see zoo_set_path_sampling */
+    /* the reads that identical ones can join, see zoo_set_read_coalescing,
+     * and the count of the other requests queued; both are guarded by the
+     * lock of sent_requests */
+    struct hashtable *reads_in_flight;
+    unsigned read_barrier;
+    /* the watchers whose events are coalesced and their deliveries not
+     * made yet, see zoo_set_watcher_coalescing; both are guarded by the lock
+     * of completions_to_process */
+    struct _watch_window *watch_windows;
+    struct _coalesced_watch *coalesced_watches;
+    int coalesced_events; /* that the watcher being called stands for */
+    int compress_min; /* the size of the values compressed, 0 for none */
+    zk_timer_wheel_t timers; /* the deadlines of the IO loop */
+    zk_timer_t recv_timer; /* the connection times out */
+    zk_timer_t ping_timer; /* a PING is due */
+    zk_timer_t connect_timer; /* the backoff after every server was tried */
+    zk_timer_t request_timer; /* the oldest request times out */
+    zk_timer_t rebalance_timer; /* look for a faster server */
     buffer_list_t *input_buffer; /* the current buffer being read in */
     buffer_head_t to_process; /* The buffers that have been read and are ready to be processed. */
     buffer_head_t to_send; /* The packets queued to send */
@@ -221,19 +272,43 @@ struct _zhandle {
     int32_t ref_counter;
     volatile int close_requested;
     void *adaptor_priv;
-    /* Used for debugging only: non-zero value indicates the time when the zookeeper_process
-     * call returned while there was at least one unprocessed server response 
-     * available in the socket recv buffer */
-    struct timeval socket_readable;
+    /* non-zero value indicates the time (in us) when the zookeeper_process
+     * call returned while there was at least one unprocessed server response
+     * available in the socket recv buffer; only set when frame delays are
+     * measured */
+    int64_t socket_readable;
     
     zk_hashtable* active_node_watchers;   
     zk_hashtable* active_exist_watchers;
     zk_hashtable* active_child_watchers;
+    zk_watcher_registry* watcher_registry; /* distinct watchers of the maps above */
+    zoo_arena_t *completion_arena; /* backs the results passed to completions */
+#if !defined(THREADED) && !defined(WIN32)
+    /* the external event loop driving the handle, see zoo_set_io_callbacks */
+    zoo_io_callbacks_t io;
+    int io_fd; /* the socket registered with fd_add, or -1 */
+    int io_events; /* the events it is watched for */
+    int64_t io_deadline; /* the deadline given to timer_set, -1 if none */
+    int io_busy; /* inside zoo_io_event: it updates the callbacks itself */
+#endif
     /** used for chroot path at the client side **/
     char *chroot;
+    size_t chroot_len; /* the length of the chroot path, if any */
 };
 
 
+/**
+ * zookeeper_init, connecting to the servers in the order of the host list
+ * starting at the first_addr-th address (modulo their count), or in random
+ * order if first_addr is negative
+ */
+zhandle_t *zookeeper_init_at(const char *host, watcher_fn fn,
+  int recv_timeout, const clientid_t *clientid, void *context, int flags,
+  int first_addr);
+
+/* a random number from a freshly seeded generator */
+long int zk_random(void);
+
 int adaptor_init(zhandle_t *zh);
 void adaptor_finish(zhandle_t *zh);
 void adaptor_destroy(zhandle_t *zh);
@@ -245,8 +320,14 @@ int adaptor_send_queue(zhandle_t *zh, int timeout);
 int process_async(int outstanding_sync);
 void process_completions(zhandle_t *zh);
 int flush_send_queue(zhandle_t*zh, int timeout);
-char* sub_string(zhandle_t *zh, const char* server_path);
-void free_duplicate_path(const char* free_path, const char* path);
+/* accounts for a watcher called at start (a zk_clock_us time) */
+void record_watcher_time(zhandle_t *zh, int64_t start, watcher_fn watcher,
+        int type, const char *path);
+#if !defined(THREADED) && !defined(WIN32)
+/* tells the external event loop, if any, about the requests just queued */
+void io_send_queued(zhandle_t *zh);
+#endif
+const char* sub_string(zhandle_t *zh, const char* server_path);
 void zoo_lock_auth(zhandle_t *zh);
 void zoo_unlock_auth(zhandle_t *zh);
 
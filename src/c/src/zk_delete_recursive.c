@@ -0,0 +1,448 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef THREADED
+#ifndef WIN32
+#include <pthread.h>
+#else
+#include "winport.h"
+#endif
+#endif
+#include "zookeeper.h"
+#include "zookeeper_log.h"
+
+/*
+ * zoo_adelete_recursive keeps a node of the tree from the time it is found
+ * until it is deleted. A node is listed, then waits for its children to be
+ * deleted (or to fail), then is deleted in a batch; the last child of a
+ * node to go makes it ready. The requests are sent by pump(), which runs
+ * after every completion with the lock of the walk held.
+ */
+
+#define DEFAULT_BATCH_SIZE 100
+#define DEFAULT_MAX_IN_FLIGHT 16
+
+struct walk;
+
+typedef struct walk_node {
+    struct walk *walk;
+    struct walk_node *parent;
+    struct walk_node *next; /* in the queue the node is in */
+    char *path;
+    int children; /* not deleted yet, -1 until listed */
+    int blocked; /* a descendant failed: the node cannot be deleted */
+    int relisted; /* it had new children once already */
+} walk_node_t;
+
+typedef struct walk {
+#ifdef THREADED
+    pthread_mutex_t lock;
+#endif
+    zhandle_t *zh;
+    int batch_size;
+    int max_in_flight;
+    delete_progress_t progress;
+    delete_recursive_completion_t completion;
+    const void *data;
+    walk_node_t *to_list; /* a stack: the tree is walked depth first */
+    walk_node_t *ready; /* to delete in batches */
+    walk_node_t *ready_last;
+    int ready_count;
+    walk_node_t *singles; /* to delete one at a time */
+    int listing; /* get_children in flight */
+    int in_flight;
+    int64_t deleted;
+    int64_t found;
+    int rc;
+    struct String_vector failed;
+    int failed_capacity;
+} walk_t;
+
+/* a multi in flight, followed by its ops, results and nodes */
+typedef struct walk_batch {
+    walk_t *walk;
+    int count;
+    walk_node_t **nodes;
+    zoo_op_t *ops;
+    zoo_op_result_t *results;
+} walk_batch_t;
+
+#ifdef THREADED
+#define lock_walk(w) pthread_mutex_lock(&(w)->lock)
+#define unlock_walk(w) pthread_mutex_unlock(&(w)->lock)
+#else
+#define lock_walk(w)
+#define unlock_walk(w)
+#endif
+
+static void pump(walk_t *w);
+
+static walk_node_t *create_node(walk_t *w, walk_node_t *parent,
+        const char *name)
+{
+    walk_node_t *node = calloc(1, sizeof(*node));
+    if (!node)
+        return 0;
+    if (parent) {
+        size_t len = strlen(parent->path);
+        node->path = malloc(len + strlen(name) + 2);
+        if (node->path) {
+            memcpy(node->path, parent->path, len);
+            node->path[len] = '/';
+            strcpy(node->path + len + 1, name);
+        }
+    } else {
+        node->path = strdup(name);
+    }
+    if (!node->path) {
+        free(node);
+        return 0;
+    }
+    node->walk = w;
+    node->parent = parent;
+    node->children = -1;
+    w->found++;
+    return node;
+}
+
+static void free_node(walk_node_t *node)
+{
+    free(node->path);
+    free(node);
+}
+
+static void push_to_list(walk_t *w, walk_node_t *node)
+{
+    node->children = -1;
+    node->next = w->to_list;
+    w->to_list = node;
+}
+
+static void push_ready(walk_t *w, walk_node_t *node)
+{
+    node->next = 0;
+    if (w->ready_last)
+        w->ready_last->next = node;
+    else
+        w->ready = node;
+    w->ready_last = node;
+    w->ready_count++;
+}
+
+/* takes a node out of the way of its parent, which is ready once its last
+ * child is; the ancestors of a node that failed are only freed */
+static void resolve(walk_t *w, walk_node_t *node)
+{
+    while (node) {
+        walk_node_t *parent = node->parent;
+        free_node(node);
+        if (!parent || --parent->children > 0)
+            return;
+        if (!parent->blocked) {
+            push_ready(w, parent);
+            return;
+        }
+        node = parent;
+    }
+}
+
+/* lists a node that cannot be deleted, and so neither can its ancestors */
+static void note_failure(walk_t *w, walk_node_t *node, int rc)
+{
+    char *path;
+
+    LOG_DEBUG(("Could not delete %s: %s", node->path, zerror(rc)));
+    if (w->rc == ZOK)
+        w->rc = rc;
+    if (w->failed.count == w->failed_capacity) {
+        int capacity = w->failed_capacity ? w->failed_capacity * 2 : 16;
+        char **data = realloc(w->failed.data, capacity * sizeof(*data));
+        if (data) {
+            w->failed.data = data;
+            w->failed_capacity = capacity;
+        }
+    }
+    path = strdup(node->path);
+    if (path && w->failed.count < w->failed_capacity)
+        w->failed.data[w->failed.count++] = path;
+    else
+        free(path);
+    for (; node; node = node->parent)
+        node->blocked = 1;
+}
+
+static void fail(walk_t *w, walk_node_t *node, int rc)
+{
+    note_failure(w, node, rc);
+    resolve(w, node);
+}
+
+/* calls the callbacks outside of the lock, the completion once nothing is
+ * left to do, after which w is freed */
+static void unlock_and_notify(walk_t *w, int progressed)
+{
+    int done;
+    int64_t deleted, found;
+
+    pump(w);
+    done = w->in_flight == 0;
+    deleted = w->deleted;
+    found = w->found;
+    unlock_walk(w);
+    if (progressed && w->progress)
+        w->progress(deleted, found, w->data);
+    if (done) {
+        int i;
+        w->completion(w->rc, w->deleted, &w->failed, w->data);
+        for (i = 0; i < w->failed.count; i++)
+            free(w->failed.data[i]);
+        free(w->failed.data);
+#ifdef THREADED
+        pthread_mutex_destroy(&w->lock);
+#endif
+        free(w);
+    }
+}
+
+static void listed(int rc, const struct String_vector *children,
+        const void *data)
+{
+    walk_node_t *node = (walk_node_t *)data;
+    walk_t *w = node->walk;
+    int i;
+
+    lock_walk(w);
+    w->in_flight--;
+    w->listing--;
+    if (rc == ZOK) {
+        node->children = 0;
+        for (i = 0; i < children->count; i++) {
+            walk_node_t *child = create_node(w, node, children->data[i]);
+            if (!child) {
+                note_failure(w, node, ZSYSTEMERROR);
+                break;
+            }
+            push_to_list(w, child);
+            node->children++;
+        }
+        if (node->children == 0 && node->blocked)
+            resolve(w, node);
+        else if (node->children == 0)
+            push_ready(w, node);
+    } else if (rc == ZNONODE) {
+        /* deleted by another client, unless it is the root */
+        if (!node->parent)
+            w->rc = rc;
+        resolve(w, node);
+    } else {
+        fail(w, node, rc);
+    }
+    unlock_and_notify(w, 0);
+}
+
+static void deleted_one(int rc, const void *data)
+{
+    walk_node_t *node = (walk_node_t *)data;
+    walk_t *w = node->walk;
+
+    lock_walk(w);
+    w->in_flight--;
+    if (rc == ZOK || rc == ZNONODE) {
+        w->deleted += rc == ZOK;
+        resolve(w, node);
+    } else if (rc == ZNOTEMPTY && !node->relisted) {
+        node->relisted = 1;
+        push_to_list(w, node);
+    } else {
+        fail(w, node, rc);
+    }
+    unlock_and_notify(w, 1);
+}
+
+static void deleted_batch(int rc, const void *data)
+{
+    walk_batch_t *b = (walk_batch_t *)data;
+    walk_t *w = b->walk;
+    int i;
+
+    lock_walk(w);
+    w->in_flight--;
+    for (i = 0; i < b->count; i++) {
+        walk_node_t *node = b->nodes[i];
+        if (rc == ZOK) {
+            w->deleted++;
+            resolve(w, node);
+        } else {
+            /* one delete failed them all: find out which one */
+            node->next = w->singles;
+            w->singles = node;
+        }
+    }
+    free(b);
+    unlock_and_notify(w, rc == ZOK);
+}
+
+static void send_list(walk_t *w)
+{
+    walk_node_t *node = w->to_list;
+    int rc;
+
+    w->to_list = node->next;
+    rc = zoo_aget_children(w->zh, node->path, 0, listed, node);
+    if (rc == ZOK) {
+        w->in_flight++;
+        w->listing++;
+    } else {
+        fail(w, node, rc);
+    }
+}
+
+static void send_single(walk_t *w)
+{
+    walk_node_t *node = w->singles;
+    int rc;
+
+    w->singles = node->next;
+    rc = zoo_adelete(w->zh, node->path, -1, deleted_one, node);
+    if (rc == ZOK)
+        w->in_flight++;
+    else
+        fail(w, node, rc);
+}
+
+static walk_node_t *take_ready(walk_t *w)
+{
+    walk_node_t *node = w->ready;
+    w->ready = node->next;
+    if (!w->ready)
+        w->ready_last = 0;
+    w->ready_count--;
+    return node;
+}
+
+static void send_batch(walk_t *w)
+{
+    int count = w->ready_count < w->batch_size ? w->ready_count :
+        w->batch_size;
+    walk_batch_t *b;
+    int i, rc;
+
+    if (count == 1) {
+        walk_node_t *node = take_ready(w);
+        node->next = w->singles;
+        w->singles = node;
+        send_single(w);
+        return;
+    }
+    b = calloc(1, sizeof(*b) + count * (sizeof(*b->ops) +
+                sizeof(*b->results) + sizeof(*b->nodes)));
+    if (!b) {
+        /* with nothing in flight, no completion would try again */
+        while (w->in_flight == 0 && w->ready)
+            fail(w, take_ready(w), ZSYSTEMERROR);
+        return;
+    }
+    b->walk = w;
+    b->count = count;
+    b->ops = (zoo_op_t *)(b + 1);
+    b->results = (zoo_op_result_t *)(b->ops + count);
+    b->nodes = (walk_node_t **)(b->results + count);
+    for (i = 0; i < count; i++) {
+        b->nodes[i] = take_ready(w);
+        zoo_delete_op_init(&b->ops[i], b->nodes[i]->path, -1);
+    }
+    rc = zoo_amulti(w->zh, count, b->ops, b->results, deleted_batch, b);
+    if (rc == ZOK) {
+        w->in_flight++;
+        return;
+    }
+    for (i = 0; i < count; i++)
+        fail(w, b->nodes[i], rc);
+    free(b);
+}
+
+/* sends the full batches first, so that the nodes listed do not pile up,
+ * and the last partial batch once nothing is left to list */
+static void pump(walk_t *w)
+{
+    while (w->in_flight < w->max_in_flight) {
+        int ready_count = w->ready_count;
+        if (ready_count >= w->batch_size || (ready_count > 0 &&
+                    !w->singles && !w->to_list && w->listing == 0)) {
+            send_batch(w);
+            /* out of memory: the next completion tries again */
+            if (w->ready_count == ready_count)
+                break;
+        } else if (w->singles) {
+            send_single(w);
+        } else if (w->to_list) {
+            send_list(w);
+        } else {
+            break;
+        }
+    }
+}
+
+int zoo_adelete_recursive(zhandle_t *zh, const char *path, int batch_size,
+        int max_in_flight, delete_progress_t progress,
+        delete_recursive_completion_t completion, const void *data)
+{
+    walk_t *w;
+    walk_node_t *root;
+    int rc;
+
+    if (zh == 0 || path == 0 || completion == 0 || strcmp(path, "/") == 0 ||
+            batch_size < 0 || max_in_flight < 0)
+        return ZBADARGUMENTS;
+    w = calloc(1, sizeof(*w));
+    if (!w)
+        return ZSYSTEMERROR;
+    root = create_node(w, 0, path);
+    if (!root) {
+        free(w);
+        return ZSYSTEMERROR;
+    }
+    w->zh = zh;
+    w->batch_size = batch_size ? batch_size : DEFAULT_BATCH_SIZE;
+    w->max_in_flight = max_in_flight ? max_in_flight : DEFAULT_MAX_IN_FLIGHT;
+    w->progress = progress;
+    w->completion = completion;
+    w->data = data;
+#ifdef THREADED
+    pthread_mutex_init(&w->lock, 0);
+#endif
+
+    /* the completion cannot run before the lock is released */
+    lock_walk(w);
+    rc = zoo_aget_children(zh, path, 0, listed, root);
+    if (rc == ZOK) {
+        w->in_flight = 1;
+        w->listing = 1;
+    }
+    unlock_walk(w);
+    if (rc != ZOK) {
+        free_node(root);
+#ifdef THREADED
+        pthread_mutex_destroy(&w->lock);
+#endif
+        free(w);
+    }
+    return rc;
+}
@@ -23,6 +23,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
 
 typedef struct _watcher_object {
     watcher_fn watcher;
@@ -39,6 +40,17 @@ struct watcher_object_list {
     watcher_object_t* head;
 };
 
+/* a distinct watcher object and the number of active watches using it */
+typedef struct _registered_watcher {
+    watcher_fn watcher;
+    void* context;
+    int refs;
+} registered_watcher_t;
+
+struct _zk_watcher_registry {
+    struct hashtable* ht;
+};
+
 /* the following functions are for testing only */
 typedef struct hashtable hashtable_impl;
 
@@ -80,6 +92,21 @@ static int string_equal(void *key1,void *key2)
     return strcmp((const char*)key1,(const char*)key2)==0;
 }
 
+static unsigned int watcher_hash(void *key)
+{
+    registered_watcher_t* rw=(registered_watcher_t*)key;
+    uintptr_t h=(uintptr_t)rw->watcher;
+    h=h*31+((uintptr_t)rw->context>>3);
+    return (unsigned int)(h^(h>>16));
+}
+
+static int watcher_equal(void *key1,void *key2)
+{
+    registered_watcher_t* rw1=(registered_watcher_t*)key1;
+    registered_watcher_t* rw2=(registered_watcher_t*)key2;
+    return rw1->watcher==rw2->watcher && rw1->context==rw2->context;
+}
+
 static watcher_object_t* create_watcher_object(watcher_fn watcher,void* ctx)
 {
     watcher_object_t* wo=calloc(1,sizeof(watcher_object_t));
@@ -120,6 +147,55 @@ zk_hashtable* create_zk_hashtable()
     return ht;
 }
 
+zk_watcher_registry* create_zk_watcher_registry()
+{
+    struct _zk_watcher_registry *reg=calloc(1,sizeof(struct _zk_watcher_registry));
+    assert(reg);
+    reg->ht=create_hashtable(32,watcher_hash,watcher_equal);
+    return reg;
+}
+
+void destroy_zk_watcher_registry(zk_watcher_registry* reg)
+{
+    if(reg!=0){
+        // every entry is its own key, so freeing the keys frees the entries
+        hashtable_destroy(reg->ht,0);
+        free(reg);
+    }
+}
+
+static void register_watcher(zk_watcher_registry* reg,watcher_object_t* wo)
+{
+    registered_watcher_t key;
+    registered_watcher_t* rw;
+    key.watcher=wo->watcher;
+    key.context=wo->context;
+    rw=hashtable_search(reg->ht,&key);
+    if(rw==0){
+        int res;
+        rw=calloc(1,sizeof(registered_watcher_t));
+        assert(rw);
+        rw->watcher=wo->watcher;
+        rw->context=wo->context;
+        res=hashtable_insert(reg->ht,rw,rw);
+        assert(res);
+    }
+    rw->refs++;
+}
+
+static void unregister_watcher(zk_watcher_registry* reg,watcher_object_t* wo)
+{
+    registered_watcher_t key;
+    registered_watcher_t* rw;
+    key.watcher=wo->watcher;
+    key.context=wo->context;
+    rw=hashtable_search(reg->ht,&key);
+    if(rw!=0 && --rw->refs==0){
+        // frees the entry along with its key
+        hashtable_remove(reg->ht,&key);
+    }
+}
+
 static void do_clean_hashtable(zk_hashtable* ht)
 {
     struct hashtable_itr *it;
@@ -190,7 +266,7 @@ static int do_insert_watcher_object(zk_hashtable *ht, const char *path, watcher_
         assert(res);
     }else{
         /* path already exists; check if the watcher already exists */
-        res = add_to_list(&wl, wo, 1);
+        res = add_to_list(&wl, wo, 0);
     }
     return res;    
 }
@@ -231,33 +307,38 @@ static void copy_watchers(watcher_object_list_t *from, watcher_object_list_t *to
     }
 }
 
-static void copy_table(zk_hashtable *from, watcher_object_list_t *to) {
+// builds the delivery list for a session event out of the registry of
+// distinct watcher objects, so the cost doesn't depend on the number of watches
+static void collect_session_watchers(zhandle_t *zh,
+                                     watcher_object_list_t **list)
+{
     struct hashtable_itr *it;
     int hasMore;
-    if(hashtable_count(from->ht)==0)
+    if(hashtable_count(zh->watcher_registry->ht)==0)
         return;
-    it=hashtable_iterator(from->ht);
+    it=hashtable_iterator(zh->watcher_registry->ht);
     do {
-        watcher_object_list_t *w = hashtable_iterator_value(it);
-        copy_watchers(w, to, 1);
+        registered_watcher_t *rw = hashtable_iterator_value(it);
+        // the default watcher is already on the list
+        if(rw->watcher!=zh->watcher || rw->context!=zh->context){
+            watcher_object_t *wo=create_watcher_object(rw->watcher,rw->context);
+            wo->next=(*list)->head;
+            (*list)->head=wo;
+        }
         hasMore=hashtable_iterator_advance(it);
     } while(hasMore);
     free(it);
 }
 
-static void collect_session_watchers(zhandle_t *zh,
-                                     watcher_object_list_t **list)
-{
-    copy_table(zh->active_node_watchers, *list);
-    copy_table(zh->active_exist_watchers, *list);
-    copy_table(zh->active_child_watchers, *list);
-}
-
-static void add_for_event(zk_hashtable *ht, char *path, watcher_object_list_t **list)
+static void add_for_event(zhandle_t *zh, zk_hashtable *ht, char *path,
+                          watcher_object_list_t **list)
 {
     watcher_object_list_t* wl;
     wl = (watcher_object_list_t*)hashtable_remove(ht->ht, path);
     if (wl) {
+        watcher_object_t* wo;
+        for(wo=wl->head; wo!=0; wo=wo->next)
+            unregister_watcher(zh->watcher_registry, wo);
         copy_watchers(wl, *list, 0);
         // Since we move, not clone the watch_objects, we just need to free the
         // head pointer
@@ -272,10 +353,11 @@ static void do_foreach_watcher(watcher_object_t* wo,zhandle_t* zh,
     const char *client_path =
         (type != ZOO_SESSION_EVENT ? sub_string(zh, path) : path);
     while(wo!=0){
+        int64_t start = zk_clock_us();
         wo->watcher(zh,type,state,client_path,wo->context);
+        record_watcher_time(zh, start, wo->watcher, type, client_path);
         wo=wo->next;
     }    
-    free_duplicate_path(client_path, path);
 }
 
 watcher_object_list_t *collectWatchers(zhandle_t *zh,int type, char *path)
@@ -294,18 +376,18 @@ watcher_object_list_t *collectWatchers(zhandle_t *zh,int type, char *path)
     case CREATED_EVENT_DEF:
     case CHANGED_EVENT_DEF:
         // look up the watchers for the path and move them to a delivery list
-        add_for_event(zh->active_node_watchers,path,&list);
-        add_for_event(zh->active_exist_watchers,path,&list);
+        add_for_event(zh, zh->active_node_watchers,path,&list);
+        add_for_event(zh, zh->active_exist_watchers,path,&list);
         break;
     case CHILD_EVENT_DEF:
         // look up the watchers for the path and move them to a delivery list
-        add_for_event(zh->active_child_watchers,path,&list);
+        add_for_event(zh, zh->active_child_watchers,path,&list);
         break;
     case DELETED_EVENT_DEF:
         // look up the watchers for the path and move them to a delivery list
-        add_for_event(zh->active_node_watchers,path,&list);
-        add_for_event(zh->active_exist_watchers,path,&list);
-        add_for_event(zh->active_child_watchers,path,&list);
+        add_for_event(zh, zh->active_node_watchers,path,&list);
+        add_for_event(zh, zh->active_exist_watchers,path,&list);
+        add_for_event(zh, zh->active_child_watchers,path,&list);
         break;
     }
     return list;
@@ -319,6 +401,31 @@ void deliverWatchers(zhandle_t *zh, int type,int state, char *path, watcher_obje
     *list = 0;
 }
 
+watcher_object_list_t *extractWatcher(watcher_object_list_t *list,
+        watcher_fn watcher, void *context)
+{
+    watcher_object_t **wo;
+    for(wo=&list->head; *wo!=0; wo=&(*wo)->next){
+        if((*wo)->watcher==watcher && (*wo)->context==context){
+            watcher_object_t *found=*wo;
+            *wo=found->next;
+            found->next=0;
+            return create_watcher_object_list(found);
+        }
+    }
+    return 0;
+}
+
+int hasWatchers(const watcher_object_list_t *list)
+{
+    return list!=0 && list->head!=0;
+}
+
+void discardWatchers(watcher_object_list_t *list)
+{
+    destroy_watcher_object_list(list);
+}
+
 void activateWatcher(zhandle_t *zh, watcher_registration_t* reg, int rc)
 {
     if(reg){
@@ -326,8 +433,11 @@ void activateWatcher(zhandle_t *zh, watcher_registration_t* reg, int rc)
          * by the IO thread */
         zk_hashtable *ht = reg->checker(zh, rc);
         if(ht){
-            insert_watcher_object(ht,reg->path,
-                    create_watcher_object(reg->watcher, reg->context));
+            watcher_object_t* wo=create_watcher_object(reg->watcher, reg->context);
+            // the object is freed by the insert if it is a duplicate
+            watcher_object_t key=*wo;
+            if(insert_watcher_object(ht,reg->path,wo))
+                register_watcher(zh->watcher_registry,&key);
         }
     }    
 }
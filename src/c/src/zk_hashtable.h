@@ -27,6 +27,7 @@ extern "C" {
 
     typedef struct watcher_object_list watcher_object_list_t;
 typedef struct _zk_hashtable zk_hashtable;
+typedef struct _zk_watcher_registry zk_watcher_registry;
 
 /**
  * The function must return a non-zero value if the watcher object can be activated
@@ -53,6 +54,14 @@ void destroy_zk_hashtable(zk_hashtable* ht);
 
 char **collect_keys(zk_hashtable *ht, int *count);
 
+/**
+ * The registry keeps track of the distinct watcher objects (function and
+ * context pairs) referenced from the active watcher maps of a zhandle. It is
+ * used to broadcast session events without walking every single watch.
+ */
+zk_watcher_registry* create_zk_watcher_registry();
+void destroy_zk_watcher_registry(zk_watcher_registry* reg);
+
 /**
  * check if the completion has a watcher object associated
  * with it. If it does, move the watcher object to the map of
@@ -61,6 +70,12 @@ char **collect_keys(zk_hashtable *ht, int *count);
     void activateWatcher(zhandle_t *zh, watcher_registration_t* reg, int rc);
     watcher_object_list_t *collectWatchers(zhandle_t *zh,int type, char *path);
     void deliverWatchers(zhandle_t *zh, int type, int state, char *path, struct watcher_object_list **list);
+    /* takes a watcher off a delivery list, returning a list of its own or
+     * NULL if it was not on it */
+    watcher_object_list_t *extractWatcher(watcher_object_list_t *list,
+            watcher_fn watcher, void *context);
+    int hasWatchers(const watcher_object_list_t *list);
+    void discardWatchers(watcher_object_list_t *list);
 
 #ifdef __cplusplus
 }
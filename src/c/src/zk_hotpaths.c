@@ -0,0 +1,279 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "zk_hotpaths.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef THREADED
+#define lock_hotpaths(hp) pthread_mutex_lock(&(hp)->lock)
+#define unlock_hotpaths(hp) pthread_mutex_unlock(&(hp)->lock)
+#else
+#define lock_hotpaths(hp)
+#define unlock_hotpaths(hp)
+#endif
+
+/* FNV-1a: the two halves index the rows of the sketch */
+static uint64_t hash_path(const char *path)
+{
+    uint64_t h = 14695981039346656037ULL;
+    while (*path) {
+        h ^= (unsigned char)*path++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void set_rate(zk_hotpaths_t *hp, double rate)
+{
+    hp->rate = rate >= 1 ? 0xffffffffU : (uint32_t)(rate * 4294967295.0);
+    hp->scale = rate > 0 ? 1 / rate : 0;
+}
+
+zk_hotpaths_t *zk_hotpaths_create(double rate, int top)
+{
+    zk_hotpaths_t *hp = calloc(1, sizeof(*hp));
+    if (!hp)
+        return 0;
+    hp->heap = calloc(top, sizeof(*hp->heap));
+    if (!hp->heap) {
+        free(hp);
+        return 0;
+    }
+    hp->capacity = top;
+    hp->seed[0] = 0x9e3779b9U;
+    hp->seed[1] = 0x85ebca6bU;
+    set_rate(hp, rate);
+#ifdef THREADED
+    pthread_mutex_init(&hp->lock, 0);
+#endif
+    return hp;
+}
+
+static void clear_heap(zk_hotpaths_t *hp)
+{
+    int i;
+    for (i = 0; i < hp->size; i++)
+        free(hp->heap[i].path);
+    hp->size = 0;
+}
+
+int zk_hotpaths_reset(zk_hotpaths_t *hp, double rate, int top)
+{
+    int rc = ZOK;
+    lock_hotpaths(hp);
+    clear_heap(hp);
+    memset(hp->counters, 0, sizeof(hp->counters));
+    if (top != hp->capacity) {
+        zk_hotpath_t *heap = calloc(top, sizeof(*heap));
+        if (heap) {
+            free(hp->heap);
+            hp->heap = heap;
+            hp->capacity = top;
+        } else {
+            rc = ZSYSTEMERROR;
+        }
+    }
+    set_rate(hp, rate);
+    unlock_hotpaths(hp);
+    return rc;
+}
+
+void zk_hotpaths_destroy(zk_hotpaths_t *hp)
+{
+    if (!hp)
+        return;
+    clear_heap(hp);
+    free(hp->heap);
+#ifdef THREADED
+    pthread_mutex_destroy(&hp->lock);
+#endif
+    free(hp);
+}
+
+int zk_hotpaths_sample(zk_hotpaths_t *hp, int sampler)
+{
+    /* xorshift32: never 0, so a rate of 0 samples nothing */
+    uint32_t x = hp->seed[sampler];
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    hp->seed[sampler] = x;
+    return x <= hp->rate;
+}
+
+/* conservative update: only the counters equal to the estimate are
+ * incremented, the other ones already overestimate the path */
+static int64_t sketch_add(zk_hotpaths_t *hp, uint64_t h)
+{
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    uint32_t *cells[ZK_HOTPATHS_DEPTH];
+    uint32_t min = 0xffffffffU;
+    int i;
+
+    for (i = 0; i < ZK_HOTPATHS_DEPTH; i++) {
+        cells[i] = &hp->counters[i][(h1 + i * h2) % ZK_HOTPATHS_WIDTH];
+        if (*cells[i] < min)
+            min = *cells[i];
+    }
+    if (min == 0xffffffffU)
+        return min;
+    for (i = 0; i < ZK_HOTPATHS_DEPTH; i++) {
+        if (*cells[i] == min)
+            (*cells[i])++;
+    }
+    return (int64_t)min + 1;
+}
+
+static void swap_entries(zk_hotpath_t *a, zk_hotpath_t *b)
+{
+    zk_hotpath_t t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static void sift_up(zk_hotpaths_t *hp, int i)
+{
+    while (i > 0 && hp->heap[i].estimate < hp->heap[(i - 1) / 2].estimate) {
+        swap_entries(&hp->heap[i], &hp->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(zk_hotpaths_t *hp, int i)
+{
+    for (;;) {
+        int least = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < hp->size && hp->heap[l].estimate < hp->heap[least].estimate)
+            least = l;
+        if (r < hp->size && hp->heap[r].estimate < hp->heap[least].estimate)
+            least = r;
+        if (least == i)
+            return;
+        swap_entries(&hp->heap[i], &hp->heap[least]);
+        i = least;
+    }
+}
+
+/* the heap is small: a linear search costs less than keeping an index */
+static int find_entry(zk_hotpaths_t *hp, const char *path, uint32_t hash)
+{
+    int i;
+    for (i = 0; i < hp->size; i++) {
+        if (hp->heap[i].hash == hash && strcmp(hp->heap[i].path, path) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void zk_hotpaths_add(zk_hotpaths_t *hp, const char *path, int kind,
+        int32_t bytes)
+{
+    uint64_t h = hash_path(path);
+    uint32_t hash = (uint32_t)h;
+    zk_hotpath_t *e;
+    int64_t estimate;
+    int i;
+
+    lock_hotpaths(hp);
+    estimate = sketch_add(hp, h);
+    i = find_entry(hp, path, hash);
+    if (i < 0) {
+        char *copy;
+        if (hp->size < hp->capacity) {
+            i = hp->size;
+        } else if (hp->size > 0 && estimate > hp->heap[0].estimate) {
+            i = 0;
+        } else {
+            unlock_hotpaths(hp);
+            return;
+        }
+        copy = strdup(path);
+        if (!copy) {
+            unlock_hotpaths(hp);
+            return;
+        }
+        if (i == hp->size)
+            hp->size++;
+        else
+            free(hp->heap[i].path);
+        e = &hp->heap[i];
+        memset(e, 0, sizeof(*e));
+        e->path = copy;
+        e->hash = hash;
+    }
+    e = &hp->heap[i];
+    e->estimate = estimate;
+    e->kinds[kind]++;
+    e->bytes += bytes;
+    /* a new last entry moves up, an entry whose estimate grew moves down */
+    sift_up(hp, i);
+    sift_down(hp, i);
+    unlock_hotpaths(hp);
+}
+
+void zk_hotpaths_add_bytes(zk_hotpaths_t *hp, const char *path,
+        int32_t bytes)
+{
+    int i;
+    lock_hotpaths(hp);
+    i = find_entry(hp, path, (uint32_t)hash_path(path));
+    if (i >= 0)
+        hp->heap[i].bytes += bytes;
+    unlock_hotpaths(hp);
+}
+
+static int by_estimate(const void *a, const void *b)
+{
+    const zk_hotpath_t *x = a, *y = b;
+    return x->estimate < y->estimate ? 1 : x->estimate > y->estimate ? -1 : 0;
+}
+
+static int64_t scaled(zk_hotpaths_t *hp, int64_t count)
+{
+    return (int64_t)(count * hp->scale + 0.5);
+}
+
+int zk_hotpaths_top(zk_hotpaths_t *hp, zoo_hot_path_t *paths, int max)
+{
+    zk_hotpath_t *sorted;
+    int i, n;
+
+    lock_hotpaths(hp);
+    n = hp->size < max ? hp->size : max;
+    /* the heap is only ordered from its root: sort a shallow copy */
+    sorted = malloc((hp->size ? hp->size : 1) * sizeof(*sorted));
+    if (!sorted) {
+        unlock_hotpaths(hp);
+        return -1;
+    }
+    memcpy(sorted, hp->heap, hp->size * sizeof(*sorted));
+    qsort(sorted, hp->size, sizeof(*sorted), by_estimate);
+    for (i = 0; i < n; i++) {
+        zk_hotpath_t *e = &sorted[i];
+        paths[i].path = strdup(e->path);
+        paths[i].count = scaled(hp, e->estimate);
+        paths[i].reads = scaled(hp, e->kinds[ZK_HOTPATH_READ]);
+        paths[i].writes = scaled(hp, e->kinds[ZK_HOTPATH_WRITE]);
+        paths[i].watches = scaled(hp, e->kinds[ZK_HOTPATH_WATCH]);
+        paths[i].bytes = scaled(hp, e->bytes);
+    }
+    unlock_hotpaths(hp);
+    free(sorted);
+    return n;
+}
@@ -0,0 +1,114 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZK_HOTPATHS_H_
+#define ZK_HOTPATHS_H_
+
+#include <stdint.h>
+#ifdef THREADED
+#ifndef WIN32
+#include <pthread.h>
+#else
+#include "winport.h"
+#endif
+#endif
+#include "zookeeper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The paths seen most often in a sample of the requests and watch events
+ * of a handle.
+ *
+ * Every sampled path is counted in a count-min sketch of 4 rows, which
+ * estimates how often it was seen in a fixed space, never less than it
+ * was. The top paths by estimate are kept with their own counters in a
+ * min-heap: a path enters the heap when its estimate exceeds the one of
+ * the least frequent path of a full heap, which it replaces.
+ */
+
+#define ZK_HOTPATHS_DEPTH 4
+#define ZK_HOTPATHS_WIDTH 1024
+
+#define ZK_HOTPATH_READ 0
+#define ZK_HOTPATH_WRITE 1
+#define ZK_HOTPATH_WATCH 2
+
+typedef struct zk_hotpath {
+    char *path;
+    uint32_t hash;
+    int64_t estimate; /* the count of the sketch when last seen */
+    int64_t kinds[3]; /* indexed by ZK_HOTPATH_*, since it entered the heap */
+    int64_t bytes;
+} zk_hotpath_t;
+
+typedef struct zk_hotpaths {
+#ifdef THREADED
+    pthread_mutex_t lock; /* guards all but the samplers */
+#endif
+    volatile uint32_t rate; /* the sampling rate, out of 2^32 - 1 */
+    uint32_t seed[2]; /* of the request and IO thread samplers */
+    double scale; /* 1 / the sampling rate */
+    uint32_t counters[ZK_HOTPATHS_DEPTH][ZK_HOTPATHS_WIDTH];
+    int size;
+    int capacity;
+    zk_hotpath_t *heap;
+} zk_hotpaths_t;
+
+/**
+ * Creates a profile sampling the given fraction (in [0, 1]) of the paths
+ * and keeping the top ones, or returns NULL if out of memory.
+ */
+zk_hotpaths_t *zk_hotpaths_create(double rate, int top);
+/**
+ * Starts the profile over with a new rate and number of top paths. Returns
+ * ZOK, or ZSYSTEMERROR if out of memory, in which case the profile keeps
+ * its size.
+ */
+int zk_hotpaths_reset(zk_hotpaths_t *hp, double rate, int top);
+void zk_hotpaths_destroy(zk_hotpaths_t *hp);
+
+/**
+ * Tells if the next event is sampled, drawing from the sampler of the
+ * calling thread: 0 for the request sites (serialized by the critical
+ * section), 1 for the IO thread.
+ */
+int zk_hotpaths_sample(zk_hotpaths_t *hp, int sampler);
+
+/** Counts a sampled path, of the given ZK_HOTPATH_* kind. */
+void zk_hotpaths_add(zk_hotpaths_t *hp, const char *path, int kind,
+        int32_t bytes);
+
+/** Adds bytes to a path of the heap, e.g. those of a response. */
+void zk_hotpaths_add_bytes(zk_hotpaths_t *hp, const char *path,
+        int32_t bytes);
+
+/**
+ * Copies the paths of the heap by decreasing estimate, scaled by the
+ * sampling rate. Returns the number copied, at most max, or -1 if out of
+ * memory.
+ */
+int zk_hotpaths_top(zk_hotpaths_t *hp, zoo_hot_path_t *paths, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*ZK_HOTPATHS_H_*/
@@ -0,0 +1,201 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "zk_lz.h"
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_LOG 12
+
+static const unsigned char magic[4] = { 0, 'Z', 'L', 1 };
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned hash4(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/* the bytes of a length of 15 or more that do not fit in its nibble */
+static unsigned char *put_length(unsigned char *op, unsigned char *oend,
+        int n)
+{
+    for (n -= 15; n >= 255; n -= 255) {
+        if (op == oend)
+            return 0;
+        *op++ = 255;
+    }
+    if (op == oend)
+        return 0;
+    *op++ = (unsigned char)n;
+    return op;
+}
+
+/* writes a sequence, the last one if its match is empty, returning where
+ * the next one goes or NULL if it did not fit */
+static unsigned char *put_sequence(unsigned char *op, unsigned char *oend,
+        const unsigned char *lit, int nlit, int offset, int match)
+{
+    unsigned char *token;
+
+    if (op == oend)
+        return 0;
+    token = op++;
+    *token = (unsigned char)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15 && !(op = put_length(op, oend, nlit)))
+        return 0;
+    if (oend - op < nlit)
+        return 0;
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (match == 0)
+        return op;
+    if (oend - op < 2)
+        return 0;
+    *op++ = (unsigned char)offset;
+    *op++ = (unsigned char)(offset >> 8);
+    match -= MIN_MATCH;
+    *token |= match < 15 ? match : 15;
+    if (match >= 15 && !(op = put_length(op, oend, match)))
+        return 0;
+    return op;
+}
+
+int zk_lz_encode(const char *src, int len, char *dst, int cap)
+{
+    const unsigned char *in = (const unsigned char*)src;
+    unsigned char *op = (unsigned char*)dst, *oend = op + cap;
+    /* the last position + 1 of each hash, 0 for none */
+    int table[1 << HASH_LOG];
+    int i = 0, anchor = 0;
+
+    if (len < 0 || cap < ZK_LZ_HEADER)
+        return -1;
+    memcpy(op, magic, sizeof(magic));
+    op[4] = (unsigned char)(len >> 24);
+    op[5] = (unsigned char)(len >> 16);
+    op[6] = (unsigned char)(len >> 8);
+    op[7] = (unsigned char)len;
+    op += ZK_LZ_HEADER;
+    memset(table, 0, sizeof(table));
+    while (i + MIN_MATCH <= len) {
+        uint32_t v = read32(in + i);
+        unsigned h = hash4(v);
+        int ref = table[h] - 1, match;
+
+        table[h] = i + 1;
+        if (ref < 0 || i - ref > MAX_OFFSET || read32(in + ref) != v) {
+            /* the longer since the last match, the bigger the steps */
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+        for (match = MIN_MATCH; i + match < len &&
+                in[ref + match] == in[i + match]; match++)
+            ;
+        op = put_sequence(op, oend, in + anchor, i - anchor, i - ref, match);
+        if (!op)
+            return -1;
+        i += match;
+        anchor = i;
+    }
+    op = put_sequence(op, oend, in + anchor, len - anchor, 0, 0);
+    return op ? (int)(op - (unsigned char*)dst) : -1;
+}
+
+int zk_lz_size(const char *src, int len)
+{
+    const unsigned char *p = (const unsigned char*)src;
+    uint32_t size;
+
+    if (!src || len < ZK_LZ_HEADER || memcmp(p, magic, sizeof(magic)) != 0)
+        return -1;
+    size = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+    /* a byte of the block stands for at most 255 of the value */
+    if (size > 0x7fffffff || size / 255 > (uint32_t)len)
+        return -1;
+    return (int)size;
+}
+
+/* adds the bytes of a length that did not fit in its nibble */
+static int get_length(const unsigned char **ip, const unsigned char *iend,
+        size_t *n)
+{
+    unsigned char b;
+    do {
+        if (*ip == iend)
+            return -1;
+        b = *(*ip)++;
+        *n += b;
+        if (*n > 0x7fffffff)
+            return -1;
+    } while (b == 255);
+    return 0;
+}
+
+int zk_lz_decode(const char *src, int len, char *dst, int size)
+{
+    const unsigned char *ip = (const unsigned char*)src + ZK_LZ_HEADER;
+    const unsigned char *iend = (const unsigned char*)src + len;
+    unsigned char *out = (unsigned char*)dst, *op = out, *oend = out + size;
+
+    if (zk_lz_size(src, len) != size)
+        return -1;
+    for (;;) {
+        unsigned token;
+        size_t n, offset;
+        const unsigned char *ref;
+
+        /* the block ends with a sequence of literals, not with a match */
+        if (ip == iend)
+            return -1;
+        token = *ip++;
+        n = token >> 4;
+        if (n == 15 && get_length(&ip, iend, &n) < 0)
+            return -1;
+        if ((size_t)(iend - ip) < n || (size_t)(oend - op) < n)
+            return -1;
+        memcpy(op, ip, n);
+        op += n;
+        ip += n;
+        if (ip == iend)
+            break;
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - out))
+            return -1;
+        n = token & 15;
+        if (n == 15 && get_length(&ip, iend, &n) < 0)
+            return -1;
+        n += MIN_MATCH;
+        if ((size_t)(oend - op) < n)
+            return -1;
+        /* the match may overlap the bytes it produces */
+        for (ref = op - offset; n > 0; n--)
+            *op++ = *ref++;
+    }
+    return op == oend ? size : -1;
+}
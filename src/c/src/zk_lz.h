@@ -0,0 +1,69 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZK_LZ_H_
+#define ZK_LZ_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A small LZ77 codec for the values of the znodes, see zoo_set_compression.
+ *
+ * A compressed value starts with a header of 8 bytes: the 4 magic bytes
+ * 00 'Z' 'L' 01, then the size of the value once decompressed, as a big
+ * endian 32 bit integer. The block that follows is a list of sequences,
+ * each made of a token byte whose high nibble is the number of literal
+ * bytes and low nibble the length of the match minus 4, a nibble of 15
+ * being followed by bytes adding up to the rest of the length (255 meaning
+ * more bytes follow); then the literal bytes, then the little endian 16 bit
+ * offset of the match and the rest of its length. The last sequence only
+ * has literals: it ends the block. This is the block format of LZ4.
+ *
+ * A value without the header, whose block does not decode to exactly the
+ * size of its header or does not end with a sequence of literals, is not
+ * compressed.
+ */
+
+#define ZK_LZ_HEADER 8
+
+/**
+ * Compresses len bytes of src into dst, which holds cap bytes. Returns
+ * the size of the compressed value, header included, or -1 if it does not
+ * fit in cap bytes.
+ */
+int zk_lz_encode(const char *src, int len, char *dst, int cap);
+
+/**
+ * Returns the size of a value once decompressed, or -1 if the value has
+ * no header.
+ */
+int zk_lz_size(const char *src, int len);
+
+/**
+ * Decompresses a value into dst, which holds size bytes: the size given
+ * by zk_lz_size. Returns size, or -1 if the value is not compressed.
+ */
+int zk_lz_decode(const char *src, int len, char *dst, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*ZK_LZ_H_*/
@@ -0,0 +1,499 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "zookeeper_pool.h"
+#include "zk_adaptor.h"
+#include "zookeeper_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef THREADED
+#include <pthread.h>
+#define lock_member(m) pthread_mutex_lock(&(m)->lock)
+#define unlock_member(m) pthread_mutex_unlock(&(m)->lock)
+#else
+#define lock_member(m)
+#define unlock_member(m)
+#endif
+
+struct pool_member {
+    zhandle_t *zh;
+#ifdef THREADED
+    pthread_mutex_t lock;
+#endif
+    int outstanding;
+    int64_t reads;
+    int64_t writes;
+    int64_t completed;
+    int64_t errors;
+};
+
+struct _zoo_pool {
+    int size;
+    volatile unsigned next;    /* where the least loaded search starts */
+    struct pool_member *members;
+};
+
+/*
+ * A request in flight, wrapping the completion of the caller so that the
+ * member it was sent to can account for it.
+ */
+struct pool_request {
+    struct pool_member *member;
+    union {
+        void_completion_t void_result;
+        stat_completion_t stat_result;
+        data_completion_t data_result;
+        strings_completion_t strings_result;
+        strings_stat_completion_t strings_stat_result;
+        string_completion_t string_result;
+    } c;
+    const void *data;
+};
+
+static unsigned hash_path(const char *path)
+{
+    unsigned h = 5381;
+    while (*path)
+        h = h * 33 + (unsigned char)*path++;
+    return h;
+}
+
+static struct pool_member *key_member(zoo_pool_t *pool, const char *path)
+{
+    return &pool->members[path ? hash_path(path) % pool->size : 0];
+}
+
+/*
+ * The connected member with the fewest requests in flight; the search
+ * starts one member further every time so that ties are broken round robin.
+ * Falls back to any member if none is connected, so that the request fails
+ * or is queued the way it would be on a single handle.
+ */
+static struct pool_member *least_loaded_member(zoo_pool_t *pool)
+{
+    struct pool_member *best = 0;
+    int best_outstanding = 0;
+    unsigned start = pool->next++;
+    int i;
+
+    for (i = 0; i < pool->size; i++) {
+        struct pool_member *m = &pool->members[(start + i) % pool->size];
+        int outstanding;
+        if (zoo_state(m->zh) != ZOO_CONNECTED_STATE)
+            continue;
+        lock_member(m);
+        outstanding = m->outstanding;
+        unlock_member(m);
+        if (!best || outstanding < best_outstanding) {
+            best = m;
+            best_outstanding = outstanding;
+        }
+    }
+    return best ? best : &pool->members[start % pool->size];
+}
+
+static struct pool_request *begin_request(struct pool_member *m, int write,
+        const void *data)
+{
+    struct pool_request *req = malloc(sizeof(*req));
+    if (!req)
+        return 0;
+    req->member = m;
+    req->data = data;
+    lock_member(m);
+    m->outstanding++;
+    if (write)
+        m->writes++;
+    else
+        m->reads++;
+    unlock_member(m);
+    return req;
+}
+
+/* Undoes begin_request when the request could not be queued */
+static int abort_request(struct pool_request *req, int write, int rc)
+{
+    struct pool_member *m = req->member;
+    lock_member(m);
+    m->outstanding--;
+    if (write)
+        m->writes--;
+    else
+        m->reads--;
+    unlock_member(m);
+    free(req);
+    return rc;
+}
+
+static void end_request(struct pool_request *req, int rc)
+{
+    struct pool_member *m = req->member;
+    lock_member(m);
+    m->outstanding--;
+    m->completed++;
+    if (rc != ZOK)
+        m->errors++;
+    unlock_member(m);
+}
+
+static void void_done(int rc, const void *data)
+{
+    struct pool_request *req = (struct pool_request *)data;
+    end_request(req, rc);
+    if (req->c.void_result)
+        req->c.void_result(rc, req->data);
+    free(req);
+}
+
+static void stat_done(int rc, const struct Stat *stat, const void *data)
+{
+    struct pool_request *req = (struct pool_request *)data;
+    end_request(req, rc);
+    if (req->c.stat_result)
+        req->c.stat_result(rc, stat, req->data);
+    free(req);
+}
+
+static void data_done(int rc, const char *value, int value_len,
+        const struct Stat *stat, const void *data)
+{
+    struct pool_request *req = (struct pool_request *)data;
+    end_request(req, rc);
+    if (req->c.data_result)
+        req->c.data_result(rc, value, value_len, stat, req->data);
+    free(req);
+}
+
+static void strings_done(int rc, const struct String_vector *strings,
+        const void *data)
+{
+    struct pool_request *req = (struct pool_request *)data;
+    end_request(req, rc);
+    if (req->c.strings_result)
+        req->c.strings_result(rc, strings, req->data);
+    free(req);
+}
+
+static void strings_stat_done(int rc, const struct String_vector *strings,
+        const struct Stat *stat, const void *data)
+{
+    struct pool_request *req = (struct pool_request *)data;
+    end_request(req, rc);
+    if (req->c.strings_stat_result)
+        req->c.strings_stat_result(rc, strings, stat, req->data);
+    free(req);
+}
+
+static void string_done(int rc, const char *value, const void *data)
+{
+    struct pool_request *req = (struct pool_request *)data;
+    end_request(req, rc);
+    if (req->c.string_result)
+        req->c.string_result(rc, value, req->data);
+    free(req);
+}
+
+zoo_pool_t *zoo_pool_init(const char *host, int size, watcher_fn fn,
+        int recv_timeout, void *context, int flags)
+{
+    zoo_pool_t *pool;
+    int first;
+    int i;
+
+    if (size < 1) {
+        errno = EINVAL;
+        return 0;
+    }
+    pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        errno = ENOMEM;
+        return 0;
+    }
+    pool->members = calloc(size, sizeof(*pool->members));
+    if (!pool->members) {
+        free(pool);
+        errno = ENOMEM;
+        return 0;
+    }
+    /* the sessions start at consecutive servers, from a random one so
+     * that the pools of different processes do not pile onto the first
+     * servers of the list */
+    first = (int)(zk_random() & 0xffff);
+    for (i = 0; i < size; i++) {
+        struct pool_member *m = &pool->members[i];
+        m->zh = zookeeper_init_at(host, fn, recv_timeout, 0, context, flags,
+                first + i);
+        if (!m->zh) {
+            int saved_errno = errno;
+            LOG_ERROR(("Unable to create session %d of the pool", i));
+            zoo_pool_close(pool);
+            errno = saved_errno;
+            return 0;
+        }
+#ifdef THREADED
+        pthread_mutex_init(&m->lock, 0);
+#endif
+        pool->size = i + 1;
+    }
+    LOG_INFO(("Created a pool of %d sessions for %s", size, host));
+    return pool;
+}
+
+int zoo_pool_close(zoo_pool_t *pool)
+{
+    int rc = ZOK;
+    int i;
+
+    if (!pool)
+        return ZBADARGUMENTS;
+    for (i = 0; i < pool->size; i++) {
+        int close_rc = zookeeper_close(pool->members[i].zh);
+        rc = rc != ZOK ? rc : close_rc;
+#ifdef THREADED
+        pthread_mutex_destroy(&pool->members[i].lock);
+#endif
+    }
+    free(pool->members);
+    free(pool);
+    return rc;
+}
+
+int zoo_pool_size(zoo_pool_t *pool)
+{
+    return pool->size;
+}
+
+zhandle_t *zoo_pool_handle(zoo_pool_t *pool, int index)
+{
+    if (index < 0 || index >= pool->size)
+        return 0;
+    return pool->members[index].zh;
+}
+
+zhandle_t *zoo_pool_key_handle(zoo_pool_t *pool, const char *path)
+{
+    return key_member(pool, path)->zh;
+}
+
+int zoo_pool_get_stats(zoo_pool_t *pool, int index, zoo_pool_stats_t *stats)
+{
+    int first = index, last = index + 1;
+    int i;
+
+    if (index == -1) {
+        first = 0;
+        last = pool->size;
+    } else if (index < 0 || index >= pool->size) {
+        return ZBADARGUMENTS;
+    }
+    memset(stats, 0, sizeof(*stats));
+    for (i = first; i < last; i++) {
+        struct pool_member *m = &pool->members[i];
+        stats->sessions++;
+        if (zoo_state(m->zh) == ZOO_CONNECTED_STATE)
+            stats->connected++;
+        lock_member(m);
+        stats->outstanding += m->outstanding;
+        stats->reads += m->reads;
+        stats->writes += m->writes;
+        stats->completed += m->completed;
+        stats->errors += m->errors;
+        unlock_member(m);
+    }
+    return ZOK;
+}
+
+/*
+ * Reads that leave a watch behind must go to the member the writes to the
+ * path go to, otherwise the watch event may be delivered after the result
+ * of a later read.
+ */
+static struct pool_member *read_member(zoo_pool_t *pool, const char *path,
+        int watch)
+{
+    return watch ? key_member(pool, path) : least_loaded_member(pool);
+}
+
+int zoo_pool_aget(zoo_pool_t *pool, const char *path, int watch,
+        data_completion_t completion, const void *data)
+{
+    struct pool_request *req = begin_request(read_member(pool, path, watch),
+            0, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.data_result = completion;
+    rc = zoo_aget(req->member->zh, path, watch, data_done, req);
+    return rc == ZOK ? rc : abort_request(req, 0, rc);
+}
+
+int zoo_pool_awget(zoo_pool_t *pool, const char *path,
+        watcher_fn watcher, void *watcherCtx,
+        data_completion_t completion, const void *data)
+{
+    struct pool_request *req = begin_request(
+            read_member(pool, path, watcher != 0), 0, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.data_result = completion;
+    rc = zoo_awget(req->member->zh, path, watcher, watcherCtx, data_done, req);
+    return rc == ZOK ? rc : abort_request(req, 0, rc);
+}
+
+int zoo_pool_aexists(zoo_pool_t *pool, const char *path, int watch,
+        stat_completion_t completion, const void *data)
+{
+    struct pool_request *req = begin_request(read_member(pool, path, watch),
+            0, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.stat_result = completion;
+    rc = zoo_aexists(req->member->zh, path, watch, stat_done, req);
+    return rc == ZOK ? rc : abort_request(req, 0, rc);
+}
+
+int zoo_pool_awexists(zoo_pool_t *pool, const char *path,
+        watcher_fn watcher, void *watcherCtx,
+        stat_completion_t completion, const void *data)
+{
+    struct pool_request *req = begin_request(
+            read_member(pool, path, watcher != 0), 0, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.stat_result = completion;
+    rc = zoo_awexists(req->member->zh, path, watcher, watcherCtx, stat_done,
+            req);
+    return rc == ZOK ? rc : abort_request(req, 0, rc);
+}
+
+int zoo_pool_aget_children(zoo_pool_t *pool, const char *path, int watch,
+        strings_completion_t completion, const void *data)
+{
+    struct pool_request *req = begin_request(read_member(pool, path, watch),
+            0, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.strings_result = completion;
+    rc = zoo_aget_children(req->member->zh, path, watch, strings_done, req);
+    return rc == ZOK ? rc : abort_request(req, 0, rc);
+}
+
+int zoo_pool_awget_children(zoo_pool_t *pool, const char *path,
+        watcher_fn watcher, void *watcherCtx,
+        strings_completion_t completion, const void *data)
+{
+    struct pool_request *req = begin_request(
+            read_member(pool, path, watcher != 0), 0, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.strings_result = completion;
+    rc = zoo_awget_children(req->member->zh, path, watcher, watcherCtx,
+            strings_done, req);
+    return rc == ZOK ? rc : abort_request(req, 0, rc);
+}
+
+int zoo_pool_aget_children2(zoo_pool_t *pool, const char *path, int watch,
+        strings_stat_completion_t completion, const void *data)
+{
+    struct pool_request *req = begin_request(read_member(pool, path, watch),
+            0, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.strings_stat_result = completion;
+    rc = zoo_aget_children2(req->member->zh, path, watch, strings_stat_done,
+            req);
+    return rc == ZOK ? rc : abort_request(req, 0, rc);
+}
+
+int zoo_pool_awget_children2(zoo_pool_t *pool, const char *path,
+        watcher_fn watcher, void *watcherCtx,
+        strings_stat_completion_t completion, const void *data)
+{
+    struct pool_request *req = begin_request(
+            read_member(pool, path, watcher != 0), 0, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.strings_stat_result = completion;
+    rc = zoo_awget_children2(req->member->zh, path, watcher, watcherCtx,
+            strings_stat_done, req);
+    return rc == ZOK ? rc : abort_request(req, 0, rc);
+}
+
+int zoo_pool_acreate(zoo_pool_t *pool, const char *path, const char *value,
+        int valuelen, const struct ACL_vector *acl, int flags,
+        string_completion_t completion, const void *data)
+{
+    struct pool_request *req = begin_request(key_member(pool, path), 1, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.string_result = completion;
+    rc = zoo_acreate(req->member->zh, path, value, valuelen, acl, flags,
+            string_done, req);
+    return rc == ZOK ? rc : abort_request(req, 1, rc);
+}
+
+int zoo_pool_aset(zoo_pool_t *pool, const char *path, const char *buffer,
+        int buflen, int version, stat_completion_t completion,
+        const void *data)
+{
+    struct pool_request *req = begin_request(key_member(pool, path), 1, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.stat_result = completion;
+    rc = zoo_aset(req->member->zh, path, buffer, buflen, version, stat_done,
+            req);
+    return rc == ZOK ? rc : abort_request(req, 1, rc);
+}
+
+int zoo_pool_adelete(zoo_pool_t *pool, const char *path, int version,
+        void_completion_t completion, const void *data)
+{
+    struct pool_request *req = begin_request(key_member(pool, path), 1, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.void_result = completion;
+    rc = zoo_adelete(req->member->zh, path, version, void_done, req);
+    return rc == ZOK ? rc : abort_request(req, 1, rc);
+}
+
+int zoo_pool_amulti(zoo_pool_t *pool, int count, const zoo_op_t *ops,
+        zoo_op_result_t *results, void_completion_t completion,
+        const void *data)
+{
+    /* path is the first member of every op of the union */
+    struct pool_request *req = begin_request(
+            key_member(pool, count > 0 ? ops[0].create_op.path : 0), 1, data);
+    int rc;
+    if (!req)
+        return ZSYSTEMERROR;
+    req->c.void_result = completion;
+    rc = zoo_amulti(req->member->zh, count, ops, results, void_done, req);
+    return rc == ZOK ? rc : abort_request(req, 1, rc);
+}
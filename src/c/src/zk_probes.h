@@ -0,0 +1,63 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZK_PROBES_H_
+#define ZK_PROBES_H_
+
+/*
+ * Static tracepoints (USDT) of the "zookeeper" provider, for bpftrace,
+ * perf or systemtap. Each one compiles to a single nop, and to nothing at
+ * all without sys/sdt.h or with --disable-probes. Their arguments must not
+ * cost more than a few loads to compute: strings are passed as pointers.
+ *
+ * request__queued(zh, xid, op type, path, bytes)
+ *      a zoo_a* call queued a request
+ * frame__sent(zh, xid, op type, bytes)
+ *      a request was written out entirely
+ * frame__received(zh, xid, zxid, err, bytes)
+ *      a response or notification was read
+ * completion__dispatched(zh, xid, err, sync)
+ *      a response was matched with its request and handed over to the
+ *      completion thread (or the waiting caller if sync is 1)
+ * callback__begin(zh, xid, completion type)
+ * callback__end(zh, xid, completion type)
+ *      around a completion or the watchers of a notification (xid -1)
+ * watch__triggered(zh, event type, state, path)
+ *      a notification was received for the watches set on path
+ * connect__start(zh, server index, struct sockaddr_storage *)
+ *      a connection to a server was initiated
+ * handshake__done(zh, session id, negotiated timeout, handshake us)
+ *      the session was established on the connection
+ * session__event(zh, state)
+ *      a session event was queued for the watchers
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define ZK_PROBE2(name,a,b) DTRACE_PROBE2(zookeeper,name,a,b)
+#define ZK_PROBE3(name,a,b,c) DTRACE_PROBE3(zookeeper,name,a,b,c)
+#define ZK_PROBE4(name,a,b,c,d) DTRACE_PROBE4(zookeeper,name,a,b,c,d)
+#define ZK_PROBE5(name,a,b,c,d,e) DTRACE_PROBE5(zookeeper,name,a,b,c,d,e)
+#else
+#define ZK_PROBE2(name,a,b) do {} while (0)
+#define ZK_PROBE3(name,a,b,c) do {} while (0)
+#define ZK_PROBE4(name,a,b,c,d) do {} while (0)
+#define ZK_PROBE5(name,a,b,c,d,e) do {} while (0)
+#endif
+
+#endif /*ZK_PROBES_H_*/
@@ -0,0 +1,163 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WIN32
+#include "config.h"
+#endif
+
+#include "zk_timer.h"
+#include <string.h>
+#include <time.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#define SLOT_MASK (ZK_TIMER_SLOTS - 1)
+
+int64_t zk_clock_us(void)
+{
+#if defined(WIN32)
+    return (int64_t)GetTickCount64() * 1000;
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+void zk_timer_wheel_init(zk_timer_wheel_t *w, int64_t now)
+{
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+}
+
+static void insert_timer(zk_timer_wheel_t *w, zk_timer_t *t)
+{
+    int64_t expires = t->expires < w->now ? w->now : t->expires;
+    int64_t slot = 0;
+    int level;
+    zk_timer_t **head;
+
+    for (level = 0; level < ZK_TIMER_LEVELS; level++) {
+        int64_t base = w->now >> (level * ZK_TIMER_SLOT_BITS);
+        slot = expires >> (level * ZK_TIMER_SLOT_BITS);
+        if (slot - base < ZK_TIMER_SLOTS)
+            break;
+        if (level == ZK_TIMER_LEVELS - 1) {
+            /* too far away: wait in the last slot and move down later */
+            slot = base + ZK_TIMER_SLOTS - 1;
+            break;
+        }
+    }
+    head = &w->slots[level][slot & SLOT_MASK];
+    t->next = *head;
+    if (t->next)
+        t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+void zk_timer_cancel(zk_timer_t *t)
+{
+    if (!t->pprev)
+        return;
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->next = 0;
+    t->pprev = 0;
+}
+
+void zk_timer_arm(zk_timer_wheel_t *w, zk_timer_t *t, int64_t expires)
+{
+    zk_timer_cancel(t);
+    t->expires = expires;
+    insert_timer(w, t);
+}
+
+zk_timer_t *zk_timer_wheel_advance(zk_timer_wheel_t *w, int64_t now)
+{
+    zk_timer_t *expired = 0;
+    zk_timer_t *pending = 0;
+    int level;
+
+    if (now < w->now)
+        now = w->now;
+    for (level = 0; level < ZK_TIMER_LEVELS; level++) {
+        int64_t from = w->now >> (level * ZK_TIMER_SLOT_BITS);
+        int64_t to = now >> (level * ZK_TIMER_SLOT_BITS);
+        int64_t s;
+        if (to - from >= ZK_TIMER_SLOTS)
+            to = from + ZK_TIMER_SLOTS - 1;
+        for (s = from; s <= to; s++) {
+            zk_timer_t *t = w->slots[level][s & SLOT_MASK];
+            w->slots[level][s & SLOT_MASK] = 0;
+            while (t) {
+                zk_timer_t *next = t->next;
+                t->pprev = 0;
+                if (t->expires <= now) {
+                    t->next = expired;
+                    expired = t;
+                } else {
+                    t->next = pending;
+                    pending = t;
+                }
+                t = next;
+            }
+        }
+    }
+    w->now = now;
+    while (pending) {
+        zk_timer_t *next = pending->next;
+        insert_timer(w, pending);
+        pending = next;
+    }
+    return expired;
+}
+
+int64_t zk_timer_wheel_next(const zk_timer_wheel_t *w)
+{
+    int64_t next = -1;
+    int level;
+
+    for (level = 0; level < ZK_TIMER_LEVELS; level++) {
+        int64_t base = w->now >> (level * ZK_TIMER_SLOT_BITS);
+        int i;
+        for (i = 0; i < ZK_TIMER_SLOTS; i++) {
+            const zk_timer_t *t = w->slots[level][(base + i) & SLOT_MASK];
+            if (!t)
+                continue;
+            for (; t; t = t->next) {
+                if (next < 0 || t->expires < next)
+                    next = t->expires;
+            }
+            /* the timers of the first busy slot of a level are the earliest
+             * of that level, except in the last one which holds the timers
+             * too far away for the wheel */
+            if (level < ZK_TIMER_LEVELS - 1)
+                break;
+        }
+    }
+    return next;
+}
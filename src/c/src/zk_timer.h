@@ -0,0 +1,89 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZK_TIMER_H_
+#define ZK_TIMER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A hierarchical timer wheel with a millisecond resolution.
+ *
+ * Level 0 has one slot per millisecond for the next 64 ms, level 1 one slot
+ * per 64 ms for the next 4 s, level 2 one slot per 4 s for the next 4 min
+ * and level 3 one slot per 4 min; timers further away wait in the last slot
+ * of level 3. Arming and cancelling a timer are constant time, and advancing
+ * the wheel visits at most 64 slots per level however long it slept, moving
+ * the timers of the higher levels down as their time gets closer.
+ */
+
+#define ZK_TIMER_LEVELS 4
+#define ZK_TIMER_SLOT_BITS 6
+#define ZK_TIMER_SLOTS (1 << ZK_TIMER_SLOT_BITS)
+
+typedef struct zk_timer {
+    struct zk_timer *next;
+    struct zk_timer **pprev; /* NULL if the timer is not armed */
+    int64_t expires; /* in milliseconds */
+} zk_timer_t;
+
+typedef struct zk_timer_wheel {
+    int64_t now; /* the time the wheel was last advanced to, in milliseconds */
+    zk_timer_t *slots[ZK_TIMER_LEVELS][ZK_TIMER_SLOTS];
+} zk_timer_wheel_t;
+
+/**
+ * \brief returns the time of CLOCK_MONOTONIC in microseconds.
+ */
+int64_t zk_clock_us(void);
+
+void zk_timer_wheel_init(zk_timer_wheel_t *w, int64_t now);
+
+#define zk_timer_armed(t) ((t)->pprev != 0)
+
+/**
+ * \brief arms a timer to expire at the given time, re-arming it if it
+ * already was. A time in the past expires at the next advance.
+ */
+void zk_timer_arm(zk_timer_wheel_t *w, zk_timer_t *t, int64_t expires);
+
+void zk_timer_cancel(zk_timer_t *t);
+
+/**
+ * \brief moves the wheel to now.
+ *
+ * \return the timers that expired, disarmed and linked through their next
+ * field.
+ */
+zk_timer_t *zk_timer_wheel_advance(zk_timer_wheel_t *w, int64_t now);
+
+/**
+ * \brief returns the expiry time of the earliest timer, or -1 if no timer
+ * is armed.
+ */
+int64_t zk_timer_wheel_next(const zk_timer_wheel_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*ZK_TIMER_H_*/
@@ -0,0 +1,839 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * zkbench drives a configurable mix of asynchronous operations against a
+ * zookeeper ensemble from several threads and handles, and reports the
+ * throughput and latency percentiles of every operation type.
+ */
+
+#include <zookeeper.h>
+#include "zookeeper_log.h"
+#include "loopback_server.h"
+#include <errno.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define OP_GET 0
+#define OP_SET 1
+#define OP_CREATE 2
+#define OP_DELETE 3
+#define OP_EXISTS 4
+#define OP_CHILDREN 5
+#define OP_COUNT 6
+
+static const char *op_names[OP_COUNT] = {
+    "get", "set", "create", "delete", "exists", "children"
+};
+
+/*
+ * Latency histogram with a bounded relative error: values below HIST_SUB
+ * microseconds get a bucket each, larger values are bucketed by their
+ * most significant bit and the HIST_SUB_BITS-1 bits below it.
+ */
+#define HIST_SUB_BITS 6
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB / 2)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 2) * HIST_HALF)
+
+typedef struct histogram {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} histogram_t;
+
+static int hist_index(uint64_t v) {
+    int msb = 0;
+    int g;
+    if (v < HIST_SUB)
+        return (int)v;
+    while ((v >> msb) > 1)
+        msb++;
+    g = msb - HIST_SUB_BITS + 1;
+    return g * HIST_HALF + (int)(v >> g);
+}
+
+/* the largest value falling into the bucket */
+static uint64_t hist_value(int index) {
+    int g;
+    if (index < HIST_SUB)
+        return index;
+    g = index / HIST_HALF - 1;
+    return (((uint64_t)(index - g * HIST_HALF) + 1) << g) - 1;
+}
+
+static void hist_record(histogram_t *h, uint64_t v) {
+    h->buckets[hist_index(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void hist_merge(histogram_t *to, const histogram_t *from) {
+    int i;
+    for (i = 0; i < HIST_BUCKETS; i++)
+        to->buckets[i] += from->buckets[i];
+    to->count += from->count;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+static uint64_t hist_percentile(const histogram_t *h, double p) {
+    uint64_t rank;
+    uint64_t seen = 0;
+    int i;
+    if (h->count == 0)
+        return 0;
+    rank = (uint64_t)(p * h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+// *****************************************************************************
+// configuration
+
+static struct bench_config {
+    const char *hosts;
+    const char *root;
+    int mix[OP_COUNT];
+    int mix_total;
+    int value_size;
+    int keys;
+    int handles;
+    int threads;
+    int outstanding;
+    double rate;
+    double duration;
+    double warmup;
+    int json;
+    int clean;
+    int local;
+    loopback_options_t server;
+} cfg;
+
+static char *value_buffer;
+
+// *****************************************************************************
+// time
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline) {
+    uint64_t now = now_ns();
+    struct timespec ts;
+    if (now >= deadline)
+        return;
+    ts.tv_sec = (deadline - now) / 1000000000ULL;
+    ts.tv_nsec = (deadline - now) % 1000000000ULL;
+    nanosleep(&ts, 0);
+}
+
+// *****************************************************************************
+// handles
+
+typedef struct bench_handle {
+    zhandle_t *zh;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} bench_handle_t;
+
+static bench_handle_t *handles;
+
+static void listener(zhandle_t *zh, int type, int state, const char *path,
+        void *ctx) {
+    bench_handle_t *h = (bench_handle_t *)ctx;
+    if (type == ZOO_SESSION_EVENT) {
+        pthread_mutex_lock(&h->lock);
+        pthread_cond_broadcast(&h->cond);
+        pthread_mutex_unlock(&h->lock);
+    }
+}
+
+static int ensure_connected(bench_handle_t *h, int timeout_secs) {
+    struct timespec deadline;
+    int rc = 0;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_secs;
+    pthread_mutex_lock(&h->lock);
+    while (zoo_state(h->zh) != ZOO_CONNECTED_STATE && rc != ETIMEDOUT) {
+        rc = pthread_cond_timedwait(&h->cond, &h->lock, &deadline);
+    }
+    pthread_mutex_unlock(&h->lock);
+    return zoo_state(h->zh) == ZOO_CONNECTED_STATE ? ZOK : ZOPERATIONTIMEOUT;
+}
+
+// *****************************************************************************
+// workers
+
+struct bench_thread;
+
+typedef struct bench_req {
+    struct bench_thread *thread;
+    int op;
+    uint64_t start;
+    uint64_t seq; /* the node a create made */
+    struct bench_req *next;
+} bench_req_t;
+
+typedef struct bench_thread {
+    int id;
+    pthread_t tid;
+    bench_handle_t *handle;
+    unsigned int seed;
+    /* the requests not in flight */
+    bench_req_t *reqs;
+    bench_req_t *free_reqs;
+    int in_flight;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* the nodes created by this thread and not deleted yet, oldest first */
+    uint64_t *created;
+    int created_cap;
+    int created_head;
+    int created_count;
+    uint64_t next_seq;
+    /* written by the completion thread of the handle only */
+    histogram_t hist[OP_COUNT];
+    uint64_t errors[OP_COUNT];
+} bench_thread_t;
+
+static bench_thread_t *threads;
+static uint64_t measure_start;
+static uint64_t measure_end;
+
+static void release_req(bench_req_t *req, int rc, int ok) {
+    bench_thread_t *t = req->thread;
+    uint64_t end = now_ns();
+    /* only the requests issued in the measurement window are counted */
+    if (req->start >= measure_start && req->start < measure_end) {
+        if (ok) {
+            hist_record(&t->hist[req->op], (end - req->start) / 1000);
+        } else {
+            t->errors[req->op]++;
+        }
+    }
+    pthread_mutex_lock(&t->lock);
+    if (req->op == OP_CREATE && ok && t->created_count < t->created_cap) {
+        t->created[(t->created_head + t->created_count) % t->created_cap] =
+            req->seq;
+        t->created_count++;
+    }
+    req->next = t->free_reqs;
+    t->free_reqs = req;
+    t->in_flight--;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    if (!ok && rc != ZOK) {
+        LOG_DEBUG(("%s failed rc=%d", op_names[req->op], rc));
+    }
+}
+
+static void data_completion(int rc, const char *value, int value_len,
+        const struct Stat *stat, const void *data) {
+    release_req((bench_req_t *)data, rc, rc == ZOK);
+}
+
+static void stat_completion(int rc, const struct Stat *stat, const void *data) {
+    bench_req_t *req = (bench_req_t *)data;
+    release_req(req, rc,
+            rc == ZOK || (req->op == OP_EXISTS && rc == ZNONODE));
+}
+
+static void string_completion(int rc, const char *value, const void *data) {
+    release_req((bench_req_t *)data, rc, rc == ZOK);
+}
+
+static void void_completion(int rc, const void *data) {
+    release_req((bench_req_t *)data, rc, rc == ZOK);
+}
+
+static void strings_completion(int rc, const struct String_vector *strings,
+        const void *data) {
+    release_req((bench_req_t *)data, rc, rc == ZOK);
+}
+
+static int pick_op(bench_thread_t *t) {
+    int r = rand_r(&t->seed) % cfg.mix_total;
+    int op;
+    for (op = 0; op < OP_COUNT; op++) {
+        if (r < cfg.mix[op])
+            return op;
+        r -= cfg.mix[op];
+    }
+    return OP_GET;
+}
+
+static int issue(bench_thread_t *t, bench_req_t *req) {
+    zhandle_t *zh = t->handle->zh;
+    char path[1024];
+    int rc;
+    if (req->op == OP_DELETE) {
+        pthread_mutex_lock(&t->lock);
+        if (t->created_count > 0) {
+            req->seq = t->created[t->created_head];
+            t->created_head = (t->created_head + 1) % t->created_cap;
+            t->created_count--;
+        } else {
+            // nothing left to delete, so make something instead
+            req->op = OP_CREATE;
+        }
+        pthread_mutex_unlock(&t->lock);
+    }
+    if (req->op == OP_CREATE) {
+        req->seq = t->next_seq++;
+    }
+    switch (req->op) {
+    case OP_CREATE:
+    case OP_DELETE:
+        snprintf(path, sizeof(path), "%s/n/%d-%llu", cfg.root, t->id,
+                (unsigned long long)req->seq);
+        break;
+    case OP_CHILDREN:
+        snprintf(path, sizeof(path), "%s", cfg.root);
+        break;
+    default:
+        snprintf(path, sizeof(path), "%s/k%d", cfg.root,
+                rand_r(&t->seed) % cfg.keys);
+    }
+    switch (req->op) {
+    case OP_GET:
+        rc = zoo_aget(zh, path, 0, data_completion, req);
+        break;
+    case OP_SET:
+        rc = zoo_aset(zh, path, value_buffer, cfg.value_size, -1,
+                stat_completion, req);
+        break;
+    case OP_CREATE:
+        rc = zoo_acreate(zh, path, value_buffer, cfg.value_size,
+                &ZOO_OPEN_ACL_UNSAFE, 0, string_completion, req);
+        break;
+    case OP_DELETE:
+        rc = zoo_adelete(zh, path, -1, void_completion, req);
+        break;
+    case OP_EXISTS:
+        rc = zoo_aexists(zh, path, 0, stat_completion, req);
+        break;
+    default:
+        rc = zoo_aget_children(zh, path, 0, strings_completion, req);
+    }
+    return rc;
+}
+
+static void *worker(void *arg) {
+    bench_thread_t *t = (bench_thread_t *)arg;
+    /* in open loop mode requests are scheduled rather than sent back to back */
+    uint64_t interval = cfg.rate > 0 ? (uint64_t)(cfg.threads * 1e9 / cfg.rate) : 0;
+    uint64_t next = now_ns();
+    for (;;) {
+        bench_req_t *req;
+        uint64_t start;
+        if (interval) {
+            sleep_until(next);
+            start = next;
+            next += interval;
+        } else {
+            start = 0;
+        }
+        pthread_mutex_lock(&t->lock);
+        while (t->free_reqs == 0) {
+            pthread_cond_wait(&t->cond, &t->lock);
+        }
+        req = t->free_reqs;
+        t->free_reqs = req->next;
+        t->in_flight++;
+        pthread_mutex_unlock(&t->lock);
+        if (start == 0) {
+            start = now_ns();
+        }
+        if (start >= measure_end) {
+            pthread_mutex_lock(&t->lock);
+            req->next = t->free_reqs;
+            t->free_reqs = req;
+            t->in_flight--;
+            pthread_mutex_unlock(&t->lock);
+            break;
+        }
+        /* the latency of an open loop request counts from its scheduled
+         * time, so a backlog shows up in the percentiles */
+        req->start = start;
+        req->op = pick_op(t);
+        if (issue(t, req) != ZOK) {
+            release_req(req, ZCONNECTIONLOSS, 0);
+        }
+    }
+    return 0;
+}
+
+static int wait_drained(bench_thread_t *t, int timeout_secs) {
+    struct timespec deadline;
+    int rc = 0;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_secs;
+    pthread_mutex_lock(&t->lock);
+    while (t->in_flight > 0 && rc != ETIMEDOUT) {
+        rc = pthread_cond_timedwait(&t->cond, &t->lock, &deadline);
+    }
+    rc = t->in_flight;
+    pthread_mutex_unlock(&t->lock);
+    return rc;
+}
+
+// *****************************************************************************
+// setup and cleanup
+
+static pthread_mutex_t setup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t setup_cond = PTHREAD_COND_INITIALIZER;
+static int setup_pending;
+static int setup_errors;
+
+static void setup_completion(int rc, const void *data) {
+    pthread_mutex_lock(&setup_lock);
+    if (rc != ZOK) {
+        setup_errors++;
+    }
+    setup_pending--;
+    pthread_cond_broadcast(&setup_cond);
+    pthread_mutex_unlock(&setup_lock);
+}
+
+static void setup_stat_completion(int rc, const struct Stat *stat,
+        const void *data) {
+    setup_completion(rc, data);
+}
+
+static void setup_create_completion(int rc, const char *value,
+        const void *data) {
+    const char *path = (const char *)data;
+    if (rc == ZNODEEXISTS) {
+        // reuse the key, but give it the value size of this run
+        if (zoo_aset(handles[0].zh, path, value_buffer, cfg.value_size, -1,
+                setup_stat_completion, 0) == ZOK) {
+            free((void *)path);
+            return;
+        }
+    }
+    free((void *)path);
+    setup_completion(rc, 0);
+}
+
+static int setup_keys() {
+    zhandle_t *zh = handles[0].zh;
+    char path[1024];
+    int rc;
+    int i;
+    rc = zoo_create(zh, cfg.root, "", 0, &ZOO_OPEN_ACL_UNSAFE, 0, 0, 0);
+    if (rc != ZOK && rc != ZNODEEXISTS)
+        return rc;
+    snprintf(path, sizeof(path), "%s/n", cfg.root);
+    rc = zoo_create(zh, path, "", 0, &ZOO_OPEN_ACL_UNSAFE, 0, 0, 0);
+    if (rc != ZOK && rc != ZNODEEXISTS)
+        return rc;
+    setup_pending = 0;
+    setup_errors = 0;
+    for (i = 0; i < cfg.keys; i++) {
+        snprintf(path, sizeof(path), "%s/k%d", cfg.root, i);
+        pthread_mutex_lock(&setup_lock);
+        // don't let the setup run away from the server
+        while (setup_pending >= 1000) {
+            pthread_cond_wait(&setup_cond, &setup_lock);
+        }
+        setup_pending++;
+        pthread_mutex_unlock(&setup_lock);
+        rc = zoo_acreate(zh, path, value_buffer, cfg.value_size,
+                &ZOO_OPEN_ACL_UNSAFE, 0, setup_create_completion, strdup(path));
+        if (rc != ZOK)
+            return rc;
+    }
+    pthread_mutex_lock(&setup_lock);
+    while (setup_pending > 0) {
+        pthread_cond_wait(&setup_cond, &setup_lock);
+    }
+    pthread_mutex_unlock(&setup_lock);
+    return setup_errors == 0 ? ZOK : ZAPIERROR;
+}
+
+static int deleted_count;
+
+static int recursive_delete(zhandle_t *zh, const char *root) {
+    struct String_vector children;
+    int i;
+    int rc = zoo_get_children(zh, root, 0, &children);
+    if (rc != ZNONODE) {
+        if (rc != ZOK) {
+            LOG_ERROR(("Failed to get children of %s, rc=%d", root, rc));
+            return rc;
+        }
+        for (i = 0; i < children.count; i++) {
+            char node[2048];
+            snprintf(node, sizeof(node), "%s/%s", root, children.data[i]);
+            rc = recursive_delete(zh, node);
+            if (rc != ZOK) {
+                deallocate_String_vector(&children);
+                return rc;
+            }
+        }
+        deallocate_String_vector(&children);
+    }
+    rc = zoo_delete(zh, root, -1);
+    if (rc == ZOK) {
+        deleted_count++;
+    } else if (rc != ZNONODE) {
+        LOG_ERROR(("Failed to delete znode %s, rc=%d", root, rc));
+        return rc;
+    }
+    return ZOK;
+}
+
+// *****************************************************************************
+// reporting
+
+typedef struct op_report {
+    const char *name;
+    uint64_t count;
+    uint64_t errors;
+    double ops;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} op_report_t;
+
+static void make_report(op_report_t *r, const char *name,
+        const histogram_t *h, uint64_t errors, double secs) {
+    r->name = name;
+    r->count = h->count;
+    r->errors = errors;
+    r->ops = secs > 0 ? h->count / secs : 0;
+    r->p50 = hist_percentile(h, 0.50);
+    r->p99 = hist_percentile(h, 0.99);
+    r->p999 = hist_percentile(h, 0.999);
+    r->max = h->max;
+}
+
+static void print_text(const op_report_t *r, int count, double secs) {
+    int i;
+    printf("zkbench: %d handle(s), %d thread(s), %s, %.1fs measured\n",
+            cfg.handles, cfg.threads, cfg.rate > 0 ? "open loop" : "closed loop",
+            secs);
+    printf("%-9s %10s %8s %12s %10s %10s %10s %10s\n", "op", "count",
+            "errors", "ops/s", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+    for (i = 0; i < count; i++) {
+        printf("%-9s %10llu %8llu %12.1f %10llu %10llu %10llu %10llu\n",
+                r[i].name, (unsigned long long)r[i].count,
+                (unsigned long long)r[i].errors, r[i].ops,
+                (unsigned long long)r[i].p50, (unsigned long long)r[i].p99,
+                (unsigned long long)r[i].p999, (unsigned long long)r[i].max);
+    }
+}
+
+static void print_json_op(const op_report_t *r) {
+    printf("{\"count\":%llu,\"errors\":%llu,\"ops_per_sec\":%.1f,"
+            "\"p50_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu,\"max_us\":%llu}",
+            (unsigned long long)r->count, (unsigned long long)r->errors, r->ops,
+            (unsigned long long)r->p50, (unsigned long long)r->p99,
+            (unsigned long long)r->p999, (unsigned long long)r->max);
+}
+
+static void print_json(const op_report_t *r, int count, double secs) {
+    int i;
+    printf("{\"handles\":%d,\"threads\":%d,\"mode\":\"%s\",\"rate\":%.1f,"
+            "\"outstanding\":%d,\"value_size\":%d,\"keys\":%d,"
+            "\"warmup_s\":%.1f,\"duration_s\":%.3f,\"ops\":{",
+            cfg.handles, cfg.threads, cfg.rate > 0 ? "open" : "closed",
+            cfg.rate, cfg.outstanding, cfg.value_size, cfg.keys, cfg.warmup,
+            secs);
+    // the last report is the total
+    for (i = 0; i < count - 1; i++) {
+        printf("%s\"%s\":", i ? "," : "", r[i].name);
+        print_json_op(&r[i]);
+    }
+    printf("},\"total\":");
+    print_json_op(&r[count - 1]);
+    printf("}\n");
+}
+
+static void report() {
+    op_report_t reports[OP_COUNT + 1];
+    histogram_t *merged = calloc(OP_COUNT + 1, sizeof(histogram_t));
+    uint64_t errors[OP_COUNT + 1];
+    double secs = (measure_end - measure_start) / 1e9;
+    int count = 0;
+    int op;
+    int i;
+    memset(errors, 0, sizeof(errors));
+    for (i = 0; i < cfg.threads; i++) {
+        for (op = 0; op < OP_COUNT; op++) {
+            hist_merge(&merged[op], &threads[i].hist[op]);
+            hist_merge(&merged[OP_COUNT], &threads[i].hist[op]);
+            errors[op] += threads[i].errors[op];
+            errors[OP_COUNT] += threads[i].errors[op];
+        }
+    }
+    for (op = 0; op < OP_COUNT; op++) {
+        if (merged[op].count > 0 || errors[op] > 0) {
+            make_report(&reports[count++], op_names[op], &merged[op],
+                    errors[op], secs);
+        }
+    }
+    make_report(&reports[count++], "total", &merged[OP_COUNT],
+            errors[OP_COUNT], secs);
+    if (cfg.json) {
+        print_json(reports, count, secs);
+    } else {
+        print_text(reports, count, secs);
+    }
+    free(merged);
+}
+
+// *****************************************************************************
+
+static void usage(char *argv[]) {
+    fprintf(stderr, "USAGE:\t%s [options] zookeeper_host_list\n", argv[0]);
+    fprintf(stderr, "\t%s [options] --local\n", argv[0]);
+    fprintf(stderr,
+"  -p, --root PATH        znode the benchmark works under (default /zkbench)\n"
+"  -m, --mix SPEC         weighted op mix, e.g. get=80,set=15,create=5\n"
+"                         ops: get set create delete exists children\n"
+"                         (default get=100)\n"
+"  -s, --value-size N     bytes written by set and create (default 100)\n"
+"  -k, --keys N           znodes read and written by get/set/exists (default 1000)\n"
+"  -c, --handles N        zookeeper handles, shared round robin (default 1)\n"
+"  -t, --threads N        threads issuing requests (default 1)\n"
+"  -o, --outstanding N    requests in flight per thread: the closed loop\n"
+"                         concurrency, or the open loop backlog limit\n"
+"                         (default 1 closed loop, 1000 open loop)\n"
+"  -r, --rate N           open loop: total requests per second to schedule;\n"
+"                         closed loop if not given\n"
+"  -d, --duration SECS    measured run time (default 10)\n"
+"  -w, --warmup SECS      run time before measuring (default 2)\n"
+"  -j, --json             print the results as JSON\n"
+"      --clean            delete the root and everything under it, then exit\n"
+"  -L, --local            run against an in-process loopback server\n"
+"      --server-latency DIST\n"
+"                         delay of every loopback response in microseconds\n"
+"      --server-get-size DIST\n"
+"                         bytes returned by every loopback getData\n"
+"                         DIST is N, fixed:N, uniform:MIN-MAX or exp:MEAN\n");
+    exit(1);
+}
+
+static int parse_mix(const char *spec) {
+    char *copy = strdup(spec);
+    char *saveptr = 0;
+    char *item;
+    int op;
+    memset(cfg.mix, 0, sizeof(cfg.mix));
+    cfg.mix_total = 0;
+    for (item = strtok_r(copy, ",", &saveptr); item;
+            item = strtok_r(0, ",", &saveptr)) {
+        char *eq = strchr(item, '=');
+        int weight = 1;
+        if (eq) {
+            *eq = 0;
+            weight = atoi(eq + 1);
+        }
+        for (op = 0; op < OP_COUNT; op++) {
+            if (strcmp(item, op_names[op]) == 0)
+                break;
+        }
+        if (op == OP_COUNT || weight < 0) {
+            fprintf(stderr, "invalid op mix entry: %s\n", item);
+            free(copy);
+            return -1;
+        }
+        cfg.mix[op] += weight;
+        cfg.mix_total += weight;
+    }
+    free(copy);
+    return cfg.mix_total > 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    static struct option options[] = {
+        {"root", required_argument, 0, 'p'},
+        {"mix", required_argument, 0, 'm'},
+        {"value-size", required_argument, 0, 's'},
+        {"keys", required_argument, 0, 'k'},
+        {"handles", required_argument, 0, 'c'},
+        {"threads", required_argument, 0, 't'},
+        {"outstanding", required_argument, 0, 'o'},
+        {"rate", required_argument, 0, 'r'},
+        {"duration", required_argument, 0, 'd'},
+        {"warmup", required_argument, 0, 'w'},
+        {"json", no_argument, 0, 'j'},
+        {"clean", no_argument, 0, 'C'},
+        {"local", no_argument, 0, 'L'},
+        {"server-latency", required_argument, 0, 'D'},
+        {"server-get-size", required_argument, 0, 'G'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    int rc;
+    int i;
+    int stuck = 0;
+    loopback_server_t *server = 0;
+    char local_hosts[32];
+
+    cfg.root = "/zkbench";
+    cfg.value_size = 100;
+    cfg.keys = 1000;
+    cfg.handles = 1;
+    cfg.threads = 1;
+    cfg.outstanding = 0;
+    cfg.duration = 10;
+    cfg.warmup = 2;
+    parse_mix("get=100");
+    while ((opt = getopt_long(argc, argv, "p:m:s:k:c:t:o:r:d:w:jL", options,
+            0)) != -1) {
+        switch (opt) {
+        case 'p': cfg.root = optarg; break;
+        case 'm': if (parse_mix(optarg) != 0) usage(argv); break;
+        case 's': cfg.value_size = atoi(optarg); break;
+        case 'k': cfg.keys = atoi(optarg); break;
+        case 'c': cfg.handles = atoi(optarg); break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'o': cfg.outstanding = atoi(optarg); break;
+        case 'r': cfg.rate = atof(optarg); break;
+        case 'd': cfg.duration = atof(optarg); break;
+        case 'w': cfg.warmup = atof(optarg); break;
+        case 'j': cfg.json = 1; break;
+        case 'C': cfg.clean = 1; break;
+        case 'L': cfg.local = 1; break;
+        case 'D':
+            if (loopback_parse_dist(optarg, &cfg.server.latency) != 0)
+                usage(argv);
+            break;
+        case 'G':
+            if (loopback_parse_dist(optarg, &cfg.server.data_size) != 0)
+                usage(argv);
+            break;
+        default: usage(argv);
+        }
+    }
+    if (optind != argc - (cfg.local ? 0 : 1) || cfg.value_size < 0 || cfg.keys < 1 ||
+            cfg.handles < 1 || cfg.threads < 1 || cfg.outstanding < 0 ||
+            cfg.duration <= 0 || cfg.warmup < 0) {
+        usage(argv);
+    }
+    if (cfg.local) {
+        cfg.server.seed = (unsigned int)now_ns();
+        server = loopback_server_create(&cfg.server);
+        if (!server || loopback_server_start(server) != 0) {
+            perror("unable to start the loopback server");
+            return 1;
+        }
+        sprintf(local_hosts, "127.0.0.1:%d", loopback_server_port(server));
+        cfg.hosts = local_hosts;
+    } else {
+        cfg.hosts = argv[optind];
+    }
+    if (cfg.outstanding == 0) {
+        cfg.outstanding = cfg.rate > 0 ? 1000 : 1;
+    }
+
+    zoo_set_debug_level(ZOO_LOG_LEVEL_WARN);
+    value_buffer = malloc(cfg.value_size + 1);
+    memset(value_buffer, 'x', cfg.value_size);
+
+    handles = calloc(cfg.handles, sizeof(bench_handle_t));
+    for (i = 0; i < cfg.handles; i++) {
+        pthread_mutex_init(&handles[i].lock, 0);
+        pthread_cond_init(&handles[i].cond, 0);
+        handles[i].zh = zookeeper_init(cfg.hosts, listener, 10000, 0,
+                &handles[i], 0);
+        if (!handles[i].zh) {
+            fprintf(stderr, "zookeeper_init failed: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    for (i = 0; i < cfg.handles; i++) {
+        if (ensure_connected(&handles[i], 30) != ZOK) {
+            fprintf(stderr, "unable to connect to %s\n", cfg.hosts);
+            return 1;
+        }
+    }
+
+    if (cfg.clean) {
+        rc = recursive_delete(handles[0].zh, cfg.root);
+        fprintf(stderr, "deleted %d znodes under %s\n", deleted_count, cfg.root);
+        return rc == ZOK ? 0 : 1;
+    }
+
+    rc = setup_keys();
+    if (rc != ZOK) {
+        fprintf(stderr, "failed to set up %d keys under %s: %s\n", cfg.keys,
+                cfg.root, zerror(rc));
+        return 1;
+    }
+
+    threads = calloc(cfg.threads, sizeof(bench_thread_t));
+    measure_start = now_ns() + (uint64_t)(cfg.warmup * 1e9);
+    measure_end = measure_start + (uint64_t)(cfg.duration * 1e9);
+    for (i = 0; i < cfg.threads; i++) {
+        bench_thread_t *t = &threads[i];
+        int j;
+        t->id = i;
+        t->handle = &handles[i % cfg.handles];
+        t->seed = (unsigned int)(now_ns() ^ (i * 2654435761U));
+        pthread_mutex_init(&t->lock, 0);
+        pthread_cond_init(&t->cond, 0);
+        t->reqs = calloc(cfg.outstanding, sizeof(bench_req_t));
+        for (j = 0; j < cfg.outstanding; j++) {
+            t->reqs[j].thread = t;
+            t->reqs[j].next = t->free_reqs;
+            t->free_reqs = &t->reqs[j];
+        }
+        t->created_cap = 65536;
+        t->created = calloc(t->created_cap, sizeof(uint64_t));
+        pthread_create(&t->tid, 0, worker, t);
+    }
+    for (i = 0; i < cfg.threads; i++) {
+        pthread_join(threads[i].tid, 0);
+    }
+    for (i = 0; i < cfg.threads; i++) {
+        stuck += wait_drained(&threads[i], 30);
+    }
+    if (stuck > 0) {
+        fprintf(stderr, "%d requests did not complete\n", stuck);
+    }
+    report();
+
+    for (i = 0; i < cfg.handles; i++) {
+        zookeeper_close(handles[i].zh);
+    }
+    if (server) {
+        loopback_server_stop(server);
+        loopback_server_destroy(server);
+    }
+    return stuck > 0 ? 1 : 0;
+}
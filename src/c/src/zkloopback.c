@@ -0,0 +1,96 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * zkloopback runs the in-memory loopback server on its own, so that cli_st,
+ * cli_mt, zkbench or an application can be pointed at it.
+ */
+
+#include "loopback_server.h"
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static loopback_server_t *server;
+
+static void on_signal(int sig)
+{
+    loopback_server_stop(server);
+}
+
+static void usage(char *argv[])
+{
+    fprintf(stderr, "USAGE:\t%s [options]\n", argv[0]);
+    fprintf(stderr,
+"  -p, --port N           port to listen on, 0 for any (default 2181)\n"
+"  -l, --latency DIST     delay of every response in microseconds\n"
+"  -g, --get-size DIST    bytes returned by every getData, whatever was stored\n"
+"  -S, --seed N           seed of the distributions\n"
+"  DIST is N, fixed:N, uniform:MIN-MAX or exp:MEAN\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option options[] = {
+        {"port", required_argument, 0, 'p'},
+        {"latency", required_argument, 0, 'l'},
+        {"get-size", required_argument, 0, 'g'},
+        {"seed", required_argument, 0, 'S'},
+        {0, 0, 0, 0}
+    };
+    loopback_options_t opts;
+    int opt;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.port = 2181;
+    opts.seed = (unsigned int)time(0);
+    while ((opt = getopt_long(argc, argv, "p:l:g:S:", options, 0)) != -1) {
+        switch (opt) {
+        case 'p': opts.port = atoi(optarg); break;
+        case 'l':
+            if (loopback_parse_dist(optarg, &opts.latency) != 0)
+                usage(argv);
+            break;
+        case 'g':
+            if (loopback_parse_dist(optarg, &opts.data_size) != 0)
+                usage(argv);
+            break;
+        case 'S': opts.seed = strtoul(optarg, 0, 10); break;
+        default: usage(argv);
+        }
+    }
+    if (optind != argc)
+        usage(argv);
+
+    server = loopback_server_create(&opts);
+    if (!server) {
+        perror("unable to listen");
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    printf("listening on 127.0.0.1:%d\n", loopback_server_port(server));
+    fflush(stdout);
+    loopback_server_run(server);
+    loopback_server_destroy(server);
+    return 0;
+}
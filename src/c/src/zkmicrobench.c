@@ -0,0 +1,532 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * zkmicrobench measures the client's hot paths in isolation: the recordio
+ * primitives, the generated jute codecs for typical requests and responses,
+ * and the watcher tables at 1k to 1M watches. Every case prints the time
+ * and the number of heap allocations per operation.
+ */
+
+#include <zookeeper.h>
+#include <proto.h>
+#include <recordio.h>
+#include "zk_adaptor.h"
+#include "zk_hashtable.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+// *****************************************************************************
+// allocation counting
+
+static uint64_t alloc_count;
+
+#ifdef __GLIBC__
+/* interpose the allocator, so allocations made inside libc (strdup) count */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+#define COUNTS_ALLOCATIONS 1
+#else
+#define COUNTS_ALLOCATIONS 0
+#endif
+
+// *****************************************************************************
+// the harness
+
+typedef struct bench {
+    const char *name;
+    uint64_t iters;         /* operations to run */
+    uint64_t start_ns;
+    uint64_t start_allocs;
+    uint64_t elapsed_ns;
+    uint64_t allocs;
+} bench_t;
+
+static double min_time = 0.2;
+static const char *filter;
+static int max_watches = 1000000;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_start(bench_t *b)
+{
+    b->start_allocs = alloc_count;
+    b->start_ns = now_ns();
+}
+
+static void bench_stop(bench_t *b)
+{
+    b->elapsed_ns += now_ns() - b->start_ns;
+    b->allocs += alloc_count - b->start_allocs;
+}
+
+static void report(const bench_t *b)
+{
+    char allocs[32] = "-";
+    if (COUNTS_ALLOCATIONS)
+        sprintf(allocs, "%.2f", (double)b->allocs / b->iters);
+    printf("%-44s %12llu %14.1f %12s\n", b->name,
+            (unsigned long long)b->iters, (double)b->elapsed_ns / b->iters,
+            allocs);
+}
+
+static int selected(const char *name)
+{
+    return !filter || strstr(name, filter);
+}
+
+/* runs fn with a growing number of iterations until it takes min_time */
+static void run(const char *name, void (*fn)(bench_t*, void*), void *arg)
+{
+    bench_t b;
+    uint64_t iters = 1;
+    if (!selected(name))
+        return;
+    for (;;) {
+        memset(&b, 0, sizeof(b));
+        b.name = name;
+        b.iters = iters;
+        fn(&b, arg);
+        if (b.elapsed_ns >= min_time * 1e9 || iters >= (1ULL << 40))
+            break;
+        if (b.elapsed_ns < 1000000)
+            iters *= 100;
+        else
+            iters = (uint64_t)(iters * (min_time * 1.2e9 / b.elapsed_ns)) + 1;
+    }
+    report(&b);
+}
+
+static volatile int sink;
+
+// *****************************************************************************
+// recordio and request encoding
+
+static void bench_oa_primitives(bench_t *b, void *arg)
+{
+    struct oarchive *oa = create_buffer_oarchive();
+    uint64_t i;
+    bench_start(b);
+    for (i = 0; i < b->iters; i++) {
+        int32_t v = (int32_t)i;
+        int64_t l = (int64_t)i << 20;
+        oa->serialize_Int(oa, "i", &v);
+        oa->serialize_Long(oa, "l", &l);
+        /* keep the buffer from growing without bound */
+        if ((i & 1023) == 1023) {
+            close_buffer_oarchive(&oa, 1);
+            oa = create_buffer_oarchive();
+        }
+    }
+    bench_stop(b);
+    close_buffer_oarchive(&oa, 1);
+}
+
+static void bench_encode_get_data(bench_t *b, void *arg)
+{
+    uint64_t i;
+    bench_start(b);
+    for (i = 0; i < b->iters; i++) {
+        struct oarchive *oa = create_buffer_oarchive();
+        struct RequestHeader h = { (int32_t)i, ZOO_GETDATA_OP };
+        struct GetDataRequest req = { (char*)"/zkmicrobench/key-0000001234", 1 };
+        serialize_RequestHeader(oa, "header", &h);
+        serialize_GetDataRequest(oa, "req", &req);
+        sink += get_buffer_len(oa);
+        close_buffer_oarchive(&oa, 1);
+    }
+    bench_stop(b);
+}
+
+static void bench_encode_set_data(bench_t *b, void *arg)
+{
+    static char value[1024];
+    uint64_t i;
+    bench_start(b);
+    for (i = 0; i < b->iters; i++) {
+        struct oarchive *oa = create_buffer_oarchive();
+        struct RequestHeader h = { (int32_t)i, ZOO_SETDATA_OP };
+        struct SetDataRequest req;
+        req.path = (char*)"/zkmicrobench/key-0000001234";
+        req.data.buff = value;
+        req.data.len = sizeof(value);
+        req.version = -1;
+        serialize_RequestHeader(oa, "header", &h);
+        serialize_SetDataRequest(oa, "req", &req);
+        sink += get_buffer_len(oa);
+        close_buffer_oarchive(&oa, 1);
+    }
+    bench_stop(b);
+}
+
+static void bench_encode_create(bench_t *b, void *arg)
+{
+    static char value[100];
+    uint64_t i;
+    bench_start(b);
+    for (i = 0; i < b->iters; i++) {
+        struct oarchive *oa = create_buffer_oarchive();
+        struct RequestHeader h = { (int32_t)i, ZOO_CREATE_OP };
+        struct CreateRequest req;
+        req.path = (char*)"/zkmicrobench/key-";
+        req.data.buff = value;
+        req.data.len = sizeof(value);
+        req.acl = ZOO_OPEN_ACL_UNSAFE;
+        req.flags = ZOO_SEQUENCE;
+        serialize_RequestHeader(oa, "header", &h);
+        serialize_CreateRequest(oa, "req", &req);
+        sink += get_buffer_len(oa);
+        close_buffer_oarchive(&oa, 1);
+    }
+    bench_stop(b);
+}
+
+// *****************************************************************************
+// response decoding
+
+typedef struct encoded {
+    char *buffer;
+    int len;
+} encoded_t;
+
+static void encode_get_data_response(encoded_t *e, int size)
+{
+    struct oarchive *oa = create_buffer_oarchive();
+    struct ReplyHeader h = { 1, 1000, ZOK };
+    struct GetDataResponse rsp;
+    memset(&rsp, 0, sizeof(rsp));
+    rsp.data.buff = calloc(1, size);
+    rsp.data.len = size;
+    rsp.stat.dataLength = size;
+    serialize_ReplyHeader(oa, "hdr", &h);
+    serialize_GetDataResponse(oa, "reply", &rsp);
+    e->len = get_buffer_len(oa);
+    e->buffer = get_buffer(oa);
+    close_buffer_oarchive(&oa, 0);
+    free(rsp.data.buff);
+}
+
+static void encode_children_response(encoded_t *e, int count)
+{
+    struct oarchive *oa = create_buffer_oarchive();
+    struct ReplyHeader h = { 1, 1000, ZOK };
+    struct GetChildren2Response rsp;
+    char name[32];
+    int i;
+    memset(&rsp, 0, sizeof(rsp));
+    rsp.children.count = count;
+    rsp.children.data = calloc(count, sizeof(char*));
+    for (i = 0; i < count; i++) {
+        sprintf(name, "lock-%010d", i);
+        rsp.children.data[i] = strdup(name);
+    }
+    serialize_ReplyHeader(oa, "hdr", &h);
+    serialize_GetChildren2Response(oa, "reply", &rsp);
+    e->len = get_buffer_len(oa);
+    e->buffer = get_buffer(oa);
+    close_buffer_oarchive(&oa, 0);
+    deallocate_GetChildren2Response(&rsp);
+}
+
+static void bench_decode_stat(bench_t *b, void *arg)
+{
+    encoded_t *e = arg;
+    uint64_t i;
+    bench_start(b);
+    for (i = 0; i < b->iters; i++) {
+        struct iarchive *ia = create_buffer_iarchive(e->buffer, e->len);
+        struct ReplyHeader h;
+        struct Stat stat;
+        deserialize_ReplyHeader(ia, "hdr", &h);
+        deserialize_Stat(ia, "stat", &stat);
+        sink += stat.version;
+        close_buffer_iarchive(&ia);
+    }
+    bench_stop(b);
+}
+
+static void bench_decode_get_data(bench_t *b, void *arg)
+{
+    encoded_t *e = arg;
+    uint64_t i;
+    bench_start(b);
+    for (i = 0; i < b->iters; i++) {
+        struct iarchive *ia = create_buffer_iarchive(e->buffer, e->len);
+        struct ReplyHeader h;
+        struct GetDataResponse rsp;
+        deserialize_ReplyHeader(ia, "hdr", &h);
+        deserialize_GetDataResponse(ia, "reply", &rsp);
+        sink += rsp.data.len;
+        deallocate_GetDataResponse(&rsp);
+        close_buffer_iarchive(&ia);
+    }
+    bench_stop(b);
+}
+
+static void bench_decode_children(bench_t *b, void *arg)
+{
+    encoded_t *e = arg;
+    uint64_t i;
+    bench_start(b);
+    for (i = 0; i < b->iters; i++) {
+        struct iarchive *ia = create_buffer_iarchive(e->buffer, e->len);
+        struct ReplyHeader h;
+        struct GetChildren2Response rsp;
+        deserialize_ReplyHeader(ia, "hdr", &h);
+        deserialize_GetChildren2Response(ia, "reply", &rsp);
+        sink += rsp.children.count;
+        deallocate_GetChildren2Response(&rsp);
+        close_buffer_iarchive(&ia);
+    }
+    bench_stop(b);
+}
+
+static void bench_decode_children_arena(bench_t *b, void *arg)
+{
+    encoded_t *e = arg;
+    zoo_arena_t *arena = zoo_arena_create(0);
+    uint64_t i;
+    bench_start(b);
+    for (i = 0; i < b->iters; i++) {
+        struct iarchive *ia = create_buffer_iarchive(e->buffer, e->len);
+        struct ReplyHeader h;
+        struct GetChildren2Response rsp;
+        ia->arena = arena;
+        deserialize_ReplyHeader(ia, "hdr", &h);
+        deserialize_GetChildren2Response(ia, "reply", &rsp);
+        sink += rsp.children.count;
+        close_buffer_iarchive(&ia);
+        zoo_arena_reset(arena);
+    }
+    bench_stop(b);
+    zoo_arena_destroy(arena);
+}
+
+// *****************************************************************************
+// watcher tables
+
+static void noop_watcher(zhandle_t *zh, int type, int state, const char *path,
+        void *ctx)
+{
+    sink++;
+}
+
+static zk_hashtable *node_table(zhandle_t *zh, int rc)
+{
+    return rc == ZOK ? zh->active_node_watchers : 0;
+}
+
+static zk_hashtable *child_table(zhandle_t *zh, int rc)
+{
+    return rc == ZOK ? zh->active_child_watchers : 0;
+}
+
+static char **make_paths(int count)
+{
+    char **paths = malloc(count * sizeof(char*));
+    char path[64];
+    int i;
+    for (i = 0; i < count; i++) {
+        sprintf(path, "/zkmicrobench/watched-%010d", i);
+        paths[i] = strdup(path);
+    }
+    return paths;
+}
+
+static void report_once(const char *name, int count, uint64_t ns,
+        uint64_t allocs)
+{
+    bench_t b;
+    memset(&b, 0, sizeof(b));
+    b.name = name;
+    b.iters = count;
+    b.elapsed_ns = ns;
+    b.allocs = allocs;
+    report(&b);
+}
+
+/*
+ * The watch tables only grow by activation and shrink by collection, so
+ * each size is measured by a single pass: activate N watches, walk them as
+ * a reconnect does, broadcast session events, then trigger every watch.
+ */
+static void bench_watches(int count)
+{
+    zhandle_t *zh = zookeeper_init("127.0.0.1:2181", 0, 10000, 0, 0, 0);
+    char **paths = make_paths(count);
+    char name[64];
+    uint64_t t0, a0;
+    int i, keys;
+
+    if (!zh) {
+        fprintf(stderr, "zookeeper_init failed\n");
+        exit(1);
+    }
+    /* the context tells the watchers apart: 16 distinct watcher objects */
+    t0 = now_ns(); a0 = alloc_count;
+    for (i = 0; i < count; i++) {
+        watcher_registration_t reg;
+        reg.watcher = noop_watcher;
+        reg.context = (void*)(intptr_t)(i & 15);
+        reg.checker = i & 1 ? child_table : node_table;
+        reg.path = paths[i];
+        activateWatcher(zh, &reg, ZOK);
+    }
+    sprintf(name, "watches/activate/%d", count);
+    if (selected(name))
+        report_once(name, count, now_ns() - t0, alloc_count - a0);
+
+    sprintf(name, "watches/collect_keys/%d", count);
+    if (selected(name)) {
+        char **list;
+        t0 = now_ns(); a0 = alloc_count;
+        list = collect_keys(zh->active_node_watchers, &keys);
+        report_once(name, 1, now_ns() - t0, alloc_count - a0);
+        for (i = 0; i < keys; i++)
+            free(list[i]);
+        free(list);
+    }
+
+    sprintf(name, "watches/session_event/%d", count);
+    if (selected(name)) {
+        int reps = 100;
+        t0 = now_ns(); a0 = alloc_count;
+        for (i = 0; i < reps; i++) {
+            watcher_object_list_t *list =
+                    collectWatchers(zh, ZOO_SESSION_EVENT, (char*)"");
+            deliverWatchers(zh, ZOO_SESSION_EVENT, ZOO_CONNECTING_STATE,
+                    (char*)"", &list);
+        }
+        report_once(name, reps, now_ns() - t0, alloc_count - a0);
+    }
+
+    t0 = now_ns(); a0 = alloc_count;
+    for (i = 0; i < count; i++) {
+        int type = i & 1 ? ZOO_CHILD_EVENT : ZOO_CHANGED_EVENT;
+        watcher_object_list_t *list = collectWatchers(zh, type, paths[i]);
+        deliverWatchers(zh, type, ZOO_CONNECTED_STATE, paths[i], &list);
+    }
+    sprintf(name, "watches/trigger/%d", count);
+    if (selected(name))
+        report_once(name, count, now_ns() - t0, alloc_count - a0);
+
+    for (i = 0; i < count; i++)
+        free(paths[i]);
+    free(paths);
+    zookeeper_close(zh);
+}
+
+// *****************************************************************************
+
+static void usage(char *argv[])
+{
+    fprintf(stderr, "USAGE:\t%s [options]\n", argv[0]);
+    fprintf(stderr,
+"  -f, --filter TEXT      run only the cases whose name contains TEXT\n"
+"  -t, --time SECS        minimum run time of each timed case (default 0.2)\n"
+"  -n, --max-watches N    largest watch table to measure (default 1000000)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option options[] = {
+        {"filter", required_argument, 0, 'f'},
+        {"time", required_argument, 0, 't'},
+        {"max-watches", required_argument, 0, 'n'},
+        {0, 0, 0, 0}
+    };
+    encoded_t stat_rsp, data_rsp_small, data_rsp_large;
+    encoded_t children_small, children_large;
+    int opt;
+    int count;
+
+    while ((opt = getopt_long(argc, argv, "f:t:n:", options, 0)) != -1) {
+        switch (opt) {
+        case 'f': filter = optarg; break;
+        case 't': min_time = atof(optarg); break;
+        case 'n': max_watches = atoi(optarg); break;
+        default: usage(argv);
+        }
+    }
+    if (optind != argc || min_time <= 0)
+        usage(argv);
+    zoo_set_debug_level(ZOO_LOG_LEVEL_ERROR);
+
+    encode_get_data_response(&stat_rsp, 0);
+    encode_get_data_response(&data_rsp_small, 100);
+    encode_get_data_response(&data_rsp_large, 64 * 1024);
+    encode_children_response(&children_small, 1000);
+    encode_children_response(&children_large, 100000);
+
+    printf("%-44s %12s %14s %12s\n", "case", "ops", "ns/op", "allocs/op");
+    run("recordio/oa_int_long", bench_oa_primitives, 0);
+    run("encode/get_data_request", bench_encode_get_data, 0);
+    run("encode/set_data_request/1024", bench_encode_set_data, 0);
+    run("encode/create_request/100", bench_encode_create, 0);
+    run("decode/reply_header_stat", bench_decode_stat, &stat_rsp);
+    run("decode/get_data_response/100", bench_decode_get_data,
+            &data_rsp_small);
+    run("decode/get_data_response/65536", bench_decode_get_data,
+            &data_rsp_large);
+    run("decode/get_children2_response/1000", bench_decode_children,
+            &children_small);
+    run("decode/get_children2_response/100000", bench_decode_children,
+            &children_large);
+    run("decode/get_children2_response_arena/1000",
+            bench_decode_children_arena, &children_small);
+    run("decode/get_children2_response_arena/100000",
+            bench_decode_children_arena, &children_large);
+    for (count = 1000; count <= max_watches; count *= 10)
+        bench_watches(count);
+
+    zoo_frame_free(stat_rsp.buffer);
+    zoo_frame_free(data_rsp_small.buffer);
+    zoo_frame_free(data_rsp_large.buffer);
+    zoo_frame_free(children_small.buffer);
+    zoo_frame_free(children_large.buffer);
+    return 0;
+}
@@ -28,8 +28,12 @@
 #include <zookeeper.jute.h>
 #include <proto.h>
 #include "zk_adaptor.h"
+#include "zk_probes.h"
+#include "zk_hotpaths.h"
+#include "zk_lz.h"
 #include "zookeeper_log.h"
 #include "zk_hashtable.h"
+#include "hashtable/hashtable.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -61,6 +65,10 @@
 #include <pwd.h>
 #endif
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define IF_DEBUG(x) if(logLevel==ZOO_LOG_LEVEL_DEBUG) {x;}
 
 const int ZOOKEEPER_WRITE = 1 << 0;
@@ -144,6 +152,9 @@ struct ACL_vector ZOO_CREATOR_ALL_ACL = { 1, _CREATOR_ALL_ACL_ACL};
 #define COMPLETION_MULTI 7
 #define COMPLETION_SASL 8
 
+/* server paths shorter than this are built on the caller's stack */
+#define PATH_BUFFER_SIZE 512
+
 typedef struct _auth_completion_list {
     void_completion_t completion;
     const char *auth_data;
@@ -173,8 +184,45 @@ typedef struct _completion_list {
     buffer_list_t *buffer;
     struct _completion_list *next;
     watcher_registration_t* watcher;
+    int op; /* the ZOO_*_OP type of the request */
+    int32_t bytes; /* the size of the serialized request */
+    char *path; /* the path of the request, or NULL */
+    int sampled; /* counted by the path profile */
+    int64_t queued; /* when the request was queued, in us */
+    int64_t dispatched; /* when the response was read, in us, or 0 */
+    /* the reads that joined this one, latest first */
+    struct _completion_list *followers;
+    int unpack; /* the value read may be compressed */
 } completion_list_t;
 
+/* an entry of zh->reads_in_flight: the request that identical reads join */
+typedef struct _read_in_flight {
+    int op;
+    const char *path; /* stored after the entry */
+    unsigned barrier; /* zh->read_barrier when the request was queued */
+    completion_list_t *leader;
+} read_in_flight_t;
+
+/* the coalescing window of a watcher, see zoo_set_watcher_coalescing */
+typedef struct _watch_window {
+    watcher_fn watcher;
+    void *context;
+    int window; /* ms */
+    struct _watch_window *next;
+} watch_window_t;
+
+/* the delivery to a watcher of the events of one type for one path */
+typedef struct _coalesced_watch {
+    zk_timer_t timer; /* ends the window */
+    watcher_fn watcher;
+    void *context;
+    int type;
+    char *path;
+    int count; /* the events merged into the delivery */
+    completion_list_t *c; /* the delivery, NULL once queued */
+    struct _coalesced_watch *next;
+} coalesced_watch_t;
+
 const char*err2string(int err);
 static int queue_session_event(zhandle_t *zh, int state);
 static const char* format_endpoint_info(const struct sockaddr_storage* ep);
@@ -199,10 +247,33 @@ static void queue_completion(completion_head_t *list, completion_list_t *c,
 static int handle_socket_error_msg(zhandle_t *zh, int line, int rc,
     const char* format,...);
 static void cleanup_bufs(zhandle_t *zh,int callCompletion,int rc);
+static int add_latency(zhandle_t *zh, zoo_latency_t *l, int64_t us,
+        int threshold);
+static int queue_request(zhandle_t *zh, const struct RequestHeader *h,
+        const char *path, struct oarchive *oa);
+static struct hashtable *create_reads_in_flight(void);
+static completion_list_t *take_followers(completion_list_t *cptr);
+static completion_list_t *detach_followers(zhandle_t *zh,
+        completion_list_t *cptr, buffer_list_t *bptr);
+static void answer_followers(zhandle_t *zh, completion_list_t *f, int rc);
+static void release_coalesced_watch(zhandle_t *zh, zk_timer_t *t);
+static void free_coalesced_watches(zhandle_t *zh);
+#if !defined(THREADED) && !defined(WIN32)
+static void io_fd_closing(zhandle_t *zh);
+#else
+#define io_fd_closing(zh)
+#endif
 
-static int disable_conn_permute=0; // permute enabled by default
+/* the i-th int of a serialized request header, for the probes */
+static inline int32_t header_int(const char *buffer, int i)
+{
+    int32_t v;
+    memcpy(&v, buffer + i * sizeof(v), sizeof(v));
+    return ntohl(v);
+}
 
-static __attribute__((unused)) void print_completion_queue(zhandle_t *zh);
+static int disable_conn_permute=0; // permute enabled by default
+static char *client_zone=0; // servers tagged with this zone are preferred
 
 static void *SYNCHRONOUS_MARKER = (void*)&SYNCHRONOUS_MARKER;
 static int isValidPath(const char* path, const int flags);
@@ -398,6 +469,7 @@ static void destroy(zhandle_t *zh)
         zh->hostname = NULL;
     }
     if (zh->fd != -1) {
+        io_fd_closing(zh);
         close(zh->fd);
         zh->fd = -1;
         zh->state = 0;
@@ -406,6 +478,10 @@ static void destroy(zhandle_t *zh)
         free(zh->addrs);
         zh->addrs = NULL;
     }
+    if (zh->addr_stats != 0) {
+        free(zh->addr_stats);
+        zh->addr_stats = NULL;
+    }
 
     if (zh->chroot != 0) {
         free(zh->chroot);
@@ -416,6 +492,15 @@ static void destroy(zhandle_t *zh)
     destroy_zk_hashtable(zh->active_node_watchers);
     destroy_zk_hashtable(zh->active_exist_watchers);
     destroy_zk_hashtable(zh->active_child_watchers);
+    destroy_zk_watcher_registry(zh->watcher_registry);
+    zoo_arena_destroy(zh->completion_arena);
+    zk_hotpaths_destroy(zh->hotpaths);
+    zh->hotpaths = NULL;
+    if (zh->reads_in_flight) {
+        hashtable_destroy(zh->reads_in_flight, 0);
+        zh->reads_in_flight = NULL;
+    }
+    free_coalesced_watches(zh);
 }
 
 static void setup_random()
@@ -434,6 +519,12 @@ static void setup_random()
 #endif
 }
 
+long int zk_random(void)
+{
+    setup_random();
+    return random();
+}
+
 #ifndef __CYGWIN__
 /**
  * get the errno from the return code 
@@ -456,11 +547,49 @@ static int getaddrinfo_errno(int rc) {
 }
 #endif
 
+static int resolve_addrs(zhandle_t *zh, int first_addr);
+
 /**
  * fill in the addrs array of the zookeeper servers in the zhandle. after filling
  * them in, we will permute them for load balancing.
  */
 int getaddrs(zhandle_t *zh)
+{
+    return resolve_addrs(zh, -1);
+}
+
+static void swap_addrs(zhandle_t *zh, int i, int j)
+{
+    struct sockaddr_storage t = zh->addrs[i];
+    struct server_stats ts = zh->addr_stats[i];
+    zh->addrs[i] = zh->addrs[j];
+    zh->addrs[j] = t;
+    zh->addr_stats[i] = zh->addr_stats[j];
+    zh->addr_stats[j] = ts;
+}
+
+/* rotates the addresses in [begin, end) to start at begin + shift */
+static void rotate_addrs(zhandle_t *zh, int begin, int end, int shift)
+{
+    int i, j;
+    if (end - begin < 2 || (shift %= end - begin) == 0)
+        return;
+    for (i = begin, j = begin + shift - 1; i < j; i++, j--)
+        swap_addrs(zh, i, j);
+    for (i = begin + shift, j = end - 1; i < j; i++, j--)
+        swap_addrs(zh, i, j);
+    for (i = begin, j = end - 1; i < j; i++, j--)
+        swap_addrs(zh, i, j);
+}
+
+/**
+ * fill in the addrs array. If first_addr is not negative the addresses are
+ * kept in the order of the host list, rotated to start at the first_addr-th
+ * one (modulo their count), otherwise they are permuted unless zoo_deterministic_conn_order() was
+ * called. Either way the addresses of the servers in the client's zone come
+ * first.
+ */
+static int resolve_addrs(zhandle_t *zh, int first_addr)
 {
     char *hosts = strdup(zh->hostname);
     char *host;
@@ -469,12 +598,18 @@ int getaddrs(zhandle_t *zh)
     int i;
     int rc;
     int alen = 0; /* the allocated length of the addrs array */
+    int slen = 0; /* the allocated length of the addr_stats array */
+    int nlocal = 0;
 
     zh->addrs_count = 0;
     if (zh->addrs) {
         free(zh->addrs);
         zh->addrs = 0;
     }
+    if (zh->addr_stats) {
+        free(zh->addr_stats);
+        zh->addr_stats = 0;
+    }
     if (!hosts) {
          LOG_ERROR(("out of memory"));
         errno=ENOMEM;
@@ -483,9 +618,17 @@ int getaddrs(zhandle_t *zh)
     zh->addrs = 0;
     host=strtok_r(hosts, ",", &strtok_last);
     while(host) {
-        char *port_spec = strrchr(host, ':');
+        char *zone = strchr(host, '@');
+        char *port_spec;
         char *end_port_spec;
         int port;
+        int local = 0;
+        int first = zh->addrs_count;
+        if (zone) {
+            *zone++ = '\0';
+            local = client_zone && strcmp(zone, client_zone) == 0;
+        }
+        port_spec = strrchr(host, ':');
         if (!port_spec) {
             LOG_ERROR(("no port in %s", host));
             errno=EINVAL;
@@ -555,7 +698,6 @@ int getaddrs(zhandle_t *zh)
                          addr->ss_family, zh->hostname));
             }
         }
-        host = strtok_r(0, ",", &strtok_last);
         }
 #else
         {
@@ -632,31 +774,62 @@ int getaddrs(zhandle_t *zh)
         }
 
         freeaddrinfo(res0);
-
-        host = strtok_r(0, ",", &strtok_last);
         }
 #endif
+        if (slen < alen) {
+            void *tmpstats = realloc(zh->addr_stats, sizeof(*zh->addr_stats)*alen);
+            if (tmpstats == 0) {
+                LOG_ERROR(("out of memory"));
+                errno=ENOMEM;
+                rc=ZSYSTEMERROR;
+                goto fail;
+            }
+            zh->addr_stats=tmpstats;
+            slen = alen;
+        }
+        for (i = first; i < zh->addrs_count; i++) {
+            memset(&zh->addr_stats[i], 0, sizeof(zh->addr_stats[i]));
+            zh->addr_stats[i].local = local;
+        }
+        host = strtok_r(0, ",", &strtok_last);
     }
     free(hosts);
+    hosts = 0;
 
-    if(!disable_conn_permute){
+    if(first_addr < 0 && !disable_conn_permute){
         setup_random();
         /* Permute */
         for (i = zh->addrs_count - 1; i > 0; --i) {
             long int j = random()%(i+1);
             if (i != j) {
-                struct sockaddr_storage t = zh->addrs[i];
-                zh->addrs[i] = zh->addrs[j];
-                zh->addrs[j] = t;
+                swap_addrs(zh, i, j);
             }
         }
     }
+    /* Move the servers of the client's zone to the front, keeping the order */
+    for (i = 0; i < zh->addrs_count; i++) {
+        if (zh->addr_stats[i].local) {
+            int j;
+            for (j = i; j > nlocal; j--) {
+                swap_addrs(zh, j, j - 1);
+            }
+            nlocal++;
+        }
+    }
+    if (first_addr >= 0) {
+        rotate_addrs(zh, 0, nlocal, first_addr);
+        rotate_addrs(zh, nlocal, zh->addrs_count, first_addr);
+    }
     return ZOK;
 fail:
     if (zh->addrs) {
         free(zh->addrs);
         zh->addrs=0;
     }
+    if (zh->addr_stats) {
+        free(zh->addr_stats);
+        zh->addr_stats=0;
+    }
     if (hosts) {
         free(hosts);
     }
@@ -758,6 +931,14 @@ static void log_env() {
  */
 zhandle_t *zookeeper_init(const char *host, watcher_fn watcher,
   int recv_timeout, const clientid_t *clientid, void *context, int flags)
+{
+    return zookeeper_init_at(host, watcher, recv_timeout, clientid, context,
+            flags, -1);
+}
+
+zhandle_t *zookeeper_init_at(const char *host, watcher_fn watcher,
+  int recv_timeout, const clientid_t *clientid, void *context, int flags,
+  int first_addr)
 {
     int errnosave = 0;
     zhandle_t *zh = NULL;
@@ -803,10 +984,12 @@ zhandle_t *zookeeper_init(const char *host, watcher_fn watcher,
     //available
     index_chroot = strchr(host, '/');
     if (index_chroot) {
-        zh->chroot = strdup(index_chroot);
         // if chroot is just / set it to null
-        if (strlen(zh->chroot) == 1) {
+        if (strlen(index_chroot) == 1) {
             zh->chroot = NULL;
+        } else {
+            zh->chroot = strdup(index_chroot);
+            zh->chroot_len = strlen(zh->chroot);
         }
         // cannot use strndup so allocate and strcpy
         zh->hostname = (char *) malloc(index_chroot - host + 1);
@@ -825,10 +1008,11 @@ zhandle_t *zookeeper_init(const char *host, watcher_fn watcher,
     if (zh->hostname == 0) {
         goto abort;
     }
-    if(getaddrs(zh)!=0) {
+    if(resolve_addrs(zh, first_addr)!=0) {
         goto abort;
     }
     zh->connect_index = 0;
+    zh->rebalance_index = -1;
     if (clientid) {
         memcpy(&zh->client_id, clientid, sizeof(zh->client_id));
     } else {
@@ -839,11 +1023,20 @@ zhandle_t *zookeeper_init(const char *host, watcher_fn watcher,
     zh->primer_buffer.len = sizeof(zh->primer_storage_buffer);
     zh->primer_buffer.next = 0;
     zh->last_zxid = 0;
-    zh->next_deadline.tv_sec=zh->next_deadline.tv_usec=0;
-    zh->socket_readable.tv_sec=zh->socket_readable.tv_usec=0;
+    zh->next_deadline = 0;
+    zh->socket_readable = 0;
+    zh->lag_threshold = ZOO_DEFAULT_LAG_THRESHOLD;
+    zh->callback_threshold = ZOO_DEFAULT_CALLBACK_THRESHOLD;
+#if !defined(THREADED) && !defined(WIN32)
+    zh->io_fd = -1;
+    zh->io_deadline = -1;
+#endif
+    zk_timer_wheel_init(&zh->timers, zk_clock_us() / 1000);
     zh->active_node_watchers=create_zk_hashtable();
     zh->active_exist_watchers=create_zk_hashtable();
     zh->active_child_watchers=create_zk_hashtable();
+    zh->watcher_registry=create_zk_watcher_registry();
+    zh->completion_arena=zoo_arena_create(0);
 
     if (adaptor_init(zh) == -1) {
         goto abort;
@@ -859,52 +1052,64 @@ abort:
 }
 
 /**
- * deallocated the free_path only its beeen allocated
- * and not equal to path
+ * deallocates the free_path only if it has been allocated on the heap,
+ * that is if it is neither the path itself nor the caller's path buffer
  */
-void free_duplicate_path(const char *free_path, const char* path) {
-    if (free_path != path) {
+static void free_duplicate_path(const char *free_path, const char* path,
+        const char *path_buf) {
+    if (free_path != path && free_path != path_buf) {
         free((void*)free_path);
     }
 }
 
 /**
-  prepend the chroot path if available else return the path
+  prepend the chroot path if available else return the path. The server path
+  is built in path_buf, a PATH_BUFFER_SIZE buffer owned by the caller, and is
+  only allocated if it doesn't fit there
 */
-static char* prepend_string(zhandle_t *zh, const char* client_path) {
+static char* prepend_string(zhandle_t *zh, const char* client_path,
+        char *path_buf) {
     char *ret_str;
-    if (zh->chroot == NULL)
+    size_t len;
+    if (zh == NULL || zh->chroot == NULL || client_path == NULL)
         return (char *) client_path;
+    len = strlen(client_path);
     // handle the chroot itself, client_path = "/"
-    if (strlen(client_path) == 1) {
-        return strdup(zh->chroot);
+    if (len == 1) {
+        len = 0;
+    }
+    if (zh->chroot_len + len < PATH_BUFFER_SIZE) {
+        ret_str = path_buf;
+    } else {
+        ret_str = (char *) malloc(zh->chroot_len + len + 1);
+        if (ret_str == NULL)
+            return NULL;
     }
-    ret_str = (char *) malloc(strlen(zh->chroot) + strlen(client_path) + 1);
-    strcpy(ret_str, zh->chroot);
-    return strcat(ret_str, client_path);
+    memcpy(ret_str, zh->chroot, zh->chroot_len);
+    memcpy(ret_str + zh->chroot_len, client_path, len);
+    ret_str[zh->chroot_len + len] = '\0';
+    return ret_str;
 }
 
 /**
    strip off the chroot string from the server path
-   if there is one else return the exact path
+   if there is one else return the exact path. The client path
+   points into the server path, so there is nothing to free
  */
-char* sub_string(zhandle_t *zh, const char* server_path) {
-    char *ret_str;
+const char* sub_string(zhandle_t *zh, const char* server_path) {
     if (zh->chroot == NULL)
-        return (char *) server_path;
+        return server_path;
     //ZOOKEEPER-1027
-    if (strncmp(server_path, zh->chroot, strlen(zh->chroot)) != 0) {
+    if (strncmp(server_path, zh->chroot, zh->chroot_len) != 0) {
         LOG_ERROR(("server path %s does not include chroot path %s",
                    server_path, zh->chroot));
-        return (char *) server_path;
+        return server_path;
     }
-    if (strlen(server_path) == strlen(zh->chroot)) {
+    if (server_path[zh->chroot_len] == '\0') {
         //return "/"
-        ret_str = strdup("/");
-        return ret_str;
+        return "/";
     }
-    ret_str = strdup(server_path + strlen(zh->chroot));
-    return ret_str;
+    return server_path + zh->chroot_len;
 }
 
 static buffer_list_t *allocate_buffer(char *buff, int len)
@@ -920,14 +1125,28 @@ static buffer_list_t *allocate_buffer(char *buff, int len)
     return buffer;
 }
 
+static buffer_list_t *copy_buffer(const buffer_list_t *b)
+{
+    buffer_list_t *copy;
+    char *buff = zoo_frame_alloc(b->len);
+    if (!buff)
+        return 0;
+    memcpy(buff, b->buffer, b->len);
+    copy = allocate_buffer(buff, b->len);
+    if (!copy) {
+        zoo_frame_free(buff);
+        return 0;
+    }
+    copy->curr_offset = b->curr_offset;
+    return copy;
+}
+
 static void free_buffer(buffer_list_t *b)
 {
     if (!b) {
         return;
     }
-    if (b->buffer) {
-        free(b->buffer);
-    }
+    zoo_frame_free(b->buffer);
     free(b);
 }
 
@@ -1101,7 +1320,7 @@ static int recv_buffer(int fd, buffer_list_t *buff)
         off = buff->curr_offset;
         if (buff->curr_offset == sizeof(buff->len)) {
             buff->len = ntohl(buff->len);
-            buff->buffer = calloc(1, buff->len);
+            buff->buffer = zoo_frame_alloc(buff->len);
         }
     }
     if (buff->buffer) {
@@ -1146,11 +1365,25 @@ void free_completions(zhandle_t *zh,int callCompletion,int reason)
     tmp_list = zh->sent_requests;
     zh->sent_requests.head = 0;
     zh->sent_requests.last = 0;
+    /* no read can join the requests taken off anymore */
+    if (zh->reads_in_flight) {
+        hashtable_destroy(zh->reads_in_flight, 0);
+        zh->reads_in_flight = create_reads_in_flight();
+    }
     unlock_completion_list(&zh->sent_requests);
     while (tmp_list.head) {
         completion_list_t *cptr = tmp_list.head;
+        completion_list_t *f = take_followers(cptr);
 
         tmp_list.head = cptr->next;
+        /* the reads that joined the request fail along with it */
+        if (f) {
+            completion_list_t *last = f;
+            while (last->next)
+                last = last->next;
+            last->next = tmp_list.head;
+            tmp_list.head = f;
+        }
         if (cptr->c.data_result == SYNCHRONOUS_MARKER) {
             struct sync_completion
                         *sc = (struct sync_completion*)cptr->data;
@@ -1217,8 +1450,11 @@ static void cleanup_bufs(zhandle_t *zh,int callCompletion,int rc)
     }
 }
 
+static void next_server(zhandle_t *zh);
+
 static void handle_error(zhandle_t *zh,int rc)
 {
+    io_fd_closing(zh);
     close(zh->fd);
     if (is_unrecoverable(zh)) {
         LOG_DEBUG(("Calling a watcher for a ZOO_SESSION_EVENT and the state=%s",
@@ -1230,12 +1466,17 @@ static void handle_error(zhandle_t *zh,int rc)
     }
     cleanup_bufs(zh,1,rc);
     zh->fd = -1;
-    zh->connect_index++;
+    zk_timer_cancel(&zh->recv_timer);
+    zk_timer_cancel(&zh->ping_timer);
+    zk_timer_cancel(&zh->request_timer);
+    zk_timer_cancel(&zh->rebalance_timer);
+    next_server(zh);
     if (!is_unrecoverable(zh)) {
         zh->state = 0;
     }
     if (process_async(zh->outstanding_sync)) {
         process_completions(zh);
+        zh->now_fresh = 0;
     }
 }
 
@@ -1307,6 +1548,10 @@ static int send_info_packet(zhandle_t *zh, auth_info* auth) {
     req.scheme = auth->scheme;
     req.auth = auth->auth;
     rc = rc < 0 ? rc : serialize_AuthPacket(oa, "req", &req);
+    /* the reads issued next may be allowed more */
+    lock_completion_list(&zh->sent_requests);
+    zh->read_barrier++;
+    unlock_completion_list(&zh->sent_requests);
     /* add this buffer to the head of the send queue */
     rc = rc < 0 ? rc : queue_front_buffer_bytes(&zh->to_send, get_buffer(oa),
             get_buffer_len(oa));
@@ -1489,17 +1734,6 @@ static int prime_connection(zhandle_t *zh)
     return ZOK;
 }
 
-static inline int calculate_interval(const struct timeval *start,
-        const struct timeval *end)
-{
-    int interval;
-    struct timeval i = *end;
-    i.tv_sec -= start->tv_sec;
-    i.tv_usec -= start->tv_usec;
-    interval = i.tv_sec * 1000 + (i.tv_usec/1000);
-    return interval;
-}
-
 static struct timeval get_timeval(int interval)
 {
     struct timeval tv;
@@ -1511,6 +1745,165 @@ static struct timeval get_timeval(int interval)
     return tv;
 }
 
+/* the estimated round trip to a server in microseconds, 0 if unknown */
+static int server_latency(const struct server_stats *s)
+{
+    return s->rtt ? s->rtt : s->handshake / 2;
+}
+
+/* a server is better than another one if it is in the client's zone, or
+ * noticeably faster */
+static int better_server(const struct server_stats *a,
+        const struct server_stats *b)
+{
+    int la = server_latency(a);
+    int lb = server_latency(b);
+    if (a->local != b->local)
+        return a->local;
+    if (la == 0)
+        return 0;
+    return lb == 0 || la + la/4 + 100 < lb;
+}
+
+/*
+ * Picks the server to connect to after the current connection failed or was
+ * given up, setting connect_index to addrs_count once every server was tried.
+ */
+static void next_server(zhandle_t *zh)
+{
+    struct server_stats *cur;
+    int i, best = -1;
+
+    if (zh->connect_index >= zh->addrs_count)
+        return;
+    cur = &zh->addr_stats[zh->connect_index];
+    cur->tried = 1;
+    if (zh->rebalance_index >= 0) {
+        zh->connect_index = zh->rebalance_index;
+        zh->rebalance_index = -1;
+        return;
+    }
+    cur->failures++;
+    cur->failed_at = zh->now / 1000;
+    if (zh->server_selection != ZOO_SELECT_LATENCY) {
+        zh->connect_index++;
+        return;
+    }
+    for (i = 0; i < zh->addrs_count; i++) {
+        if (zh->addr_stats[i].tried)
+            continue;
+        if (best < 0 || better_server(&zh->addr_stats[i], &zh->addr_stats[best]))
+            best = i;
+    }
+    zh->connect_index = best < 0 ? zh->addrs_count : best;
+}
+
+/* Records the handshake that just completed on the current server */
+static void record_handshake(zhandle_t *zh)
+{
+    struct server_stats *cur = &zh->addr_stats[zh->connect_index];
+    int i;
+    cur->handshake = (int)(zh->now - zh->connect_start);
+    if (cur->handshake <= 0)
+        cur->handshake = 1;
+    cur->failures = 0;
+    for (i = 0; i < zh->addrs_count; i++)
+        zh->addr_stats[i].tried = 0;
+    zh->connected_at = zh->now / 1000;
+}
+
+static void record_rtt(zhandle_t *zh, int rtt)
+{
+    struct server_stats *cur = &zh->addr_stats[zh->connect_index];
+    if (rtt <= 0)
+        rtt = 1;
+    cur->rtt = cur->rtt ? (cur->rtt*7 + rtt)/8 : rtt;
+}
+
+/* Starts over once every server was tried */
+static void reset_servers(zhandle_t *zh)
+{
+    int i;
+    for (i = 0; i < zh->addrs_count; i++)
+        zh->addr_stats[i].tried = 0;
+    zh->connect_index = 0;
+    if (zh->server_selection == ZOO_SELECT_LATENCY) {
+        for (i = 1; i < zh->addrs_count; i++) {
+            if (better_server(&zh->addr_stats[i],
+                        &zh->addr_stats[zh->connect_index]))
+                zh->connect_index = i;
+        }
+    }
+}
+
+/*
+ * Returns a healthy server at least twice as fast as the current one, or in
+ * the client's zone if the current one is not, or -1.
+ */
+static int faster_server(zhandle_t *zh, int64_t now)
+{
+    const struct server_stats *cur = &zh->addr_stats[zh->connect_index];
+    int cur_latency = server_latency(cur);
+    int i, best = -1;
+
+    for (i = 0; i < zh->addrs_count; i++) {
+        const struct server_stats *s = &zh->addr_stats[i];
+        int latency = server_latency(s);
+        if (i == zh->connect_index || latency == 0 || s->local < cur->local)
+            continue;
+        if (s->failures && now - s->failed_at < zh->rebalance_interval)
+            continue;
+        if ((s->local > cur->local || (cur_latency && latency*2 <= cur_latency))
+                && (best < 0 || better_server(s, &zh->addr_stats[best])))
+            best = i;
+    }
+    return best;
+}
+
+/* Moves the session to a faster server, if there is one and nothing is in
+ * flight */
+static int rebalance(zhandle_t *zh, int64_t now)
+{
+    int target;
+    if (zh->sent_requests.head || zh->to_send.head)
+        return ZOK;
+    target = faster_server(zh, now);
+    if (target < 0)
+        return ZOK;
+    LOG_INFO(("Moving the session from %s (%dus) to %s (%dus)",
+            format_current_endpoint_info(zh),
+            server_latency(&zh->addr_stats[zh->connect_index]),
+            format_endpoint_info(&zh->addrs[target]),
+            server_latency(&zh->addr_stats[target])));
+    zh->rebalance_index = target;
+    handle_error(zh, ZCONNECTIONLOSS);
+    return ZCONNECTIONLOSS;
+}
+
+/* Arms a timer unless it already expires by the deadline: a timer that
+ * expires early is simply armed again */
+static void arm_deadline(zhandle_t *zh, zk_timer_t *t, int64_t deadline)
+{
+    if (!zk_timer_armed(t) || t->expires > deadline)
+        zk_timer_arm(&zh->timers, t, deadline);
+}
+
+/* The time the oldest request in flight times out, or -1 if none is. The
+ * time spent connecting does not count. */
+static int64_t request_deadline(zhandle_t *zh)
+{
+    int64_t queued = -1;
+    lock_completion_list(&zh->sent_requests);
+    if (zh->sent_requests.head)
+        queued = zh->sent_requests.head->queued / 1000;
+    unlock_completion_list(&zh->sent_requests);
+    if (queued < 0)
+        return -1;
+    if (queued < zh->connected_at)
+        queued = zh->connected_at;
+    return queued + zh->request_timeout;
+}
+
  static int add_void_completion(zhandle_t *zh, int xid, void_completion_t dc,
      const void *data);
  static int add_string_completion(zhandle_t *zh, int xid,
@@ -1524,10 +1917,9 @@ static struct timeval get_timeval(int interval)
 
     rc = serialize_RequestHeader(oa, "header", &h);
     enter_critical(zh);
-    gettimeofday(&zh->last_ping, 0);
+    zh->last_ping = zh->now;
     rc = rc < 0 ? rc : add_void_completion(zh, h.xid, 0, 0);
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, 0, oa);
     leave_critical(zh);
     close_buffer_oarchive(&oa, 0);
     return rc<0 ? rc : adaptor_send_queue(zh, 0);
@@ -1544,18 +1936,37 @@ int zookeeper_interest(zhandle_t *zh, int *fd, int *interest,
      struct timeval *tv)
 {
 #endif
-    struct timeval now;
+    int64_t now, next;
+    zk_timer_t *expired;
+    int rebalance_due = 0;
     if(zh==0 || fd==0 ||interest==0 || tv==0)
         return ZBADARGUMENTS;
     if (is_unrecoverable(zh))
         return ZINVALIDSTATE;
-    gettimeofday(&now, 0);
-    if(zh->next_deadline.tv_sec!=0 || zh->next_deadline.tv_usec!=0){
-        int time_left = calculate_interval(&zh->next_deadline, &now);
-        if (time_left > 10)
-            LOG_WARN(("Exceeded deadline by %dms", time_left));
+    if (!zh->now_fresh)
+        zh->now = zk_clock_us();
+    zh->now_fresh = 0;
+    now = zh->now / 1000;
+    if (zh->next_deadline && now > zh->next_deadline &&
+            add_latency(zh, &zh->latency.wakeup_lag,
+                zh->now - zh->next_deadline * 1000, zh->lag_threshold)) {
+        LOG_WARN(("Exceeded deadline by %dms: the IO loop was held up",
+                    (int)(now - zh->next_deadline)));
     }
     api_prolog(zh);
+    /* the timers are armed lazily: each deadline below is checked against
+     * the time it is computed from whether or not its timer expired, and the
+     * timers only tell how long the caller can sleep */
+    expired = zk_timer_wheel_advance(&zh->timers, now);
+    while (expired) {
+        zk_timer_t *t = expired;
+        /* a released watch delivery may be made and freed right away */
+        expired = expired->next;
+        if (t == &zh->rebalance_timer)
+            rebalance_due = 1;
+        else if (zh->coalesced_watches)
+            release_coalesced_watch(zh, t);
+    }
     *fd = zh->fd;
     *interest = 0;
     tv->tv_sec = 0;
@@ -1563,7 +1974,9 @@ int zookeeper_interest(zhandle_t *zh, int *fd, int *interest,
     if (*fd == -1) {
         if (zh->connect_index == zh->addrs_count) {
             /* Wait a bit before trying again so that we don't spin */
-            zh->connect_index = 0;
+            reset_servers(zh);
+            zk_timer_arm(&zh->timers, &zh->connect_timer,
+                    now + zh->recv_timeout/3);
         }else {
             int rc;
 #ifdef WIN32
@@ -1573,6 +1986,8 @@ int zookeeper_interest(zhandle_t *zh, int *fd, int *interest,
 #endif
             int ssoresult;
 
+            zk_timer_cancel(&zh->connect_timer);
+            zh->connect_start = zh->now;
             zh->fd = socket(zh->addrs[zh->connect_index].ss_family, SOCK_STREAM, 0);
             if (zh->fd < 0) {
                 return api_epilog(zh,handle_socket_error_msg(zh,__LINE__,
@@ -1587,6 +2002,8 @@ int zookeeper_interest(zhandle_t *zh, int *fd, int *interest,
 #else
             fcntl(zh->fd, F_SETFL, O_NONBLOCK|fcntl(zh->fd, F_GETFL, 0));
 #endif
+            ZK_PROBE3(connect__start, zh, zh->connect_index,
+                    &zh->addrs[zh->connect_index]);
 #if defined(AF_INET6)
             if (zh->addrs[zh->connect_index].ss_family == AF_INET6) {
                 rc = connect(zh->fd, (struct sockaddr*) &zh->addrs[zh->connect_index], sizeof(struct sockaddr_in6));
@@ -1618,18 +2035,14 @@ int zookeeper_interest(zhandle_t *zh, int *fd, int *interest,
             }
         }
         *fd = zh->fd;
-        *tv = get_timeval(zh->recv_timeout/3);
         zh->last_recv = now;
         zh->last_send = now;
-        zh->last_ping = now;
+        zh->last_ping = zh->now;
     }
     if (zh->fd != -1) {
-        int idle_recv = calculate_interval(&zh->last_recv, &now);
-        int idle_send = calculate_interval(&zh->last_send, &now);
-        int recv_to = zh->recv_timeout*2/3 - idle_recv;
-        int send_to = zh->recv_timeout/3;
+        int64_t deadline = zh->last_recv + zh->recv_timeout*2/3;
         // have we exceeded the receive timeout threshold?
-        if (recv_to <= 0) {
+        if (deadline <= now) {
             // We gotta cut our losses and connect to someone else
 #ifdef WIN32
             errno = WSAETIMEDOUT;
@@ -1641,30 +2054,65 @@ int zookeeper_interest(zhandle_t *zh, int *fd, int *interest,
             *tv = get_timeval(0);
             return api_epilog(zh,handle_socket_error_msg(zh,
                     __LINE__,ZOPERATIONTIMEOUT,
-                    "connection timed out (exceeded timeout by %dms)",-recv_to));
+                    "connection timed out (exceeded timeout by %dms)",
+                    (int)(now - deadline)));
+        }
+        arm_deadline(zh, &zh->recv_timer, deadline);
+        if (zh->state==ZOO_CONNECTED_STATE && zh->request_timeout > 0) {
+            deadline = request_deadline(zh);
+            if (deadline < 0) {
+                zk_timer_cancel(&zh->request_timer);
+            } else if (deadline <= now) {
+#ifdef WIN32
+                errno = WSAETIMEDOUT;
+#else
+                errno = ETIMEDOUT;
+#endif
+                *fd=-1;
+                *interest=0;
+                *tv = get_timeval(0);
+                return api_epilog(zh,handle_socket_error_msg(zh,
+                        __LINE__,ZOPERATIONTIMEOUT,
+                        "request timed out (exceeded timeout by %dms)",
+                        (int)(now - deadline)));
+            } else {
+                arm_deadline(zh, &zh->request_timer, deadline);
+            }
+        }
+        if (zh->state==ZOO_CONNECTED_STATE && zh->rebalance_interval > 0) {
+            if (rebalance_due && rebalance(zh, now) != ZOK) {
+                /* reconnect right away */
+                *fd=-1;
+                *interest=0;
+                *tv = get_timeval(0);
+                return api_epilog(zh,ZOK);
+            }
+            if (!zk_timer_armed(&zh->rebalance_timer))
+                zk_timer_arm(&zh->timers, &zh->rebalance_timer,
+                        now + zh->rebalance_interval);
         }
         // We only allow 1/3 of our timeout time to expire before sending
         // a PING
         if (zh->state==ZOO_CONNECTED_STATE) {
-            send_to = zh->recv_timeout/3 - idle_send;
-            if (send_to <= 0 && zh->sent_requests.head==0) {
+            deadline = zh->last_send + zh->recv_timeout/3;
+            if (deadline <= now && zh->sent_requests.head==0) {
 //                LOG_DEBUG(("Sending PING to %s (exceeded idle by %dms)",
-//                                format_current_endpoint_info(zh),-send_to));
+//                                format_current_endpoint_info(zh),
+//                                (int)(now - deadline)));
                 int rc=send_ping(zh);
                 if (rc < 0){
                     LOG_ERROR(("failed to send PING request (zk retcode=%d)",rc));
                     return api_epilog(zh,rc);
                 }
-                send_to = zh->recv_timeout/3;
+                deadline = now + zh->recv_timeout/3;
+            }
+            if (deadline <= now) {
+                /* the PING is sent once the requests in flight are
+                 * answered, which wakes us up anyway */
+                zk_timer_cancel(&zh->ping_timer);
+            } else {
+                arm_deadline(zh, &zh->ping_timer, deadline);
             }
-        }
-        // choose the lesser value as the timeout
-        *tv = get_timeval(recv_to < send_to? recv_to:send_to);
-        zh->next_deadline.tv_sec = now.tv_sec + tv->tv_sec;
-        zh->next_deadline.tv_usec = now.tv_usec + tv->tv_usec;
-        if (zh->next_deadline.tv_usec > 1000000) {
-            zh->next_deadline.tv_sec += zh->next_deadline.tv_usec / 1000000;
-            zh->next_deadline.tv_usec = zh->next_deadline.tv_usec % 1000000;
         }
         *interest = ZOOKEEPER_READ;
         /* we are interested in a write if we are connected and have something
@@ -1674,6 +2122,14 @@ int zookeeper_interest(zhandle_t *zh, int *fd, int *interest,
             *interest |= ZOOKEEPER_WRITE;
         }
     }
+    // sleep until the earliest deadline
+    next = zk_timer_wheel_next(&zh->timers);
+    if (next >= 0) {
+        *tv = get_timeval(next > now ? (int)(next - now) : 0);
+        zh->next_deadline = next > now ? next : now;
+    } else {
+        zh->next_deadline = 0;
+    }
     return api_epilog(zh,ZOK);
 }
 
@@ -1719,7 +2175,7 @@ static int check_events(zhandle_t *zh, int events)
                 "failed while receiving a server response");
         }
         if (rc > 0) {
-            gettimeofday(&zh->last_recv, 0);
+            zh->last_recv = zh->now / 1000;
             if (zh->input_buffer != &zh->primer_buffer) {
                 queue_buffer(&zh->to_process, zh->input_buffer, 0);
             } else  {
@@ -1742,6 +2198,9 @@ static int check_events(zhandle_t *zh, int events)
                     memcpy(zh->client_id.passwd, &zh->primer_storage.passwd,
                            sizeof(zh->client_id.passwd));
                     zh->state = ZOO_CONNECTED_STATE;
+                    record_handshake(zh);
+                    ZK_PROBE4(handshake__done, zh, newid, zh->recv_timeout,
+                            (int)(zh->now - zh->connect_start));
                     LOG_INFO(("session establishment complete on server [%s], sessionId=%#llx, negotiated timeout=%d",
                               format_endpoint_info(&zh->addrs[zh->connect_index]),
                               newid, zh->recv_timeout));
@@ -1777,24 +2236,88 @@ int api_epilog(zhandle_t *zh,int rc)
     return rc;
 }
 
-static __attribute__((unused)) void print_completion_queue(zhandle_t *zh)
+static void add_request_info(zoo_inflight_t *inflight, int max_requests,
+        completion_list_t *c, int queue, int32_t bytes, int64_t age)
 {
-    completion_list_t* cptr;
+    zoo_queue_info_t *q = &inflight->queues[queue];
+    zoo_request_info_t *r;
+
+    q->count++;
+    q->bytes += bytes;
+    if (age > q->oldest_us)
+        q->oldest_us = age;
+    if (inflight->count == max_requests)
+        return;
+    r = &inflight->requests[inflight->count++];
+    r->xid = c->xid;
+    r->type = c->op;
+    r->queue = queue;
+    r->bytes = bytes;
+    r->age_us = age;
+    r->path = c->path ? strdup(c->path) : 0;
+}
 
-    if(logLevel<ZOO_LOG_LEVEL_DEBUG) return;
+int zoo_get_inflight(zhandle_t *zh, int max_requests, zoo_inflight_t *inflight)
+{
+    buffer_list_t *b;
+    completion_list_t *c;
+    int64_t now;
+    int unsent = 0, sent = 0;
+    int to_send_count = 0;
+    int64_t to_send_bytes = 0;
 
-    fprintf(LOGSTREAM,"Completion queue: ");
-    if (zh->sent_requests.head==0) {
-        fprintf(LOGSTREAM,"empty\n");
-        return;
+    if (zh == 0 || inflight == 0 || max_requests < 0)
+        return ZBADARGUMENTS;
+    memset(inflight, 0, sizeof(*inflight));
+    if (max_requests > 0) {
+        inflight->requests = calloc(max_requests, sizeof(*inflight->requests));
+        if (!inflight->requests)
+            return ZSYSTEMERROR;
     }
+    now = zk_clock_us();
+    /* the requests of the send queue are the last ones added to the sent
+     * requests, apart from the packets answered out of band */
+    lock_buffer_list(&zh->to_send);
+    for (b = zh->to_send.head; b; b = b->next) {
+        int xid = header_int(b->buffer, 0);
+        to_send_count++;
+        to_send_bytes += b->len;
+        if (xid != AUTH_XID && xid != SET_WATCHES_XID)
+            unsent++;
+    }
+    unlock_buffer_list(&zh->to_send);
+
+    lock_completion_list(&zh->sent_requests);
+    for (c = zh->sent_requests.head; c; c = c->next)
+        sent++;
+    for (c = zh->sent_requests.head; c; c = c->next, sent--) {
+        add_request_info(inflight, max_requests, c,
+                sent > unsent ? ZOO_REQUEST_SENT : ZOO_REQUEST_TO_SEND,
+                c->bytes, now - c->queued);
+    }
+    unlock_completion_list(&zh->sent_requests);
+    /* the send queue also holds the packets without a completion */
+    inflight->queues[ZOO_REQUEST_TO_SEND].count = to_send_count;
+    inflight->queues[ZOO_REQUEST_TO_SEND].bytes = to_send_bytes;
 
-    cptr=zh->sent_requests.head;
-    while(cptr){
-        fprintf(LOGSTREAM,"%d,",cptr->xid);
-        cptr=cptr->next;
+    lock_completion_list(&zh->completions_to_process);
+    for (c = zh->completions_to_process.head; c; c = c->next) {
+        int64_t since = c->queued ? c->queued : c->dispatched;
+        add_request_info(inflight, max_requests, c, ZOO_REQUEST_ANSWERED,
+                c->buffer ? c->buffer->len : 0, since ? now - since : 0);
     }
-    fprintf(LOGSTREAM,"end\n");
+    unlock_completion_list(&zh->completions_to_process);
+    return ZOK;
+}
+
+void zoo_free_inflight(zoo_inflight_t *inflight)
+{
+    int i;
+    for (i = 0; i < inflight->count; i++)
+        free(inflight->requests[i].path);
+    free(inflight->requests);
+    inflight->requests = 0;
+    inflight->count = 0;
 }
 
 //#ifdef THREADED
@@ -1807,6 +2330,7 @@ static int queue_session_event(zhandle_t *zh, int state)
     struct oarchive *oa;
     completion_list_t *cptr;
 
+    ZK_PROBE2(session__event, zh, state);
     if ((oa=create_buffer_oarchive())==NULL) {
         LOG_ERROR(("out of memory"));
         goto error;
@@ -1855,6 +2379,50 @@ completion_list_t *dequeue_completion(completion_head_t *list)
     return cptr;
 }
 
+/* points value at a copy compressed if the handle compresses values that
+ * large and it saves space, returning its length; the copy is to be freed
+ * with zoo_frame_free once serialized */
+static int pack_value(zhandle_t *zh, char **value, int len)
+{
+    char *packed;
+    int n;
+
+    if (zh->compress_min <= 0 || *value == 0 || len < zh->compress_min)
+        return len;
+    packed = zoo_frame_alloc(len);
+    if (!packed)
+        return len;
+    n = zk_lz_encode(*value, len, packed, len - 1);
+    if (n < 0) {
+        zoo_frame_free(packed);
+        return len;
+    }
+    *value = packed;
+    return n;
+}
+
+/* points value at a decompressed copy if it is compressed, to be freed
+ * with zoo_frame_free, returning -1 if out of memory */
+static int unpack_value(char **value, int *len)
+{
+    int size = zk_lz_size(*value, *len);
+    char *buff;
+
+    if (size < 0)
+        return 0;
+    buff = zoo_frame_alloc(size ? size : 1);
+    if (!buff)
+        return -1;
+    if (zk_lz_decode(*value, *len, buff, size) != size) {
+        /* a value of the application that looks like a compressed one */
+        zoo_frame_free(buff);
+        return 0;
+    }
+    *value = buff;
+    *len = size;
+    return 0;
+}
+
 static void process_sync_completion(
         completion_list_t *cptr,
         struct sync_completion *sc,
@@ -1868,11 +2436,16 @@ static void process_sync_completion(
     case COMPLETION_DATA: 
         if (sc->rc==0) {
             struct GetDataResponse res;
+            char *value;
             int len;
             deserialize_GetDataResponse(ia, "reply", &res);
-            if (res.data.len <= sc->u.data.buff_len) {
-                len = res.data.len;
-            } else {
+            value = res.data.buff;
+            len = res.data.len;
+            if (cptr->unpack && unpack_value(&value, &len) < 0) {
+                sc->rc = ZSYSTEMERROR;
+                len = 0;
+            }
+            if (len > sc->u.data.buff_len) {
                 len = sc->u.data.buff_len;
             }
             sc->u.data.buff_len = len;
@@ -1881,10 +2454,13 @@ static void process_sync_completion(
             if (len == -1) {
                 sc->u.data.buffer = NULL;
             } else {
-                memcpy(sc->u.data.buffer, res.data.buff, len);
+                memcpy(sc->u.data.buffer, value, len);
             }
+            if (value != res.data.buff)
+                zoo_frame_free(value);
             sc->u.data.stat = res.stat;
-            deallocate_GetDataResponse(&res);
+            if (!ia->arena)
+                deallocate_GetDataResponse(&res);
         }
         break;
     case COMPLETION_STAT:
@@ -1892,7 +2468,8 @@ static void process_sync_completion(
             struct SetDataResponse res;
             deserialize_SetDataResponse(ia, "reply", &res);
             sc->u.stat = res.stat;
-            deallocate_SetDataResponse(&res);
+            if (!ia->arena)
+                deallocate_SetDataResponse(&res);
         }
         break;
     case COMPLETION_STRINGLIST:
@@ -1922,15 +2499,16 @@ static void process_sync_completion(
             deserialize_CreateResponse(ia, "reply", &res);
             //ZOOKEEPER-1027
             client_path = sub_string(zh, res.path); 
-            len = strlen(client_path) + 1;if (len > sc->u.str.str_len) {
+            len = strlen(client_path) + 1;
+            if (len > sc->u.str.str_len) {
                 len = sc->u.str.str_len;
             }
             if (len > 0) {
                 memcpy(sc->u.str.str, client_path, len - 1);
                 sc->u.str.str[len - 1] = '\0';
             }
-            free_duplicate_path(client_path, res.path);
-            deallocate_CreateResponse(&res);
+            if (!ia->arena)
+                deallocate_CreateResponse(&res);
         }
         break;
     case COMPLETION_ACLLIST:
@@ -1964,7 +2542,8 @@ static void process_sync_completion(
             } else {
                 memcpy(sc->u.sasl.token, res.token.buff, len);
             }
-            deallocate_SetSASLResponse(&res);
+            if (!ia->arena)
+                deallocate_SetSASLResponse(&res);
         }
         break;
     default:
@@ -1973,6 +2552,29 @@ static void process_sync_completion(
     }
 }
 
+/*
+ * Waits for a synchronous request to complete and decodes the server
+ * response (if any) on the calling thread.
+ */
+static int wait_sync_result(zhandle_t *zh, struct sync_completion *sc)
+{
+    completion_list_t *cptr;
+    wait_sync_completion(sc);
+    cptr = sc->deferred;
+    if (cptr) {
+        struct ReplyHeader hdr;
+        struct iarchive *ia = create_buffer_iarchive(cptr->buffer->buffer,
+                cptr->buffer->len);
+        ia->arena = sc->arena;
+        deserialize_ReplyHeader(ia, "hdr", &hdr);
+        process_sync_completion(cptr, sc, ia, zh);
+        close_buffer_iarchive(&ia);
+        destroy_completion_entry(cptr);
+        sc->deferred = 0;
+    }
+    return sc->rc;
+}
+
 static int deserialize_multi(int xid, completion_list_t *cptr, struct iarchive *ia)
 {
     int rc = 0;
@@ -2010,10 +2612,19 @@ static void deserialize_response(int type, int xid, int failed, int rc, completi
             cptr->c.data_result(rc, 0, 0, 0, cptr->data);
         } else {
             struct GetDataResponse res;
+            char *value;
+            int len;
             deserialize_GetDataResponse(ia, "reply", &res);
-            cptr->c.data_result(rc, res.data.buff, res.data.len,
-                    &res.stat, cptr->data);
-            deallocate_GetDataResponse(&res);
+            value = res.data.buff;
+            len = res.data.len;
+            if (cptr->unpack && unpack_value(&value, &len) < 0)
+                cptr->c.data_result(ZSYSTEMERROR, 0, 0, 0, cptr->data);
+            else
+                cptr->c.data_result(rc, value, len, &res.stat, cptr->data);
+            if (value != res.data.buff)
+                zoo_frame_free(value);
+            if (!ia->arena)
+                deallocate_GetDataResponse(&res);
         }
         break;
     case COMPLETION_STAT:
@@ -2025,7 +2636,8 @@ static void deserialize_response(int type, int xid, int failed, int rc, completi
             struct SetDataResponse res;
             deserialize_SetDataResponse(ia, "reply", &res);
             cptr->c.stat_result(rc, &res.stat, cptr->data);
-            deallocate_SetDataResponse(&res);
+            if (!ia->arena)
+                deallocate_SetDataResponse(&res);
         }
         break;
     case COMPLETION_STRINGLIST:
@@ -2037,7 +2649,8 @@ static void deserialize_response(int type, int xid, int failed, int rc, completi
             struct GetChildrenResponse res;
             deserialize_GetChildrenResponse(ia, "reply", &res);
             cptr->c.strings_result(rc, &res.children, cptr->data);
-            deallocate_GetChildrenResponse(&res);
+            if (!ia->arena)
+                deallocate_GetChildrenResponse(&res);
         }
         break;
     case COMPLETION_STRINGLIST_STAT:
@@ -2049,7 +2662,8 @@ static void deserialize_response(int type, int xid, int failed, int rc, completi
             struct GetChildren2Response res;
             deserialize_GetChildren2Response(ia, "reply", &res);
             cptr->c.strings_stat_result(rc, &res.children, &res.stat, cptr->data);
-            deallocate_GetChildren2Response(&res);
+            if (!ia->arena)
+                deallocate_GetChildren2Response(&res);
         }
         break;
     case COMPLETION_STRING:
@@ -2061,7 +2675,8 @@ static void deserialize_response(int type, int xid, int failed, int rc, completi
             struct CreateResponse res;
             deserialize_CreateResponse(ia, "reply", &res);
             cptr->c.string_result(rc, res.path, cptr->data);
-            deallocate_CreateResponse(&res);
+            if (!ia->arena)
+                deallocate_CreateResponse(&res);
         }
         break;
     case COMPLETION_ACLLIST:
@@ -2073,7 +2688,8 @@ static void deserialize_response(int type, int xid, int failed, int rc, completi
             struct GetACLResponse res;
             deserialize_GetACLResponse(ia, "reply", &res);
             cptr->c.acl_result(rc, &res.acl, &res.stat, cptr->data);
-            deallocate_GetACLResponse(&res);
+            if (!ia->arena)
+                deallocate_GetACLResponse(&res);
         }
         break;
     case COMPLETION_VOID:
@@ -2107,7 +2723,8 @@ static void deserialize_response(int type, int xid, int failed, int rc, completi
             deserialize_SetSASLResponse(ia, "reply", &res);
             cptr->c.sasl_result(rc, sctx->zh, sctx->conn,
                     res.token.buff, res.token.len);
-            deallocate_SetSASLResponse(&res);
+            if (!ia->arena)
+                deallocate_SetSASLResponse(&res);
         }
         break;
     default:
@@ -2116,17 +2733,155 @@ static void deserialize_response(int type, int xid, int failed, int rc, completi
 }
 
 
+/* hands the events for the watchers with a coalescing window over to the
+ * deliveries of their own, merging those for the same watcher, type and
+ * path until the delivery is made. Returns whether other watchers are left
+ * for the event */
+static int coalesce_watchers(zhandle_t *zh, completion_list_t *c,
+        int type, const char *path)
+{
+    completion_list_t *ready = 0, *d;
+    watch_window_t *w;
+
+    lock_completion_list(&zh->completions_to_process);
+    for (w = zh->watch_windows; w; w = w->next) {
+        watcher_object_list_t *single = extractWatcher(c->c.watcher_result,
+                w->watcher, w->context);
+        coalesced_watch_t *e;
+        if (!single)
+            continue;
+        for (e = zh->coalesced_watches; e; e = e->next) {
+            if (e->watcher == w->watcher && e->context == w->context &&
+                    e->type == type && strcmp(e->path, path) == 0)
+                break;
+        }
+        if (e) {
+            e->count++;
+            discardWatchers(single);
+            continue;
+        }
+        e = calloc(1, sizeof(*e));
+        assert(e);
+        e->watcher = w->watcher;
+        e->context = w->context;
+        e->type = type;
+        e->path = strdup(path);
+        e->count = 1;
+        d = create_completion_entry(WATCHER_EVENT_XID, -1, 0, e, 0, 0);
+        assert(e->path && d);
+        d->buffer = copy_buffer(c->buffer);
+        assert(d->buffer);
+        d->c.watcher_result = single;
+        e->next = zh->coalesced_watches;
+        zh->coalesced_watches = e;
+        if (w->window > 0) {
+            e->c = d;
+            zk_timer_arm(&zh->timers, &e->timer, zh->now / 1000 + w->window);
+        } else {
+            d->dispatched = zh->now;
+            d->next = ready;
+            ready = d;
+        }
+    }
+    unlock_completion_list(&zh->completions_to_process);
+    while ((d = ready) != 0) {
+        ready = d->next;
+        queue_completion(&zh->completions_to_process, d, 0);
+    }
+    return hasWatchers(c->c.watcher_result);
+}
+
+/* queues the delivery whose window ended */
+static void release_coalesced_watch(zhandle_t *zh, zk_timer_t *t)
+{
+    completion_list_t *d = 0;
+    coalesced_watch_t *e;
+
+    lock_completion_list(&zh->completions_to_process);
+    for (e = zh->coalesced_watches; e; e = e->next) {
+        if (&e->timer == t) {
+            d = e->c;
+            e->c = 0;
+            break;
+        }
+    }
+    unlock_completion_list(&zh->completions_to_process);
+    if (d) {
+        d->dispatched = zh->now;
+        queue_completion(&zh->completions_to_process, d, 0);
+    }
+}
+
+/* ends the merging into a delivery about to be made, returning the number
+ * of events it stands for */
+static int take_coalesced_watch(zhandle_t *zh, coalesced_watch_t *e)
+{
+    coalesced_watch_t **pe;
+    int count;
+
+    lock_completion_list(&zh->completions_to_process);
+    for (pe = &zh->coalesced_watches; *pe != e; pe = &(*pe)->next)
+        ;
+    *pe = e->next;
+    count = e->count;
+    unlock_completion_list(&zh->completions_to_process);
+    free(e->path);
+    free(e);
+    return count;
+}
+
+static void free_coalesced_watches(zhandle_t *zh)
+{
+    while (zh->coalesced_watches) {
+        coalesced_watch_t *e = zh->coalesced_watches;
+        zh->coalesced_watches = e->next;
+        if (e->c) {
+            discardWatchers(e->c->c.watcher_result);
+            destroy_completion_entry(e->c);
+        }
+        free(e->path);
+        free(e);
+    }
+    while (zh->watch_windows) {
+        watch_window_t *w = zh->watch_windows;
+        zh->watch_windows = w->next;
+        free(w);
+    }
+}
+
 /* handles async completion (both single- and multithreaded) */
 void process_completions(zhandle_t *zh)
 {
-    completion_list_t *cptr;
-    while ((cptr = dequeue_completion(&zh->completions_to_process)) != 0) {
+    completion_list_t *cptr, *batch;
+    /* the results are decoded into the handle's arena, which is reset once
+     * the completion has returned. A nested call (a completion driving
+     * zookeeper_process) falls back to the heap */
+    zoo_arena_t *arena = zh->completion_arena;
+    zh->completion_arena = 0;
+    /* take the whole list in one go: the completions queued meanwhile are
+     * processed by the next call */
+    lock_completion_list(&zh->completions_to_process);
+    batch = zh->completions_to_process.head;
+    zh->completions_to_process.head = 0;
+    zh->completions_to_process.last = 0;
+    unlock_completion_list(&zh->completions_to_process);
+    while ((cptr = batch) != 0) {
         struct ReplyHeader hdr;
+        int64_t start, elapsed;
         buffer_list_t *bptr = cptr->buffer;
         struct iarchive *ia = create_buffer_iarchive(bptr->buffer,
                 bptr->len);
+        batch = cptr->next;
+        ia->arena = arena;
         deserialize_ReplyHeader(ia, "hdr", &hdr);
 
+        start = zk_clock_us();
+        if (cptr->dispatched && add_latency(zh, &zh->latency.queue_delay,
+                    start - cptr->dispatched, zh->lag_threshold)) {
+            LOG_WARN(("The response to xid=%#x waited %dms for the completion thread",
+                        hdr.xid, (int)((start - cptr->dispatched) / 1000)));
+        }
+        ZK_PROBE3(callback__begin, zh, hdr.xid, cptr->c.type);
         if (hdr.xid == WATCHER_EVENT_XID) {
             int type, state;
             struct WatcherEvent evt;
@@ -2138,13 +2893,58 @@ void process_completions(zhandle_t *zh)
             LOG_DEBUG(("Calling a watcher for node [%s], type = %d event=%s",
                        (evt.path==NULL?"NULL":evt.path), cptr->c.type,
                        watcherEvent2String(type)));
+            if (cptr->data)
+                zh->coalesced_events = take_coalesced_watch(zh,
+                        (coalesced_watch_t*)cptr->data);
             deliverWatchers(zh,type,state,evt.path, &cptr->c.watcher_result);
-            deallocate_WatcherEvent(&evt);
+            zh->coalesced_events = 0;
+            if (!ia->arena)
+                deallocate_WatcherEvent(&evt);
         } else {
             deserialize_response(cptr->c.type, hdr.xid, hdr.err != 0, hdr.err, cptr, ia);
+            elapsed = zk_clock_us() - start;
+            if (add_latency(zh, &zh->latency.callback, elapsed,
+                        zh->callback_threshold)) {
+                LOG_WARN(("Completion %p of xid=%#x (context %p) ran for %dms",
+                            (void*)cptr->c.void_result, hdr.xid, cptr->data,
+                            (int)(elapsed / 1000)));
+            }
         }
+        ZK_PROBE3(callback__end, zh, hdr.xid, cptr->c.type);
         destroy_completion_entry(cptr);
         close_buffer_iarchive(&ia);
+        if (arena) {
+            zoo_arena_reset(arena);
+        }
+    }
+    zh->completion_arena = arena;
+}
+
+/* adds a duration to the stats, telling if it is over the threshold (in
+ * ms, 0 for none) */
+static int add_latency(zhandle_t *zh, zoo_latency_t *l, int64_t us,
+        int threshold)
+{
+    int over = threshold > 0 && us > (int64_t)threshold * 1000;
+    lock_completion_list(&zh->completions_to_process);
+    l->count++;
+    l->over += over;
+    l->total_us += us;
+    if (us > l->max_us)
+        l->max_us = us;
+    unlock_completion_list(&zh->completions_to_process);
+    return over;
+}
+
+void record_watcher_time(zhandle_t *zh, int64_t start, watcher_fn watcher,
+        int type, const char *path)
+{
+    int64_t elapsed = zk_clock_us() - start;
+    if (add_latency(zh, &zh->latency.callback, elapsed,
+                zh->callback_threshold)) {
+        LOG_WARN(("Watcher %p of the %s event for node [%s] ran for %dms",
+                    (void*)watcher, watcherEvent2String(type),
+                    path ? path : "", (int)(elapsed / 1000)));
     }
 }
 
@@ -2156,7 +2956,7 @@ static void isSocketReadable(zhandle_t* zh)
     fds.events = POLLIN;
     if (poll(&fds,1,0)<=0) {
         // socket not readable -- no more responses to process
-        zh->socket_readable.tv_sec=zh->socket_readable.tv_usec=0;
+        zh->socket_readable = 0;
     }
 #else
     fd_set rfds;
@@ -2165,30 +2965,35 @@ static void isSocketReadable(zhandle_t* zh)
     FD_SET( zh->fd , &rfds);
     if (select(0, &rfds, NULL, NULL, &waittime) <= 0){
         // socket not readable -- no more responses to process
-        zh->socket_readable.tv_sec=zh->socket_readable.tv_usec=0;
+        zh->socket_readable = 0;
     }
 #endif
     else{
-        gettimeofday(&zh->socket_readable,0);
+        zh->socket_readable = zh->now;
     }
 }
 
 static void checkResponseLatency(zhandle_t* zh)
 {
-    int delay;
-    struct timeval now;
+    int64_t delay;
 
-    if(zh->socket_readable.tv_sec==0)
+    if(zh->socket_readable==0)
         return;
 
-    gettimeofday(&now,0);
-    delay=calculate_interval(&zh->socket_readable, &now);
-    if(delay>20)
-        LOG_DEBUG(("The following server response has spent at least %dms sitting in the client socket recv buffer",delay));
+    delay = zh->now - zh->socket_readable;
+    if (add_latency(zh, &zh->latency.frame_delay, delay,
+                zh->frame_delay_threshold ? zh->frame_delay_threshold : 20))
+        LOG_WARN(("The following server response has spent at least %dms sitting in the client socket recv buffer",
+                    (int)(delay / 1000)));
 
-    zh->socket_readable.tv_sec=zh->socket_readable.tv_usec=0;
+    zh->socket_readable = 0;
 }
 
+/* the frame delays are measured on demand, or always at the debug level as
+ * they used to be */
+#define MEASURE_FRAME_DELAY(zh) \
+    ((zh)->frame_delay_threshold > 0 || logLevel == ZOO_LOG_LEVEL_DEBUG)
+
 int zookeeper_process(zhandle_t *zh, int events)
 {
     buffer_list_t *bptr;
@@ -2199,18 +3004,26 @@ int zookeeper_process(zhandle_t *zh, int events)
     if (is_unrecoverable(zh))
         return ZINVALIDSTATE;
     api_prolog(zh);
-    IF_DEBUG(checkResponseLatency(zh));
+    /* the clock is read once per wakeup, here, and the following call to
+     * zookeeper_interest uses the same time */
+    zh->now = zk_clock_us();
+    zh->now_fresh = 1;
+    if (MEASURE_FRAME_DELAY(zh))
+        checkResponseLatency(zh);
     rc = check_events(zh, events);
     if (rc!=ZOK)
         return api_epilog(zh, rc);
 
-    IF_DEBUG(isSocketReadable(zh));
+    if (MEASURE_FRAME_DELAY(zh))
+        isSocketReadable(zh);
 
     while (rc >= 0 && (bptr=dequeue_buffer(&zh->to_process))) {
         struct ReplyHeader hdr;
         struct iarchive *ia = create_buffer_iarchive(
                                     bptr->buffer, bptr->curr_offset);
         deserialize_ReplyHeader(ia, "hdr", &hdr);
+        ZK_PROBE5(frame__received, zh, hdr.xid, hdr.zxid, hdr.err,
+                bptr->curr_offset);
         if (hdr.zxid > 0) {
             zh->last_zxid = hdr.zxid;
         } else {
@@ -2228,14 +3041,26 @@ int zookeeper_process(zhandle_t *zh, int events)
             deserialize_WatcherEvent(ia, "event", &evt);
             type = evt.type;
             path = evt.path;
+            ZK_PROBE4(watch__triggered, zh, type, evt.state, path);
+            if (zh->hotpaths && zk_hotpaths_sample(zh->hotpaths, 1))
+                zk_hotpaths_add(zh->hotpaths, path, ZK_HOTPATH_WATCH,
+                        bptr->curr_offset);
             /* We are doing a notification, so there is no pending request */
             c = create_completion_entry(WATCHER_EVENT_XID,-1,0,0,0,0);
             c->buffer = bptr;
+            c->dispatched = zh->now;
             c->c.watcher_result = collectWatchers(zh, type, path);
+            if (zh->watch_windows && type != ZOO_SESSION_EVENT &&
+                    !coalesce_watchers(zh, c, type, path)) {
+                discardWatchers(c->c.watcher_result);
+                destroy_completion_entry(c);
+                c = NULL;
+            }
 
             // We cannot free until now, otherwise path will become invalid
             deallocate_WatcherEvent(&evt);
-            queue_completion(&zh->completions_to_process, c, 0);
+            if (c)
+                queue_completion(&zh->completions_to_process, c, 0);
         } else if (hdr.xid == SET_WATCHES_XID) {
             LOG_DEBUG(("Processing SET_WATCHES"));
             free_buffer(bptr);
@@ -2257,10 +3082,20 @@ int zookeeper_process(zhandle_t *zh, int events)
             int rc = hdr.err;
             /* Find the request corresponding to the response */
             completion_list_t *cptr = dequeue_completion(&zh->sent_requests);
+            completion_list_t *followers;
 
             /* [ZOOKEEPER-804] Don't assert if zookeeper_close has been called. */
             if (zh->close_requested == 1) {
                 if (cptr) {
+                    /* the reads that joined it fail with the others */
+                    lock_completion_list(&zh->sent_requests);
+                    followers = take_followers(cptr);
+                    unlock_completion_list(&zh->sent_requests);
+                    while (followers) {
+                        completion_list_t *next = followers->next;
+                        queue_completion(&zh->sent_requests, followers, 1);
+                        followers = next;
+                    }
                     destroy_completion_entry(cptr);
                     cptr = NULL;
                 }
@@ -2284,14 +3119,16 @@ int zookeeper_process(zhandle_t *zh, int events)
             }
 
             activateWatcher(zh, cptr->watcher, rc);
+            followers = detach_followers(zh, cptr, bptr);
+            if (cptr->sampled)
+                zk_hotpaths_add_bytes(zh->hotpaths, cptr->path,
+                        bptr->curr_offset);
 
             if (cptr->c.void_result != SYNCHRONOUS_MARKER) {
                 if(hdr.xid == PING_XID){
-                    int elapsed = 0;
-                    struct timeval now;
-                    gettimeofday(&now, 0);
-                    elapsed = calculate_interval(&zh->last_ping, &now);
-                    LOG_DEBUG(("Got ping response in %d ms", elapsed));
+                    int elapsed = (int)(zh->now - zh->last_ping);
+                    LOG_DEBUG(("Got ping response in %d us", elapsed));
+                    record_rtt(zh, elapsed);
 
                     // Nothing to do with a ping response
                     free_buffer(bptr);
@@ -2299,21 +3136,25 @@ int zookeeper_process(zhandle_t *zh, int events)
                 } else {
                     LOG_DEBUG(("Queueing asynchronous response"));
 
+                    ZK_PROBE4(completion__dispatched, zh, hdr.xid, rc, 0);
                     cptr->buffer = bptr;
+                    cptr->dispatched = zh->now;
                     queue_completion(&zh->completions_to_process, cptr, 0);
                 }
             } else {
                 struct sync_completion
                         *sc = (struct sync_completion*)cptr->data;
                 sc->rc = rc;
-                
-                process_sync_completion(cptr, sc, ia, zh); 
-                
-                notify_sync_completion(sc);
-                free_buffer(bptr);
+                ZK_PROBE4(completion__dispatched, zh, hdr.xid, rc, 1);
+
+                /* hand the response over to the waiting thread; decoding
+                 * a large reply here would stall all socket I/O and pings */
+                cptr->buffer = bptr;
+                sc->deferred = cptr;
                 zh->outstanding_sync--;
-                destroy_completion_entry(cptr);
+                notify_sync_completion(sc);
             }
+            answer_followers(zh, followers, rc);
         }
 
         close_buffer_iarchive(&ia);
@@ -2321,9 +3162,146 @@ int zookeeper_process(zhandle_t *zh, int events)
     }
     if (process_async(zh->outstanding_sync)) {
         process_completions(zh);
+        /* the completions may have taken a while */
+        zh->now_fresh = 0;
     }
     return api_epilog(zh,ZOK);}
 
+#if !defined(THREADED) && !defined(WIN32)
+/* takes the socket out of the external event loop before it is closed */
+static void io_fd_closing(zhandle_t *zh)
+{
+    if (zh->io_fd != -1) {
+        zh->io.fd_del(zh, zh->io_fd, zh->io.ctx);
+        zh->io_fd = -1;
+        zh->io_events = 0;
+    }
+}
+
+/* passes the socket, its events and the deadline to the external event
+ * loop, calling only the callbacks whose arguments changed */
+static int io_register(zhandle_t *zh, int fd, int events, int64_t deadline)
+{
+    if (fd != zh->io_fd)
+        io_fd_closing(zh);
+    if (fd != -1 && zh->io_fd == -1) {
+        if (zh->io.fd_add(zh, fd, events, zh->io.ctx) != 0)
+            return ZSYSTEMERROR;
+        zh->io_fd = fd;
+        zh->io_events = events;
+    } else if (fd != -1 && events != zh->io_events) {
+        if (zh->io.fd_mod(zh, fd, events, zh->io.ctx) != 0)
+            return ZSYSTEMERROR;
+        zh->io_events = events;
+    }
+    if (deadline != zh->io_deadline) {
+        struct timespec ts;
+        zh->io_deadline = deadline;
+        if (deadline < 0) {
+            zh->io.timer_set(zh, 0, zh->io.ctx);
+        } else {
+            ts.tv_sec = deadline / 1000;
+            ts.tv_nsec = (long)(deadline % 1000) * 1000000;
+            zh->io.timer_set(zh, &ts, zh->io.ctx);
+        }
+    }
+    return ZOK;
+}
+
+/* runs the deadlines of the handle, (re)connecting if need be, and tells
+ * the external event loop what to wait for next */
+static int io_update(zhandle_t *zh)
+{
+    int fd, interest, i, rc = ZOK;
+    struct timeval tv;
+
+    for (i = 0; i < 2; i++) {
+        int irc = zookeeper_interest(zh, &fd, &interest, &tv);
+        rc = rc != ZOK ? rc : irc;
+        /* a caller of zookeeper_interest would call it again right away
+         * after the connection was dropped, to connect to the next server,
+         * unless it has to wait for the backoff */
+        if (zh->fd != -1 || is_unrecoverable(zh) ||
+                zk_timer_armed(&zh->connect_timer))
+            break;
+    }
+    if (is_unrecoverable(zh)) {
+        io_register(zh, -1, 0, -1);
+        return rc;
+    }
+    fd = zh->fd;
+    interest = fd == -1 ? 0 : interest;
+    i = io_register(zh, fd, interest, zk_timer_wheel_next(&zh->timers));
+    return rc != ZOK ? rc : i;
+}
+
+void io_send_queued(zhandle_t *zh)
+{
+    int events = ZOOKEEPER_READ;
+
+    if (zh->io.fd_add == 0 || zh->io_busy || zh->io_fd == -1 ||
+            zh->close_requested)
+        return;
+    if ((zh->to_send.head && zh->state == ZOO_CONNECTED_STATE) ||
+            zh->state == ZOO_CONNECTING_STATE)
+        events |= ZOOKEEPER_WRITE;
+    if (zh->state == ZOO_CONNECTED_STATE && zh->request_timeout > 0 &&
+            !zk_timer_armed(&zh->request_timer)) {
+        int64_t deadline = request_deadline(zh);
+        if (deadline >= 0)
+            zk_timer_arm(&zh->timers, &zh->request_timer, deadline);
+    }
+    io_register(zh, zh->io_fd, events, zk_timer_wheel_next(&zh->timers));
+}
+
+int zoo_set_io_callbacks(zhandle_t *zh, const zoo_io_callbacks_t *callbacks)
+{
+    int rc;
+
+    if (zh == 0)
+        return ZBADARGUMENTS;
+    if (callbacks && (callbacks->fd_add == 0 || callbacks->fd_mod == 0 ||
+            callbacks->fd_del == 0 || callbacks->timer_set == 0))
+        return ZBADARGUMENTS;
+    if (zh->io.fd_add)
+        io_register(zh, -1, 0, -1);
+    if (callbacks == 0) {
+        memset(&zh->io, 0, sizeof(zh->io));
+        return ZOK;
+    }
+    zh->io = *callbacks;
+    api_prolog(zh);
+    zh->io_busy = 1;
+    rc = io_update(zh);
+    zh->io_busy = 0;
+    return api_epilog(zh, rc);
+}
+
+int zoo_io_event(zhandle_t *zh, int events)
+{
+    int rc = ZOK, urc = ZOK;
+
+    if (zh == 0 || zh->io.fd_add == 0)
+        return ZBADARGUMENTS;
+    api_prolog(zh);
+    zh->io_busy = 1;
+    if (events && zh->fd != -1) {
+        rc = zookeeper_process(zh, events);
+        /* read until the socket would block, it may be watched
+         * edge-triggered */
+        while (rc == ZOK && (events & ZOOKEEPER_READ) && !zh->close_requested)
+            rc = zookeeper_process(zh, ZOOKEEPER_READ);
+        if (rc == ZNOTHING)
+            rc = ZOK;
+    }
+    /* a completion may have closed the handle: it is freed by api_epilog */
+    if (!zh->close_requested)
+        urc = io_update(zh);
+    zh->io_busy = 0;
+    return api_epilog(zh, rc != ZOK ? rc : urc);
+}
+#endif
+
 int zoo_state(zhandle_t *zh)
 {
     if(zh!=0)
@@ -2401,6 +3379,7 @@ static completion_list_t* create_completion_entry(int xid, int completion_type,
 static void destroy_completion_entry(completion_list_t* c){
     if(c!=0){
         destroy_watcher_registration(c->watcher);
+        free(c->path);
         if(c->buffer!=0)
             free_buffer(c->buffer);
         free(c);
@@ -2434,9 +3413,16 @@ static void queue_completion_nolock(completion_head_t *list,
 static void queue_completion(completion_head_t *list, completion_list_t *c,
         int add_to_front)
 {
+    int was_empty;
 
     lock_completion_list(list);
+    was_empty = list->head == 0;
     queue_completion_nolock(list, c, add_to_front);
+    /* the consumer drains the whole list once woken up, so only the first
+     * entry of a batch needs to wake it */
+    if (was_empty) {
+        signal_completion_list(list);
+    }
     unlock_completion_list(list);
 }
 
@@ -2449,6 +3435,7 @@ static int add_completion(zhandle_t *zh, int xid, int completion_type,
     int rc = 0;
     if (!c)
         return ZSYSTEMERROR;
+    c->queued = zk_clock_us();
     lock_completion_list(&zh->sent_requests);
     if (zh->close_requested != 1) {
         queue_completion_nolock(&zh->sent_requests, c, add_to_front);
@@ -2464,6 +3451,211 @@ static int add_completion(zhandle_t *zh, int xid, int completion_type,
     return rc;
 }
 
+static int is_coalesced_op(int type)
+{
+    return type == ZOO_GETDATA_OP || type == ZOO_EXISTS_OP ||
+        type == ZOO_GETCHILDREN_OP || type == ZOO_GETCHILDREN2_OP;
+}
+
+static int is_write_op(int type)
+{
+    return type == ZOO_CREATE_OP || type == ZOO_DELETE_OP ||
+        type == ZOO_SETDATA_OP || type == ZOO_SETACL_OP ||
+        type == ZOO_CHECK_OP || type == ZOO_MULTI_OP;
+}
+
+/* queues a request whose completion was just added, noting what it is
+ * for zoo_get_inflight and the path profile */
+static void lead_read(zhandle_t *zh, completion_list_t *c);
+
+static int queue_request(zhandle_t *zh, const struct RequestHeader *h,
+        const char *path, struct oarchive *oa)
+{
+    completion_list_t *c;
+    int rc;
+
+    /* the completion was added in the same critical section: it is the
+     * last one and cannot have been answered yet */
+    int sampled = zh->hotpaths && path &&
+        zk_hotpaths_sample(zh->hotpaths, 0);
+
+    lock_completion_list(&zh->sent_requests);
+    c = zh->sent_requests.last;
+    if (c && c->xid == h->xid) {
+        c->op = h->type;
+        c->bytes = get_buffer_len(oa);
+        c->path = path ? strdup(path) : 0;
+        c->sampled = sampled && c->path;
+        c->unpack = h->type == ZOO_GETDATA_OP && zh->compress_min > 0;
+        if (zh->reads_in_flight && c->path && is_coalesced_op(h->type))
+            lead_read(zh, c);
+    }
+    /* the reads issued next must not join those issued before */
+    if (!is_coalesced_op(h->type) && h->type != ZOO_PING_OP &&
+            h->type != ZOO_GETACL_OP)
+        zh->read_barrier++;
+    unlock_completion_list(&zh->sent_requests);
+    if (sampled)
+        zk_hotpaths_add(zh->hotpaths, path, is_write_op(h->type) ?
+                ZK_HOTPATH_WRITE : ZK_HOTPATH_READ, get_buffer_len(oa));
+    rc = queue_buffer_bytes(&zh->to_send, get_buffer(oa), get_buffer_len(oa));
+    if (rc >= 0)
+        ZK_PROBE5(request__queued, zh, h->xid, h->type, path ? path : "",
+                get_buffer_len(oa));
+    return rc;
+}
+
+static unsigned int read_hash(void *key)
+{
+    const read_in_flight_t *r = key;
+    const char *p = r->path;
+    unsigned int hash = 5381 + r->op;
+    while (*p)
+        hash = ((hash << 5) + hash) + *p++;
+    return hash;
+}
+
+static int read_equal(void *key1, void *key2)
+{
+    const read_in_flight_t *r1 = key1, *r2 = key2;
+    return r1->op == r2->op && strcmp(r1->path, r2->path) == 0;
+}
+
+static struct hashtable *create_reads_in_flight(void)
+{
+    return create_hashtable(32, read_hash, read_equal);
+}
+
+/* makes a read just queued the one the next identical reads join, with
+ * the lock of sent_requests held */
+static void lead_read(zhandle_t *zh, completion_list_t *c)
+{
+    read_in_flight_t key, *r;
+
+    key.op = c->op;
+    key.path = c->path;
+    r = hashtable_search(zh->reads_in_flight, &key);
+    if (!r) {
+        /* every entry is its own key, freed along with it */
+        size_t len = strlen(c->path) + 1;
+        r = malloc(sizeof(*r) + len);
+        if (!r)
+            return;
+        r->op = c->op;
+        r->path = memcpy(r + 1, c->path, len);
+        if (!hashtable_insert(zh->reads_in_flight, r, r)) {
+            free(r);
+            return;
+        }
+    }
+    /* the read was not coalesced with the previous leader: it is newer or
+     * it sets a watch */
+    r->barrier = zh->read_barrier;
+    r->leader = c;
+}
+
+/* attaches a read to an identical one in flight, returning 1 if it did:
+ * it completes with the response to that one */
+static int join_read(zhandle_t *zh, int op, const char *path,
+        int completion_type, const void *dc, const void *data,
+        result_checker_fn checker, watcher_fn watcher, void *watcherCtx)
+{
+    read_in_flight_t key, *r;
+    completion_list_t *c = 0;
+    int joined = 0;
+
+    if (!zh->reads_in_flight)
+        return 0;
+    lock_completion_list(&zh->sent_requests);
+    if (zh->reads_in_flight && zh->close_requested != 1) {
+        key.op = op;
+        key.path = path;
+        r = hashtable_search(zh->reads_in_flight, &key);
+        if (r && r->barrier == zh->read_barrier &&
+                (!watcher || r->leader->watcher)) {
+            c = create_completion_entry(r->leader->xid, completion_type, dc,
+                    data, create_watcher_registration(path, checker,
+                        watcher, watcherCtx), 0);
+            if (c) {
+                c->op = op;
+                c->unpack = op == ZOO_GETDATA_OP && zh->compress_min > 0;
+                c->queued = zk_clock_us();
+                c->next = r->leader->followers;
+                r->leader->followers = c;
+                if (dc == SYNCHRONOUS_MARKER)
+                    zh->outstanding_sync++;
+                joined = 1;
+            }
+        }
+    }
+    unlock_completion_list(&zh->sent_requests);
+    if (joined)
+        LOG_DEBUG(("Coalesced a request for path [%s] with xid=%#x", path,
+                c->xid));
+    return joined;
+}
+
+/* the reads that joined a request, in the order they were made */
+static completion_list_t *take_followers(completion_list_t *cptr)
+{
+    completion_list_t *f = cptr->followers, *list = 0;
+    cptr->followers = 0;
+    while (f) {
+        completion_list_t *next = f->next;
+        f->next = list;
+        list = f;
+        f = next;
+    }
+    return list;
+}
+
+/* stops the reads from joining a request that was answered, and gives
+ * those that did a copy of the response */
+static completion_list_t *detach_followers(zhandle_t *zh,
+        completion_list_t *cptr, buffer_list_t *bptr)
+{
+    completion_list_t *list, *f;
+    read_in_flight_t key, *r;
+
+    if (!cptr->path || !is_coalesced_op(cptr->op))
+        return 0;
+    lock_completion_list(&zh->sent_requests);
+    if (zh->reads_in_flight) {
+        key.op = cptr->op;
+        key.path = cptr->path;
+        r = hashtable_search(zh->reads_in_flight, &key);
+        if (r && r->leader == cptr)
+            hashtable_remove(zh->reads_in_flight, &key);
+    }
+    list = take_followers(cptr);
+    unlock_completion_list(&zh->sent_requests);
+    for (f = list; f; f = f->next) {
+        f->buffer = copy_buffer(bptr);
+        assert(f->buffer);
+    }
+    return list;
+}
+
+/* completes the reads that joined a request with its response */
+static void answer_followers(zhandle_t *zh, completion_list_t *f, int rc)
+{
+    while (f) {
+        completion_list_t *next = f->next;
+        activateWatcher(zh, f->watcher, rc);
+        if (f->c.void_result != SYNCHRONOUS_MARKER) {
+            f->dispatched = zh->now;
+            queue_completion(&zh->completions_to_process, f, 0);
+        } else {
+            struct sync_completion *sc = (struct sync_completion*)f->data;
+            sc->rc = rc;
+            sc->deferred = f;
+            zh->outstanding_sync--;
+            notify_sync_completion(sc);
+        }
+        f = next;
+    }
+}
+
 static int add_data_completion(zhandle_t *zh, int xid, data_completion_t dc,
         const void *data,watcher_registration_t* wo)
 {
@@ -2578,11 +3770,46 @@ finish:
     return rc;
 }
 
+/* bit masks of the characters isValidPath cares about, one bit per byte
+ * of a block of at most 16 path characters */
+typedef struct _path_masks {
+    unsigned int slash;
+    unsigned int dot;
+    unsigned int ctrl;
+} path_masks_t;
+
+static void get_path_masks(const char *block, int n, path_masks_t *m) {
+    int i;
+#ifdef __SSE2__
+    if (n == 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)block);
+        m->slash = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+        m->dot = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+        // bytes below 0x1f, compared as unsigned
+        m->ctrl = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_min_epu8(v, _mm_set1_epi8(0x1e)), v));
+        return;
+    }
+#endif
+    m->slash = m->dot = m->ctrl = 0;
+    for (i = 0; i < n; i++) {
+        char c = block[i];
+        if (c == '/') {
+            m->slash |= 1u << i;
+        } else if (c == '.') {
+            m->dot |= 1u << i;
+        } else if (c > 0x00 && c < 0x1f) {
+            m->ctrl |= 1u << i;
+        }
+    }
+}
+
 static int isValidPath(const char* path, const int flags) {
     int len = 0;
-    char lastc = '/';
-    char c;
     int i = 0;
+    /* the masks of the last three characters of the previous block */
+    unsigned int slash = 0;
+    unsigned int dot = 0;
 
   if (path == 0)
     return 0;
@@ -2596,27 +3823,31 @@ static int isValidPath(const char* path, const int flags) {
   if (path[len - 1] == '/' && !(flags & ZOO_SEQUENCE))
     return 0;
 
-  i = 1;
-  for (; i < len; lastc = path[i], i++) {
-    c = path[i];
+  // look for control characters and "//", "/./" or "/../" sixteen
+  // characters at a time; bit 3 of s and d stands for the block's first
+  // character, so the patterns can straddle two blocks
+  for (; i < len; i += 16) {
+    path_masks_t m;
+    unsigned int s, d;
 
-    if (c == 0) {
+    get_path_masks(path + i, len - i < 16 ? len - i : 16, &m);
+    if (m.ctrl != 0)
       return 0;
-    } else if (c == '/' && lastc == '/') {
+    s = (m.slash << 3) | slash;
+    d = (m.dot << 3) | dot;
+    if ((s & (s << 1)) != 0
+        || (s & (d << 1) & (s << 2)) != 0
+        || (s & (d << 1) & (d << 2) & (s << 3)) != 0)
       return 0;
-    } else if (c == '.' && lastc == '.') {
-      if (path[i-2] == '/' && (((i + 1 == len) && !(flags & ZOO_SEQUENCE))
-                               || path[i+1] == '/')) {
-        return 0;
-      }
-    } else if (c == '.') {
-      if ((path[i-1] == '/') && (((i + 1 == len) && !(flags & ZOO_SEQUENCE))
-                                 || path[i+1] == '/')) {
-        return 0;
-      }
-    } else if (c > 0x00 && c < 0x1f) {
+    slash = (s >> 16) & 7;
+    dot = (d >> 16) & 7;
+  }
+
+  // a trailing "/." or "/.." is only allowed for the prefix of a sequential node
+  if (path[len - 1] == '.' && !(flags & ZOO_SEQUENCE)) {
+    if (path[len - 2] == '/' ||
+        (path[len - 2] == '.' && len > 2 && path[len - 3] == '/'))
       return 0;
-    }
   }
 
   return 1;
@@ -2627,17 +3858,17 @@ static int isValidPath(const char* path, const int flags) {
  *---------------------------------------------------------------------------*/
 /* Common Request init helper functions to reduce code duplication */
 static int Request_path_init(zhandle_t *zh, int flags, 
-        char **path_out, const char *path)
+        char **path_out, const char *path, char *path_buf)
 {
     assert(path_out);
     
-    *path_out = prepend_string(zh, path);
+    *path_out = prepend_string(zh, path, path_buf);
     if (zh == NULL || !isValidPath(*path_out, flags)) {
-        free_duplicate_path(*path_out, path);
+        free_duplicate_path(*path_out, path, path_buf);
         return ZBADARGUMENTS;
     }
     if (is_unrecoverable(zh)) {
-        free_duplicate_path(*path_out, path);
+        free_duplicate_path(*path_out, path, path_buf);
         return ZINVALIDSTATE;
     }
 
@@ -2645,10 +3876,10 @@ static int Request_path_init(zhandle_t *zh, int flags,
 }
 
 static int Request_path_watch_init(zhandle_t *zh, int flags,
-        char **path_out, const char *path,
+        char **path_out, const char *path, char *path_buf,
         int32_t *watch_out, uint32_t watch)
 {
-    int rc = Request_path_init(zh, flags, path_out, path);
+    int rc = Request_path_init(zh, flags, path_out, path, path_buf);
     if (rc != ZOK) {
         return rc;
     }
@@ -2670,29 +3901,34 @@ int zoo_awget(zhandle_t *zh, const char *path,
         data_completion_t dc, const void *data)
 {
     struct oarchive *oa;
-    char *server_path = prepend_string(zh, path);
+    char path_buf[PATH_BUFFER_SIZE];
+    char *server_path = prepend_string(zh, path, path_buf);
     struct RequestHeader h = { STRUCT_INITIALIZER (xid , get_xid()), STRUCT_INITIALIZER (type ,ZOO_GETDATA_OP)};
     struct GetDataRequest req =  { (char*)server_path, watcher!=0 };
     int rc;
 
     if (zh==0 || !isValidPath(server_path, 0)) {
-        free_duplicate_path(server_path, path);
+        free_duplicate_path(server_path, path, path_buf);
         return ZBADARGUMENTS;
     }
     if (is_unrecoverable(zh)) {
-        free_duplicate_path(server_path, path);
+        free_duplicate_path(server_path, path, path_buf);
         return ZINVALIDSTATE;
     }
+    if (join_read(zh, h.type, server_path, COMPLETION_DATA, dc, data,
+                data_result_checker, watcher, watcherCtx)) {
+        free_duplicate_path(server_path, path, path_buf);
+        return ZOK;
+    }
     oa=create_buffer_oarchive();
     rc = serialize_RequestHeader(oa, "header", &h);
     rc = rc < 0 ? rc : serialize_GetDataRequest(oa, "req", &req);
     enter_critical(zh);
     rc = rc < 0 ? rc : add_data_completion(zh, h.xid, dc, data,
         create_watcher_registration(server_path,data_result_checker,watcher,watcherCtx));
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, server_path, oa);
     leave_critical(zh);
-    free_duplicate_path(server_path, path);
+    free_duplicate_path(server_path, path, path_buf);
     /* We queued the buffer, so don't free it */
     close_buffer_oarchive(&oa, 0);
 
@@ -2704,11 +3940,12 @@ int zoo_awget(zhandle_t *zh, const char *path,
 }
 
 static int SetDataRequest_init(zhandle_t *zh, struct SetDataRequest *req,
-        const char *path, const char *buffer, int buflen, int version)
+        const char *path, char *path_buf, const char *buffer, int buflen,
+        int version)
 {
     int rc;
     assert(req);
-    rc = Request_path_init(zh, 0, &req->path, path);
+    rc = Request_path_init(zh, 0, &req->path, path, path_buf);
     if (rc != ZOK) {
         return rc;
     }
@@ -2722,22 +3959,26 @@ static int SetDataRequest_init(zhandle_t *zh, struct SetDataRequest *req,
 int zoo_aset(zhandle_t *zh, const char *path, const char *buffer, int buflen,
         int version, stat_completion_t dc, const void *data)
 {
+    char path_buf[PATH_BUFFER_SIZE];
     struct oarchive *oa;
     struct RequestHeader h = { STRUCT_INITIALIZER(xid , get_xid()), STRUCT_INITIALIZER (type , ZOO_SETDATA_OP)};
     struct SetDataRequest req;
-    int rc = SetDataRequest_init(zh, &req, path, buffer, buflen, version);
+    int rc = SetDataRequest_init(zh, &req, path, path_buf, buffer, buflen,
+            version);
     if (rc != ZOK) {
         return rc;
     }
+    req.data.len = pack_value(zh, &req.data.buff, req.data.len);
     oa = create_buffer_oarchive();
     rc = serialize_RequestHeader(oa, "header", &h);
     rc = rc < 0 ? rc : serialize_SetDataRequest(oa, "req", &req);
     enter_critical(zh);
     rc = rc < 0 ? rc : add_stat_completion(zh, h.xid, dc, data,0);
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, req.path, oa);
     leave_critical(zh);
-    free_duplicate_path(req.path, path);
+    free_duplicate_path(req.path, path, path_buf);
+    if (req.data.buff != buffer)
+        zoo_frame_free(req.data.buff);
     /* We queued the buffer, so don't free it */
     close_buffer_oarchive(&oa, 0);
 
@@ -2749,12 +3990,12 @@ int zoo_aset(zhandle_t *zh, const char *path, const char *buffer, int buflen,
 }
 
 static int CreateRequest_init(zhandle_t *zh, struct CreateRequest *req,
-        const char *path, const char *value,
+        const char *path, char *path_buf, const char *value,
         int valuelen, const struct ACL_vector *acl_entries, int flags)
 {
     int rc;
     assert(req);
-    rc = Request_path_init(zh, flags, &req->path, path);
+    rc = Request_path_init(zh, flags, &req->path, path, path_buf);
     assert(req);
     if (rc != ZOK) {
         return rc;
@@ -2776,24 +4017,27 @@ int zoo_acreate(zhandle_t *zh, const char *path, const char *value,
         int valuelen, const struct ACL_vector *acl_entries, int flags,
         string_completion_t completion, const void *data)
 {
+    char path_buf[PATH_BUFFER_SIZE];
     struct oarchive *oa;
     struct RequestHeader h = { STRUCT_INITIALIZER (xid , get_xid()), STRUCT_INITIALIZER (type ,ZOO_CREATE_OP) };
     struct CreateRequest req;
 
     int rc = CreateRequest_init(zh, &req, 
-            path, value, valuelen, acl_entries, flags);
+            path, path_buf, value, valuelen, acl_entries, flags);
     if (rc != ZOK) {
         return rc;
     }
+    req.data.len = pack_value(zh, &req.data.buff, req.data.len);
     oa = create_buffer_oarchive();
     rc = serialize_RequestHeader(oa, "header", &h);
     rc = rc < 0 ? rc : serialize_CreateRequest(oa, "req", &req);
     enter_critical(zh);
     rc = rc < 0 ? rc : add_string_completion(zh, h.xid, completion, data);
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, req.path, oa);
     leave_critical(zh);
-    free_duplicate_path(req.path, path);
+    free_duplicate_path(req.path, path, path_buf);
+    if (req.data.buff != value)
+        zoo_frame_free(req.data.buff);
     /* We queued the buffer, so don't free it */
     close_buffer_oarchive(&oa, 0);
 
@@ -2805,9 +4049,9 @@ int zoo_acreate(zhandle_t *zh, const char *path, const char *value,
 }
 
 int DeleteRequest_init(zhandle_t *zh, struct DeleteRequest *req, 
-        const char *path, int version)
+        const char *path, char *path_buf, int version)
 {
-    int rc = Request_path_init(zh, 0, &req->path, path);
+    int rc = Request_path_init(zh, 0, &req->path, path, path_buf);
     if (rc != ZOK) {
         return rc;
     }
@@ -2818,10 +4062,11 @@ int DeleteRequest_init(zhandle_t *zh, struct DeleteRequest *req,
 int zoo_adelete(zhandle_t *zh, const char *path, int version,
         void_completion_t completion, const void *data)
 {
+    char path_buf[PATH_BUFFER_SIZE];
     struct oarchive *oa;
     struct RequestHeader h = { STRUCT_INITIALIZER (xid , get_xid()), STRUCT_INITIALIZER (type , ZOO_DELETE_OP)};
     struct DeleteRequest req;
-    int rc = DeleteRequest_init(zh, &req, path, version);
+    int rc = DeleteRequest_init(zh, &req, path, path_buf, version);
     if (rc != ZOK) {
         return rc;
     }
@@ -2830,10 +4075,9 @@ int zoo_adelete(zhandle_t *zh, const char *path, int version,
     rc = rc < 0 ? rc : serialize_DeleteRequest(oa, "req", &req);
     enter_critical(zh);
     rc = rc < 0 ? rc : add_void_completion(zh, h.xid, completion, data);
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, req.path, oa);
     leave_critical(zh);
-    free_duplicate_path(req.path, path);
+    free_duplicate_path(req.path, path, path_buf);
     /* We queued the buffer, so don't free it */
     close_buffer_oarchive(&oa, 0);
 
@@ -2854,14 +4098,20 @@ int zoo_awexists(zhandle_t *zh, const char *path,
         watcher_fn watcher, void* watcherCtx,
         stat_completion_t completion, const void *data)
 {
+    char path_buf[PATH_BUFFER_SIZE];
     struct oarchive *oa;
     struct RequestHeader h = { STRUCT_INITIALIZER (xid ,get_xid()), STRUCT_INITIALIZER (type , ZOO_EXISTS_OP) };
     struct ExistsRequest req;
-    int rc = Request_path_watch_init(zh, 0, &req.path, path, 
+    int rc = Request_path_watch_init(zh, 0, &req.path, path, path_buf,
             &req.watch, watcher != NULL);
     if (rc != ZOK) {
         return rc;
     }
+    if (join_read(zh, h.type, req.path, COMPLETION_STAT, completion, data,
+                exists_result_checker, watcher, watcherCtx)) {
+        free_duplicate_path(req.path, path, path_buf);
+        return ZOK;
+    }
     oa = create_buffer_oarchive();
     rc = serialize_RequestHeader(oa, "header", &h);
     rc = rc < 0 ? rc : serialize_ExistsRequest(oa, "req", &req);
@@ -2869,10 +4119,9 @@ int zoo_awexists(zhandle_t *zh, const char *path,
     rc = rc < 0 ? rc : add_stat_completion(zh, h.xid, completion, data,
         create_watcher_registration(req.path,exists_result_checker,
                 watcher,watcherCtx));
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, req.path, oa);
     leave_critical(zh);
-    free_duplicate_path(req.path, path);
+    free_duplicate_path(req.path, path, path_buf);
     /* We queued the buffer, so don't free it */
     close_buffer_oarchive(&oa, 0);
 
@@ -2888,24 +4137,29 @@ static int zoo_awget_children_(zhandle_t *zh, const char *path,
          strings_completion_t sc,
          const void *data)
 {
+    char path_buf[PATH_BUFFER_SIZE];
     struct oarchive *oa;
     struct RequestHeader h = { STRUCT_INITIALIZER (xid , get_xid()), STRUCT_INITIALIZER (type , ZOO_GETCHILDREN_OP)};
     struct GetChildrenRequest req ;
-    int rc = Request_path_watch_init(zh, 0, &req.path, path, 
+    int rc = Request_path_watch_init(zh, 0, &req.path, path, path_buf,
             &req.watch, watcher != NULL);
     if (rc != ZOK) {
         return rc;
     }
+    if (join_read(zh, h.type, req.path, COMPLETION_STRINGLIST, sc, data,
+                child_result_checker, watcher, watcherCtx)) {
+        free_duplicate_path(req.path, path, path_buf);
+        return ZOK;
+    }
     oa = create_buffer_oarchive();
     rc = serialize_RequestHeader(oa, "header", &h);
     rc = rc < 0 ? rc : serialize_GetChildrenRequest(oa, "req", &req);
     enter_critical(zh);
     rc = rc < 0 ? rc : add_strings_completion(zh, h.xid, sc, data,
             create_watcher_registration(req.path,child_result_checker,watcher,watcherCtx));
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, req.path, oa);
     leave_critical(zh);
-    free_duplicate_path(req.path, path);
+    free_duplicate_path(req.path, path, path_buf);
     /* We queued the buffer, so don't free it */
     close_buffer_oarchive(&oa, 0);
 
@@ -2936,24 +4190,29 @@ static int zoo_awget_children2_(zhandle_t *zh, const char *path,
          const void *data)
 {
     /* invariant: (sc == NULL) != (sc == NULL) */
+    char path_buf[PATH_BUFFER_SIZE];
     struct oarchive *oa;
     struct RequestHeader h = { STRUCT_INITIALIZER( xid, get_xid()), STRUCT_INITIALIZER (type ,ZOO_GETCHILDREN2_OP)};
     struct GetChildren2Request req ;
-    int rc = Request_path_watch_init(zh, 0, &req.path, path, 
+    int rc = Request_path_watch_init(zh, 0, &req.path, path, path_buf,
             &req.watch, watcher != NULL);
     if (rc != ZOK) {
         return rc;
     }
+    if (join_read(zh, h.type, req.path, COMPLETION_STRINGLIST_STAT, ssc, data,
+                child_result_checker, watcher, watcherCtx)) {
+        free_duplicate_path(req.path, path, path_buf);
+        return ZOK;
+    }
     oa = create_buffer_oarchive();
     rc = serialize_RequestHeader(oa, "header", &h);
     rc = rc < 0 ? rc : serialize_GetChildren2Request(oa, "req", &req);
     enter_critical(zh);
     rc = rc < 0 ? rc : add_strings_stat_completion(zh, h.xid, ssc, data,
             create_watcher_registration(req.path,child_result_checker,watcher,watcherCtx));
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, req.path, oa);
     leave_critical(zh);
-    free_duplicate_path(req.path, path);
+    free_duplicate_path(req.path, path, path_buf);
     /* We queued the buffer, so don't free it */
     close_buffer_oarchive(&oa, 0);
 
@@ -2981,10 +4240,11 @@ int zoo_awget_children2(zhandle_t *zh, const char *path,
 int zoo_async(zhandle_t *zh, const char *path,
         string_completion_t completion, const void *data)
 {
+    char path_buf[PATH_BUFFER_SIZE];
     struct oarchive *oa;
     struct RequestHeader h = { STRUCT_INITIALIZER (xid , get_xid()), STRUCT_INITIALIZER (type , ZOO_SYNC_OP)};
     struct SyncRequest req;
-    int rc = Request_path_init(zh, 0, &req.path, path);
+    int rc = Request_path_init(zh, 0, &req.path, path, path_buf);
     if (rc != ZOK) {
         return rc;
     }
@@ -2993,10 +4253,9 @@ int zoo_async(zhandle_t *zh, const char *path,
     rc = rc < 0 ? rc : serialize_SyncRequest(oa, "req", &req);
     enter_critical(zh);
     rc = rc < 0 ? rc : add_string_completion(zh, h.xid, completion, data);
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, req.path, oa);
     leave_critical(zh);
-    free_duplicate_path(req.path, path);
+    free_duplicate_path(req.path, path, path_buf);
     /* We queued the buffer, so don't free it */
     close_buffer_oarchive(&oa, 0);
 
@@ -3011,10 +4270,11 @@ int zoo_async(zhandle_t *zh, const char *path,
 int zoo_aget_acl(zhandle_t *zh, const char *path, acl_completion_t completion,
         const void *data)
 {
+    char path_buf[PATH_BUFFER_SIZE];
     struct oarchive *oa;
     struct RequestHeader h = { STRUCT_INITIALIZER (xid , get_xid()), STRUCT_INITIALIZER(type ,ZOO_GETACL_OP)};
     struct GetACLRequest req;
-    int rc = Request_path_init(zh, 0, &req.path, path) ;
+    int rc = Request_path_init(zh, 0, &req.path, path, path_buf);
     if (rc != ZOK) {
         return rc;
     }
@@ -3023,10 +4283,9 @@ int zoo_aget_acl(zhandle_t *zh, const char *path, acl_completion_t completion,
     rc = rc < 0 ? rc : serialize_GetACLRequest(oa, "req", &req);
     enter_critical(zh);
     rc = rc < 0 ? rc : add_acl_completion(zh, h.xid, completion, data);
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, req.path, oa);
     leave_critical(zh);
-    free_duplicate_path(req.path, path);
+    free_duplicate_path(req.path, path, path_buf);
     /* We queued the buffer, so don't free it */
     close_buffer_oarchive(&oa, 0);
 
@@ -3040,10 +4299,11 @@ int zoo_aget_acl(zhandle_t *zh, const char *path, acl_completion_t completion,
 int zoo_aset_acl(zhandle_t *zh, const char *path, int version,
         struct ACL_vector *acl, void_completion_t completion, const void *data)
 {
+    char path_buf[PATH_BUFFER_SIZE];
     struct oarchive *oa;
     struct RequestHeader h = { STRUCT_INITIALIZER(xid ,get_xid()), STRUCT_INITIALIZER (type , ZOO_SETACL_OP)};
     struct SetACLRequest req;
-    int rc = Request_path_init(zh, 0, &req.path, path);
+    int rc = Request_path_init(zh, 0, &req.path, path, path_buf);
     if (rc != ZOK) {
         return rc;
     }
@@ -3054,10 +4314,9 @@ int zoo_aset_acl(zhandle_t *zh, const char *path, int version,
     rc = rc < 0 ? rc : serialize_SetACLRequest(oa, "req", &req);
     enter_critical(zh);
     rc = rc < 0 ? rc : add_void_completion(zh, h.xid, completion, data);
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, req.path, oa);
     leave_critical(zh);
-    free_duplicate_path(req.path, path);
+    free_duplicate_path(req.path, path, path_buf);
     /* We queued the buffer, so don't free it */
     close_buffer_oarchive(&oa, 0);
 
@@ -3110,11 +4369,11 @@ static void op_result_stat_completion(int err, const struct Stat *stat, const vo
 }   
 
 static int CheckVersionRequest_init(zhandle_t *zh, struct CheckVersionRequest *req,
-        const char *path, int version)
+        const char *path, char *path_buf, int version)
 {
     int rc ;
     assert(req);
-    rc = Request_path_init(zh, 0, &req->path, path);
+    rc = Request_path_init(zh, 0, &req->path, path, path_buf);
     if (rc != ZOK) {
         return rc;
     }
@@ -3130,6 +4389,7 @@ int zoo_amulti(zhandle_t *zh, int count, const zoo_op_t *ops,
     struct MultiHeader mh = { STRUCT_INITIALIZER(type, -1), STRUCT_INITIALIZER(done, 1), STRUCT_INITIALIZER(err, -1) };
     struct oarchive *oa = create_buffer_oarchive();
     completion_head_t clist = { 0 };
+    char path_buf[PATH_BUFFER_SIZE];
 
     int rc = serialize_RequestHeader(oa, "header", &h);
 
@@ -3147,7 +4407,7 @@ int zoo_amulti(zhandle_t *zh, int count, const zoo_op_t *ops,
                 struct CreateRequest req;
 
                 rc = rc < 0 ? rc : CreateRequest_init(zh, &req, 
-                                        op->create_op.path, op->create_op.data, 
+                                        op->create_op.path, path_buf, op->create_op.data, 
                                         op->create_op.datalen, op->create_op.acl, 
                                         op->create_op.flags);
                 rc = rc < 0 ? rc : serialize_CreateRequest(oa, "req", &req);
@@ -3157,26 +4417,26 @@ int zoo_amulti(zhandle_t *zh, int count, const zoo_op_t *ops,
                 enter_critical(zh);
                 entry = create_completion_entry(h.xid, COMPLETION_STRING, op_result_string_completion, result, 0, 0); 
                 leave_critical(zh);
-                free_duplicate_path(req.path, op->create_op.path);
+                free_duplicate_path(req.path, op->create_op.path, path_buf);
                 break;
             }
 
             case ZOO_DELETE_OP: {
                 struct DeleteRequest req;
-                rc = rc < 0 ? rc : DeleteRequest_init(zh, &req, op->delete_op.path, op->delete_op.version);
+                rc = rc < 0 ? rc : DeleteRequest_init(zh, &req, op->delete_op.path, path_buf, op->delete_op.version);
                 rc = rc < 0 ? rc : serialize_DeleteRequest(oa, "req", &req);
 
                 enter_critical(zh);
                 entry = create_completion_entry(h.xid, COMPLETION_VOID, op_result_void_completion, result, 0, 0); 
                 leave_critical(zh);
-                free_duplicate_path(req.path, op->delete_op.path);
+                free_duplicate_path(req.path, op->delete_op.path, path_buf);
                 break;
             }
 
             case ZOO_SETDATA_OP: {
                 struct SetDataRequest req;
                 rc = rc < 0 ? rc : SetDataRequest_init(zh, &req,
-                                        op->set_op.path, op->set_op.data, 
+                                        op->set_op.path, path_buf, op->set_op.data, 
                                         op->set_op.datalen, op->set_op.version);
                 rc = rc < 0 ? rc : serialize_SetDataRequest(oa, "req", &req);
                 result->stat = op->set_op.stat;
@@ -3184,20 +4444,20 @@ int zoo_amulti(zhandle_t *zh, int count, const zoo_op_t *ops,
                 enter_critical(zh);
                 entry = create_completion_entry(h.xid, COMPLETION_STAT, op_result_stat_completion, result, 0, 0); 
                 leave_critical(zh);
-                free_duplicate_path(req.path, op->set_op.path);
+                free_duplicate_path(req.path, op->set_op.path, path_buf);
                 break;
             }
 
             case ZOO_CHECK_OP: {
                 struct CheckVersionRequest req;
                 rc = rc < 0 ? rc : CheckVersionRequest_init(zh, &req,
-                                        op->check_op.path, op->check_op.version);
+                                        op->check_op.path, path_buf, op->check_op.version);
                 rc = rc < 0 ? rc : serialize_CheckVersionRequest(oa, "req", &req);
 
                 enter_critical(zh);
                 entry = create_completion_entry(h.xid, COMPLETION_VOID, op_result_void_completion, result, 0, 0); 
                 leave_critical(zh);
-                free_duplicate_path(req.path, op->check_op.path);
+                free_duplicate_path(req.path, op->check_op.path, path_buf);
                 break;
             } 
 
@@ -3214,8 +4474,7 @@ int zoo_amulti(zhandle_t *zh, int count, const zoo_op_t *ops,
     /* BEGIN: CRTICIAL SECTION */
     enter_critical(zh);
     rc = rc < 0 ? rc : add_multi_completion(zh, h.xid, completion, data, &clist);
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, 0, oa);
     leave_critical(zh);
     
     /* We queued the buffer, so don't free it */
@@ -3283,8 +4542,7 @@ int zoo_multi(zhandle_t *zh, int count, const zoo_op_t *ops, zoo_op_result_t *re
    
     rc = zoo_amulti(zh, count, ops, results, SYNCHRONOUS_MARKER, sc);
     if (rc == ZOK) {
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
     }
     free_sync_completion(sc);
 
@@ -3296,12 +4554,13 @@ int zoo_multi(zhandle_t *zh, int count, const zoo_op_t *ops, zoo_op_result_t *re
 int flush_send_queue(zhandle_t*zh, int timeout)
 {
     int rc= ZOK;
-    struct timeval started;
+    /* in the IO loop, zookeeper_process has just read the clock */
+    int64_t now = timeout == 0 && zh->now_fresh ? zh->now : zk_clock_us();
+    int64_t started = now / 1000;
 #ifdef WIN32
     fd_set pollSet; 
     struct timeval wait;
 #endif
-    gettimeofday(&started,0);
     // we can't use dequeue_buffer() here because if (non-blocking) send_buffer()
     // returns EWOULDBLOCK we'd have to put the buffer back on the queue.
     // we use a recursive lock instead and only dequeue the buffer if a send was
@@ -3309,10 +4568,7 @@ int flush_send_queue(zhandle_t*zh, int timeout)
     lock_buffer_list(&zh->to_send);
     while (zh->to_send.head != 0&& zh->state == ZOO_CONNECTED_STATE) {
         if(timeout!=0){
-            int elapsed;
-            struct timeval now;
-            gettimeofday(&now,0);
-            elapsed=calculate_interval(&started,&now);
+            int elapsed = (int)(zk_clock_us() / 1000 - started);
             if (elapsed>timeout) {
                 rc = ZOPERATIONTIMEOUT;
                 break;
@@ -3349,9 +4605,13 @@ int flush_send_queue(zhandle_t*zh, int timeout)
             break;
         }
         // if the buffer has been sent successfully, remove it from the queue
-        if (rc > 0)
+        if (rc > 0) {
+            ZK_PROBE4(frame__sent, zh, header_int(zh->to_send.head->buffer, 0),
+                    header_int(zh->to_send.head->buffer, 1),
+                    zh->to_send.head->len);
             remove_buffer(&zh->to_send);
-        gettimeofday(&zh->last_send, 0);
+        }
+        zh->last_send = (timeout != 0 ? zk_clock_us() : now) / 1000;
         rc = ZOK;
     }
     unlock_buffer_list(&zh->to_send);
@@ -3504,6 +4764,158 @@ void zoo_deterministic_conn_order(int yesOrNo)
     disable_conn_permute=yesOrNo;
 }
 
+void zoo_set_client_zone(const char *zone)
+{
+    free(client_zone);
+    client_zone = zone ? strdup(zone) : 0;
+}
+
+int zoo_set_server_selection(zhandle_t *zh, int policy, int rebalance_interval)
+{
+    if (zh == 0 || (policy != ZOO_SELECT_RANDOM && policy != ZOO_SELECT_LATENCY))
+        return ZBADARGUMENTS;
+    zh->server_selection = policy;
+    zh->rebalance_interval = rebalance_interval > 0 ? rebalance_interval : 0;
+    return ZOK;
+}
+
+int zoo_set_request_timeout(zhandle_t *zh, int timeout)
+{
+    if (zh == 0 || timeout < 0)
+        return ZBADARGUMENTS;
+    zh->request_timeout = timeout;
+    return ZOK;
+}
+
+int zoo_set_read_coalescing(zhandle_t *zh, int enable)
+{
+    int rc = ZOK;
+
+    if (zh == 0)
+        return ZBADARGUMENTS;
+    lock_completion_list(&zh->sent_requests);
+    if (enable && !zh->reads_in_flight) {
+        zh->reads_in_flight = create_reads_in_flight();
+        rc = zh->reads_in_flight ? ZOK : ZSYSTEMERROR;
+    } else if (!enable && zh->reads_in_flight) {
+        /* the reads that joined a request still complete with it */
+        hashtable_destroy(zh->reads_in_flight, 0);
+        zh->reads_in_flight = NULL;
+    }
+    unlock_completion_list(&zh->sent_requests);
+    return rc;
+}
+
+int zoo_set_compression(zhandle_t *zh, int min_size)
+{
+    if (zh == 0 || min_size < 0)
+        return ZBADARGUMENTS;
+    zh->compress_min = min_size;
+    return ZOK;
+}
+
+int zoo_set_watcher_coalescing(zhandle_t *zh, watcher_fn watcher,
+        void *context, int window)
+{
+    watch_window_t **pw, *w;
+    int rc = ZOK;
+
+    if (zh == 0 || watcher == 0)
+        return ZBADARGUMENTS;
+    lock_completion_list(&zh->completions_to_process);
+    for (pw = &zh->watch_windows; *pw; pw = &(*pw)->next) {
+        if ((*pw)->watcher == watcher && (*pw)->context == context)
+            break;
+    }
+    if (window < 0) {
+        /* the deliveries already coalescing are still made */
+        if ((w = *pw) != 0) {
+            *pw = w->next;
+            free(w);
+        }
+    } else if (*pw) {
+        (*pw)->window = window;
+    } else if ((w = calloc(1, sizeof(*w))) != 0) {
+        w->watcher = watcher;
+        w->context = context;
+        w->window = window;
+        *pw = w;
+    } else {
+        rc = ZSYSTEMERROR;
+    }
+    unlock_completion_list(&zh->completions_to_process);
+    return rc;
+}
+
+int zoo_coalesced_events(zhandle_t *zh)
+{
+    return zh != 0 && zh->coalesced_events > 0 ? zh->coalesced_events : 1;
+}
+
+int zoo_set_latency_thresholds(zhandle_t *zh, int loop_lag, int frame_delay,
+        int callback)
+{
+    if (zh == 0 || loop_lag < 0 || frame_delay < 0 || callback < 0)
+        return ZBADARGUMENTS;
+    zh->lag_threshold = loop_lag;
+    zh->frame_delay_threshold = frame_delay;
+    zh->callback_threshold = callback;
+    return ZOK;
+}
+
+int zoo_get_latency_stats(zhandle_t *zh, zoo_latency_stats_t *stats)
+{
+    if (zh == 0 || stats == 0)
+        return ZBADARGUMENTS;
+    lock_completion_list(&zh->completions_to_process);
+    *stats = zh->latency;
+    unlock_completion_list(&zh->completions_to_process);
+    return ZOK;
+}
+
+int zoo_set_path_sampling(zhandle_t *zh, double rate, int top)
+{
+    int rc = ZOK;
+
+    if (zh == 0 || !(rate >= 0 && rate <= 1) || top < 0 ||
+            (rate > 0 && top == 0))
+        return ZBADARGUMENTS;
+    /* the profile is kept until the handle is destroyed: the request sites
+     * and the IO thread use it without the critical section */
+    enter_critical(zh);
+    if (zh->hotpaths) {
+        rc = zk_hotpaths_reset(zh->hotpaths, rate, top);
+    } else if (rate > 0) {
+        zh->hotpaths = zk_hotpaths_create(rate, top);
+        rc = zh->hotpaths ? ZOK : ZSYSTEMERROR;
+    }
+    leave_critical(zh);
+    return rc;
+}
+
+int zoo_get_hot_paths(zhandle_t *zh, zoo_hot_path_t *paths, int *count)
+{
+    int n = 0;
+
+    if (zh == 0 || paths == 0 || count == 0 || *count < 0)
+        return ZBADARGUMENTS;
+    if (zh->hotpaths)
+        n = zk_hotpaths_top(zh->hotpaths, paths, *count);
+    if (n < 0)
+        return ZSYSTEMERROR;
+    *count = n;
+    return ZOK;
+}
+
+void zoo_free_hot_paths(zoo_hot_path_t *paths, int count)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        free(paths[i].path);
+        paths[i].path = 0;
+    }
+}
+
 /*---------------------------------------------------------------------------*
  * SYNC API
  *---------------------------------------------------------------------------*/
@@ -3520,8 +4932,7 @@ int zoo_create(zhandle_t *zh, const char *path, const char *value,
     sc->u.str.str_len = path_buffer_len;
     rc=zoo_acreate(zh, path, value, valuelen, acl, flags, SYNCHRONOUS_MARKER, sc);
     if(rc==ZOK){
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
     }
     free_sync_completion(sc);
     return rc;
@@ -3536,8 +4947,7 @@ int zoo_delete(zhandle_t *zh, const char *path, int version)
     }
     rc=zoo_adelete(zh, path, version, SYNCHRONOUS_MARKER, sc);
     if(rc==ZOK){
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
     }
     free_sync_completion(sc);
     return rc;
@@ -3558,8 +4968,7 @@ int zoo_wexists(zhandle_t *zh, const char *path,
     }
     rc=zoo_awexists(zh,path,watcher,watcherCtx,SYNCHRONOUS_MARKER, sc);
     if(rc==ZOK){
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
         if (rc == 0&& stat) {
             *stat = sc->u.stat;
         }
@@ -3591,8 +5000,7 @@ int zoo_wget(zhandle_t *zh, const char *path,
     sc->u.data.buff_len = *buffer_len;
     rc=zoo_awget(zh, path, watcher, watcherCtx, SYNCHRONOUS_MARKER, sc);
     if(rc==ZOK){
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
         if (rc == 0) {
             if(stat)
                 *stat = sc->u.data.stat;
@@ -3619,8 +5027,7 @@ int zoo_set2(zhandle_t *zh, const char *path, const char *buffer, int buflen,
     }
     rc=zoo_aset(zh, path, buffer, buflen, version, SYNCHRONOUS_MARKER, sc);
     if(rc==ZOK){
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
         if (rc == 0 && stat) {
             *stat = sc->u.stat;
         }
@@ -3631,21 +5038,21 @@ int zoo_set2(zhandle_t *zh, const char *path, const char *buffer, int buflen,
 
 static int zoo_wget_children_(zhandle_t *zh, const char *path,
         watcher_fn watcher, void* watcherCtx,
-        struct String_vector *strings)
+        struct String_vector *strings, zoo_arena_t *arena)
 {
     struct sync_completion *sc = alloc_sync_completion();
     int rc;
     if (!sc) {
         return ZSYSTEMERROR;
     }
+    sc->arena = arena;
     rc= zoo_awget_children (zh, path, watcher, watcherCtx, SYNCHRONOUS_MARKER, sc);
     if(rc==ZOK){
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
         if (rc == 0) {
             if (strings) {
                 *strings = sc->u.strs2;
-            } else {
+            } else if (!arena) {
                 deallocate_String_vector(&sc->u.strs2);
             }
         }
@@ -3656,23 +5063,23 @@ static int zoo_wget_children_(zhandle_t *zh, const char *path,
 
 static int zoo_wget_children2_(zhandle_t *zh, const char *path,
         watcher_fn watcher, void* watcherCtx,
-        struct String_vector *strings, struct Stat *stat)
+        struct String_vector *strings, struct Stat *stat, zoo_arena_t *arena)
 {
     struct sync_completion *sc = alloc_sync_completion();
     int rc;
     if (!sc) {
         return ZSYSTEMERROR;
     }
+    sc->arena = arena;
     rc= zoo_awget_children2(zh, path, watcher, watcherCtx, SYNCHRONOUS_MARKER, sc);
 
     if(rc==ZOK){
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
         if (rc == 0) {
             *stat = sc->u.strs_stat.stat2;
             if (strings) {
                 *strings = sc->u.strs_stat.strs2;
-            } else {
+            } else if (!arena) {
                 deallocate_String_vector(&sc->u.strs_stat.strs2);
             }
         }
@@ -3684,48 +5091,62 @@ static int zoo_wget_children2_(zhandle_t *zh, const char *path,
 int zoo_get_children(zhandle_t *zh, const char *path, int watch,
         struct String_vector *strings)
 {
-    return zoo_wget_children_(zh,path,watch?zh->watcher:0,zh->context,strings);
+    return zoo_wget_children_(zh,path,watch?zh->watcher:0,zh->context,strings,0);
 }
 
 int zoo_wget_children(zhandle_t *zh, const char *path,
         watcher_fn watcher, void* watcherCtx,
         struct String_vector *strings)
 {
-    return zoo_wget_children_(zh,path,watcher,watcherCtx,strings);
+    return zoo_wget_children_(zh,path,watcher,watcherCtx,strings,0);
+}
+
+int zoo_get_children_arena(zhandle_t *zh, const char *path, int watch,
+        struct String_vector *strings, zoo_arena_t *arena)
+{
+    return zoo_wget_children_(zh,path,watch?zh->watcher:0,zh->context,strings,
+            arena);
 }
 
 int zoo_get_children2(zhandle_t *zh, const char *path, int watch,
         struct String_vector *strings, struct Stat *stat)
 {
-    return zoo_wget_children2_(zh,path,watch?zh->watcher:0,zh->context,strings,stat);
+    return zoo_wget_children2_(zh,path,watch?zh->watcher:0,zh->context,strings,stat,0);
 }
 
 int zoo_wget_children2(zhandle_t *zh, const char *path,
         watcher_fn watcher, void* watcherCtx,
         struct String_vector *strings, struct Stat *stat)
 {
-    return zoo_wget_children2_(zh,path,watcher,watcherCtx,strings,stat);
+    return zoo_wget_children2_(zh,path,watcher,watcherCtx,strings,stat,0);
 }
 
-int zoo_get_acl(zhandle_t *zh, const char *path, struct ACL_vector *acl,
-        struct Stat *stat)
+int zoo_get_children2_arena(zhandle_t *zh, const char *path, int watch,
+        struct String_vector *strings, struct Stat *stat, zoo_arena_t *arena)
+{
+    return zoo_wget_children2_(zh,path,watch?zh->watcher:0,zh->context,strings,
+            stat,arena);
+}
+
+static int zoo_get_acl_(zhandle_t *zh, const char *path, struct ACL_vector *acl,
+        struct Stat *stat, zoo_arena_t *arena)
 {
     struct sync_completion *sc = alloc_sync_completion();
     int rc;
     if (!sc) {
         return ZSYSTEMERROR;
     }
+    sc->arena = arena;
     rc=zoo_aget_acl(zh, path, SYNCHRONOUS_MARKER, sc);
     if(rc==ZOK){
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
         if (rc == 0&& stat) {
             *stat = sc->u.acl.stat;
         }
         if (rc == 0) {
             if (acl) {
                 *acl = sc->u.acl.acl;
-            } else {
+            } else if (!arena) {
                 deallocate_ACL_vector(&sc->u.acl.acl);
             }
         }
@@ -3734,6 +5155,18 @@ int zoo_get_acl(zhandle_t *zh, const char *path, struct ACL_vector *acl,
     return rc;
 }
 
+int zoo_get_acl(zhandle_t *zh, const char *path, struct ACL_vector *acl,
+        struct Stat *stat)
+{
+    return zoo_get_acl_(zh, path, acl, stat, 0);
+}
+
+int zoo_get_acl_arena(zhandle_t *zh, const char *path, struct ACL_vector *acl,
+        struct Stat *stat, zoo_arena_t *arena)
+{
+    return zoo_get_acl_(zh, path, acl, stat, arena);
+}
+
 int zoo_set_acl(zhandle_t *zh, const char *path, int version,
         const struct ACL_vector *acl)
 {
@@ -3745,8 +5178,7 @@ int zoo_set_acl(zhandle_t *zh, const char *path, int version,
     rc=zoo_aset_acl(zh, path, version, (struct ACL_vector*)acl,
             SYNCHRONOUS_MARKER, sc);
     if(rc==ZOK){
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
     }
     free_sync_completion(sc);
     return rc;
@@ -3770,8 +5202,7 @@ static int queue_sasl_request(zhandle_t *zh, const char *data, unsigned len, voi
 
     enter_critical(zh);
     rc = rc < 0 ? rc : add_sasl_completion(zh, h.xid, cptr, ctx, NULL);
-    rc = rc < 0 ? rc : queue_buffer_bytes(&zh->to_send, get_buffer(oa),
-            get_buffer_len(oa));
+    rc = rc < 0 ? rc : queue_request(zh, &h, 0, oa);
     leave_critical(zh);
     close_buffer_oarchive(&oa, 0);
 
@@ -3793,8 +5224,7 @@ int zoo_sasl(zhandle_t *zh, zoo_sasl_conn_t *conn, const char *clientout,
     rc = queue_sasl_request(zh, clientout, clientoutlen, SYNCHRONOUS_MARKER, sc);
 
     if(rc==ZOK){
-        wait_sync_completion(sc);
-        rc = sc->rc;
+        rc = wait_sync_result(zh, sc);
         if(rc == ZOK && sc->u.sasl.token_len > 0) {
             *serverin = sc->u.sasl.token;
             *serverinlen = sc->u.sasl.token_len;
@@ -320,3 +320,17 @@ int gettimeofday(struct timeval *tp, GETTIMEOFDAY_ARG2_TYPE tzp){
 
 Mock_gettimeofday* Mock_gettimeofday::mock_=0;
 
+// *****************************************************************************
+// clock_gettime
+// the client keeps its deadlines on the monotonic clock: make it follow
+// the mocked time of day
+int clock_gettime(clockid_t clk_id, struct timespec *tp){
+    if (!Mock_gettimeofday::mock_)
+        return LIBC_SYMBOLS.clock_gettime(clk_id,tp);
+    timeval tv;
+    Mock_gettimeofday::mock_->call(&tv,0);
+    tp->tv_sec=tv.tv_sec;
+    tp->tv_nsec=tv.tv_usec*1000;
+    return 0;
+}
+
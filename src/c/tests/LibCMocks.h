@@ -405,4 +405,10 @@ inline int32_t toMilliseconds(const timeval& tv){
     return tv.tv_sec*1000+tv.tv_usec/1000;    
 }
 
+// compares with a time kept by the client, in milliseconds of the
+// (mocked) monotonic clock
+inline bool operator==(const timeval& lhs, int64_t ms){
+    return (int64_t)lhs.tv_sec*1000+lhs.tv_usec/1000==ms;
+}
+
 #endif /*LIBCMOCKS_H_*/
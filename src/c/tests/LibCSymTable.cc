@@ -51,6 +51,7 @@ LibCSymTable::LibCSymTable()
     LOAD_SYM(select);
     LOAD_SYM(poll);
     LOAD_SYM(gettimeofday);
+    LOAD_SYM(clock_gettime);
 #ifdef THREADED
     LOAD_SYM(pthread_create);
     LOAD_SYM(pthread_detach);
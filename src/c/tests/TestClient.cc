@@ -36,6 +36,7 @@ using namespace std;
 #include <list>
 
 #include <zookeeper.h>
+#include <zookeeper_pool.h>
 #include <errno.h>
 #include <recordio.h>
 #include "Util.h"
@@ -190,6 +191,8 @@ class Zookeeper_simpleSystem : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST_SUITE(Zookeeper_simpleSystem);
     CPPUNIT_TEST(testAsyncWatcherAutoReset);
     CPPUNIT_TEST(testDeserializeString);
+    CPPUNIT_TEST(testDeserializeArena);
+    CPPUNIT_TEST(testFixedLayoutRecords);
 #ifdef THREADED
     CPPUNIT_TEST(testNullData);
 #ifdef ZOO_IPV6_ENABLED
@@ -205,6 +208,7 @@ class Zookeeper_simpleSystem : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testWatcherAutoResetWithGlobal);
     CPPUNIT_TEST(testWatcherAutoResetWithLocal);
     CPPUNIT_TEST(testGetChildren2);
+    CPPUNIT_TEST(testPool);
     CPPUNIT_TEST(testSasl);
 #endif
     CPPUNIT_TEST_SUITE_END();
@@ -548,6 +552,68 @@ public:
         rc = ia->deserialize_String(ia, "string", &val_str);
         CPPUNIT_ASSERT_EQUAL(-EINVAL, rc);
     }
+
+    void testDeserializeArena() {
+        char *names[] = { (char*)"a", (char*)"bb", (char*)"ccc" };
+        struct String_vector in = { 3, names };
+        struct String_vector out;
+        struct iarchive *ia;
+        struct buff_struct_2 *b;
+        struct oarchive *oa = create_buffer_oarchive();
+        zoo_arena_t *arena = zoo_arena_create(16);
+        CPPUNIT_ASSERT(arena != 0);
+        CPPUNIT_ASSERT_EQUAL(0, serialize_String_vector(oa, "v", &in));
+        b = (struct buff_struct_2 *) oa->priv;
+        for (int i = 0; i < 2; i++) {
+            ia = create_buffer_iarchive(b->buffer, b->off);
+            ia->arena = arena;
+            CPPUNIT_ASSERT_EQUAL(0, deserialize_String_vector(ia, "v", &out));
+            close_buffer_iarchive(&ia);
+            CPPUNIT_ASSERT_EQUAL(3, out.count);
+            CPPUNIT_ASSERT_EQUAL(std::string("a"), std::string(out.data[0]));
+            CPPUNIT_ASSERT_EQUAL(std::string("bb"), std::string(out.data[1]));
+            CPPUNIT_ASSERT_EQUAL(std::string("ccc"), std::string(out.data[2]));
+            // the whole result goes away with the reset
+            zoo_arena_reset(arena);
+        }
+        zoo_arena_destroy(arena);
+        close_buffer_oarchive(&oa, 1);
+    }
+
+    void testFixedLayoutRecords() {
+        struct ReplyHeader h = { 0x01020304, 0x05060708090a0b0cLL, -101 };
+        struct ReplyHeader out;
+        struct oarchive *oa = create_buffer_oarchive();
+        struct oarchive *fields = create_buffer_oarchive();
+        struct iarchive *ia;
+        struct buff_struct_2 *b;
+        struct buff_struct_2 *fb;
+        // the inlined encoder writes what the field by field one does
+        CPPUNIT_ASSERT_EQUAL(0, serialize_ReplyHeader(oa, "hdr", &h));
+        fields->serialize_Int(fields, "xid", &h.xid);
+        fields->serialize_Long(fields, "zxid", &h.zxid);
+        fields->serialize_Int(fields, "err", &h.err);
+        b = (struct buff_struct_2 *) oa->priv;
+        fb = (struct buff_struct_2 *) fields->priv;
+        CPPUNIT_ASSERT_EQUAL(16, b->off);
+        CPPUNIT_ASSERT_EQUAL(fb->off, b->off);
+        CPPUNIT_ASSERT(memcmp(b->buffer, fb->buffer, b->off) == 0);
+        CPPUNIT_ASSERT_EQUAL((int64_t)0x0c0b0a0908070605LL,
+                htonll(0x05060708090a0b0cLL));
+
+        ia = create_buffer_iarchive(b->buffer, b->off);
+        CPPUNIT_ASSERT_EQUAL(0, deserialize_ReplyHeader(ia, "hdr", &out));
+        close_buffer_iarchive(&ia);
+        CPPUNIT_ASSERT_EQUAL(h.xid, out.xid);
+        CPPUNIT_ASSERT_EQUAL(h.zxid, out.zxid);
+        CPPUNIT_ASSERT_EQUAL(h.err, out.err);
+        // a truncated record is still rejected
+        ia = create_buffer_iarchive(b->buffer, b->off - 1);
+        CPPUNIT_ASSERT(deserialize_ReplyHeader(ia, "hdr", &out) != 0);
+        close_buffer_iarchive(&ia);
+        close_buffer_oarchive(&oa, 1);
+        close_buffer_oarchive(&fields, 1);
+    }
         
     void testAcl() {
         int rc;
@@ -726,6 +792,67 @@ public:
         CPPUNIT_ASSERT(stat_a.numChildren == 4);
     }
 
+    static void poolStringCompletion(int rc, const char *value,
+            const void *data) {
+        *(int *)data = rc;
+    }
+
+    static void poolDataCompletion(int rc, const char *value, int value_len,
+            const struct Stat *stat, const void *data) {
+        *(int *)data = rc == ZOK && value_len == 2 && !memcmp(value, "hi", 2)
+            ? ZOK : ZSYSTEMERROR;
+    }
+
+    void testPool() {
+        zoo_pool_t *pool = zoo_pool_init(hostPorts, 2, NULL, 10000, NULL, 0);
+        CPPUNIT_ASSERT(pool);
+        CPPUNIT_ASSERT_EQUAL(2, zoo_pool_size(pool));
+
+        zoo_pool_stats_t stats;
+        time_t expires = time(0) + 10;
+        do {
+            sleep(1);
+            CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_pool_get_stats(pool, -1, &stats));
+        } while (stats.connected < 2 && time(0) < expires);
+        CPPUNIT_ASSERT_EQUAL(2, stats.connected);
+
+        int created = -1;
+        int rc = zoo_pool_acreate(pool, "/pool", "hi", 2, &ZOO_OPEN_ACL_UNSAFE,
+                0, poolStringCompletion, &created);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, rc);
+        // reads of the path on its session are ordered after the create
+        int got[4] = {-1, -1, -1, -1};
+        rc = zoo_pool_aget(pool, "/pool", 1, poolDataCompletion, &got[0]);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, rc);
+        rc = zoo_pool_aget(pool, "/pool/..", 0, poolDataCompletion, &got[1]);
+        CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS, rc);
+        expires = time(0) + 10;
+        while ((created == -1 || got[0] == -1) && time(0) < expires)
+            sleep(1);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, created);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, got[0]);
+        for (int i = 1; i < 4; i++) {
+            rc = zoo_pool_aget(pool, "/pool", 0, poolDataCompletion, &got[i]);
+            CPPUNIT_ASSERT_EQUAL((int)ZOK, rc);
+        }
+        expires = time(0) + 10;
+        while ((got[1] == -1 || got[2] == -1 || got[3] == -1)
+                && time(0) < expires)
+            sleep(1);
+
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_pool_get_stats(pool, -1, &stats));
+        CPPUNIT_ASSERT_EQUAL(0, stats.outstanding);
+        CPPUNIT_ASSERT_EQUAL((int64_t)1, stats.writes);
+        CPPUNIT_ASSERT_EQUAL((int64_t)4, stats.reads);
+        CPPUNIT_ASSERT_EQUAL((int64_t)5, stats.completed);
+        CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS,
+                zoo_pool_get_stats(pool, 2, &stats));
+        CPPUNIT_ASSERT(zoo_pool_key_handle(pool, "/pool") ==
+                zoo_pool_handle(pool, 0) ||
+                zoo_pool_key_handle(pool, "/pool") == zoo_pool_handle(pool, 1));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_pool_close(pool));
+    }
+
     void testIPV6() {
         watchctx_t ctx;
         zhandle_t *zk = createClient("::1:22181", &ctx);
@@ -0,0 +1,201 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+#include "CppAssertHelper.h"
+
+// zookeeper.hpp needs C++17; its futures need the IO thread of zookeeper_mt
+#if defined(THREADED) && __cplusplus >= 201703L
+
+#include <zookeeper.hpp>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "Util.h"
+
+using namespace std;
+
+class Zookeeper_cxxClient : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(Zookeeper_cxxClient);
+    CPPUNIT_TEST(testFutures);
+    CPPUNIT_TEST(testPipelinedGets);
+    CPPUNIT_TEST(testWatch);
+#ifdef ZOOKEEPER_HPP_COROUTINES
+    CPPUNIT_TEST(testCoroutine);
+#endif
+    CPPUNIT_TEST_SUITE_END();
+
+    static const char hostPorts[];
+    FILE *logfile;
+
+    unique_ptr<zk::client> createClient() {
+        unique_ptr<zk::client> c = zk::client::init(hostPorts, 10000);
+        CPPUNIT_ASSERT(c);
+        for (int i = 0; i < 100 && c->state() != ZOO_CONNECTED_STATE; i++)
+            millisleep(100);
+        CPPUNIT_ASSERT_EQUAL((int)ZOO_CONNECTED_STATE, c->state());
+        return c;
+    }
+
+public:
+    Zookeeper_cxxClient() {
+      logfile = openlogfile("Zookeeper_cxxClient");
+    }
+
+    ~Zookeeper_cxxClient() {
+      if (logfile) {
+        fflush(logfile);
+        fclose(logfile);
+        logfile = 0;
+      }
+    }
+
+    void setUp()
+    {
+        zoo_set_log_stream(logfile);
+    }
+
+    void tearDown()
+    {
+    }
+
+    void testFutures()
+    {
+        unique_ptr<zk::client> c = createClient();
+        zk::result<string> created = c->create("/cxx1", "hello").get();
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, created.code());
+        CPPUNIT_ASSERT_EQUAL(string("/cxx1"), created.value());
+        CPPUNIT_ASSERT_EQUAL((int)ZNODEEXISTS,
+                c->create("/cxx1", "").get().code());
+
+        zk::result<zk::node> n = c->get("/cxx1").get();
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, n.code());
+        CPPUNIT_ASSERT_EQUAL(string("hello"), string(n->data.view()));
+        CPPUNIT_ASSERT_EQUAL(5, n->stat.dataLength);
+
+        zk::result<Stat> s = c->set("/cxx1", "", n->stat.version).get();
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, s.code());
+        CPPUNIT_ASSERT_EQUAL(n->stat.version + 1, s->version);
+        n = c->get("/cxx1").get();
+        CPPUNIT_ASSERT(!n->data.is_null());
+        CPPUNIT_ASSERT_EQUAL((size_t)0, n->data.size());
+
+        zk::result<vector<string> > kids = c->children("/").get();
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, kids.code());
+        CPPUNIT_ASSERT(find(kids->begin(), kids->end(), "cxx1") != kids->end());
+
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, c->remove("/cxx1").get().code());
+        CPPUNIT_ASSERT_EQUAL((int)ZNONODE, c->exists("/cxx1").get().code());
+        // the errors of the zoo_a* call itself come back the same way
+        CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS, c->get("cxx1").get().code());
+    }
+
+    void testPipelinedGets()
+    {
+        unique_ptr<zk::client> c = createClient();
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, c->create("/cxx2", "data").get().code());
+        vector<future<zk::result<zk::node> > > gets;
+        for (int i = 0; i < 1000; i++)
+            gets.push_back(c->get("/cxx2"));
+        for (size_t i = 0; i < gets.size(); i++) {
+            zk::result<zk::node> n = gets[i].get();
+            CPPUNIT_ASSERT_EQUAL((int)ZOK, n.code());
+            CPPUNIT_ASSERT_EQUAL(string("data"), string(n->data.view()));
+        }
+    }
+
+    // a watch is called once; a cancelled or destroyed one never is
+    void testWatch()
+    {
+        unique_ptr<zk::client> c = createClient();
+        atomic<int> changed(0), cancelled(0);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, c->create("/cxx3", "").get().code());
+        {
+            zk::watch w([&](const zk::event &e) {
+                if (e.type == ZOO_CHANGED_EVENT && e.path == "/cxx3")
+                    changed++;
+            });
+            zk::watch gone([&](const zk::event &) { cancelled++; });
+            CPPUNIT_ASSERT_EQUAL((int)ZOK, c->get("/cxx3", w).get().code());
+            CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                    c->exists("/cxx3", gone).get().code());
+            gone.cancel();
+            CPPUNIT_ASSERT(!gone.active());
+            CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS,
+                    c->exists("/cxx3", gone).get().code());
+
+            CPPUNIT_ASSERT_EQUAL((int)ZOK, c->set("/cxx3", "1").get().code());
+            for (int i = 0; i < 50 && changed == 0; i++)
+                millisleep(100);
+            CPPUNIT_ASSERT_EQUAL(1, changed.load());
+
+            zk::watch destroyed([&](const zk::event &) { cancelled++; });
+            CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                    c->exists("/cxx3", destroyed).get().code());
+        }
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, c->set("/cxx3", "2").get().code());
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, c->sync("/cxx3").get().code());
+        CPPUNIT_ASSERT_EQUAL(1, changed.load());
+        CPPUNIT_ASSERT_EQUAL(0, cancelled.load());
+    }
+
+#ifdef ZOOKEEPER_HPP_COROUTINES
+    struct task {
+        struct promise_type {
+            task get_return_object() { return task(); }
+            suspend_never initial_suspend() { return suspend_never(); }
+            suspend_never final_suspend() noexcept { return suspend_never(); }
+            void return_void() {}
+            void unhandled_exception() { terminate(); }
+        };
+    };
+
+    static task readAll(zk::client *c, atomic<int> *bytes)
+    {
+        zk::result<string> created = co_await c->co_create("/cxx4", "abc");
+        if (!created)
+            co_return;
+        for (int i = 0; i < 100; i++) {
+            // the view is valid until the next co_await
+            zk::result<zk::data_view> v = co_await c->co_get("/cxx4");
+            *bytes += v.code() == ZOK ? v->data.size() : 0;
+        }
+        co_await c->co_remove("/cxx4");
+        *bytes += 1;
+    }
+
+    void testCoroutine()
+    {
+        unique_ptr<zk::client> c = createClient();
+        atomic<int> bytes(0);
+        readAll(c.get(), &bytes);
+        for (int i = 0; i < 100 && bytes != 301; i++)
+            millisleep(100);
+        CPPUNIT_ASSERT_EQUAL(301, bytes.load());
+        CPPUNIT_ASSERT_EQUAL((int)ZNONODE, c->exists("/cxx4").get().code());
+    }
+#endif
+};
+
+const char Zookeeper_cxxClient::hostPorts[] = "127.0.0.1:22181";
+CPPUNIT_TEST_SUITE_REGISTRATION(Zookeeper_cxxClient);
+
+#endif
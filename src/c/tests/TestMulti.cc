@@ -177,6 +177,7 @@ class Zookeeper_multi : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testMultiFail);
     CPPUNIT_TEST(testCheck);
     CPPUNIT_TEST(testWatch);
+    CPPUNIT_TEST(testDeleteRecursive);
 #endif
     CPPUNIT_TEST_SUITE_END();
 
@@ -646,6 +647,78 @@ public:
         // wait for multi completion in doMultiInWatch
         waitForMultiCompletion(5);
      }
+
+    struct DeleteRecursive {
+        DeleteRecursive() : done(false), rc(ZAPIERROR), deleted(0),
+            failed(0), progress(0), found(0) {}
+        volatile bool done;
+        int rc;
+        int64_t deleted;
+        int failed;
+        int progress;
+        int64_t found;
+    };
+
+    static void delete_progress_fn(int64_t deleted, int64_t found,
+            const void *data) {
+        DeleteRecursive *d = (DeleteRecursive *) data;
+        d->progress++;
+        d->found = found;
+    }
+
+    static void delete_recursive_fn(int rc, int64_t deleted,
+            const struct String_vector *failed, const void *data) {
+        DeleteRecursive *d = (DeleteRecursive *) data;
+        d->rc = rc;
+        d->deleted = deleted;
+        d->failed = failed->count;
+        d->done = true;
+    }
+
+    /**
+     * Test the pipelined recursive delete
+     */
+    void testDeleteRecursive() {
+        watchctx_t ctx;
+        zhandle_t *zk = createClient(&ctx);
+        char path[64];
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_create(zk, "/multirec", "", 0,
+                &ZOO_OPEN_ACL_UNSAFE, 0, 0, 0));
+        for (int i = 0; i < 3; i++) {
+            sprintf(path, "/multirec/%d", i);
+            CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_create(zk, path, "", 0,
+                    &ZOO_OPEN_ACL_UNSAFE, 0, 0, 0));
+            for (int j = 0; j < 20; j++) {
+                sprintf(path, "/multirec/%d/%d", i, j);
+                CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_create(zk, path, "", 0,
+                        &ZOO_OPEN_ACL_UNSAFE, 0, 0, 0));
+            }
+        }
+        CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS, zoo_adelete_recursive(zk,
+                "/", 0, 0, 0, delete_recursive_fn, 0));
+
+        DeleteRecursive d;
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_adelete_recursive(zk, "/multirec",
+                7, 4, delete_progress_fn, delete_recursive_fn, &d));
+        for (int i = 0; i < 100 && !d.done; i++)
+            millisleep(100);
+        CPPUNIT_ASSERT(d.done);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, d.rc);
+        CPPUNIT_ASSERT_EQUAL((int64_t)64, d.deleted);
+        CPPUNIT_ASSERT_EQUAL((int64_t)64, d.found);
+        CPPUNIT_ASSERT_EQUAL(0, d.failed);
+        CPPUNIT_ASSERT(d.progress >= 64 / 7);
+        CPPUNIT_ASSERT_EQUAL((int)ZNONODE, zoo_exists(zk, "/multirec", 0, 0));
+
+        DeleteRecursive missing;
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_adelete_recursive(zk, "/multirec",
+                0, 0, 0, delete_recursive_fn, &missing));
+        for (int i = 0; i < 100 && !missing.done; i++)
+            millisleep(100);
+        CPPUNIT_ASSERT_EQUAL((int)ZNONODE, missing.rc);
+        CPPUNIT_ASSERT_EQUAL((int64_t)0, missing.deleted);
+        CPPUNIT_ASSERT_EQUAL(0, missing.failed);
+    }
 };
 
 volatile int Zookeeper_multi::count;
@@ -20,6 +20,7 @@
 #include "CppAssertHelper.h"
 
 #include "ZKMocks.h"
+#include "src/zk_lz.h"
 #include <proto.h>
 
 using namespace std;
@@ -31,6 +32,13 @@ class Zookeeper_operations : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testPing);
     CPPUNIT_TEST(testTimeoutCausedByWatches1);
     CPPUNIT_TEST(testTimeoutCausedByWatches2);
+    CPPUNIT_TEST(testRequestTimeout);
+    CPPUNIT_TEST(testIoCallbacks);
+    CPPUNIT_TEST(testLatencyStats);
+    CPPUNIT_TEST(testInflight);
+    CPPUNIT_TEST(testHotPaths);
+    CPPUNIT_TEST(testReadCoalescing);
+    CPPUNIT_TEST(testCompression);
 #else    
     CPPUNIT_TEST(testAsyncWatcher1);
     CPPUNIT_TEST(testAsyncGetOperation);
@@ -38,6 +46,8 @@ class Zookeeper_operations : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testOperationsAndDisconnectConcurrently1);
     CPPUNIT_TEST(testOperationsAndDisconnectConcurrently2);
     CPPUNIT_TEST(testConcurrentOperations1);
+    CPPUNIT_TEST(testFramePool);
+    CPPUNIT_TEST(testPathValidation);
     CPPUNIT_TEST_SUITE_END();
     zhandle_t *zh;
     FILE *logfile;
@@ -409,6 +419,422 @@ public:
         CPPUNIT_ASSERT_EQUAL((int32_t)TIMEOUT/3*1000,toMilliseconds(now-beginningOfTimes));
     }
 
+    // leave a request unanswered for longer than the request timeout
+    // verify the connection is given up and the request completes
+    void testRequestTimeout()
+    {
+        const int TIMEOUT=9; // timeout in secs
+        Mock_gettimeofday timeMock;
+        ZookeeperServer zkServer;
+        // must call zookeeper_close() while all the mocks are in scope
+        CloseFinally guard(&zh);
+        
+        zh=zookeeper_init("localhost:1234",watcher,TIMEOUT*1000,TEST_CLIENT_ID,0,0);
+        CPPUNIT_ASSERT(zh!=0);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_set_request_timeout(zh,500));
+        // simulate connected state
+        forceConnected(zh);
+        
+        int fd=0;
+        int interest=0;
+        timeval tv;
+        // the server never responds to this request
+        AsyncGetOperationCompletion res1;
+        int rc=zoo_aget(zh,"/x/y/1",0,asyncCompletion,&res1);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        // Round 1.
+        // the client must wake up when the request times out, well before
+        // a ping or the receive timeout is due
+        rc=zookeeper_interest(zh,&fd,&interest,&tv);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        CPPUNIT_ASSERT_EQUAL(500,toMilliseconds(tv));
+        timeMock.tick(tv);
+        rc=zookeeper_process(zh,interest);
+        CPPUNIT_ASSERT_EQUAL((int)ZNOTHING,rc);
+        CPPUNIT_ASSERT(!res1());
+        
+        // Round 2.
+        // the request has timed out
+        rc=zookeeper_interest(zh,&fd,&interest,&tv);
+        CPPUNIT_ASSERT_EQUAL((int)ZOPERATIONTIMEOUT,rc);
+        CPPUNIT_ASSERT(res1());
+        CPPUNIT_ASSERT_EQUAL((int)ZOPERATIONTIMEOUT,res1.rc_);
+    }
+
+    class SlowGetCompletion: public AsyncGetOperationCompletion{
+    public:
+        SlowGetCompletion(Mock_gettimeofday& timeMock):timeMock_(timeMock){}
+        virtual void dataCompl(int rc, const char *value, int len, const Stat *stat){
+            timeMock_.millitick(150);
+            AsyncGetOperationCompletion::dataCompl(rc,value,len,stat);
+        }
+        Mock_gettimeofday& timeMock_;
+    };
+    // a completion running longer than the threshold and an IO loop woken
+    // up late are both counted
+    void testLatencyStats()
+    {
+        Mock_gettimeofday timeMock;
+        // millitick() drops the microseconds: start on a whole millisecond so
+        // the delays measured are the ones ticked
+        timeMock.tv.tv_usec=0;
+        ZookeeperServer zkServer;
+        // must call zookeeper_close() while all the mocks are in scope
+        CloseFinally guard(&zh);
+
+        zh=zookeeper_init("localhost:2121",watcher,10000,TEST_CLIENT_ID,0,0);
+        CPPUNIT_ASSERT(zh!=0);
+        CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS,
+                zoo_set_latency_thresholds(zh,10,-1,100));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_set_latency_thresholds(zh,10,0,100));
+        forceConnected(zh);
+
+        int fd=0;
+        int interest=0;
+        timeval tv;
+        SlowGetCompletion res1(timeMock);
+        zkServer.addOperationResponse(new ZooGetResponse("1",1));
+        int rc=zoo_aget(zh,"/x/y/1",0,asyncCompletion,&res1);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        rc=zookeeper_interest(zh,&fd,&interest,&tv);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        while((rc=zookeeper_process(zh,interest))==ZOK)
+            ;
+        CPPUNIT_ASSERT_EQUAL((int)ZNOTHING,rc);
+        CPPUNIT_ASSERT(res1());
+
+        zoo_latency_stats_t stats;
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_get_latency_stats(zh,&stats));
+        CPPUNIT_ASSERT(stats.callback.count>=1);
+        CPPUNIT_ASSERT_EQUAL((int64_t)1,stats.callback.over);
+        CPPUNIT_ASSERT(stats.callback.max_us>=150000);
+        CPPUNIT_ASSERT_EQUAL((int64_t)0,stats.wakeup_lag.count);
+
+        // the IO loop wakes up 30ms after the deadline it asked for
+        rc=zookeeper_interest(zh,&fd,&interest,&tv);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        timeMock.tick(tv);
+        timeMock.millitick(30);
+        rc=zookeeper_interest(zh,&fd,&interest,&tv);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_get_latency_stats(zh,&stats));
+        CPPUNIT_ASSERT_EQUAL((int64_t)1,stats.wakeup_lag.count);
+        CPPUNIT_ASSERT_EQUAL((int64_t)1,stats.wakeup_lag.over);
+        CPPUNIT_ASSERT(stats.wakeup_lag.max_us>=30000);
+    }
+
+    // a request is listed in the send queue until it is answered
+    void testInflight()
+    {
+        Mock_gettimeofday timeMock;
+        // the ages are measured from a whole millisecond
+        timeMock.tv.tv_usec=0;
+        ZookeeperServer zkServer;
+        // must call zookeeper_close() while all the mocks are in scope
+        CloseFinally guard(&zh);
+
+        zh=zookeeper_init("localhost:2121",watcher,10000,TEST_CLIENT_ID,0,0);
+        CPPUNIT_ASSERT(zh!=0);
+        forceConnected(zh);
+
+        zoo_inflight_t inflight;
+        CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS,zoo_get_inflight(zh,-1,&inflight));
+        AsyncGetOperationCompletion res1;
+        zkServer.addOperationResponse(new ZooGetResponse("1",1));
+        // the socket is full: the request stays in the send queue
+        zkServer.sendErrno=EAGAIN;
+        int rc=zoo_aget(zh,"/x/y/1",0,asyncCompletion,&res1);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        timeMock.millitick(20);
+
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_get_inflight(zh,10,&inflight));
+        // let the request go before anything can fail: zookeeper_close()
+        // would wait for the socket on the mocked clock forever
+        zkServer.sendErrno=0;
+        CPPUNIT_ASSERT_EQUAL(1,inflight.count);
+        CPPUNIT_ASSERT_EQUAL(1,inflight.queues[ZOO_REQUEST_TO_SEND].count);
+        CPPUNIT_ASSERT_EQUAL(0,inflight.queues[ZOO_REQUEST_SENT].count);
+        CPPUNIT_ASSERT_EQUAL((int64_t)20000,
+                inflight.queues[ZOO_REQUEST_TO_SEND].oldest_us);
+        CPPUNIT_ASSERT_EQUAL(ZOO_REQUEST_TO_SEND,inflight.requests[0].queue);
+        CPPUNIT_ASSERT_EQUAL(ZOO_GETDATA_OP,inflight.requests[0].type);
+        CPPUNIT_ASSERT_EQUAL(string("/x/y/1"),string(inflight.requests[0].path));
+        CPPUNIT_ASSERT_EQUAL((int64_t)20000,inflight.requests[0].age_us);
+        zoo_free_inflight(&inflight);
+
+        int fd=0;
+        int interest=0;
+        timeval tv;
+        rc=zookeeper_interest(zh,&fd,&interest,&tv);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        while((rc=zookeeper_process(zh,interest))==ZOK)
+            ;
+        CPPUNIT_ASSERT_EQUAL((int)ZNOTHING,rc);
+        CPPUNIT_ASSERT(res1());
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_get_inflight(zh,10,&inflight));
+        CPPUNIT_ASSERT_EQUAL(0,inflight.count);
+        CPPUNIT_ASSERT_EQUAL(0,inflight.queues[ZOO_REQUEST_SENT].count);
+        zoo_free_inflight(&inflight);
+    }
+
+    // with every request sampled, the most used paths are counted exactly
+    void testHotPaths()
+    {
+        Mock_gettimeofday timeMock;
+        ZookeeperServer zkServer;
+        // must call zookeeper_close() while all the mocks are in scope
+        CloseFinally guard(&zh);
+
+        zh=zookeeper_init("localhost:2121",watcher,10000,TEST_CLIENT_ID,0,0);
+        CPPUNIT_ASSERT(zh!=0);
+        forceConnected(zh);
+        CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS,zoo_set_path_sampling(zh,2,2));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_set_path_sampling(zh,1,2));
+
+        const char* paths[]={"/a","/b","/a","/c","/a","/c","/a"};
+        AsyncGetOperationCompletion res[7];
+        for(int i=0;i<7;i++)
+            CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                    zoo_aget(zh,paths[i],0,asyncCompletion,&res[i]));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_aset(zh,"/c","1",1,-1,0,0));
+
+        zoo_hot_path_t hot[3];
+        int count=3;
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_get_hot_paths(zh,hot,&count));
+        CPPUNIT_ASSERT_EQUAL(2,count);
+        CPPUNIT_ASSERT_EQUAL(string("/a"),string(hot[0].path));
+        CPPUNIT_ASSERT_EQUAL((int64_t)4,hot[0].count);
+        CPPUNIT_ASSERT_EQUAL((int64_t)4,hot[0].reads);
+        CPPUNIT_ASSERT_EQUAL(string("/c"),string(hot[1].path));
+        CPPUNIT_ASSERT_EQUAL((int64_t)3,hot[1].count);
+        CPPUNIT_ASSERT_EQUAL((int64_t)1,hot[1].writes);
+        zoo_free_hot_paths(hot,count);
+
+        // starting over forgets the paths
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_set_path_sampling(zh,0,0));
+        count=3;
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_get_hot_paths(zh,hot,&count));
+        CPPUNIT_ASSERT_EQUAL(0,count);
+    }
+
+    class AsyncSetOperationCompletion: public AsyncCompletion{
+    public:
+        AsyncSetOperationCompletion():called_(false),rc_(ZAPIERROR){}
+        virtual void statCompl(int rc, const Stat *stat){
+            synchronized(mx_);
+            called_=true;
+            rc_=rc;
+        }
+        bool operator()()const{
+            synchronized(mx_);
+            return called_;
+        }
+        mutable Mutex mx_;
+        bool called_;
+        int rc_;
+    };
+    class RequestCountingServer: public ZookeeperServer{
+    public:
+        RequestCountingServer():getCount_(0),setCount_(0){}
+        // called when a client request is received
+        virtual void onMessageReceived(const RequestHeader& rh, iarchive* ia){
+            if(rh.type==ZOO_GETDATA_OP)
+                getCount_++;
+            else if(rh.type==ZOO_SETDATA_OP){
+                SetDataRequest req;
+                setCount_++;
+                deserialize_SetDataRequest(ia,"req",&req);
+                setValue_.assign(req.data.buff,req.data.len);
+                deallocate_SetDataRequest(&req);
+            }
+        }
+        int getCount_;
+        int setCount_;
+        // the value of the last set, as it was sent
+        string setValue_;
+    };
+    // identical reads share a request, but not across a write
+    void testReadCoalescing()
+    {
+        Mock_gettimeofday timeMock;
+        RequestCountingServer zkServer;
+        // must call zookeeper_close() while all the mocks are in scope
+        CloseFinally guard(&zh);
+
+        zh=zookeeper_init("localhost:2121",watcher,10000,TEST_CLIENT_ID,0,0);
+        CPPUNIT_ASSERT(zh!=0);
+        forceConnected(zh);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_set_read_coalescing(zh,1));
+
+        AsyncGetOperationCompletion res[4];
+        AsyncSetOperationCompletion set;
+        zkServer.addOperationResponse(new ZooGetResponse("1",1));
+        zkServer.addOperationResponse(new ZooStatResponse);
+        zkServer.addOperationResponse(new ZooGetResponse("2",1));
+        for(int i=0;i<3;i++)
+            CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                    zoo_aget(zh,"/x",0,asyncCompletion,&res[i]));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                zoo_aset(zh,"/x","2",1,-1,asyncCompletion,&set));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                zoo_aget(zh,"/x",0,asyncCompletion,&res[3]));
+        // the first three gets went out as one, the one after the set
+        // on its own
+        CPPUNIT_ASSERT_EQUAL(2,zkServer.getCount_);
+        CPPUNIT_ASSERT_EQUAL(1,zkServer.setCount_);
+
+        int fd=0;
+        int interest=0;
+        timeval tv;
+        int rc=zookeeper_interest(zh,&fd,&interest,&tv);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        while((rc=zookeeper_process(zh,interest))==ZOK)
+            ;
+        CPPUNIT_ASSERT_EQUAL((int)ZNOTHING,rc);
+        for(int i=0;i<3;i++){
+            CPPUNIT_ASSERT(res[i]());
+            CPPUNIT_ASSERT_EQUAL((int)ZOK,res[i].rc_);
+            CPPUNIT_ASSERT_EQUAL(string("1"),res[i].value_);
+        }
+        CPPUNIT_ASSERT(set());
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,set.rc_);
+        CPPUNIT_ASSERT(res[3]());
+        CPPUNIT_ASSERT_EQUAL(string("2"),res[3].value_);
+        CPPUNIT_ASSERT_EQUAL(2,zkServer.getCount_);
+    }
+
+    // the values written are compressed, those read decompressed if they
+    // were
+    void testCompression()
+    {
+        Mock_gettimeofday timeMock;
+        RequestCountingServer zkServer;
+        // must call zookeeper_close() while all the mocks are in scope
+        CloseFinally guard(&zh);
+
+        zh=zookeeper_init("localhost:2121",watcher,10000,TEST_CLIENT_ID,0,0);
+        CPPUNIT_ASSERT(zh!=0);
+        forceConnected(zh);
+        CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS,zoo_set_compression(zh,-1));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_set_compression(zh,64));
+
+        string value(4096,'a');
+        char packed[4096];
+        int len=zk_lz_encode(value.data(),value.size(),packed,sizeof(packed));
+        CPPUNIT_ASSERT(len>0 && len<64);
+        AsyncGetOperationCompletion res[3];
+        AsyncSetOperationCompletion set;
+        zkServer.addOperationResponse(new ZooStatResponse);
+        zkServer.addOperationResponse(new ZooGetResponse(packed,len));
+        zkServer.addOperationResponse(new ZooGetResponse("legacy",6));
+        // looks compressed, but is not
+        zkServer.addOperationResponse(new ZooGetResponse(packed,len-1));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_aset(zh,"/x",value.data(),
+                value.size(),-1,asyncCompletion,&set));
+        // the value went out compressed
+        CPPUNIT_ASSERT_EQUAL(1,zkServer.setCount_);
+        CPPUNIT_ASSERT_EQUAL(string(packed,len),zkServer.setValue_);
+        for(int i=0;i<3;i++)
+            CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                    zoo_aget(zh,"/x",0,asyncCompletion,&res[i]));
+
+        int fd=0;
+        int interest=0;
+        timeval tv;
+        int rc=zookeeper_interest(zh,&fd,&interest,&tv);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        while((rc=zookeeper_process(zh,interest))==ZOK)
+            ;
+        CPPUNIT_ASSERT_EQUAL((int)ZNOTHING,rc);
+        CPPUNIT_ASSERT(set());
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,set.rc_);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,res[0].rc_);
+        CPPUNIT_ASSERT_EQUAL(value,res[0].value_);
+        CPPUNIT_ASSERT_EQUAL(string("legacy"),res[1].value_);
+        CPPUNIT_ASSERT_EQUAL(string(packed,len-1),res[2].value_);
+    }
+
+    struct IoRegistration{
+        IoRegistration():fd(-1),events(0),adds(0),dels(0),armed(false){}
+        int fd;
+        int events;
+        int adds;
+        int dels;
+        bool armed;
+        int64_t deadline; // in ms
+    };
+    static int ioAdd(zhandle_t*, int fd, int events, void* ctx){
+        IoRegistration* io=(IoRegistration*)ctx;
+        io->fd=fd;
+        io->events=events;
+        io->adds++;
+        return 0;
+    }
+    static int ioMod(zhandle_t*, int fd, int events, void* ctx){
+        ((IoRegistration*)ctx)->events=events;
+        return 0;
+    }
+    static void ioDel(zhandle_t*, int fd, void* ctx){
+        IoRegistration* io=(IoRegistration*)ctx;
+        io->fd=-1;
+        io->dels++;
+    }
+    static void ioTimer(zhandle_t*, const struct timespec* deadline, void* ctx){
+        IoRegistration* io=(IoRegistration*)ctx;
+        io->armed=deadline!=0;
+        if(deadline)
+            io->deadline=(int64_t)deadline->tv_sec*1000+deadline->tv_nsec/1000000;
+    }
+    // drive an idle connection through the event loop callbacks
+    // verify the client is only woken up when the ping is due and takes
+    // its socket out of the loop when closed
+    void testIoCallbacks()
+    {
+        const int TIMEOUT=9; // timeout in secs
+        Mock_gettimeofday timeMock;
+        PingCountingServer zkServer;
+        // must call zookeeper_close() while all the mocks are in scope
+        CloseFinally guard(&zh);
+        
+        zh=zookeeper_init("localhost:1234",watcher,TIMEOUT*1000,TEST_CLIENT_ID,0,0);
+        CPPUNIT_ASSERT(zh!=0);
+        // simulate connected state
+        forceConnected(zh);
+        
+        IoRegistration io;
+        zoo_io_callbacks_t callbacks={ioAdd,ioMod,ioDel,ioTimer,&io};
+        int rc=zoo_set_io_callbacks(zh,&callbacks);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        CPPUNIT_ASSERT_EQUAL(1,io.adds);
+        CPPUNIT_ASSERT_EQUAL((int)ZookeeperServer::FD,io.fd);
+        CPPUNIT_ASSERT_EQUAL(ZOOKEEPER_READ,io.events);
+        // the first wakeup is when the ping is due
+        CPPUNIT_ASSERT(io.armed);
+        // toMilliseconds() would overflow with the time of day
+        int64_t start=(int64_t)timeMock.tv.tv_sec*1000+timeMock.tv.tv_usec/1000;
+        CPPUNIT_ASSERT_EQUAL((int64_t)TIMEOUT/3*1000,io.deadline-start);
+        
+        // the deadline passes: the ping is sent and the next one is due
+        // 1/3 of the timeout later
+        timeMock.tick(TIMEOUT/3);
+        rc=zoo_io_event(zh,0);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        CPPUNIT_ASSERT_EQUAL(1,zkServer.pingCount_);
+        CPPUNIT_ASSERT_EQUAL((int64_t)TIMEOUT/3*2000,io.deadline-start);
+        
+        // the ping response is read; the socket stays registered as it was
+        zkServer.addRecvResponse(new PingResponse);
+        timeMock.millitick(10);
+        rc=zoo_io_event(zh,ZOOKEEPER_READ);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+        CPPUNIT_ASSERT_EQUAL(1,io.adds);
+        CPPUNIT_ASSERT_EQUAL(ZOOKEEPER_READ,io.events);
+        
+        guard.execute();
+        CPPUNIT_ASSERT_EQUAL(1,io.dels);
+        CPPUNIT_ASSERT_EQUAL(-1,io.fd);
+    }
+
 #else   
     class TestGetDataJob: public TestJob{
     public:
@@ -670,6 +1096,202 @@ public:
         CPPUNIT_ASSERT_EQUAL(string("/x/y/z"),action.path_);                
     }
 #endif
+
+    // frames are reused within their size class, up to the retained limit;
+    // the pool is shared with the other tests of the process, so this only
+    // uses the 1MB and 2MB classes, which no request of theirs needs
+    void testFramePool()
+    {
+        zoo_frame_pool_stats_t stats;
+        // start from an empty pool
+        zoo_frame_pool_set_limit(0);
+        zoo_frame_pool_set_limit(ZOO_FRAME_POOL_DEFAULT_LIMIT);
+        zoo_frame_pool_get_stats(&stats);
+        int64_t hits=stats.hits;
+
+        char* frame=zoo_frame_alloc(600000);
+        CPPUNIT_ASSERT(frame!=0);
+        CPPUNIT_ASSERT(zoo_frame_capacity(frame)>=600000);
+        zoo_frame_free(frame);
+        // the same size class is served from the pool
+        char* again=zoo_frame_alloc(590000);
+        CPPUNIT_ASSERT(again==frame);
+        zoo_frame_pool_get_stats(&stats);
+        CPPUNIT_ASSERT(stats.hits>hits);
+
+        // growing keeps the content, and retains the smaller frame
+        memcpy(again,"abc",3);
+        char* grown=zoo_frame_realloc(again,1500000);
+        CPPUNIT_ASSERT(grown!=0);
+        CPPUNIT_ASSERT(zoo_frame_capacity(grown)>=1500000);
+        CPPUNIT_ASSERT(memcmp(grown,"abc",3)==0);
+        zoo_frame_free(grown);
+        char* small=zoo_frame_alloc(600000);
+        char* large=zoo_frame_alloc(1500000);
+        CPPUNIT_ASSERT(small==frame);
+        CPPUNIT_ASSERT(large==grown);
+        zoo_frame_free(small);
+        zoo_frame_free(large);
+
+        // nothing is retained beyond the limit
+        zoo_frame_pool_set_limit(1000);
+        zoo_frame_pool_get_stats(&stats);
+        CPPUNIT_ASSERT(stats.retained_bytes<=1000);
+        zoo_frame_free(zoo_frame_alloc(600000));
+        zoo_frame_pool_get_stats(&stats);
+        CPPUNIT_ASSERT(stats.retained_bytes<=1000);
+        zoo_frame_pool_set_limit(ZOO_FRAME_POOL_DEFAULT_LIMIT);
+    }
+
+    static void createCompletion(int, const char *, const void *) {}
+
+    // the validation of the client alone: a valid path is queued
+    bool isValidPath(const string &path, int flags)
+    {
+        int rc=zoo_acreate(zh,path.c_str(),"",0,&ZOO_OPEN_ACL_UNSAFE,flags,
+                createCompletion,0);
+        CPPUNIT_ASSERT(rc==ZOK || rc==ZBADARGUMENTS);
+        return rc==ZOK;
+    }
+
+    // the character by character validation isValidPath replaced
+    static bool referenceValidPath(const char *path, int flags)
+    {
+        int len=strlen(path);
+        char lastc='/';
+        if(len==0 || path[0]!='/')
+            return false;
+        if(len==1)
+            return true;
+        if(path[len-1]=='/' && !(flags & ZOO_SEQUENCE))
+            return false;
+        for(int i=1;i<len;lastc=path[i],i++){
+            char c=path[i];
+            if(c=='/' && lastc=='/')
+                return false;
+            if(c=='.' && lastc=='.'){
+                if(path[i-2]=='/' && (((i+1==len) && !(flags & ZOO_SEQUENCE))
+                        || path[i+1]=='/'))
+                    return false;
+            }else if(c=='.'){
+                if(path[i-1]=='/' && (((i+1==len) && !(flags & ZOO_SEQUENCE))
+                        || path[i+1]=='/'))
+                    return false;
+            }else if(c>0x00 && c<0x1f){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // a path of len characters "/aaa...", with s written at pos
+    static string pathWith(int len, int pos, const string &s)
+    {
+        string path="/"+string(len-1,'a');
+        path.replace(pos,s.size(),s);
+        return path.substr(0,len);
+    }
+
+    // the blocks of 16 characters must not change the result, whatever
+    // side of a block boundary a pattern falls on
+    void testPathValidation()
+    {
+        zh=zookeeper_init("localhost:2121",watcher,10000,0,0,0);
+        CPPUNIT_ASSERT(zh!=0);
+
+        struct {
+            const char *path;
+            int flags;
+            bool valid;
+        } cases[]={
+            {"/",0,true},
+            {"//",0,false},
+            {"/.",0,false},
+            {"/..",0,false},
+            {"/...",0,true},
+            {"/a/",0,false},
+            {"/a/",ZOO_SEQUENCE,true},
+            {"/a/.",ZOO_SEQUENCE,true},
+            {"/a/..",ZOO_SEQUENCE,true},
+            {"/a//",ZOO_SEQUENCE,false},
+            {"/a/./b",0,false},
+            {"/a/../b",0,false},
+            {"/a/.b/..c",0,true},
+            // 15, 16, 17 and 32 characters
+            {"/aaaaaaaaaaaaaa",0,true},
+            {"/aaaaaaaaaaaaaaa",0,true},
+            {"/aaaaaaaaaaaaaaaa",0,true},
+            {"/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",0,true},
+            // "//", "/./" and "/../" across the first block boundary
+            {"/aaaaaaaaaaaaa//a",0,false},
+            {"/aaaaaaaaaaaaaa//",0,false},
+            {"/aaaaaaaaaaaaaa/./a",0,false},
+            {"/aaaaaaaaaaaaa/../a",0,false},
+            {"/aaaaaaaaaaaa/../aa",0,false},
+            {"/aaaaaaaaaaaaaa/.a/a",0,true},
+            {"/aaaaaaaaaaaaa/..a/a",0,true},
+            // a trailing "/." or "/.." at the boundaries
+            {"/aaaaaaaaaaaa/.",0,false},
+            {"/aaaaaaaaaaaaa/.",0,false},
+            {"/aaaaaaaaaaaa/..",0,false},
+            {"/aaaaaaaaaaaaaaaaaaaaaaaaaaaaa/..",0,false},
+            {"/aaaaaaaaaaaaaaaaaaaaaaaaaaaaa/..",ZOO_SEQUENCE,true},
+            // control characters, 0x1f and DEL excepted as before
+            {"/a\x01",0,false},
+            {"/aaaaaaaaaaaaaa\x01",0,false},
+            {"/aaaaaaaaaaaaaaa\x1e",0,false},
+            {"/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\x0a",0,false},
+            {"/aaaaaaaaaaaaaaa\x1f",0,true},
+            {"/aaaaaaaaaaaaaaa\x7f",0,true},
+            // the path ends at the first NUL, even right before a boundary
+            {"/aaaaaaaaaaaaaa\0//",0,true},
+            {"/aaaaaaaaaaaaaaa\0\x01",0,true},
+            // bytes of 0x80 and above, such as the UTF-8 encoding of the
+            // UTF-16 surrogates (ED A0 80 to ED BF BF), are left to the server
+            {"/\xed\xa0\x80",0,true},
+            {"/aaaaaaaaaaaaa\xed\xbf\xbf",0,true},
+            {"/aaaaaaaaaaaaaa\xed\xa0\x80/a",0,true},
+            {"/\xc2\x80\xc2\x9f\xef\xbf\xbf",0,true},
+        };
+        for(size_t i=0;i<sizeof(cases)/sizeof(cases[0]);i++){
+            CPPUNIT_ASSERT_EQUAL_MESSAGE(cases[i].path,cases[i].valid,
+                    isValidPath(cases[i].path,cases[i].flags));
+            CPPUNIT_ASSERT_EQUAL_MESSAGE(cases[i].path,cases[i].valid,
+                    referenceValidPath(cases[i].path,cases[i].flags));
+        }
+
+        // every pattern at every position around the boundaries
+        const char *patterns[]={"//","/./","/../","/.","/..","/.a","\x01",
+                "\x1e","\x1f","\xed\xa0\x80","/"};
+        int lengths[]={15,16,17,31,32,33,48};
+        for(size_t l=0;l<sizeof(lengths)/sizeof(lengths[0]);l++){
+            for(int pos=1;pos<lengths[l];pos++){
+                for(size_t p=0;p<sizeof(patterns)/sizeof(patterns[0]);p++){
+                    string path=pathWith(lengths[l],pos,patterns[p]);
+                    for(int flags=0;flags<=ZOO_SEQUENCE;flags+=ZOO_SEQUENCE){
+                        CPPUNIT_ASSERT_EQUAL_MESSAGE(path,
+                                referenceValidPath(path.c_str(),flags),
+                                isValidPath(path,flags));
+                    }
+                }
+            }
+        }
+
+        // random paths of the characters that matter
+        const char alphabet[]="//..a\x01\x1f\xed";
+        unsigned int seed=1;
+        for(int i=0;i<2000;i++){
+            seed=seed*1103515245+12345;
+            int len=1+(seed>>16)%40;
+            string path="/";
+            for(int j=1;j<len;j++){
+                seed=seed*1103515245+12345;
+                path+=alphabet[(seed>>16)%(sizeof(alphabet)-1)];
+            }
+            CPPUNIT_ASSERT_EQUAL_MESSAGE(path,
+                    referenceValidPath(path.c_str(),0),isValidPath(path,0));
+        }
+    }
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Zookeeper_operations);
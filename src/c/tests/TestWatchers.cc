@@ -33,6 +33,9 @@ class Zookeeper_watchers : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testNodeWatcher1);
     CPPUNIT_TEST(testChildWatcher1);
     CPPUNIT_TEST(testChildWatcher2);
+#ifndef THREADED
+    CPPUNIT_TEST(testCoalescedChildWatcher);
+#endif
     CPPUNIT_TEST_SUITE_END();
 
     static void watcher(zhandle_t *, int, int, const char *,void*){}
@@ -132,6 +135,18 @@ public:
         int counter_;
     };
 
+    class CoalescedChildWatcher: public WatcherAction{
+    public:
+        CoalescedChildWatcher():counter_(0),events_(0){}
+        virtual void onChildChanged(zhandle_t* zh,const char* path){
+            synchronized(mx_);
+            counter_++;
+            events_+=zoo_coalesced_events(zh);
+        }
+        int counter_;
+        int events_;
+    };
+
 #ifndef THREADED
     
     // verify: the default watcher is called once for a session event
@@ -440,6 +455,65 @@ public:
         CPPUNIT_ASSERT_EQUAL(0,defWatcher.counter_);
     }
 
+    // testcase: the child watch on /a fires twice within the coalescing
+    // window of its watcher
+    // verify: the watcher is called once, for two events, when the window ends
+    void testCoalescedChildWatcher(){
+        Mock_gettimeofday timeMock;
+        // millitick() drops the microseconds: start on a whole millisecond
+        timeMock.tv.tv_usec=0;
+        ZookeeperServer zkServer;
+        // must call zookeeper_close() while all the mocks are in scope
+        CloseFinally guard(&zh);
+
+        ChildEventCountingWatcher defWatcher;
+        zh=zookeeper_init("localhost:2121",activeWatcher,10000,TEST_CLIENT_ID,
+                &defWatcher,0);
+        CPPUNIT_ASSERT(zh!=0);
+        // simulate connected state
+        forceConnected(zh);
+
+        CoalescedChildWatcher wobject;
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                zoo_set_watcher_coalescing(zh,activeWatcher,&wobject,1000));
+        AsyncCompletion ignored;
+        typedef ZooGetChildrenResponse::StringVector ZooVector;
+        int rc;
+        for(int i=0;i<2;i++){
+            zkServer.addOperationResponse(new ZooGetChildrenResponse(
+                    Util::CollectionBuilder<ZooVector>()("/a/1")));
+            rc=zoo_awget_children(zh,"/a",activeWatcher,
+                    &wobject,asyncCompletion,&ignored);
+            CPPUNIT_ASSERT_EQUAL((int)ZOK,rc);
+            while((rc=zookeeper_process(zh,ZOOKEEPER_READ))==ZOK) {
+              millisleep(100);
+            }
+            CPPUNIT_ASSERT_EQUAL((int)ZNOTHING,rc);
+
+            zkServer.addRecvResponse(new ZNodeEvent(ZOO_CHILD_EVENT,"/a"));
+            while((rc=zookeeper_process(zh,ZOOKEEPER_READ))==ZOK) {
+              millisleep(100);
+            }
+            CPPUNIT_ASSERT_EQUAL((int)ZNOTHING,rc);
+        }
+        CPPUNIT_ASSERT_EQUAL(0,wobject.counter_);
+
+        // the end of the window releases the delivery
+        timeMock.millitick(1001);
+        // zookeeper_interest goes by the time the last zookeeper_process
+        // read: read it after the tick
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zookeeper_process(zh,0));
+        CPPUNIT_ASSERT_EQUAL(0,wobject.counter_);
+        int fd=0;
+        int interest=0;
+        timeval tv;
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zookeeper_interest(zh,&fd,&interest,&tv));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zookeeper_process(zh,0));
+        CPPUNIT_ASSERT_EQUAL(1,wobject.counter_);
+        CPPUNIT_ASSERT_EQUAL(2,wobject.events_);
+        CPPUNIT_ASSERT_EQUAL(0,defWatcher.counter_);
+    }
+
 #else
     // verify: the default watcher is called once for a session event
     void testDefaultSessionWatcher1(){
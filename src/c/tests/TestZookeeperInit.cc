@@ -52,6 +52,11 @@ class Zookeeper_init : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testOutOfMemory_getaddrs2);
 #endif
     CPPUNIT_TEST(testPermuteAddrsList);
+    CPPUNIT_TEST(testZoneTaggedAddrs);
+#ifndef THREADED
+    CPPUNIT_TEST(testLatencyServerSelection);
+    CPPUNIT_TEST(testRebalance);
+#endif
     CPPUNIT_TEST_SUITE_END();
     zhandle_t *zh;
     MockPthreadsNull* pthreadMock;
@@ -296,6 +301,112 @@ public:
         }
         CPPUNIT_ASSERT_EQUAL(EXPECTED_SEQ,string(ACTUAL_SEQ));
     }
+    void testZoneTaggedAddrs()
+    {
+        zoo_deterministic_conn_order(1);
+        zoo_set_client_zone("az2");
+        zh=zookeeper_init("127.0.0.1:2121@az1,127.0.0.2:3434@az2,127.0.0.3:4545",
+                0,1000,0,0,0);
+        zoo_set_client_zone(0);
+
+        CPPUNIT_ASSERT(zh!=0);
+        CPPUNIT_ASSERT_EQUAL(3,zh->addrs_count);
+        // the server of the client's zone comes first, the others keep their order
+        const char EXPECTED_IPS[][4]={{127,0,0,2},{127,0,0,1},{127,0,0,3}};
+        for(int i=0;i<zh->addrs_count;i++){
+            sockaddr_in* addr=(struct sockaddr_in*)&zh->addrs[i];
+            CPPUNIT_ASSERT(memcmp(EXPECTED_IPS[i],&addr->sin_addr,sizeof(addr->sin_addr))==0);
+            CPPUNIT_ASSERT_EQUAL(i==0?1:0,(int)zh->addr_stats[i].local);
+        }
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_set_server_selection(zh,ZOO_SELECT_LATENCY,1000));
+        CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS,zoo_set_server_selection(zh,2,0));
+    }
+#ifndef THREADED
+    // records the last byte of the addresses connected to
+    class RecordingServer: public ZookeeperServer{
+    public:
+        virtual int callConnect(int s,const struct sockaddr *addr,socklen_t len){
+            hosts.push_back(((const unsigned char*)
+                    &((const sockaddr_in*)addr)->sin_addr)[3]);
+            return ZookeeperServer::callConnect(s,addr,len);
+        }
+        vector<int> hosts;
+    };
+    void testLatencyServerSelection()
+    {
+        RecordingServer zkServer;
+        // must call zookeeper_close() while all the mocks are in scope
+        CloseFinally guard(&zh);
+        // every connect fails right away
+        zkServer.connectErrno=ECONNREFUSED;
+
+        zoo_deterministic_conn_order(1);
+        zh=zookeeper_init("127.0.0.1:2121,127.0.0.2:2121,127.0.0.3:2121,127.0.0.4:2121",
+                watcher,10000,0,0,0);
+        CPPUNIT_ASSERT(zh!=0);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_set_server_selection(zh,ZOO_SELECT_LATENCY,0));
+        // 127.0.0.2 was never measured, 127.0.0.4 only by its handshake
+        zh->addr_stats[0].rtt=4000;
+        zh->addr_stats[2].rtt=1000;
+        zh->addr_stats[3].handshake=6000;
+
+        int fd=0;
+        int interest=0;
+        timeval tv;
+        for(int i=0;i<4;i++){
+            int rc=zookeeper_interest(zh,&fd,&interest,&tv);
+            CPPUNIT_ASSERT_EQUAL((int)ZCONNECTIONLOSS,rc);
+            CPPUNIT_ASSERT_EQUAL(-1,zh->fd);
+        }
+        // after the first server, the untried ones from the fastest to the
+        // unmeasured one
+        const int EXPECTED_HOSTS[]={1,3,4,2};
+        CPPUNIT_ASSERT_EQUAL(4,(int)zkServer.hosts.size());
+        for(int i=0;i<4;i++)
+            CPPUNIT_ASSERT_EQUAL(EXPECTED_HOSTS[i],zkServer.hosts[i]);
+        CPPUNIT_ASSERT_EQUAL(zh->addrs_count,zh->connect_index);
+        // once every server was tried, the client starts over from the fastest
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zookeeper_interest(zh,&fd,&interest,&tv));
+        CPPUNIT_ASSERT_EQUAL(2,zh->connect_index);
+        CPPUNIT_ASSERT_EQUAL(4,(int)zkServer.hosts.size());
+    }
+    void testRebalance()
+    {
+        ZookeeperServer zkServer;
+        // must call zookeeper_close() while all the mocks are in scope
+        CloseFinally guard(&zh);
+
+        zoo_deterministic_conn_order(1);
+        zh=zookeeper_init("127.0.0.1:2121,127.0.0.2:2121,127.0.0.3:2121",
+                watcher,10000,0,0,0);
+        CPPUNIT_ASSERT(zh!=0);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zoo_set_server_selection(zh,ZOO_SELECT_LATENCY,1));
+        forceConnected(zh);
+        zh->addr_stats[0].rtt=3000;
+        zh->addr_stats[1].rtt=2000;
+
+        int fd=0;
+        int interest=0;
+        timeval tv;
+        // arms the rebalance timer
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zookeeper_interest(zh,&fd,&interest,&tv));
+        millisleep(5);
+        // 127.0.0.2 is faster, but not twice as fast: the session stays
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zookeeper_interest(zh,&fd,&interest,&tv));
+        CPPUNIT_ASSERT_EQUAL((int)ZookeeperServer::FD,zh->fd);
+        CPPUNIT_ASSERT_EQUAL(0,zh->connect_index);
+
+        zh->addr_stats[2].rtt=1500;
+        millisleep(5);
+        // 127.0.0.3 is: the idle session moves to it
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,zookeeper_interest(zh,&fd,&interest,&tv));
+        CPPUNIT_ASSERT_EQUAL(-1,fd);
+        CPPUNIT_ASSERT_EQUAL(-1,zh->fd);
+        CPPUNIT_ASSERT_EQUAL(2,zh->connect_index);
+        // the move is not counted as a failure of the server left
+        CPPUNIT_ASSERT_EQUAL(0,(int)zh->addr_stats[0].failures);
+    }
+#endif
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Zookeeper_init);
@@ -509,8 +509,7 @@ void forceConnected(zhandle_t* zh){
     zh->state=ZOO_CONNECTED_STATE;
     zh->fd=ZookeeperServer::FD;
     zh->input_buffer=0;
-    gettimeofday(&zh->last_recv,0);    
-    gettimeofday(&zh->last_send,0);    
+    zh->last_recv=zh->last_send=zk_clock_us()/1000;
 }
 
 void terminateZookeeperThreads(zhandle_t* zh){
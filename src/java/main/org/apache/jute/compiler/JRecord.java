@@ -24,6 +24,7 @@ import java.io.IOException;
 import java.util.ArrayList;
 import java.util.HashMap;
 import java.util.Iterator;
+import java.util.List;
 
 /**
  *
@@ -191,7 +192,7 @@ public class JRecord extends JCompType {
                     c.write("    int rc = 0;\n");
                     c.write("    int32_t i;\n");
                     c.write("    rc = in->start_vector(in, tag, &v->count);\n");
-                    c.write("    v->data = calloc(v->count, sizeof(*v->data));\n");
+                    c.write("    v->data = ia_allocate_vector(in, v->count, sizeof(*v->data));\n");
                     c.write("    for(i=0;i<v->count;i++) {\n");
                     genDeserialize(c, jvType, "value", "data[i]");
                     c.write("    }\n");
@@ -211,12 +212,37 @@ public class JRecord extends JCompType {
         h.write("int serialize_" + rec_name + "(struct oarchive *out, const char *tag, struct " + rec_name + " *v);\n");
         h.write("int deserialize_" + rec_name + "(struct iarchive *in, const char *tag, struct " + rec_name + "*v);\n");
         h.write("void deallocate_" + rec_name + "(struct " + rec_name + "*);\n");
+        int fixedSize = getCFixedSize();
+        if (fixedSize > 0) {
+            genCFixedCode(c, fixedSize);
+        }
+        List<List<JField>> runs = getCFieldRuns();
+        boolean hasRuns = false;
+        for (List<JField> run : runs) {
+            hasRuns |= run.size() > 1;
+        }
         c.write("int serialize_" + rec_name + "(struct oarchive *out, const char *tag, struct " + rec_name + " *v)");
         c.write("{\n");
         c.write("    int rc;\n");
+        if (fixedSize > 0) {
+            // the whole record is written with one bounds check
+            c.write("    char *p = oa_reserve(out, " + fixedSize + ");\n");
+            c.write("    if (p) {\n");
+            c.write("        encode_fixed_" + rec_name + "(p, v);\n");
+            c.write("        return 0;\n");
+            c.write("    }\n");
+        } else if (hasRuns) {
+            c.write("    char *p;\n");
+        }
         c.write("    rc = out->start_record(out, tag);\n");
-        for(JField f : mFields) {
-            genSerialize(c, f.getType(), f.getTag(), f.getName());
+        for (List<JField> run : runs) {
+            if (fixedSize <= 0 && run.size() > 1) {
+                genSerializeRun(c, run);
+                continue;
+            }
+            for (JField f : run) {
+                genSerialize(c, f.getType(), f.getTag(), f.getName());
+            }
         }
         c.write("    rc = rc ? rc : out->end_record(out, tag);\n");
         c.write("    return rc;\n");
@@ -224,9 +250,24 @@ public class JRecord extends JCompType {
         c.write("int deserialize_" + rec_name + "(struct iarchive *in, const char *tag, struct " + rec_name + "*v)");
         c.write("{\n");
         c.write("    int rc;\n");
+        if (fixedSize > 0) {
+            c.write("    const char *p = ia_consume(in, " + fixedSize + ");\n");
+            c.write("    if (p) {\n");
+            c.write("        decode_fixed_" + rec_name + "(p, v);\n");
+            c.write("        return 0;\n");
+            c.write("    }\n");
+        } else if (hasRuns) {
+            c.write("    const char *p;\n");
+        }
         c.write("    rc = in->start_record(in, tag);\n");
-        for(JField f : mFields) {
-            genDeserialize(c, f.getType(), f.getTag(), f.getName());
+        for (List<JField> run : runs) {
+            if (fixedSize <= 0 && run.size() > 1) {
+                genDeserializeRun(c, run);
+                continue;
+            }
+            for (JField f : run) {
+                genDeserialize(c, f.getType(), f.getTag(), f.getName());
+            }
         }
         c.write("    rc = rc ? rc : in->end_record(in, tag);\n");
         c.write("    return rc;\n");
@@ -246,6 +287,150 @@ public class JRecord extends JCompType {
         c.write("}\n");
     }
 
+    /**
+     * Returns the size of the encoding of a field of the given type if it
+     * does not depend on the value, -1 otherwise.
+     */
+    static int getCFixedSize(JType type) {
+        if (type instanceof JInt) {
+            return 4;
+        } else if (type instanceof JLong) {
+            return 8;
+        } else if (type instanceof JBoolean) {
+            return 1;
+        } else if (type instanceof JRecord) {
+            return ((JRecord)type).getCFixedSize();
+        }
+        return -1;
+    }
+
+    /**
+     * Returns the size of the encoding of this record if every field has a
+     * fixed size, -1 otherwise.
+     */
+    int getCFixedSize() {
+        int size = 0;
+        for (JField f : mFields) {
+            int fieldSize = getCFixedSize(f.getType());
+            if (fieldSize < 0) {
+                return -1;
+            }
+            size += fieldSize;
+        }
+        return size > 0 ? size : -1;
+    }
+
+    /**
+     * Splits the fields into runs of consecutive fixed size fields, which
+     * are encoded together, and single variable size fields.
+     */
+    private List<List<JField>> getCFieldRuns() {
+        List<List<JField>> runs = new ArrayList<List<JField>>();
+        List<JField> run = null;
+        for (JField f : mFields) {
+            if (getCFixedSize(f.getType()) < 0) {
+                run = null;
+                List<JField> single = new ArrayList<JField>();
+                single.add(f);
+                runs.add(single);
+                continue;
+            }
+            if (run == null) {
+                run = new ArrayList<JField>();
+                runs.add(run);
+            }
+            run.add(f);
+        }
+        return runs;
+    }
+
+    /**
+     * Generates the functions encoding and decoding a fixed size record
+     * straight to and from its bytes.
+     */
+    private void genCFixedCode(FileWriter c, int size) throws IOException {
+        String rec_name = getName();
+        c.write("/* the fields of " + rec_name + " take " + size + " bytes */\n");
+        c.write("static void encode_fixed_" + rec_name + "(char *p, const struct " + rec_name + " *v)\n");
+        c.write("{\n");
+        genEncodeFields(c, "    ", mFields);
+        c.write("}\n");
+        c.write("static void decode_fixed_" + rec_name + "(const char *p, struct " + rec_name + " *v)\n");
+        c.write("{\n");
+        genDecodeFields(c, "    ", mFields);
+        c.write("}\n");
+    }
+
+    private static int runSize(List<JField> run) {
+        int size = 0;
+        for (JField f : run) {
+            size += getCFixedSize(f.getType());
+        }
+        return size;
+    }
+
+    private void genEncodeFields(FileWriter c, String indent, List<JField> fields) throws IOException {
+        int off = 0;
+        for (JField f : fields) {
+            JType type = f.getType();
+            String at = off == 0 ? "p" : "p + " + off;
+            if (type instanceof JInt) {
+                c.write(indent + "zoo_put_int32(" + at + ", v->" + f.getName() + ");\n");
+            } else if (type instanceof JLong) {
+                c.write(indent + "zoo_put_int64(" + at + ", v->" + f.getName() + ");\n");
+            } else if (type instanceof JBoolean) {
+                c.write(indent + "p[" + off + "] = v->" + f.getName() + " == 0 ? '\\0' : '\\1';\n");
+            } else {
+                c.write(indent + "encode_fixed_" + extractStructName(type) + "(" + at + ", &v->" + f.getName() + ");\n");
+            }
+            off += getCFixedSize(type);
+        }
+    }
+
+    private void genDecodeFields(FileWriter c, String indent, List<JField> fields) throws IOException {
+        int off = 0;
+        for (JField f : fields) {
+            JType type = f.getType();
+            String at = off == 0 ? "p" : "p + " + off;
+            if (type instanceof JInt) {
+                c.write(indent + "v->" + f.getName() + " = zoo_get_int32(" + at + ");\n");
+            } else if (type instanceof JLong) {
+                c.write(indent + "v->" + f.getName() + " = zoo_get_int64(" + at + ");\n");
+            } else if (type instanceof JBoolean) {
+                c.write(indent + "v->" + f.getName() + " = p[" + off + "];\n");
+            } else {
+                c.write(indent + "decode_fixed_" + extractStructName(type) + "(" + at + ", &v->" + f.getName() + ");\n");
+            }
+            off += getCFixedSize(type);
+        }
+    }
+
+    /* a run of fixed size fields in a variable size record, with a field by
+     * field fallback for archives other than the buffer archive */
+    private void genSerializeRun(FileWriter c, List<JField> run) throws IOException {
+        c.write("    p = rc ? 0 : oa_reserve(out, " + runSize(run) + ");\n");
+        c.write("    if (p) {\n");
+        genEncodeFields(c, "        ", run);
+        c.write("    } else {\n");
+        for (JField f : run) {
+            c.write("    ");
+            genSerialize(c, f.getType(), f.getTag(), f.getName());
+        }
+        c.write("    }\n");
+    }
+
+    private void genDeserializeRun(FileWriter c, List<JField> run) throws IOException {
+        c.write("    p = rc ? 0 : ia_consume(in, " + runSize(run) + ");\n");
+        c.write("    if (p) {\n");
+        genDecodeFields(c, "        ", run);
+        c.write("    } else {\n");
+        for (JField f : run) {
+            c.write("    ");
+            genDeserialize(c, f.getType(), f.getTag(), f.getName());
+        }
+        c.write("    }\n");
+    }
+
     private void genSerialize(FileWriter c, JType type, String tag, String name) throws IOException {
         if (type instanceof JRecord) {
             c.write("    rc = rc ? rc : serialize_" + extractStructName(type) + "(out, \"" + tag + "\", &v->" + name + ");\n");
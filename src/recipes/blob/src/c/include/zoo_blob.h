@@ -0,0 +1,150 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZOOKEEPER_BLOB_H_
+#define ZOOKEEPER_BLOB_H_
+
+#include <zookeeper.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** 
+ * \file zoo_blob.h
+ * \brief zookeeper recipe for values larger than a znode can hold.
+ *
+ * A blob is stored as a manifest znode at its path and a generation of
+ * chunk znodes under it:
+ *
+ *     path                 the manifest: the size of the blob, the size of
+ *                          its chunks and the name of its generation
+ *     path/g-0000000007    the generation, created by one write
+ *     path/g-0000000007/0  the chunks of the blob, in order
+ *     path/g-0000000007/1
+ *
+ * A write creates a new generation, then commits it with a single multi
+ * that sets the manifest (checking its version) and deletes the previous
+ * generation. The chunks of a generation are never modified, so a reader
+ * that read them all after the manifest saw a consistent snapshot; one
+ * that finds a chunk deleted by a newer write starts over. The chunks are
+ * written and read with pipelined requests, up to window of them in
+ * flight, so that the throughput is bound by the bandwidth rather than by
+ * round trips.
+ *
+ * The calls are synchronous and must not be made from a completion or a
+ * watcher.
+ */
+
+/** the default size of the chunks, well below the 1 MB of jute.maxbuffer */
+#define ZKR_BLOB_CHUNK_SIZE (512 * 1024)
+/** the default number of chunk requests in flight */
+#define ZKR_BLOB_WINDOW 16
+
+struct zkr_blob {
+    zhandle_t *zh;
+    char *path;
+    struct ACL_vector *acl;
+    int chunk_size; /* of the blobs written */
+    int window;
+};
+
+typedef struct zkr_blob zkr_blob_t;
+
+
+/**
+ * \brief initializes a zookeeper blob
+ *
+ * this method only initializes the structure: the blob is created by its
+ * first write.
+ * \param blob the zookeeper blob to initialize
+ * \param zh the zookeeper handle to use
+ * \param path the path of the manifest of the blob
+ * \param acl the acl of the znodes created
+ * \param chunk_size the size of the chunks written, 0 for
+ * ZKR_BLOB_CHUNK_SIZE
+ * \return returns 0 (ZOK) if successful, ZBADARGUMENTS if chunk_size is
+ * negative, or ZSYSTEMERROR if out of memory.
+ */
+ZOOAPI int zkr_blob_init(zkr_blob_t *blob, zhandle_t *zh, const char *path,
+        struct ACL_vector *acl, int chunk_size);
+
+/**
+ * \brief replaces the value of a zookeeper blob
+ *
+ * this method writes the chunks of a new generation, then makes it the
+ * value of the blob with a multi. No reader sees a partial value.
+ * \param blob the zookeeper blob to write
+ * \param data the value
+ * \param len the length of the value
+ * \param version the expected version of the manifest, as returned by
+ * zkr_blob_read, or -1 to write whatever the current value.
+ * \return returns 0 (ZOK) if successful, ZBADVERSION if the blob is not
+ * at the given version (another write went first), otherwise a zookeeper
+ * error code. The chunks of a failed write are deleted.
+ */
+ZOOAPI int zkr_blob_write(zkr_blob_t *blob, const char *data, int len,
+        int version);
+
+/**
+ * \brief reads the value of a zookeeper blob
+ *
+ * \param blob the zookeeper blob to read
+ * \param data set to the value, allocated with malloc and to be freed
+ * with free
+ * \param len set to the length of the value
+ * \param version if not NULL, set to the version of the manifest to pass
+ * to zkr_blob_write or zkr_blob_remove
+ * \return returns 0 (ZOK) if successful, ZNONODE if the blob was never
+ * written, otherwise a zookeeper error code.
+ */
+ZOOAPI int zkr_blob_read(zkr_blob_t *blob, char **data, int *len,
+        int *version);
+
+/**
+ * \brief deletes a zookeeper blob
+ *
+ * this method deletes the manifest and the current generation with a
+ * multi, after the chunks left by the writes that failed half way before
+ * the current value was written. The chunks of a write still in progress,
+ * or of one that failed after it, are kept: the blob cannot be deleted
+ * until it completes, or until another write makes them left over.
+ * \param blob the zookeeper blob to delete
+ * \param version the expected version of the manifest, or -1
+ * \return returns 0 (ZOK) if successful, ZNONODE if there is no blob,
+ * ZBADVERSION if it is not at the given version (or was written since it
+ * was read), ZNOTEMPTY if the chunks of another write are kept, otherwise
+ * a zookeeper error code.
+ */
+ZOOAPI int zkr_blob_remove(zkr_blob_t *blob, int version);
+
+/**
+ * \brief destroys a zookeeper blob structure
+ *
+ * this is only a local operation and will not affect the blob on the
+ * zookeeper server.
+ * \param blob the zookeeper blob to destroy
+ */
+void zkr_blob_destroy(zkr_blob_t *blob);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif  //ZOOKEEPER_BLOB_H_
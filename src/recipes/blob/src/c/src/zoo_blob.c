@@ -0,0 +1,492 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef DLL_EXPORT
+#define USE_STATIC_LIB
+#endif
+
+#if defined(__CYGWIN__)
+#define USE_IPV6
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <zookeeper_log.h>
+#include <zoo_blob.h>
+
+#define MANIFEST_FORMAT 1
+#define GENERATION_PREFIX "g-"
+
+/* the content of a manifest */
+struct manifest {
+    int version;
+    int64_t czxid; /* tells the manifest from one created after a remove */
+    int size;
+    int chunk_size;
+    char generation[32]; /* empty if no value was committed yet */
+};
+
+/* the chunk requests in flight and the first one that failed */
+struct pipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int outstanding;
+    int rc;
+};
+
+struct chunk_read {
+    struct pipeline *pipeline;
+    char *buffer;
+    int len;
+};
+
+
+static void free_String_vector(struct String_vector *v) {
+    if (v->data) {
+        int32_t i;
+        for (i=0; i<v->count; i++) {
+            free(v->data[i]);
+        }
+        free(v->data);
+        v->data = 0;
+    }
+}
+
+static char *concat_path_nodename(const char *path, const char *node_name){
+    int node_path_length = strlen(path) + 1+ strlen(node_name) +1;
+    char *node_path = (char *) malloc(node_path_length * sizeof(char));
+    if (node_path != NULL)
+        snprintf(node_path, node_path_length, "%s/%s", path, node_name);
+    return node_path;
+}
+
+static char *chunk_path(const char *generation_path, int index){
+    char name[16];
+    snprintf(name, sizeof(name), "%d", index);
+    return concat_path_nodename(generation_path, name);
+}
+
+static int chunk_count(const struct manifest *m){
+    return m->size == 0 ? 0 : (m->size - 1) / m->chunk_size + 1;
+}
+
+
+static void pipeline_init(struct pipeline *p){
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    p->outstanding = 0;
+    p->rc = ZOK;
+}
+
+static void pipeline_destroy(struct pipeline *p){
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+}
+
+/* waits until at most max requests are in flight, returning the first
+ * error */
+static int pipeline_wait(struct pipeline *p, int max){
+    int rc;
+    pthread_mutex_lock(&p->lock);
+    while (p->outstanding > max)
+        pthread_cond_wait(&p->cond, &p->lock);
+    rc = p->rc;
+    pthread_mutex_unlock(&p->lock);
+    return rc;
+}
+
+static void pipeline_add(struct pipeline *p){
+    pthread_mutex_lock(&p->lock);
+    p->outstanding++;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void pipeline_done(struct pipeline *p, int rc){
+    pthread_mutex_lock(&p->lock);
+    if (rc != ZOK && p->rc == ZOK)
+        p->rc = rc;
+    p->outstanding--;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void chunk_created(int rc, const char *value, const void *data){
+    pipeline_done((struct pipeline *) data, rc);
+}
+
+static void chunk_deleted(int rc, const void *data){
+    pipeline_done((struct pipeline *) data, rc == ZNONODE ? ZOK : rc);
+}
+
+static void chunk_read(int rc, const char *value, int len,
+        const struct Stat *stat, const void *data){
+    struct chunk_read *r = (struct chunk_read *) data;
+    if (rc == ZOK) {
+        if (len == r->len)
+            memcpy(r->buffer, value, len);
+        else
+            rc = ZDATAINCONSISTENCY;
+    }
+    pipeline_done(r->pipeline, rc);
+}
+
+
+ZOOAPI int zkr_blob_init(zkr_blob_t *blob, zhandle_t *zh, const char *path,
+        struct ACL_vector *acl, int chunk_size){
+    if (chunk_size < 0)
+        return ZBADARGUMENTS;
+    blob->path = strdup(path);
+    if (blob->path == NULL)
+        return ZSYSTEMERROR;
+    blob->zh = zh;
+    blob->acl = acl;
+    blob->chunk_size = chunk_size ? chunk_size : ZKR_BLOB_CHUNK_SIZE;
+    blob->window = ZKR_BLOB_WINDOW;
+    return ZOK;
+}
+
+static int read_manifest(zkr_blob_t *blob, struct manifest *m){
+    char buffer[128];
+    int len = sizeof(buffer) - 1;
+    int format;
+    struct Stat stat;
+    int rc = zoo_get(blob->zh, blob->path, 0, buffer, &len, &stat);
+    if (rc != ZOK)
+        return rc;
+    m->version = stat.version;
+    m->czxid = stat.czxid;
+    m->size = 0;
+    m->chunk_size = 1;
+    m->generation[0] = '\0';
+    /* created by the first write, which did not commit yet */
+    if (len < 0)
+        return ZOK;
+    buffer[len] = '\0';
+    if (sscanf(buffer, "%d %d %d %31s", &format, &m->size, &m->chunk_size,
+                m->generation) != 4 || format != MANIFEST_FORMAT ||
+            m->size < 0 || m->chunk_size <= 0) {
+        LOG_WARN(("%s is not the manifest of a blob", blob->path));
+        return ZDATAINCONSISTENCY;
+    }
+    return ZOK;
+}
+
+/* the sequence number of a generation, or -1 if name is not one */
+static int generation_number(const char *name){
+    size_t len = strlen(GENERATION_PREFIX);
+    if (strncmp(name, GENERATION_PREFIX, len) != 0)
+        return -1;
+    return atoi(name + len);
+}
+
+/* deletes a generation that is not (or no longer) in the manifest */
+static int delete_generation(zkr_blob_t *blob, const char *generation_path){
+    struct String_vector children;
+    struct pipeline p;
+    int i, rc;
+
+    rc = zoo_get_children(blob->zh, generation_path, 0, &children);
+    if (rc != ZOK)
+        return rc;
+    pipeline_init(&p);
+    for (i = 0; i < children.count; i++) {
+        char *path = concat_path_nodename(generation_path, children.data[i]);
+        if (path == NULL || pipeline_wait(&p, blob->window - 1) != ZOK) {
+            free(path);
+            break;
+        }
+        pipeline_add(&p);
+        rc = zoo_adelete(blob->zh, path, -1, chunk_deleted, &p);
+        if (rc != ZOK)
+            pipeline_done(&p, rc);
+        free(path);
+    }
+    rc = pipeline_wait(&p, 0);
+    pipeline_destroy(&p);
+    free_String_vector(&children);
+    return rc == ZOK ? zoo_delete(blob->zh, generation_path, -1) : rc;
+}
+
+static int write_chunks(zkr_blob_t *blob, const char *generation_path,
+        const char *data, int len){
+    struct pipeline p;
+    int i = 0, offset = 0, rc = ZOK, done_rc;
+
+    pipeline_init(&p);
+    while (offset < len) {
+        int n = len - offset < blob->chunk_size ? len - offset :
+            blob->chunk_size;
+        char *path;
+        if (pipeline_wait(&p, blob->window - 1) != ZOK)
+            break;
+        path = chunk_path(generation_path, i++);
+        if (path == NULL) {
+            rc = ZSYSTEMERROR;
+            break;
+        }
+        pipeline_add(&p);
+        rc = zoo_acreate(blob->zh, path, data + offset, n, blob->acl, 0,
+                chunk_created, &p);
+        free(path);
+        if (rc != ZOK) {
+            pipeline_done(&p, rc);
+            break;
+        }
+        offset += n;
+    }
+    /* the requests in flight use p */
+    done_rc = pipeline_wait(&p, 0);
+    pipeline_destroy(&p);
+    return rc != ZOK ? rc : done_rc;
+}
+
+static int read_chunks(zkr_blob_t *blob, const struct manifest *m,
+        char *buffer){
+    int count = chunk_count(m);
+    struct chunk_read *reads;
+    struct pipeline p;
+    char *generation_path;
+    int i, rc = ZOK, done_rc;
+
+    generation_path = concat_path_nodename(blob->path, m->generation);
+    reads = (struct chunk_read *) calloc(count ? count : 1, sizeof(*reads));
+    if (generation_path == NULL || reads == NULL) {
+        free(generation_path);
+        free(reads);
+        return ZSYSTEMERROR;
+    }
+    pipeline_init(&p);
+    for (i = 0; i < count; i++) {
+        int offset = i * m->chunk_size;
+        char *path;
+        if (pipeline_wait(&p, blob->window - 1) != ZOK)
+            break;
+        path = chunk_path(generation_path, i);
+        if (path == NULL) {
+            rc = ZSYSTEMERROR;
+            break;
+        }
+        reads[i].pipeline = &p;
+        reads[i].buffer = buffer + offset;
+        reads[i].len = m->size - offset < m->chunk_size ? m->size - offset :
+            m->chunk_size;
+        pipeline_add(&p);
+        rc = zoo_aget(blob->zh, path, 0, chunk_read, &reads[i]);
+        free(path);
+        if (rc != ZOK) {
+            pipeline_done(&p, rc);
+            break;
+        }
+    }
+    /* the requests in flight use p and reads */
+    done_rc = pipeline_wait(&p, 0);
+    pipeline_destroy(&p);
+    free(reads);
+    free(generation_path);
+    return rc != ZOK ? rc : done_rc;
+}
+
+/* fills ops with the deletes of a generation, its chunks first, returning
+ * their count, 0 if there is none, or -1 if out of memory; the paths are
+ * to be freed with free_paths */
+static int delete_ops(zkr_blob_t *blob, const struct manifest *m,
+        zoo_op_t *ops, char **paths){
+    int i, count = chunk_count(m);
+
+    if (m->generation[0] == '\0')
+        return 0;
+    paths[count] = concat_path_nodename(blob->path, m->generation);
+    if (paths[count] == NULL)
+        return -1;
+    for (i = 0; i < count; i++) {
+        paths[i] = chunk_path(paths[count], i);
+        if (paths[i] == NULL)
+            return -1;
+        zoo_delete_op_init(&ops[i], paths[i], -1);
+    }
+    zoo_delete_op_init(&ops[count], paths[count], -1);
+    return count + 1;
+}
+
+static void free_paths(char **paths, int count){
+    int i;
+    for (i = 0; i < count; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+/* makes a generation the value of the blob, deleting the previous one */
+static int commit(zkr_blob_t *blob, const struct manifest *m,
+        const char *generation, int len){
+    int count = 1 + (m->generation[0] ? chunk_count(m) + 1 : 0);
+    zoo_op_t *ops = (zoo_op_t *) calloc(count, sizeof(*ops));
+    zoo_op_result_t *results = (zoo_op_result_t *) calloc(count,
+            sizeof(*results));
+    char **paths = (char **) calloc(count, sizeof(*paths));
+    char value[128];
+    int rc = ZSYSTEMERROR;
+
+    snprintf(value, sizeof(value), "%d %d %d %s", MANIFEST_FORMAT, len,
+            blob->chunk_size, generation);
+    if (ops && results && paths &&
+            delete_ops(blob, m, ops + 1, paths) == count - 1) {
+        zoo_set_op_init(&ops[0], blob->path, value, strlen(value),
+                m->version, NULL);
+        rc = zoo_multi(blob->zh, count, ops, results);
+    }
+    free_paths(paths, paths ? count : 0);
+    free(results);
+    free(ops);
+    return rc;
+}
+
+ZOOAPI int zkr_blob_write(zkr_blob_t *blob, const char *data, int len,
+        int version){
+    for(;;){
+        struct manifest m;
+        char generation_path[1024];
+        char *prefix;
+        int rc = read_manifest(blob, &m);
+        if (rc == ZNONODE && version == -1) {
+            rc = zoo_create(blob->zh, blob->path, NULL, -1, blob->acl, 0,
+                    NULL, 0);
+            if (rc == ZOK || rc == ZNODEEXISTS)
+                continue;
+        }
+        if (rc != ZOK)
+            return rc;
+        if (version != -1 && m.version != version)
+            return ZBADVERSION;
+
+        prefix = concat_path_nodename(blob->path, GENERATION_PREFIX);
+        if (prefix == NULL)
+            return ZSYSTEMERROR;
+        rc = zoo_create(blob->zh, prefix, NULL, -1, blob->acl, ZOO_SEQUENCE,
+                generation_path, sizeof(generation_path));
+        free(prefix);
+        if (rc != ZOK)
+            return rc;
+        rc = write_chunks(blob, generation_path, data, len);
+        if (rc == ZOK)
+            rc = commit(blob, &m, strrchr(generation_path, '/') + 1, len);
+        if (rc != ZOK)
+            delete_generation(blob, generation_path);
+        if (rc != ZBADVERSION || version != -1)
+            return rc;
+        LOG_DEBUG(("another write of %s went first, writing over it",
+                    blob->path));
+    }
+}
+
+ZOOAPI int zkr_blob_read(zkr_blob_t *blob, char **data, int *len,
+        int *version){
+    struct manifest stale;
+    stale.version = -1;
+    stale.czxid = 0;
+    for(;;){
+        struct manifest m;
+        char *buffer;
+        int rc = read_manifest(blob, &m);
+        if (rc != ZOK)
+            return rc;
+        if (m.generation[0] == '\0')
+            return ZNONODE;
+        /* the manifest did not change, yet its chunks are missing */
+        if (m.version == stale.version && m.czxid == stale.czxid)
+            return ZDATAINCONSISTENCY;
+        buffer = (char *) malloc(m.size ? m.size : 1);
+        if (buffer == NULL)
+            return ZSYSTEMERROR;
+        rc = read_chunks(blob, &m, buffer);
+        if (rc == ZOK) {
+            *data = buffer;
+            *len = m.size;
+            if (version)
+                *version = m.version;
+            return ZOK;
+        }
+        free(buffer);
+        if (rc != ZNONODE)
+            return rc;
+        /* a newer write deleted the generation: read the new one */
+        stale = m;
+    }
+}
+
+ZOOAPI int zkr_blob_remove(zkr_blob_t *blob, int version){
+    struct String_vector children;
+    struct Stat stat;
+    struct manifest m;
+    zoo_op_t *ops;
+    zoo_op_result_t *results;
+    char **paths;
+    int i, count, current, rc;
+
+    rc = read_manifest(blob, &m);
+    if (rc != ZOK)
+        return rc;
+    if (version != -1 && m.version != version)
+        return ZBADVERSION;
+
+    /* the generations of the writes that failed half way. Only those older
+     * than the current one are left over: a write creates its generation
+     * after reading the manifest, so a younger one may belong to a write
+     * that can still commit */
+    rc = zoo_get_children2(blob->zh, blob->path, 0, &children, &stat);
+    if (rc != ZOK)
+        return rc;
+    if (stat.czxid != m.czxid) {
+        /* removed and written again meanwhile */
+        free_String_vector(&children);
+        return ZBADVERSION;
+    }
+    current = generation_number(m.generation);
+    for (i = 0; i < children.count; i++) {
+        char *path;
+        int number = generation_number(children.data[i]);
+        if (number < 0 || number >= current)
+            continue;
+        path = concat_path_nodename(blob->path, children.data[i]);
+        if (path != NULL)
+            delete_generation(blob, path);
+        free(path);
+    }
+    free_String_vector(&children);
+
+    count = 1 + (m.generation[0] ? chunk_count(&m) + 1 : 0);
+    ops = (zoo_op_t *) calloc(count, sizeof(*ops));
+    results = (zoo_op_result_t *) calloc(count, sizeof(*results));
+    paths = (char **) calloc(count, sizeof(*paths));
+    rc = ZSYSTEMERROR;
+    if (ops && results && paths &&
+            delete_ops(blob, &m, ops, paths) == count - 1) {
+        zoo_delete_op_init(&ops[count - 1], blob->path, m.version);
+        rc = zoo_multi(blob->zh, count, ops, results);
+    }
+    free_paths(paths, paths ? count : 0);
+    free(results);
+    free(ops);
+    return rc;
+}
+
+void zkr_blob_destroy(zkr_blob_t *blob){
+    free(blob->path);
+    blob->path = NULL;
+}
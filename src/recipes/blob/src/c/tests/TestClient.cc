@@ -0,0 +1,445 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/select.h>
+#include <cppunit/TestAssert.h>
+
+
+using namespace std;
+
+#include <cstring>
+#include <list>
+#include <string>
+
+#include <zookeeper.h>
+#include <zoo_blob.h>
+
+static void yield(zhandle_t *zh, int i)
+{
+    sleep(i);
+}
+
+typedef struct evt {
+    string path;
+    int type;
+} evt_t;
+
+typedef struct watchCtx {
+private:
+    list<evt_t> events;
+public:
+    bool connected;
+    zhandle_t *zh;
+    
+    watchCtx() {
+        connected = false;
+        zh = 0;
+    }
+    ~watchCtx() {
+        if (zh) {
+            zookeeper_close(zh);
+            zh = 0;
+        }
+    }
+
+    evt_t getEvent() {
+        evt_t evt;
+        evt = events.front();
+        events.pop_front();
+        return evt;
+    }
+
+    int countEvents() {
+        int count;
+        count = events.size();
+        return count;
+    }
+
+    void putEvent(evt_t evt) {
+        events.push_back(evt);
+    }
+
+    bool waitForConnected(zhandle_t *zh) {
+        time_t expires = time(0) + 10;
+        while(!connected && time(0) < expires) {
+            yield(zh, 1);
+        }
+        return connected;
+    }
+    bool waitForDisconnected(zhandle_t *zh) {
+        time_t expires = time(0) + 15;
+        while(connected && time(0) < expires) {
+            yield(zh, 1);
+        }
+        return !connected;
+    }
+} watchctx_t; 
+
+extern "C" {
+
+    struct reader_args {
+        zhandle_t *zh;
+        volatile bool stop;
+        int reads;
+        int torn;
+    };
+
+    // every value written by testConcurrentReaders is one repeated byte
+    void *read_thread_shared_blob(void *args){
+        reader_args *a = (reader_args *) args;
+        zkr_blob_t blob;
+        zkr_blob_init(&blob, a->zh, "/testConcurrentReaders",
+                &ZOO_OPEN_ACL_UNSAFE, 0);
+        while(!a->stop){
+            char *data;
+            int len;
+            int rc = zkr_blob_read(&blob, &data, &len, NULL);
+            if(rc == ZOK){
+                for(int i = 1; i < len; i++){
+                    if(data[i] != data[0]){
+                        a->torn++;
+                        break;
+                    }
+                }
+                a->reads++;
+                free(data);
+            }else if(rc != ZNONODE){
+                a->torn++;
+            }
+        }
+        zkr_blob_destroy(&blob);
+        pthread_exit(NULL);
+    }
+
+    struct writer_args {
+        zhandle_t *zh;
+        volatile bool done;
+        int errors;
+    };
+
+    // a write fails with ZNONODE when a remove went first
+    void *write_thread_shared_blob(void *args){
+        writer_args *a = (writer_args *) args;
+        zkr_blob_t blob;
+        zkr_blob_init(&blob, a->zh, "/testConcurrentRemove",
+                &ZOO_OPEN_ACL_UNSAFE, 50000);
+        for(int i = 0; i < 30; i++){
+            string value(200000 + i * 1000, (char) i);
+            int rc = zkr_blob_write(&blob, value.data(), value.size(), -1);
+            if(rc != ZOK && rc != ZNONODE)
+                a->errors++;
+        }
+        zkr_blob_destroy(&blob);
+        a->done = true;
+        pthread_exit(NULL);
+    }
+}
+
+class Zookeeper_blobtest : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(Zookeeper_blobtest);
+    CPPUNIT_TEST(testReadMissing);
+    CPPUNIT_TEST(testWriteRead);
+    CPPUNIT_TEST(testEmpty);
+    CPPUNIT_TEST(testOverwrite);
+    CPPUNIT_TEST(testBadVersion);
+    CPPUNIT_TEST(testRemove);
+    CPPUNIT_TEST(testConcurrentReaders);
+    CPPUNIT_TEST(testConcurrentRemove);
+    CPPUNIT_TEST_SUITE_END();
+
+    static void watcher(zhandle_t *, int type, int state, const char *path,void*v){
+        watchctx_t *ctx = (watchctx_t*)v;
+
+        if (state == ZOO_CONNECTED_STATE) {
+            ctx->connected = true;
+        } else {
+            ctx->connected = false;
+        }
+        if (type != ZOO_SESSION_EVENT) {
+            evt_t evt;
+            evt.path = path;
+            evt.type = type;
+            ctx->putEvent(evt);
+        }
+    }
+
+    static const char hostPorts[];
+
+    const char *getHostPorts() {
+        return hostPorts;
+    }
+
+    zhandle_t *createClient(watchctx_t *ctx) {
+        zhandle_t *zk = zookeeper_init(hostPorts, watcher, 10000, 0,
+                                       ctx, 0);
+        ctx->zh = zk;
+        sleep(1);
+        return zk;
+    }
+    
+public:
+
+#define ZKSERVER_CMD "./tests/zkServer.sh"
+
+    void setUp()
+        {
+            char cmd[1024];
+            sprintf(cmd, "%s startClean %s", ZKSERVER_CMD, getHostPorts());
+            CPPUNIT_ASSERT(system(cmd) == 0);
+        }
+    
+
+    void startServer() {
+        char cmd[1024];
+        sprintf(cmd, "%s start %s", ZKSERVER_CMD, getHostPorts());
+        CPPUNIT_ASSERT(system(cmd) == 0);
+    }
+
+    void stopServer() {
+        tearDown();
+    }
+
+    void tearDown()
+        {
+            char cmd[1024];
+            sprintf(cmd, "%s stop %s", ZKSERVER_CMD, getHostPorts());
+            CPPUNIT_ASSERT(system(cmd) == 0);
+        }
+
+    string makeValue(int len){
+        string value(len, 0);
+        for(int i = 0; i < len; i++)
+            value[i] = (char) (i * 31 + i / 1000);
+        return value;
+    }
+
+    void checkRead(zkr_blob_t *blob, const string &expected, int *version){
+        char *data = NULL;
+        int len = -1;
+        int rc = zkr_blob_read(blob, &data, &len, version);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, rc);
+        CPPUNIT_ASSERT_EQUAL((int)expected.size(), len);
+        CPPUNIT_ASSERT(memcmp(expected.data(), data, len) == 0);
+        free(data);
+    }
+
+    int countChildren(zhandle_t *zh, const char *path){
+        struct String_vector children;
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_get_children(zh, path, 0, &children));
+        int count = children.count;
+        deallocate_String_vector(&children);
+        return count;
+    }
+
+    void testReadMissing(){
+        watchctx_t ctx;
+        zhandle_t *zh = createClient(&ctx);
+        zkr_blob_t blob;
+        CPPUNIT_ASSERT_EQUAL((int)ZBADARGUMENTS,
+                zkr_blob_init(&blob, zh, "/testReadMissing", &ZOO_OPEN_ACL_UNSAFE, -1));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                zkr_blob_init(&blob, zh, "/testReadMissing", &ZOO_OPEN_ACL_UNSAFE, 0));
+        char *data;
+        int len;
+        CPPUNIT_ASSERT_EQUAL((int)ZNONODE, zkr_blob_read(&blob, &data, &len, NULL));
+        CPPUNIT_ASSERT_EQUAL((int)ZNONODE, zkr_blob_remove(&blob, -1));
+        zkr_blob_destroy(&blob);
+    }
+
+    // 3 MB, three times jute.maxbuffer
+    void testWriteRead(){
+        watchctx_t ctx;
+        zhandle_t *zh = createClient(&ctx);
+        zkr_blob_t blob;
+        zkr_blob_init(&blob, zh, "/testWriteRead", &ZOO_OPEN_ACL_UNSAFE, 0);
+        string value = makeValue(3 * 1024 * 1024 + 17);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                zkr_blob_write(&blob, value.data(), value.size(), -1));
+        checkRead(&blob, value, NULL);
+        CPPUNIT_ASSERT_EQUAL(1, countChildren(zh, "/testWriteRead"));
+
+        // chunks of another size read all the same
+        zkr_blob_t reader;
+        zkr_blob_init(&reader, zh, "/testWriteRead", &ZOO_OPEN_ACL_UNSAFE, 1000);
+        reader.window = 1;
+        checkRead(&reader, value, NULL);
+        zkr_blob_destroy(&reader);
+        zkr_blob_destroy(&blob);
+    }
+
+    void testEmpty(){
+        watchctx_t ctx;
+        zhandle_t *zh = createClient(&ctx);
+        zkr_blob_t blob;
+        zkr_blob_init(&blob, zh, "/testEmpty", &ZOO_OPEN_ACL_UNSAFE, 0);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zkr_blob_write(&blob, "", 0, -1));
+        checkRead(&blob, "", NULL);
+        zkr_blob_destroy(&blob);
+    }
+
+    // the previous generation is deleted by the write replacing it
+    void testOverwrite(){
+        watchctx_t ctx;
+        zhandle_t *zh = createClient(&ctx);
+        zkr_blob_t blob;
+        zkr_blob_init(&blob, zh, "/testOverwrite", &ZOO_OPEN_ACL_UNSAFE, 100000);
+        for(int i = 1; i <= 3; i++){
+            string value = makeValue(i * 250000);
+            CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                    zkr_blob_write(&blob, value.data(), value.size(), -1));
+            checkRead(&blob, value, NULL);
+            CPPUNIT_ASSERT_EQUAL(1, countChildren(zh, "/testOverwrite"));
+        }
+        zkr_blob_destroy(&blob);
+    }
+
+    void testBadVersion(){
+        watchctx_t ctx;
+        zhandle_t *zh = createClient(&ctx);
+        zkr_blob_t blob;
+        zkr_blob_init(&blob, zh, "/testBadVersion", &ZOO_OPEN_ACL_UNSAFE, 0);
+        string first = makeValue(1000);
+        string second = makeValue(2000);
+        int version;
+        CPPUNIT_ASSERT_EQUAL((int)ZNONODE,
+                zkr_blob_write(&blob, first.data(), first.size(), 0));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                zkr_blob_write(&blob, first.data(), first.size(), -1));
+        checkRead(&blob, first, &version);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                zkr_blob_write(&blob, second.data(), second.size(), version));
+        // the first writer lost the race
+        CPPUNIT_ASSERT_EQUAL((int)ZBADVERSION,
+                zkr_blob_write(&blob, first.data(), first.size(), version));
+        checkRead(&blob, second, NULL);
+        CPPUNIT_ASSERT_EQUAL(1, countChildren(zh, "/testBadVersion"));
+        zkr_blob_destroy(&blob);
+    }
+
+    // including the chunks of a write that did not commit before the
+    // current value, but not those of a later one
+    void testRemove(){
+        watchctx_t ctx;
+        zhandle_t *zh = createClient(&ctx);
+        zkr_blob_t blob;
+        zkr_blob_init(&blob, zh, "/testRemove", &ZOO_OPEN_ACL_UNSAFE, 0);
+        string value = makeValue(1500000);
+        int version;
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                zkr_blob_write(&blob, value.data(), value.size(), -1));
+        char older[256], younger[256], path[256];
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_create(zh, "/testRemove/g-", NULL, -1,
+                &ZOO_OPEN_ACL_UNSAFE, ZOO_SEQUENCE, older, sizeof(older)));
+        sprintf(path, "%s/0", older);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_create(zh, path, "x", 1,
+                &ZOO_OPEN_ACL_UNSAFE, 0, NULL, 0));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                zkr_blob_write(&blob, value.data(), value.size(), -1));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_create(zh, "/testRemove/g-", NULL, -1,
+                &ZOO_OPEN_ACL_UNSAFE, ZOO_SEQUENCE, younger, sizeof(younger)));
+        checkRead(&blob, value, &version);
+        CPPUNIT_ASSERT_EQUAL((int)ZBADVERSION, zkr_blob_remove(&blob, version + 1));
+        // the younger generation may be a write in progress
+        CPPUNIT_ASSERT_EQUAL((int)ZNOTEMPTY, zkr_blob_remove(&blob, version));
+        CPPUNIT_ASSERT_EQUAL((int)ZNONODE, zoo_exists(zh, older, 0, NULL));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_exists(zh, younger, 0, NULL));
+        checkRead(&blob, value, NULL);
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zoo_delete(zh, younger, -1));
+        CPPUNIT_ASSERT_EQUAL((int)ZOK, zkr_blob_remove(&blob, version));
+        CPPUNIT_ASSERT_EQUAL((int)ZNONODE, zoo_exists(zh, "/testRemove", 0, NULL));
+        zkr_blob_destroy(&blob);
+    }
+
+    // a remove racing with writes never deletes the committed generation
+    void testConcurrentRemove(){
+        watchctx_t ctxs[2];
+        zhandle_t *remover = createClient(&ctxs[0]);
+        writer_args args;
+        args.zh = createClient(&ctxs[1]);
+        args.done = false;
+        args.errors = 0;
+        zkr_blob_t blob;
+        zkr_blob_init(&blob, remover, "/testConcurrentRemove",
+                &ZOO_OPEN_ACL_UNSAFE, 50000);
+
+        pthread_t writer_thread;
+        pthread_create(&writer_thread, NULL, write_thread_shared_blob, &args);
+        int removes = 0;
+        while(!args.done){
+            int rc = zkr_blob_remove(&blob, -1);
+            CPPUNIT_ASSERT(rc == ZOK || rc == ZNONODE || rc == ZBADVERSION ||
+                    rc == ZNOTEMPTY);
+            removes += rc == ZOK;
+
+            char *data;
+            int len;
+            rc = zkr_blob_read(&blob, &data, &len, NULL);
+            CPPUNIT_ASSERT(rc == ZOK || rc == ZNONODE);
+            if(rc == ZOK){
+                for(int i = 1; i < len; i++)
+                    CPPUNIT_ASSERT_EQUAL(data[0], data[i]);
+                free(data);
+            }
+        }
+        pthread_join(writer_thread, NULL);
+        CPPUNIT_ASSERT_EQUAL(0, args.errors);
+
+        // the blob is still usable
+        string value(300000, 'x');
+        CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                zkr_blob_write(&blob, value.data(), value.size(), -1));
+        checkRead(&blob, value, NULL);
+        CPPUNIT_ASSERT_EQUAL(1, countChildren(remover, "/testConcurrentRemove"));
+        zkr_blob_destroy(&blob);
+    }
+
+    // the readers never see a value mixing two writes
+    void testConcurrentReaders(){
+        watchctx_t ctxs[2];
+        zhandle_t *writer = createClient(&ctxs[0]);
+        reader_args args;
+        args.zh = createClient(&ctxs[1]);
+        args.stop = false;
+        args.reads = 0;
+        args.torn = 0;
+        zkr_blob_t blob;
+        zkr_blob_init(&blob, writer, "/testConcurrentReaders", &ZOO_OPEN_ACL_UNSAFE, 50000);
+
+        pthread_t reader_thread;
+        pthread_create(&reader_thread, NULL, read_thread_shared_blob, &args);
+        for(int i = 0; i < 20; i++){
+            string value(400000 + i * 1000, (char) i);
+            CPPUNIT_ASSERT_EQUAL((int)ZOK,
+                    zkr_blob_write(&blob, value.data(), value.size(), -1));
+        }
+        args.stop = true;
+        pthread_join(reader_thread, NULL);
+        CPPUNIT_ASSERT(args.reads > 0);
+        CPPUNIT_ASSERT_EQUAL(0, args.torn);
+        zkr_blob_destroy(&blob);
+    }
+};
+
+const char Zookeeper_blobtest::hostPorts[] = "127.0.0.1:22181";
+CPPUNIT_TEST_SUITE_REGISTRATION(Zookeeper_blobtest);
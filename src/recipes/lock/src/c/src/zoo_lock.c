@@ -128,14 +128,53 @@ static void free_String_vector(struct String_vector *v) {
     }
 }
 
+/* a child node name along with the sequence suffix it is ordered by */
+typedef struct seq_child {
+    const char *seq;
+    char *name;
+} seq_child_t;
+
+static const char* sequence_suffix(const char *name) {
+    const char *seq = strrchr(name, '-');
+    return seq == NULL ? name : seq + 1;
+}
+
+static int vseqcmp(const void* child1, const void* child2) {
+    const seq_child_t *a = (const seq_child_t*) child1;
+    const seq_child_t *b = (const seq_child_t*) child2;
+    return strcmp(a->seq, b->seq);
+}
+
 static int vstrcmp(const void* str1, const void* str2) {
     const char **a = (const char**)str1;
     const char **b = (const char**) str2;
-    return strcmp(strrchr(*a, '-')+1, strrchr(*b, '-')+1); 
+    return strcmp(sequence_suffix(*a), sequence_suffix(*b));
 } 
 
+/**
+ * sort the children by their sequence suffix. The suffixes are looked
+ * up once per child rather than twice per comparison
+ */
 static void sort_children(struct String_vector *vector) {
-    qsort( vector->data, vector->count, sizeof(char*), &vstrcmp);
+    seq_child_t *children;
+    int32_t i;
+    if (vector->count < 2) {
+        return;
+    }
+    children = (seq_child_t *) malloc(vector->count * sizeof(seq_child_t));
+    if (children == NULL) {
+        qsort( vector->data, vector->count, sizeof(char*), &vstrcmp);
+        return;
+    }
+    for (i = 0; i < vector->count; i++) {
+        children[i].name = vector->data[i];
+        children[i].seq = sequence_suffix(vector->data[i]);
+    }
+    qsort(children, vector->count, sizeof(seq_child_t), &vseqcmp);
+    for (i = 0; i < vector->count; i++) {
+        vector->data[i] = children[i].name;
+    }
+    free(children);
 }
         
 static char* child_floor(char **sorted_data, int len, char *element) {